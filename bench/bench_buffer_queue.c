@@ -0,0 +1,108 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+/*
+ * Throughput of the buffer queue, producers fill blank buffers and consumers recycle the filled ones.
+ * Built as bench_buffer_queue and, with KC__BUFFER_QUEUE_LOCKED, as bench_buffer_queue_locked.
+ *
+ * Usage: bench_buffer_queue [producers] [consumers] [buffers] [items]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/buffer_queue.h"
+
+
+static size_t items_count;
+static size_t produced_count;
+
+static void* produce(void* ptr) {
+    KC__BufferQueue* bq = ptr;
+
+    while (__sync_fetch_and_add(&produced_count, 1) < items_count) {
+        KC__Buffer* buffer = KC__buffer_queue_get_blank_buffer(bq);
+        ((char*)(buffer->data))[0] = 1;
+        buffer->length = 1;
+        KC__buffer_queue_enqueue_filled_buffer(bq, buffer);
+    }
+
+    return NULL;
+}
+
+static void* consume(void* ptr) {
+    KC__BufferQueue* bq = ptr;
+
+    KC__Buffer* buffer;
+    while ((buffer = KC__buffer_queue_dequeue_filled_buffer(bq)) != NULL) {
+        KC__buffer_queue_recycle_blank_buffer(bq, buffer);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t producers_count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1;
+    const size_t consumers_count = (argc > 2) ? strtoul(argv[2], NULL, 10) : 4;
+    const size_t buffers_count = (argc > 3) ? strtoul(argv[3], NULL, 10) : 16;
+    items_count = (argc > 4) ? strtoul(argv[4], NULL, 10) : 1000000;
+    if ((producers_count == 0) || (consumers_count == 0) || (buffers_count == 0)) {
+        fprintf(stderr, "Usage: %s [producers] [consumers] [buffers] [items]\n", argv[0]);
+        return 1;
+    }
+
+    KC__MemAllocator* ma = KC__mem_allocator_create(1 << 20);
+    KC__BufferQueue* bq = KC__buffer_queue_create(ma, 64, buffers_count);
+    pthread_t producers[producers_count];
+    pthread_t consumers[consumers_count];
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    KC__buffer_queue_start_input(bq);
+    for (size_t i = 0; i < producers_count; i++)
+        pthread_create(&(producers[i]), NULL, produce, bq);
+    for (size_t i = 0; i < consumers_count; i++)
+        pthread_create(&(consumers[i]), NULL, consume, bq);
+    for (size_t i = 0; i < producers_count; i++)
+        pthread_join(producers[i], NULL);
+    KC__buffer_queue_finish_input(bq);
+    for (size_t i = 0; i < consumers_count; i++)
+        pthread_join(consumers[i], NULL);
+
+    struct timespec finish_time;
+    clock_gettime(CLOCK_MONOTONIC, &finish_time);
+    const double seconds = (double)(finish_time.tv_sec - start_time.tv_sec) + (double)(finish_time.tv_nsec - start_time.tv_nsec) / 1e9;
+
+#ifdef KC__BUFFER_QUEUE_LOCKED
+    const char* implementation = "locked";
+#else
+    const char* implementation = "lock-free";
+#endif
+    printf("%s: %zu producers, %zu consumers, %zu buffers, %zu items in %.3f s, %.0f items/s\n", implementation,
+           producers_count, consumers_count, buffers_count, items_count, seconds, (double)items_count / seconds);
+
+    KC__buffer_queue_free(ma, bq);
+    KC__mem_allocator_free(ma);
+
+    return 0;
+}
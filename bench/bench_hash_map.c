@@ -0,0 +1,194 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+/*
+ * Throughput of adding K-mers to the chaining hash map, shared by all threads (CAS on bucket heads and counts) or
+ * partitioned (each thread owns a slice of the table, the K-mers of other slices are routed to their owners). A part of
+ * the K-mers are drawn from a few hot ones, as adapters and poly-A of real reads, the others from a pool of distinct
+ * ones. Each count of threads runs both modes, and the counts are checked against the K-mers added.
+ *
+ * Usage: bench_hash_map [threads,...] [kmers per thread] [hot percent] [distinct kmers]
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/hash_map.h"
+#include "../src/hash.h"
+#include "../src/logging.h"
+
+
+#define BENCH_K 31
+#define BENCH_HOT_KMERS_COUNT 16
+#define BENCH_THREADS_COUNT_MAX 1024
+
+static size_t kmers_count;
+static size_t hot_percent;
+static size_t distinct_count;
+
+static size_t rejected_count;
+static size_t exported_sum;
+
+typedef struct {
+    KC__HashMap* hash_map;
+    size_t thread_id;
+} BenchWorker;
+
+static inline uint64_t next_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * The K-mers are spread over the 2 * K bits by the mixed index, and the hot ones are the first of the pool.
+ */
+static inline KC__unit_t draw_kmer(uint64_t* state) {
+    const uint64_t r = next_random(state);
+    const uint64_t idx = ((r % 100) < hot_percent) ? ((r >> 8) % BENCH_HOT_KMERS_COUNT) : ((r >> 8) % distinct_count);
+    return (KC__unit_t)(KC__hash_mix(idx) & ((UINT64_C(1) << (2 * BENCH_K)) - 1));
+}
+
+static void reject_kmer(const KC__unit_t* kmer, void* data) {
+    (void)kmer;
+    (void)data;
+    __sync_fetch_and_add(&rejected_count, 1);
+}
+
+static void export_kmer(const KC__unit_t* kmer, KC__count_t count, void* data) {
+    (void)kmer;
+    (void)data;
+    exported_sum += count;
+}
+
+static void* add_kmers(void* ptr) {
+    BenchWorker* worker = ptr;
+
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (worker->thread_id + 1);
+    KC__unit_t kmers[KC__HASH_MAP_BATCH_SIZE_MAX];
+    bool added[KC__HASH_MAP_BATCH_SIZE_MAX];
+
+    for (size_t i = 0; i < kmers_count; i += KC__HASH_MAP_BATCH_SIZE_MAX) {
+        const size_t count = (kmers_count - i < KC__HASH_MAP_BATCH_SIZE_MAX) ? (kmers_count - i) : KC__HASH_MAP_BATCH_SIZE_MAX;
+        for (size_t j = 0; j < count; j++) {
+            kmers[j] = draw_kmer(&state);
+        }
+
+        KC__hash_map_add_kmers_batch(worker->hash_map, worker->thread_id, kmers, count, added);
+
+        for (size_t j = 0; j < count; j++) {
+            if (!added[j]) {
+                __sync_fetch_and_add(&rejected_count, 1);
+            }
+        }
+    }
+
+    KC__hash_map_finish_adding_kmers(worker->hash_map, worker->thread_id);
+
+    return NULL;
+}
+
+static bool run(size_t threads_count, bool partitioned) {
+    KC__HashMapParam param;
+    memset(&param, 0, sizeof(param));
+    param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    param.partitioned = partitioned;
+    // Each thread takes the nodes of a block, the blocks are used out unevenly.
+    param.keys_count_hint = distinct_count * 2;
+
+    KC__MemAllocator* ma = KC__mem_allocator_create((size_t)1 << 40);
+    KC__ThreadPool* pool = KC__thread_pool_create(ma, threads_count);
+    KC__HashMap* hm = KC__hash_map_create(ma, BENCH_K, threads_count, param, pool);
+
+    BenchWorker workers[threads_count];
+    pthread_t threads[threads_count];
+    for (size_t i = 0; i < threads_count; i++) {
+        workers[i].hash_map = hm;
+        workers[i].thread_id = i;
+        KC__hash_map_set_reject_callback(hm, i, reject_kmer, NULL);
+    }
+    rejected_count = 0;
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    for (size_t i = 0; i < threads_count; i++)
+        pthread_create(&(threads[i]), NULL, add_kmers, &(workers[i]));
+    for (size_t i = 0; i < threads_count; i++)
+        pthread_join(threads[i], NULL);
+
+    struct timespec finish_time;
+    clock_gettime(CLOCK_MONOTONIC, &finish_time);
+    const double seconds = (double)(finish_time.tv_sec - start_time.tv_sec) + (double)(finish_time.tv_nsec - start_time.tv_nsec) / 1e9;
+
+    size_t keys_count = 0;
+    exported_sum = 0;
+    for (size_t i = 0; i < threads_count; i++) {
+        size_t exported_count = 0;
+        KC__hash_map_export(hm, i, export_kmer, NULL, &exported_count);
+        keys_count += exported_count;
+    }
+
+    const size_t total_count = kmers_count * threads_count;
+    const bool valid = (exported_sum + rejected_count == total_count);
+    printf("%s: %zu threads, %zu K-mers (%zu%% hot, %zu keys, %zu rejected) in %.3f s, %.0f K-mers/s%s\n",
+           partitioned ? "partitioned" : "shared", threads_count, total_count, hot_percent, keys_count, rejected_count,
+           seconds, (double)total_count / seconds, valid ? "" : ", counts mismatch");
+
+    KC__hash_map_free(ma, hm);
+    KC__thread_pool_free(ma, pool);
+    KC__mem_allocator_free(ma);
+
+    return valid;
+}
+
+int main(int argc, char* argv[]) {
+    KC__LOG_FILE = stderr;
+
+    char threads_list[256] = "8,32,64";
+    if (argc > 1) {
+        snprintf(threads_list, sizeof(threads_list), "%s", argv[1]);
+    }
+    kmers_count = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+    hot_percent = (argc > 3) ? strtoul(argv[3], NULL, 10) : 10;
+    distinct_count = (argc > 4) ? strtoul(argv[4], NULL, 10) : 4000000;
+    if ((kmers_count == 0) || (hot_percent > 100) || (distinct_count < BENCH_HOT_KMERS_COUNT)) {
+        fprintf(stderr, "Usage: %s [threads,...] [kmers per thread] [hot percent] [distinct kmers]\n", argv[0]);
+        return 1;
+    }
+
+    bool valid = true;
+    for (char* token = strtok(threads_list, ","); token != NULL; token = strtok(NULL, ",")) {
+        const size_t threads_count = strtoul(token, NULL, 10);
+        if ((threads_count == 0) || (threads_count > BENCH_THREADS_COUNT_MAX)) {
+            fprintf(stderr, "Threads count invalid: %s\n", token);
+            return 1;
+        }
+        valid = run(threads_count, false) && valid;
+        valid = run(threads_count, true) && valid;
+    }
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,465 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+
+// O_DIRECT.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef KC__IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "async_reader.h"
+#include "assert.h"
+#include "logging.h"
+
+
+/** The alignment of the buffers, offsets and sizes of direct I/O. */
+#define KC__ASYNC_READER_ALIGNMENT 4096
+#define KC__ASYNC_READER_PREAD_THREADS_MAX 4
+
+typedef struct {
+    char* data;
+    struct iovec iov;
+    size_t offset;
+    /** The size read, or the negative error number. */
+    ssize_t result;
+    bool done;
+} KC__AsyncReadSlot;
+
+/**
+ * The slots are read in turn, the data of the slot at head is taken, and the slot is submitted again for the next chunk
+ * once it is used up. Only the slots ending before the end of the file are submitted.
+ */
+struct KC__AsyncReader {
+    KC__AsyncReadEngine engine;
+    size_t chunk_size;
+    size_t depth;
+
+    void* mem;
+    KC__AsyncReadSlot* slots;
+
+    int fd;
+    size_t file_size;
+    size_t next_offset;
+    size_t taken_size;
+    size_t head;
+    size_t head_taken_size;
+    size_t in_flight_count;
+
+    // The pread engine, the slots submitted are in [pending_start, pending_start + pending_count) of pending_slots.
+    pthread_t threads[KC__ASYNC_READER_PREAD_THREADS_MAX];
+    size_t threads_count;
+    size_t* pending_slots;
+    size_t pending_start;
+    size_t pending_count;
+    bool threads_stop;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv_submitted;
+    pthread_cond_t cv_done;
+
+#ifdef KC__IO_URING
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+#endif
+};
+
+static void* KC__async_reader_pread_work(void* ptr) {
+    KC__AsyncReader* ar = ptr;
+
+    pthread_mutex_lock(&(ar->mtx));
+    while (true) {
+        while (!ar->threads_stop && (ar->pending_count == 0)) {
+            pthread_cond_wait(&(ar->cv_submitted), &(ar->mtx));
+        }
+        if (ar->pending_count == 0) {
+            break;
+        }
+
+        KC__AsyncReadSlot* slot = &(ar->slots[ar->pending_slots[ar->pending_start]]);
+        ar->pending_start = (ar->pending_start + 1) % ar->depth;
+        ar->pending_count--;
+        const int fd = ar->fd;
+        pthread_mutex_unlock(&(ar->mtx));
+
+        ssize_t result;
+        do {
+            result = pread(fd, slot->data, ar->chunk_size, (off_t)(slot->offset));
+        } while ((result < 0) && (errno == EINTR));
+        if (result < 0) {
+            result = -errno;
+        }
+
+        pthread_mutex_lock(&(ar->mtx));
+        slot->result = result;
+        slot->done = true;
+        ar->in_flight_count--;
+        pthread_cond_broadcast(&(ar->cv_done));
+    }
+    pthread_mutex_unlock(&(ar->mtx));
+
+    pthread_exit(NULL);
+}
+
+#ifdef KC__IO_URING
+/**
+ * Set up the rings of io_uring by the system calls, as in the man page of io_uring.
+ * @return False if io_uring is not available.
+ */
+static bool KC__async_reader_uring_init(KC__AsyncReader* ar) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ar->ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)(ar->depth), &p);
+    if (ar->ring_fd < 0) {
+        return false;
+    }
+
+    ar->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ar->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = ((p.features & IORING_FEAT_SINGLE_MMAP) != 0);
+    if (single_mmap) {
+        if (ar->cq_ring_size > ar->sq_ring_size) {
+            ar->sq_ring_size = ar->cq_ring_size;
+        }
+        ar->cq_ring_size = ar->sq_ring_size;
+    }
+
+    ar->sq_ring = mmap(NULL, ar->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_SQ_RING);
+    if (ar->sq_ring == MAP_FAILED) {
+        close(ar->ring_fd);
+        return false;
+    }
+    ar->cq_ring = ar->sq_ring;
+    if (!single_mmap) {
+        ar->cq_ring = mmap(NULL, ar->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_CQ_RING);
+        if (ar->cq_ring == MAP_FAILED) {
+            munmap(ar->sq_ring, ar->sq_ring_size);
+            close(ar->ring_fd);
+            return false;
+        }
+    }
+
+    ar->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ar->sqes = mmap(NULL, ar->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ar->ring_fd, IORING_OFF_SQES);
+    if (ar->sqes == MAP_FAILED) {
+        if (!single_mmap) {
+            munmap(ar->cq_ring, ar->cq_ring_size);
+        }
+        munmap(ar->sq_ring, ar->sq_ring_size);
+        close(ar->ring_fd);
+        return false;
+    }
+
+    char* sq = ar->sq_ring;
+    char* cq = ar->cq_ring;
+    ar->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ar->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ar->sq_array = (unsigned*)(sq + p.sq_off.array);
+    ar->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ar->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ar->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ar->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void KC__async_reader_uring_destroy(KC__AsyncReader* ar) {
+    munmap(ar->sqes, ar->sqes_size);
+    if (ar->cq_ring != ar->sq_ring) {
+        munmap(ar->cq_ring, ar->cq_ring_size);
+    }
+    munmap(ar->sq_ring, ar->sq_ring_size);
+    close(ar->ring_fd);
+}
+
+static int KC__async_reader_uring_enter(KC__AsyncReader* ar, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    int result;
+    do {
+        result = (int)syscall(__NR_io_uring_enter, ar->ring_fd, to_submit, min_complete, flags, NULL, 0);
+    } while ((result < 0) && (errno == EINTR));
+    return result;
+}
+
+static void KC__async_reader_uring_submit(KC__AsyncReader* ar, size_t slot_index) {
+    KC__AsyncReadSlot* slot = &(ar->slots[slot_index]);
+    slot->iov.iov_base = slot->data;
+    slot->iov.iov_len = ar->chunk_size;
+
+    // Only this thread submits, so the tail is not changed by others.
+    const unsigned tail = *(ar->sq_tail);
+    const unsigned index = tail & *(ar->sq_mask);
+    struct io_uring_sqe* sqe = &(ar->sqes[index]);
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = ar->fd;
+    sqe->addr = (unsigned long)&(slot->iov);
+    sqe->len = 1;
+    sqe->off = slot->offset;
+    sqe->user_data = slot_index;
+    ar->sq_array[index] = index;
+    __atomic_store_n(ar->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (KC__async_reader_uring_enter(ar, 1, 0, 0) < 0) {
+        LOGGING_ERROR("Submitting to io_uring failed.");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void KC__async_reader_uring_reap(KC__AsyncReader* ar) {
+    unsigned head = *(ar->cq_head);
+    const unsigned tail = __atomic_load_n(ar->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = &(ar->cqes[head & *(ar->cq_mask)]);
+        KC__AsyncReadSlot* slot = &(ar->slots[cqe->user_data]);
+        slot->result = cqe->res;
+        slot->done = true;
+        ar->in_flight_count--;
+        head++;
+    }
+    __atomic_store_n(ar->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void KC__async_reader_uring_wait(KC__AsyncReader* ar, const KC__AsyncReadSlot* slot) {
+    while (true) {
+        KC__async_reader_uring_reap(ar);
+        if ((slot == NULL) ? (ar->in_flight_count == 0) : slot->done) {
+            break;
+        }
+        if (KC__async_reader_uring_enter(ar, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+            LOGGING_ERROR("Waiting for io_uring failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+#endif
+
+KC__AsyncReader* KC__async_reader_create(KC__MemAllocator* ma, KC__AsyncReadEngine engine, size_t chunk_size, size_t depth) {
+    KC__ASSERT((chunk_size > 0) && (chunk_size % KC__ASYNC_READER_ALIGNMENT == 0));
+    KC__ASSERT(depth > 0);
+
+    KC__AsyncReader* ar = (KC__AsyncReader*)KC__mem_alloc(ma, sizeof(KC__AsyncReader), "async reader");
+    ar->chunk_size = chunk_size;
+    ar->depth = depth;
+    ar->fd = -1;
+    ar->in_flight_count = 0;
+
+    ar->mem = KC__mem_alloc(ma, chunk_size * depth + KC__ASYNC_READER_ALIGNMENT, "async reader data");
+    char* data = (char*)(((uintptr_t)(ar->mem) + KC__ASYNC_READER_ALIGNMENT - 1) & ~(uintptr_t)(KC__ASYNC_READER_ALIGNMENT - 1));
+    ar->slots = (KC__AsyncReadSlot*)KC__mem_alloc(ma, sizeof(KC__AsyncReadSlot) * depth, "async reader slots");
+    for (size_t i = 0; i < depth; i++) {
+        ar->slots[i].data = data + chunk_size * i;
+        ar->slots[i].done = true;
+    }
+    ar->pending_slots = (size_t*)KC__mem_alloc(ma, sizeof(size_t) * depth, "async reader pending slots");
+
+#ifdef KC__IO_URING
+    if ((engine == KC__ASYNC_READ_ENGINE_URING) && !KC__async_reader_uring_init(ar)) {
+        LOGGING_INFO("io_uring is not available, use pread.");
+        engine = KC__ASYNC_READ_ENGINE_PREAD;
+    }
+#else
+    engine = KC__ASYNC_READ_ENGINE_PREAD;
+#endif
+    ar->engine = engine;
+
+    ar->threads_count = 0;
+    if (ar->engine == KC__ASYNC_READ_ENGINE_PREAD) {
+        ar->pending_start = 0;
+        ar->pending_count = 0;
+        ar->threads_stop = false;
+        pthread_mutex_init(&(ar->mtx), NULL);
+        pthread_cond_init(&(ar->cv_submitted), NULL);
+        pthread_cond_init(&(ar->cv_done), NULL);
+
+        ar->threads_count = (depth < KC__ASYNC_READER_PREAD_THREADS_MAX) ? depth : KC__ASYNC_READER_PREAD_THREADS_MAX;
+        for (size_t i = 0; i < ar->threads_count; i++) {
+            pthread_create(&(ar->threads[i]), NULL, KC__async_reader_pread_work, ar);
+        }
+    }
+
+    return ar;
+}
+
+void KC__async_reader_free(KC__MemAllocator* ma, KC__AsyncReader* ar) {
+    KC__ASSERT(ar->in_flight_count == 0);
+
+    if (ar->engine == KC__ASYNC_READ_ENGINE_PREAD) {
+        pthread_mutex_lock(&(ar->mtx));
+        ar->threads_stop = true;
+        pthread_cond_broadcast(&(ar->cv_submitted));
+        pthread_mutex_unlock(&(ar->mtx));
+        for (size_t i = 0; i < ar->threads_count; i++) {
+            pthread_join(ar->threads[i], NULL);
+        }
+        pthread_mutex_destroy(&(ar->mtx));
+        pthread_cond_destroy(&(ar->cv_submitted));
+        pthread_cond_destroy(&(ar->cv_done));
+    }
+#ifdef KC__IO_URING
+    if (ar->engine == KC__ASYNC_READ_ENGINE_URING) {
+        KC__async_reader_uring_destroy(ar);
+    }
+#endif
+
+    KC__mem_free(ma, ar->pending_slots);
+    KC__mem_free(ma, ar->slots);
+    KC__mem_free(ma, ar->mem);
+    KC__mem_free(ma, ar);
+}
+
+KC__AsyncReadEngine KC__async_reader_engine(const KC__AsyncReader* ar) {
+    return ar->engine;
+}
+
+static void KC__async_reader_submit(KC__AsyncReader* ar, size_t slot_index) {
+    KC__AsyncReadSlot* slot = &(ar->slots[slot_index]);
+    slot->offset = ar->next_offset;
+    slot->done = false;
+    ar->next_offset += ar->chunk_size;
+
+#ifdef KC__IO_URING
+    if (ar->engine == KC__ASYNC_READ_ENGINE_URING) {
+        ar->in_flight_count++;
+        KC__async_reader_uring_submit(ar, slot_index);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&(ar->mtx));
+    ar->pending_slots[(ar->pending_start + ar->pending_count) % ar->depth] = slot_index;
+    ar->pending_count++;
+    ar->in_flight_count++;
+    pthread_cond_signal(&(ar->cv_submitted));
+    pthread_mutex_unlock(&(ar->mtx));
+}
+
+/**
+ * Wait for the slot to be read, or for all reads in flight if the slot is NULL.
+ */
+static void KC__async_reader_wait(KC__AsyncReader* ar, const KC__AsyncReadSlot* slot) {
+#ifdef KC__IO_URING
+    if (ar->engine == KC__ASYNC_READ_ENGINE_URING) {
+        KC__async_reader_uring_wait(ar, slot);
+        return;
+    }
+#endif
+
+    pthread_mutex_lock(&(ar->mtx));
+    while ((slot == NULL) ? (ar->in_flight_count > 0) : !slot->done) {
+        pthread_cond_wait(&(ar->cv_done), &(ar->mtx));
+    }
+    pthread_mutex_unlock(&(ar->mtx));
+}
+
+void KC__async_reader_start(KC__AsyncReader* ar, int fd, bool direct) {
+    KC__ASSERT(ar->in_flight_count == 0);
+
+    struct stat st;
+    ar->fd = fd;
+    ar->file_size = (fstat(fd, &st) == 0) ? (size_t)(st.st_size) : 0;
+    ar->next_offset = 0;
+    ar->taken_size = 0;
+    ar->head = 0;
+    ar->head_taken_size = 0;
+
+    if (direct) {
+        const int flags = fcntl(fd, F_GETFL);
+        if ((flags == -1) || (fcntl(fd, F_SETFL, flags | O_DIRECT) == -1)) {
+            LOGGING_DEBUG("Direct I/O is not supported, read through the page cache.");
+        }
+    }
+
+    for (size_t i = 0; (i < ar->depth) && (ar->next_offset < ar->file_size); i++) {
+        KC__async_reader_submit(ar, i);
+    }
+}
+
+bool KC__async_reader_read(KC__AsyncReader* ar, void* out, size_t size, size_t* read_size) {
+    size_t got_size = 0;
+
+    while ((got_size < size) && (ar->taken_size < ar->file_size)) {
+        KC__AsyncReadSlot* slot = &(ar->slots[ar->head]);
+        KC__async_reader_wait(ar, slot);
+        if (slot->result < 0) {
+            errno = (int)(-slot->result);
+            *read_size = got_size;
+            return false;
+        }
+
+        // Only the last chunk of the file is short.
+        const size_t slot_size = (size_t)(slot->result);
+        if ((slot_size < ar->chunk_size) && (slot->offset + slot_size < ar->file_size)) {
+            errno = EIO;
+            *read_size = got_size;
+            return false;
+        }
+
+        size_t n = slot_size - ar->head_taken_size;
+        if (n > size - got_size) {
+            n = size - got_size;
+        }
+        memcpy((char*)out + got_size, slot->data + ar->head_taken_size, n);
+        got_size += n;
+        ar->taken_size += n;
+        ar->head_taken_size += n;
+
+        if (ar->head_taken_size == ar->chunk_size) {
+            if (ar->next_offset < ar->file_size) {
+                KC__async_reader_submit(ar, ar->head);
+            }
+            ar->head = (ar->head + 1) % ar->depth;
+            ar->head_taken_size = 0;
+        }
+    }
+
+    *read_size = got_size;
+    return true;
+}
+
+void KC__async_reader_stop(KC__AsyncReader* ar) {
+    KC__async_reader_wait(ar, NULL);
+    for (size_t i = 0; i < ar->depth; i++) {
+        ar->slots[i].done = true;
+    }
+    ar->fd = -1;
+}
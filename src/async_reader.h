@@ -0,0 +1,69 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+#ifndef KC__ASYNC_READER_H
+#define KC__ASYNC_READER_H
+
+#include <stdbool.h>
+#include "types.h"
+#include "mem_allocator.h"
+
+struct KC__AsyncReader;
+typedef struct KC__AsyncReader KC__AsyncReader;
+
+/**
+ * Create an async reader, which keeps depth reads of chunk_size bytes in flight ahead of the data taken from a file.
+ * The io_uring engine falls back to the pread engine, a pool of threads calling pread, if io_uring is not available.
+ * @param mem_allocator Memory allocator.
+ * @param engine The engine.
+ * @param chunk_size The size of each read, a multiple of the alignment of direct I/O (4 KB).
+ * @param depth The count of reads in flight.
+ * @return The async reader.
+ */
+KC__AsyncReader* KC__async_reader_create(KC__MemAllocator* mem_allocator, KC__AsyncReadEngine engine, size_t chunk_size, size_t depth);
+void KC__async_reader_free(KC__MemAllocator* mem_allocator, KC__AsyncReader* async_reader);
+
+KC__AsyncReadEngine KC__async_reader_engine(const KC__AsyncReader* async_reader);
+
+/**
+ * Start reading the file ahead from its start.
+ * @param async_reader The async reader.
+ * @param fd The file descriptor, which is not closed by the async reader.
+ * @param direct Bypass the page cache by O_DIRECT, if the file system supports it.
+ */
+void KC__async_reader_start(KC__AsyncReader* async_reader, int fd, bool direct);
+
+/**
+ * Take the next data of the file, wait for it if it is still being read.
+ * @param async_reader The async reader.
+ * @param out The output.
+ * @param size The size of the output.
+ * @param read_size Set to the size of the data taken, less than size only at the end of the file.
+ * @return False if a read failed.
+ */
+bool KC__async_reader_read(KC__AsyncReader* async_reader, void* out, size_t size, size_t* read_size);
+
+/**
+ * Wait for the reads still in flight, the file can be closed after.
+ * @param async_reader The async reader.
+ */
+void KC__async_reader_stop(KC__AsyncReader* async_reader);
+
+#endif
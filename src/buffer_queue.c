@@ -18,81 +18,311 @@
  */
 
 
+// syscall.
+#define _GNU_SOURCE
+
+#include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef KC__BUFFER_QUEUE_LOCKED
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include "buffer_queue.h"
 #include "queue.h"
 #include "logging.h"
 #include "assert.h"
+#include "utils.h"
+
+
+#ifndef KC__BUFFER_QUEUE_LOCKED
+
+/** Times a thread tries an empty ring again before it parks on the futex of the ring, if there are several CPUs. */
+#define KC__BUFFER_QUEUE_SPIN_COUNT 128
+#define KC__BUFFER_QUEUE_CACHE_LINE_SIZE 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KC__BUFFER_QUEUE_PAUSE() __builtin_ia32_pause()
+#else
+#define KC__BUFFER_QUEUE_PAUSE() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#endif
+
+typedef struct {
+    size_t sequence;
+    KC__Buffer* buffer;
+} KC__BufferRingCell;
+
+/**
+ * A bounded MPMC ring of buffers (Vyukov's queue), each cell has a sequence telling whether it is free to enqueue into
+ * or ready to dequeue from at a position. Threads finding the ring empty park on epoch, which is bumped by the enqueues
+ * seeing waiters.
+ */
+typedef struct {
+    KC__BufferRingCell* cells;
+    size_t mask;
+    char pad_0[KC__BUFFER_QUEUE_CACHE_LINE_SIZE];
+    size_t enqueue_pos;
+    char pad_1[KC__BUFFER_QUEUE_CACHE_LINE_SIZE];
+    size_t dequeue_pos;
+    char pad_2[KC__BUFFER_QUEUE_CACHE_LINE_SIZE];
+    int epoch;
+    int waiters_count;
+    size_t spin_count;
+    char pad_3[KC__BUFFER_QUEUE_CACHE_LINE_SIZE];
+} KC__BufferRing;
+
+#endif
 
 
 struct KC__BufferQueue {
     KC__Buffer* buffers;
     size_t buffers_count;
+    bool views;
+
+    bool input_finished;
 
+#ifdef KC__BUFFER_QUEUE_LOCKED
     KC__Queue* blank_buffers_queue;
     KC__Queue* filled_buffers_queue;
 
-    bool input_finished;
-
     pthread_mutex_t blank_buffers_queue_mtx;
     pthread_mutex_t filled_buffers_queue_mtx;
     pthread_cond_t cv_has_blank_buffers;
     pthread_cond_t cv_has_filled_buffers;
+#else
+    KC__BufferRing blank_buffers_ring;
+    KC__BufferRing filled_buffers_ring;
+#endif
 };
 
 
-KC__BufferQueue* KC__buffer_queue_create(KC__MemAllocator* ma, uint32_t buffer_size, size_t buffers_count) {
-    KC__ASSERT(buffer_size > 0);
+#ifndef KC__BUFFER_QUEUE_LOCKED
+
+static void KC__buffer_ring_init(KC__MemAllocator* ma, KC__BufferRing* ring, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->cells = (KC__BufferRingCell*)KC__mem_alloc(ma, sizeof(KC__BufferRingCell) * size, "buffer queue ring cells");
+    for (size_t i = 0; i < size; i++) {
+        ring->cells[i].sequence = i;
+        ring->cells[i].buffer = NULL;
+    }
+    ring->mask = size - 1;
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    ring->epoch = 0;
+    ring->waiters_count = 0;
+    // Spinning only keeps the thread enqueuing from running on a single CPU.
+    ring->spin_count = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? KC__BUFFER_QUEUE_SPIN_COUNT : 0;
+}
+
+static void KC__buffer_ring_free(KC__MemAllocator* ma, KC__BufferRing* ring) {
+    KC__mem_free(ma, ring->cells);
+}
+
+static inline size_t KC__buffer_ring_length(const KC__BufferRing* ring) {
+    return __atomic_load_n(&(ring->enqueue_pos), __ATOMIC_SEQ_CST) - __atomic_load_n(&(ring->dequeue_pos), __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Enqueue a buffer. The ring has room for all the buffers, so a cell is found taken only while the dequeue of the
+ * buffer in it is in progress, and the enqueue waits for it.
+ * @param ring The ring.
+ * @param buffer The buffer.
+ */
+static void KC__buffer_ring_enqueue(KC__BufferRing* ring, KC__Buffer* buffer) {
+    KC__BufferRingCell* cell;
+    size_t pos = __atomic_load_n(&(ring->enqueue_pos), __ATOMIC_RELAXED);
+    while (true) {
+        cell = &(ring->cells[pos & ring->mask]);
+        const size_t sequence = __atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE);
+        const intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&(ring->enqueue_pos), &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            KC__BUFFER_QUEUE_PAUSE();
+        } else {
+            pos = __atomic_load_n(&(ring->enqueue_pos), __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->buffer = buffer;
+    __atomic_store_n(&(cell->sequence), pos + 1, __ATOMIC_RELEASE);
+}
+
+static KC__Buffer* KC__buffer_ring_dequeue(KC__BufferRing* ring) {
+    KC__BufferRingCell* cell;
+    size_t pos = __atomic_load_n(&(ring->dequeue_pos), __ATOMIC_RELAXED);
+    while (true) {
+        cell = &(ring->cells[pos & ring->mask]);
+        const size_t sequence = __atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE);
+        const intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&(ring->dequeue_pos), &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&(ring->dequeue_pos), __ATOMIC_RELAXED);
+        }
+    }
+
+    KC__Buffer* buffer = cell->buffer;
+    __atomic_store_n(&(cell->sequence), pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return buffer;
+}
+
+/**
+ * Wake the threads parked on the ring, one for an enqueue if any is parked, or all of them.
+ * @param ring The ring.
+ * @param all Whether to wake all the threads.
+ */
+static void KC__buffer_ring_wake(KC__BufferRing* ring, bool all) {
+    // Orders the enqueue before the load of the waiters count, against the increment and dequeue of the waiters.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (all || (__atomic_load_n(&(ring->waiters_count), __ATOMIC_SEQ_CST) > 0)) {
+        __atomic_add_fetch(&(ring->epoch), 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &(ring->epoch), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+    }
+}
+
+/**
+ * Dequeue a buffer, spin for a while and then park if the ring is empty.
+ * @param ring The ring.
+ * @param input_finished If not NULL, return NULL once it is set and the ring is empty.
+ * @return The buffer dequeued.
+ */
+static KC__Buffer* KC__buffer_ring_wait_dequeue(KC__BufferRing* ring, const bool* input_finished) {
+    while (true) {
+        for (size_t i = 0; i < ring->spin_count; i++) {
+            KC__Buffer* buffer = KC__buffer_ring_dequeue(ring);
+            if (buffer != NULL) {
+                return buffer;
+            }
+            KC__BUFFER_QUEUE_PAUSE();
+        }
+
+        // The waiter is counted before the ring is checked again, so an enqueue after the check wakes it, or bumps
+        // the epoch before the wait and the wait returns at once.
+        const int epoch = __atomic_load_n(&(ring->epoch), __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&(ring->waiters_count), 1, __ATOMIC_SEQ_CST);
+        KC__Buffer* buffer = KC__buffer_ring_dequeue(ring);
+        const bool finished = (input_finished != NULL) && __atomic_load_n(input_finished, __ATOMIC_SEQ_CST);
+        if ((buffer == NULL) && !finished) {
+            syscall(SYS_futex, &(ring->epoch), FUTEX_WAIT_PRIVATE, epoch, NULL, NULL, 0);
+        }
+        __atomic_sub_fetch(&(ring->waiters_count), 1, __ATOMIC_SEQ_CST);
+
+        if (buffer != NULL) {
+            return buffer;
+        }
+        if (finished) {
+            // All the buffers are enqueued before the input is finished.
+            return KC__buffer_ring_dequeue(ring);
+        }
+    }
+}
+
+#endif
+
+
+static KC__BufferQueue* KC__buffer_queue_create_buffers(KC__MemAllocator* ma, uint32_t buffer_size, size_t buffers_count, bool views) {
+    KC__ASSERT(views || (buffer_size > 0));
     KC__ASSERT(buffers_count > 0);
 
     KC__BufferQueue* bq = (KC__BufferQueue*)KC__mem_alloc(ma, sizeof(KC__BufferQueue), "buffer queue");
 
     bq->buffers_count = buffers_count;
+    bq->views = views;
     LOGGING_DEBUG("buffers count: %zu", bq->buffers_count);
 
     bq->buffers = (KC__Buffer*)KC__mem_alloc(ma, sizeof(KC__Buffer) * bq->buffers_count, "buffer queue buffers");
 
     for (size_t i = 0; i < bq->buffers_count; i++) {
-        bq->buffers[i].data = KC__mem_alloc(ma, buffer_size, "buffer queue buffers data");
+        bq->buffers[i].data = views ? NULL : KC__mem_alloc(ma, buffer_size, "buffer queue buffers data");
         bq->buffers[i].size = buffer_size;
+        bq->buffers[i].mapping = NULL;
+        bq->buffers[i].mapping_size = 0;
+        bq->buffers[i].recycled_time = NULL;
     }
 
+    bq->input_finished = true;
+
+#ifdef KC__BUFFER_QUEUE_LOCKED
     bq->blank_buffers_queue = KC__queue_create(ma, bq->buffers_count);
     bq->filled_buffers_queue = KC__queue_create(ma, bq->buffers_count);
 
     for (size_t i = 0; i < bq->buffers_count; i++)
         KC__queue_enqueue(bq->blank_buffers_queue, &(bq->buffers[i]));
 
-    bq->input_finished = true;
-
     pthread_mutex_init(&(bq->blank_buffers_queue_mtx), NULL);
     pthread_mutex_init(&(bq->filled_buffers_queue_mtx), NULL);
     pthread_cond_init(&(bq->cv_has_blank_buffers), NULL);
     pthread_cond_init(&(bq->cv_has_filled_buffers), NULL);
+#else
+    KC__buffer_ring_init(ma, &(bq->blank_buffers_ring), bq->buffers_count);
+    KC__buffer_ring_init(ma, &(bq->filled_buffers_ring), bq->buffers_count);
+
+    for (size_t i = 0; i < bq->buffers_count; i++)
+        KC__buffer_ring_enqueue(&(bq->blank_buffers_ring), &(bq->buffers[i]));
+#endif
 
     return bq;
 }
 
+KC__BufferQueue* KC__buffer_queue_create(KC__MemAllocator* ma, uint32_t buffer_size, size_t buffers_count) {
+    return KC__buffer_queue_create_buffers(ma, buffer_size, buffers_count, false);
+}
+
+KC__BufferQueue* KC__buffer_queue_create_views(KC__MemAllocator* ma, size_t buffers_count) {
+    return KC__buffer_queue_create_buffers(ma, 0, buffers_count, true);
+}
+
 void KC__buffer_queue_free(KC__MemAllocator* ma, KC__BufferQueue* bq) {
+#ifdef KC__BUFFER_QUEUE_LOCKED
     KC__ASSERT(KC__queue_is_full(bq->blank_buffers_queue));
     KC__ASSERT(KC__queue_is_empty(bq->filled_buffers_queue));
 
     KC__queue_free(ma, bq->blank_buffers_queue);
     KC__queue_free(ma, bq->filled_buffers_queue);
 
-    for (size_t i = 0; i < bq->buffers_count; i++) {
-        KC__mem_free(ma, bq->buffers[i].data);
-    }
-    KC__mem_free(ma, bq->buffers);
-
     pthread_mutex_destroy(&(bq->blank_buffers_queue_mtx));
     pthread_mutex_destroy(&(bq->filled_buffers_queue_mtx));
     pthread_cond_destroy(&(bq->cv_has_blank_buffers));
     pthread_cond_destroy(&(bq->cv_has_filled_buffers));
+#else
+    KC__ASSERT(KC__buffer_ring_length(&(bq->blank_buffers_ring)) == bq->buffers_count);
+    KC__ASSERT(KC__buffer_ring_length(&(bq->filled_buffers_ring)) == 0);
+
+    KC__buffer_ring_free(ma, &(bq->blank_buffers_ring));
+    KC__buffer_ring_free(ma, &(bq->filled_buffers_ring));
+#endif
+
+    if (!bq->views) {
+        for (size_t i = 0; i < bq->buffers_count; i++) {
+            KC__mem_free(ma, bq->buffers[i].data);
+        }
+    }
+    KC__mem_free(ma, bq->buffers);
 
     KC__mem_free(ma, bq);
 }
 
+bool KC__buffer_queue_holds_views(const KC__BufferQueue* bq) {
+    return bq->views;
+}
+
+#ifdef KC__BUFFER_QUEUE_LOCKED
+
 void KC__buffer_queue_start_input(KC__BufferQueue* bq) {
     pthread_mutex_lock(&(bq->filled_buffers_queue_mtx));
     bq->input_finished = false;
@@ -149,10 +379,62 @@ KC__Buffer* KC__buffer_queue_dequeue_filled_buffer(KC__BufferQueue* bq) {
     return filled_buffer;
 }
 
+#else
+
+void KC__buffer_queue_start_input(KC__BufferQueue* bq) {
+    __atomic_store_n(&(bq->input_finished), false, __ATOMIC_SEQ_CST);
+}
+
+void KC__buffer_queue_finish_input(KC__BufferQueue* bq) {
+    __atomic_store_n(&(bq->input_finished), true, __ATOMIC_SEQ_CST);
+    KC__buffer_ring_wake(&(bq->filled_buffers_ring), true);
+}
+
+KC__Buffer* KC__buffer_queue_get_blank_buffer(KC__BufferQueue* bq) {
+    KC__Buffer* blank_buffer = KC__buffer_ring_wait_dequeue(&(bq->blank_buffers_ring), NULL);
+
+    blank_buffer->length = 0;
+    return blank_buffer;
+}
+
+void KC__buffer_queue_enqueue_filled_buffer(KC__BufferQueue* bq, KC__Buffer* filled_buffer) {
+    KC__ASSERT(filled_buffer->length <= filled_buffer->size);
+
+    KC__buffer_ring_enqueue(&(bq->filled_buffers_ring), filled_buffer);
+    KC__buffer_ring_wake(&(bq->filled_buffers_ring), false);
+}
+
+KC__Buffer* KC__buffer_queue_dequeue_filled_buffer(KC__BufferQueue* bq) {
+    return KC__buffer_ring_wait_dequeue(&(bq->filled_buffers_ring), &(bq->input_finished));
+}
+
+#endif
+
 void KC__buffer_queue_recycle_blank_buffer(KC__BufferQueue* bq, KC__Buffer* blank_buffer) {
+    if (blank_buffer->mapping != NULL) {
+        munmap(blank_buffer->mapping, blank_buffer->mapping_size);
+        blank_buffer->mapping = NULL;
+        blank_buffer->mapping_size = 0;
+        blank_buffer->data = NULL;
+        blank_buffer->size = 0;
+    }
+
+    if (blank_buffer->recycled_time != NULL) {
+        const uint64_t now = KC__monotonic_time_ns();
+        uint64_t time = __atomic_load_n(blank_buffer->recycled_time, __ATOMIC_RELAXED);
+        while ((time < now) && !__atomic_compare_exchange_n(blank_buffer->recycled_time, &time, now, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        blank_buffer->recycled_time = NULL;
+    }
+
+#ifdef KC__BUFFER_QUEUE_LOCKED
     pthread_mutex_lock(&(bq->blank_buffers_queue_mtx));
     bool success = KC__queue_enqueue(bq->blank_buffers_queue, blank_buffer);
     KC__ASSERT(success);
     pthread_cond_signal(&(bq->cv_has_blank_buffers));
     pthread_mutex_unlock(&(bq->blank_buffers_queue_mtx));
-}
\ No newline at end of file
+#else
+    KC__buffer_ring_enqueue(&(bq->blank_buffers_ring), blank_buffer);
+    KC__buffer_ring_wake(&(bq->blank_buffers_ring), false);
+#endif
+}
@@ -21,14 +21,19 @@
 #ifndef KC__BUFFER_QUEUE_H
 #define KC__BUFFER_QUEUE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "mem_allocator.h"
 
 
 typedef enum {
     KC__BUFFER_TYPE_FASTA = 0,
+    /** A FASTA buffer starting in the sequence of a record, after the last K - 1 bases of the buffer in front of it. */
+    KC__BUFFER_TYPE_FASTA_CONTINUED,
     KC__BUFFER_TYPE_FASTQ,
     KC__BUFFER_TYPE_SUPER_KMER,
+    /** Each super K-mer has its spill partition in front of it, written to the tmp file of the partition. */
+    KC__BUFFER_TYPE_PARTITIONED_SUPER_KMER,
     KC__BUFFER_TYPE_KMER
 } KC__BufferType;
 
@@ -38,6 +43,14 @@ typedef struct {
     KC__BufferType type;
     uint32_t size;
     uint32_t length;
+    /** The mapping of the file a view points into, unmapped when the buffer is recycled, NULL if none. */
+    void* mapping;
+    size_t mapping_size;
+    /**
+     * Raised to the time the buffer is recycled (KC__monotonic_time_ns), so that the producer knows when its last buffer
+     * is consumed, NULL if not tracked. It is reset when the buffer is recycled.
+     */
+    uint64_t* recycled_time;
 } KC__Buffer;
 
 
@@ -45,8 +58,18 @@ struct KC__BufferQueue;
 typedef struct KC__BufferQueue KC__BufferQueue;
 
 KC__BufferQueue* KC__buffer_queue_create(KC__MemAllocator* mem_allocator, uint32_t buffer_size, size_t buffers_count);
+/**
+ * Create a buffer queue of buffers without data, each filled buffer is a view into a mapping of a file, which is
+ * unmapped when the buffer is recycled.
+ * @param mem_allocator Memory allocator.
+ * @param buffers_count The count of buffers.
+ * @return The buffer queue.
+ */
+KC__BufferQueue* KC__buffer_queue_create_views(KC__MemAllocator* mem_allocator, size_t buffers_count);
 void KC__buffer_queue_free(KC__MemAllocator* mem_allocator, KC__BufferQueue* buffer_queue);
 
+bool KC__buffer_queue_holds_views(const KC__BufferQueue* buffer_queue);
+
 /**
  * Inform queue to accept producing,
  * should be called before producers and consumers start running.
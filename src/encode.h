@@ -0,0 +1,132 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+#ifndef KC__ENCODE_H
+#define KC__ENCODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+/** The count of bases KC__encode_bases handles at most. */
+#define KC__ENCODE_BLOCK_SIZE 32
+
+#define KC__ENCODE_SKIPPED 0x4
+#define KC__ENCODE_INVALID 0x5
+
+/**
+ * Encode a base, A, C, G, T (case insensitive) are encoded to 0 to 3, line breaks to KC__ENCODE_SKIPPED, others to
+ * KC__ENCODE_INVALID.
+ * @param ch The base.
+ * @return The code.
+ */
+static inline KC__unit_t KC__encode(char ch) {
+    switch (ch) {
+        case 'A':
+        case 'a':
+            return 0x0;
+        case 'C':
+        case 'c':
+            return 0x1;
+        case 'G':
+        case 'g':
+            return 0x2;
+        case 'T':
+        case 't':
+            return 0x3;
+        case '\n':
+        case '\r':
+            return KC__ENCODE_SKIPPED;
+        default:
+            return KC__ENCODE_INVALID;
+    }
+}
+
+/**
+ * The bits 1 and 2 of the ASCII of A, C, G, T (either case) are 00, 01, 11, 10, xor the two bits gives the code.
+ */
+static inline uint8_t KC__encode_valid_base(char ch) {
+    return (uint8_t)((((uint8_t)ch >> 1) ^ ((uint8_t)ch >> 2)) & 0x3);
+}
+
+#if defined(__SSE2__)
+/**
+ * Encode 16 bases, return the mask of the bases other than A, C, G, T.
+ */
+static inline uint32_t KC__encode_bases_sse2(const char* bases, uint8_t* codes) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)bases);
+
+    // Shifts by 16-bit lanes are fine, only the low 2 bits of each byte are kept.
+    const __m128i c = _mm_and_si128(_mm_xor_si128(_mm_srli_epi16(v, 1), _mm_srli_epi16(v, 2)), _mm_set1_epi8(0x3));
+    _mm_storeu_si128((__m128i*)codes, c);
+
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i valid = _mm_cmpeq_epi8(lower, _mm_set1_epi8('a'));
+    valid = _mm_or_si128(valid, _mm_cmpeq_epi8(lower, _mm_set1_epi8('c')));
+    valid = _mm_or_si128(valid, _mm_cmpeq_epi8(lower, _mm_set1_epi8('g')));
+    valid = _mm_or_si128(valid, _mm_cmpeq_epi8(lower, _mm_set1_epi8('t')));
+    return (~(uint32_t)_mm_movemask_epi8(valid)) & UINT32_C(0xffff);
+}
+#endif // __SSE2__
+
+/**
+ * Encode a block of bases into 2-bit codes, the codes of the bases other than A, C, G, T (case insensitive) are
+ * undefined, and the bits of their positions are set in the returned mask, so that K-mers can be generated over the runs
+ * of valid bases.
+ * @param bases The bases.
+ * @param count The count of bases, should not be larger than KC__ENCODE_BLOCK_SIZE.
+ * @param codes The codes of the bases, at least KC__ENCODE_BLOCK_SIZE bytes.
+ * @return The mask of invalid bases, bit i for the (i)th base.
+ */
+static inline uint32_t KC__encode_bases(const char* bases, size_t count, uint8_t* codes) {
+    if (count == KC__ENCODE_BLOCK_SIZE) {
+#if defined(__AVX2__)
+        const __m256i v = _mm256_loadu_si256((const __m256i*)bases);
+
+        const __m256i c = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi16(v, 1), _mm256_srli_epi16(v, 2)), _mm256_set1_epi8(0x3));
+        _mm256_storeu_si256((__m256i*)codes, c);
+
+        const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i valid = _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('a'));
+        valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('c')));
+        valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('g')));
+        valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('t')));
+        return ~(uint32_t)_mm256_movemask_epi8(valid);
+#elif defined(__SSE2__)
+        return KC__encode_bases_sse2(bases, codes) | (KC__encode_bases_sse2(bases + 16, codes + 16) << 16);
+#endif
+    }
+
+    // Scalar fallback, also for the tail of a read, as the bytes after it may not be readable.
+    uint32_t invalid = 0;
+    for (size_t i = 0; i < count; i++) {
+        codes[i] = KC__encode_valid_base(bases[i]);
+        if (KC__encode(bases[i]) > 0x3) {
+            invalid |= UINT32_C(1) << i;
+        }
+    }
+    return invalid;
+}
+
+#endif
@@ -18,18 +18,41 @@
  */
 
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
 
 #include "file_reader.h"
 #include "logging.h"
 #include "assert.h"
 #include "buffer_queue.h"
-
+#include "async_reader.h"
+#include "utils.h"
+
+
+/** The header of a BGZF block, a gzip member header whose first extra subfield 'BC' holds the size of the block. */
+#define KC__BGZF_HEADER_SIZE 18
+#define KC__BGZF_FOOTER_SIZE 8
+/** Both the compressed and the inflated sizes of a BGZF block are at most 64 KB. */
+#define KC__BGZF_BLOCK_SIZE_MAX 65536
+#define KC__FILE_READER_BGZF_BATCH_MAX 1024
+/** The size of each read of compressed data kept in flight by the async reader. */
+#define KC__FILE_READER_ASYNC_CHUNK_SIZE ((size_t)1 << 20)
+
+typedef struct {
+    const unsigned char* data;
+    size_t data_size;
+    char* out;
+    size_t out_size;
+    uint32_t crc;
+} KC__BgzfBlock;
 
 struct KC__FileReader {
     KC__FileInputDescription input;
@@ -43,9 +66,61 @@ struct KC__FileReader {
     z_stream gz_stream;
     void* gz_data;
     size_t gz_data_size;
+
+    /**
+     * BGZF files are inflated in batches of blocks by inflating_threads_count threads (this thread included, the others
+     * are works of the thread pool), the blocks of a batch are inflated into their places of the buffer, so the buffers
+     * are still filled in order. The
+     * compressed data not yet inflated is in [gz_data_start, gz_data_end) of gz_data, and the inflated data of the block
+     * split between two buffers is in [bgzf_pending_start, bgzf_pending_end) of bgzf_pending.
+     */
+    bool bgzf;
+    size_t inflating_threads_count;
+    size_t gz_data_start;
+    size_t gz_data_end;
+    bool gz_data_eof;
+    KC__BgzfBlock* bgzf_blocks;
+    size_t bgzf_blocks_count;
+    size_t bgzf_next_block;
+    bool bgzf_error;
+    bool bgzf_stop;
+    char* bgzf_pending;
+    size_t bgzf_pending_start;
+    size_t bgzf_pending_end;
+    pthread_barrier_t bgzf_barrier;
+    KC__ThreadPool* thread_pool;
+
+    /** Compressed files are read ahead by the async reader if it is initialized, while the data read is inflated. */
+    KC__AsyncReader* async_reader;
+    bool direct_io;
+
+    /**
+     * The byte range [range_start, range_end) of the plain file read, the records starting in it are read, and
+     * range_remaining is the size of the data left to read.
+     */
+    size_t range_start;
+    size_t range_end;
+    size_t range_remaining;
+
+    /**
+     * If the buffer queue holds views, plain files are mapped instead of read, each buffer is a view of at most
+     * view_size bytes into a mapping of its own, cut at the start of a record.
+     */
+    bool mapping_files;
+    size_t view_size;
+    size_t page_size;
+
+    /**
+     * The times the last work started and finished, the time its last buffer was consumed, and the count of the file
+     * ranges (or whole files) it read. The views of mapped files are only read when they are consumed.
+     */
+    uint64_t start_time;
+    uint64_t finish_time;
+    uint64_t recycled_time;
+    size_t busy_ranges_count;
 };
 
-KC__FileReader* KC__file_reader_create(KC__MemAllocator* ma, size_t K, KC__FileCompressionType compressionType, size_t buffer_size) {
+KC__FileReader* KC__file_reader_create(KC__MemAllocator* ma, size_t K, KC__FileCompressionType compressionType, size_t buffer_size, size_t inflating_threads_count) {
     KC__FileReader* fr = (KC__FileReader*)KC__mem_alloc(ma, sizeof(KC__FileReader), "file reader");
 
     fr->K = K;
@@ -54,11 +129,33 @@ KC__FileReader* KC__file_reader_create(KC__MemAllocator* ma, size_t K, KC__FileC
     fr->gz_data_size = buffer_size;
     fr->gz_data = NULL;
 
+    fr->bgzf = false;
+    fr->inflating_threads_count = inflating_threads_count;
+    fr->bgzf_blocks = NULL;
+    fr->bgzf_pending = NULL;
+    fr->thread_pool = NULL;
+
+    fr->async_reader = NULL;
+    fr->direct_io = false;
+
+    fr->range_start = 0;
+    fr->range_end = SIZE_MAX;
+    fr->range_remaining = SIZE_MAX;
+
+    fr->mapping_files = false;
+    fr->view_size = buffer_size;
+    fr->page_size = (size_t)sysconf(_SC_PAGESIZE);
+
     switch (compressionType) {
         case KC__FILE_COMPRESSION_TYPE_PLAIN:
             break;
         case KC__FILE_COMPRESSION_TYPE_GZIP:
             fr->gz_data = KC__mem_alloc(ma, fr->gz_data_size, "file reader gz data");
+            fr->bgzf_blocks = (KC__BgzfBlock*)KC__mem_alloc(ma, sizeof(KC__BgzfBlock) * KC__FILE_READER_BGZF_BATCH_MAX, "file reader bgzf blocks");
+            fr->bgzf_pending = (char*)KC__mem_alloc(ma, KC__BGZF_BLOCK_SIZE_MAX, "file reader bgzf pending data");
+            if (fr->inflating_threads_count > 1) {
+                pthread_barrier_init(&(fr->bgzf_barrier), NULL, (unsigned int)(fr->inflating_threads_count));
+            }
             break;
         default:
             KC__ASSERT(false);
@@ -69,14 +166,34 @@ KC__FileReader* KC__file_reader_create(KC__MemAllocator* ma, size_t K, KC__FileC
 }
 
 void KC__file_reader_free(KC__MemAllocator* ma, KC__FileReader* fr) {
+    if (fr->async_reader != NULL) {
+        KC__async_reader_free(ma, fr->async_reader);
+    }
     if (fr->gz_data) {
         KC__mem_free(ma, fr->gz_data);
+        KC__mem_free(ma, fr->bgzf_blocks);
+        KC__mem_free(ma, fr->bgzf_pending);
+        if (fr->inflating_threads_count > 1) {
+            pthread_barrier_destroy(&(fr->bgzf_barrier));
+        }
     }
     KC__mem_free(ma, fr);
 }
 
+void KC__file_reader_init_async_reading(KC__MemAllocator* ma, KC__FileReader* fr, KC__AsyncReadEngine engine, size_t depth, bool direct_io) {
+    KC__ASSERT(fr->gz_data != NULL);
+    KC__ASSERT(fr->async_reader == NULL);
+    fr->async_reader = KC__async_reader_create(ma, engine, KC__FILE_READER_ASYNC_CHUNK_SIZE, depth);
+    fr->direct_io = direct_io;
+}
+
+void KC__file_reader_set_thread_pool(KC__FileReader* fr, KC__ThreadPool* pool) {
+    fr->thread_pool = pool;
+}
+
 void KC__file_reader_link_modules(KC__FileReader* fr, KC__BufferQueue* buffer_queue) {
     fr->buffer_queue = buffer_queue;
+    fr->mapping_files = KC__buffer_queue_holds_views(buffer_queue);
 }
 
 void KC__file_reader_update_input(KC__FileReader* fr, KC__FileInputDescription input) {
@@ -120,7 +237,7 @@ static inline void KC__file_reader_request_buffer(KC__FileReader* fr, KC__Buffer
     KC__Buffer* bf = KC__buffer_queue_get_blank_buffer(fr->buffer_queue);
     KC__ASSERT(bf != NULL);
 
-    KC__BufferType buffer_type;
+    KC__BufferType buffer_type = KC__BUFFER_TYPE_FASTA;
     switch (fr->input.file_type) {
         case KC__FILE_TYPE_FASTA:
             buffer_type = KC__BUFFER_TYPE_FASTA;
@@ -137,6 +254,7 @@ static inline void KC__file_reader_request_buffer(KC__FileReader* fr, KC__Buffer
     }
 
     bf->type = buffer_type;
+    bf->recycled_time = &(fr->recycled_time);
 
     *buffer = bf;
 }
@@ -229,12 +347,598 @@ static inline void KC__file_reader_modify_fastq_buffers(KC__FileReader* fr, KC__
     KC__file_reader_transfer_data(fr, current_buffer, extra_buffer, extra_size);
 }
 
+/**
+ * Read the compressed data, from the async reader if it is initialized.
+ * @return The size read, less than size only at the end of the file.
+ */
+static size_t KC__file_reader_read_compressed(KC__FileReader* fr, FILE* file, void* out, size_t size) {
+    size_t read_size;
+    if (fr->async_reader != NULL) {
+        if (!KC__async_reader_read(fr->async_reader, out, size, &read_size)) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, strerror(errno));
+        }
+    } else {
+        read_size = fread(out, 1, size, file);
+        if (ferror(file)) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
+        }
+    }
+    return read_size;
+}
+
+/**
+ * Move the compressed data not yet inflated to the front of gz_data, and fill the rest of gz_data from the file.
+ */
+static void KC__file_reader_refill_gz_data(KC__FileReader* fr, FILE* file) {
+    char* gz_data = fr->gz_data;
+    const size_t remain_size = fr->gz_data_end - fr->gz_data_start;
+    memmove(gz_data, gz_data + fr->gz_data_start, remain_size);
+    fr->gz_data_start = 0;
+    fr->gz_data_end = remain_size;
+
+    if (fr->gz_data_eof) {
+        return;
+    }
+
+    const size_t size = fr->gz_data_size - fr->gz_data_end;
+    const size_t read_size = KC__file_reader_read_compressed(fr, file, gz_data + fr->gz_data_end, size);
+    fr->gz_data_end += read_size;
+    fr->gz_data_eof = (read_size < size);
+}
+
+/**
+ * Get the size of the BGZF block from its header.
+ * @param data The start of the block.
+ * @param size The size of the data available.
+ * @return The size of the block, 0 if the data is not the header of a BGZF block.
+ */
+static inline size_t KC__bgzf_block_size(const void* data, size_t size) {
+    const unsigned char* p = data;
+    if (size < KC__BGZF_HEADER_SIZE) {
+        return 0;
+    }
+    // Magic number, deflate, FEXTRA flag.
+    if ((p[0] != 0x1F) || (p[1] != 0x8B) || (p[2] != 0x08) || ((p[3] & 0x04) == 0)) {
+        return 0;
+    }
+    const size_t xlen = (size_t)(p[10]) | ((size_t)(p[11]) << 8);
+    if ((xlen < 6) || (p[12] != 'B') || (p[13] != 'C') || (p[14] != 2) || (p[15] != 0)) {
+        return 0;
+    }
+    const size_t block_size = ((size_t)(p[16]) | ((size_t)(p[17]) << 8)) + 1;
+    if (block_size < 12 + xlen + KC__BGZF_FOOTER_SIZE) {
+        return 0;
+    }
+    return block_size;
+}
+
+static inline uint32_t KC__bgzf_read_uint32(const unsigned char* p) {
+    return (uint32_t)(p[0]) | ((uint32_t)(p[1]) << 8) | ((uint32_t)(p[2]) << 16) | ((uint32_t)(p[3]) << 24);
+}
+
+/**
+ * Inflate the raw deflate data of the block, and check its size and CRC.
+ * @return If the block is inflated correctly.
+ */
+static bool KC__bgzf_inflate_block(z_stream* stream, const KC__BgzfBlock* block) {
+    if (block->out_size == 0) {
+        return block->crc == 0;
+    }
+
+    if (inflateReset(stream) != Z_OK) {
+        return false;
+    }
+    stream->next_in = (Bytef*)(block->data);
+    stream->avail_in = (uInt)(block->data_size);
+    stream->next_out = (Bytef*)(block->out);
+    stream->avail_out = (uInt)(block->out_size);
+
+    if ((inflate(stream, Z_FINISH) != Z_STREAM_END) || (stream->avail_out != 0)) {
+        return false;
+    }
+    return crc32(crc32(0L, Z_NULL, 0), (const Bytef*)(block->out), (uInt)(block->out_size)) == block->crc;
+}
+
+static void KC__file_reader_inflate_bgzf_blocks(KC__FileReader* fr, z_stream* stream) {
+    while (true) {
+        const size_t i = __atomic_fetch_add(&(fr->bgzf_next_block), 1, __ATOMIC_RELAXED);
+        if (i >= fr->bgzf_blocks_count) {
+            break;
+        }
+        if (!KC__bgzf_inflate_block(stream, &(fr->bgzf_blocks[i]))) {
+            __atomic_store_n(&(fr->bgzf_error), true, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Inflate the blocks of every batch with the reader until the file is finished.
+ */
+static void* KC__file_reader_inflate_work(void* ptr) {
+    KC__FileReader* fr = ptr;
+
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.avail_in = 0;
+    stream.next_in = Z_NULL;
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        LOGGING_ERROR("Init gz stream failed.");
+        exit(EXIT_FAILURE);
+    }
+
+    while (true) {
+        pthread_barrier_wait(&(fr->bgzf_barrier));
+        if (fr->bgzf_stop) {
+            break;
+        }
+        KC__file_reader_inflate_bgzf_blocks(fr, &stream);
+        pthread_barrier_wait(&(fr->bgzf_barrier));
+    }
+
+    inflateEnd(&stream);
+
+    return NULL;
+}
+
+/**
+ * Inflate a batch of the BGZF blocks which fit in the output. If not even the first block fits, it is inflated to the
+ * pending data, and the part of it fitting in the output is copied.
+ * @return The size of data inflated to the output, 0 if the file is finished.
+ */
+static size_t KC__file_reader_inflate_bgzf_batch(KC__FileReader* fr, FILE* file, char* out, size_t out_size) {
+    size_t got_size = 0;
+    bool split = false;
+    fr->bgzf_blocks_count = 0;
+
+    while (fr->bgzf_blocks_count < KC__FILE_READER_BGZF_BATCH_MAX) {
+        const unsigned char* data = (const unsigned char*)(fr->gz_data) + fr->gz_data_start;
+        size_t available_size = fr->gz_data_end - fr->gz_data_start;
+        size_t block_size = KC__bgzf_block_size(data, available_size);
+
+        if ((available_size < KC__BGZF_HEADER_SIZE) || (block_size > available_size)) {
+            // The batch points into gz_data, which can only be refilled before the first block.
+            if (fr->bgzf_blocks_count > 0) {
+                break;
+            }
+            KC__file_reader_refill_gz_data(fr, file);
+            data = fr->gz_data;
+            available_size = fr->gz_data_end;
+            if (available_size == 0) {
+                break;
+            }
+            block_size = KC__bgzf_block_size(data, available_size);
+            if ((available_size < KC__BGZF_HEADER_SIZE) || (block_size > available_size)) {
+                if (fr->gz_data_eof) {
+                    KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "File is truncated");
+                }
+                KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "Buffer size is less than BGZF block size");
+            }
+        }
+        if (block_size == 0) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "Invalid BGZF block");
+        }
+
+        const size_t header_size = 12 + ((size_t)(data[10]) | ((size_t)(data[11]) << 8));
+        KC__BgzfBlock* block = &(fr->bgzf_blocks[fr->bgzf_blocks_count]);
+        block->data = data + header_size;
+        block->data_size = block_size - header_size - KC__BGZF_FOOTER_SIZE;
+        block->crc = KC__bgzf_read_uint32(data + block_size - KC__BGZF_FOOTER_SIZE);
+        block->out_size = KC__bgzf_read_uint32(data + block_size - 4);
+        if (block->out_size > KC__BGZF_BLOCK_SIZE_MAX) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "Invalid BGZF block");
+        }
+
+        if (got_size + block->out_size > out_size) {
+            if (fr->bgzf_blocks_count > 0) {
+                break;
+            }
+            split = true;
+            block->out = fr->bgzf_pending;
+        } else {
+            block->out = out + got_size;
+            got_size += block->out_size;
+        }
+
+        fr->bgzf_blocks_count++;
+        fr->gz_data_start += block_size;
+
+        if (split) {
+            break;
+        }
+    }
+
+    fr->bgzf_next_block = 0;
+    fr->bgzf_error = false;
+    if (fr->inflating_threads_count > 1) {
+        pthread_barrier_wait(&(fr->bgzf_barrier));
+    }
+    KC__file_reader_inflate_bgzf_blocks(fr, &(fr->gz_stream));
+    if (fr->inflating_threads_count > 1) {
+        pthread_barrier_wait(&(fr->bgzf_barrier));
+    }
+    if (fr->bgzf_error) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, "GZip file read error");
+    }
+
+    if (split) {
+        got_size = out_size;
+        memcpy(out, fr->bgzf_pending, got_size);
+        fr->bgzf_pending_start = got_size;
+        fr->bgzf_pending_end = fr->bgzf_blocks[0].out_size;
+    }
+
+    return got_size;
+}
+
+static void KC__file_reader_read_bgzf(KC__FileReader* fr, FILE* file, const size_t in_size, void* out, size_t* out_size, bool* end_of_file) {
+    // The rest of the block split by the last read.
+    size_t got_size = fr->bgzf_pending_end - fr->bgzf_pending_start;
+    if (got_size > in_size) {
+        got_size = in_size;
+    }
+    memcpy(out, fr->bgzf_pending + fr->bgzf_pending_start, got_size);
+    fr->bgzf_pending_start += got_size;
+
+    while (got_size < in_size) {
+        const size_t size = KC__file_reader_inflate_bgzf_batch(fr, file, (char*)out + got_size, in_size - got_size);
+        if (size == 0) {
+            break;
+        }
+        got_size += size;
+    }
+
+    *out_size = got_size;
+    *end_of_file = fr->gz_data_eof && (fr->gz_data_start == fr->gz_data_end) && (fr->bgzf_pending_start == fr->bgzf_pending_end);
+}
+
+typedef struct {
+    size_t start;
+    size_t length;
+    char first;
+} KC__FileReaderLine;
+
+/**
+ * Find the first record starting at or after the offset, so that a record crossing the boundary of two ranges is read
+ * by the range its first byte is in. A FASTQ record is recognized by its '@' and '+' lines, and its sequence and
+ * quality lines of the same length, rather than by a '@' alone, which may also start a quality line.
+ * @param fr The file reader.
+ * @param file The file.
+ * @param offset The offset.
+ * @return The offset of the record, or the size of the file if there is none.
+ */
+static size_t KC__file_reader_find_record_start(KC__FileReader* fr, FILE* file, size_t offset) {
+    if (offset == 0) {
+        return 0;
+    }
+
+    // The byte in front of the offset tells if the offset is the start of a line.
+    if (fseeko(file, (off_t)(offset - 1), SEEK_SET) != 0) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
+    }
+
+    // The last 4 complete lines, the newest one at (lines_count - 1) % 4.
+    KC__FileReaderLine lines[4];
+    size_t lines_count = 0;
+    KC__FileReaderLine line = {0, 0, 0};
+    bool in_line = false;
+    bool at_line_start = false;
+
+    char data[4096];
+    size_t pos = offset - 1;
+    while (true) {
+        const size_t read_size = fread(data, 1, sizeof(data), file);
+        if (ferror(file)) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
+        }
+
+        for (size_t i = 0; i < read_size; i++, pos++) {
+            const char c = data[i];
+            if (pos == offset - 1) {
+                at_line_start = (c == '\n');
+                continue;
+            }
+
+            if (!in_line) {
+                if (!at_line_start) {
+                    at_line_start = (c == '\n');
+                    continue;
+                }
+                if ((fr->input.file_type == KC__FILE_TYPE_FASTA) && (c == '>')) {
+                    return pos;
+                }
+                line.start = pos;
+                line.length = 0;
+                line.first = c;
+                in_line = true;
+            }
+
+            if (c != '\n') {
+                line.length++;
+                continue;
+            }
+
+            in_line = false;
+            lines[lines_count % 4] = line;
+            lines_count++;
+            if ((fr->input.file_type == KC__FILE_TYPE_FASTQ) && (lines_count >= 4)) {
+                const KC__FileReaderLine* l0 = &(lines[lines_count % 4]);
+                const KC__FileReaderLine* l1 = &(lines[(lines_count + 1) % 4]);
+                const KC__FileReaderLine* l2 = &(lines[(lines_count + 2) % 4]);
+                const KC__FileReaderLine* l3 = &(lines[(lines_count + 3) % 4]);
+                if ((l0->first == '@') && (l2->first == '+') && (l1->length == l3->length)) {
+                    return l0->start;
+                }
+            }
+        }
+
+        if (read_size < sizeof(data)) {
+            break;
+        }
+    }
+
+    // The quality line of the last record may not be ended.
+    if (in_line && (fr->input.file_type == KC__FILE_TYPE_FASTQ) && (lines_count >= 3)) {
+        const KC__FileReaderLine* l0 = &(lines[(lines_count - 3) % 4]);
+        if ((l0->first == '@') && (lines[(lines_count - 1) % 4].first == '+') && (lines[(lines_count - 2) % 4].length == line.length)) {
+            return l0->start;
+        }
+    }
+
+    return pos;
+}
+
+/**
+ * Move to the first record of the range of the file, and limit the data read to the range.
+ */
+static void KC__file_reader_seek_range(KC__FileReader* fr, FILE* file) {
+    const size_t start = KC__file_reader_find_record_start(fr, file, fr->range_start);
+    const size_t end = KC__file_reader_find_record_start(fr, file, fr->range_end);
+    KC__ASSERT(start <= end);
+
+    if (fseeko(file, (off_t)start, SEEK_SET) != 0) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
+    }
+    fr->range_remaining = end - start;
+    LOGGING_DEBUG("Read range [%zu, %zu) [%s]", start, end, fr->file_name);
+}
+
+/**
+ * Map [offset, offset + size) of the file, the mapping starts at the page the offset is in.
+ * @param fr The file reader.
+ * @param fd The file descriptor.
+ * @param offset The offset.
+ * @param size The size of the data, larger than 0.
+ * @param advice The advice of the access pattern.
+ * @param mapping Set to the mapping.
+ * @param mapping_size Set to the size of the mapping.
+ * @return The data at the offset.
+ */
+static char* KC__file_reader_map(KC__FileReader* fr, int fd, size_t offset, size_t size, int advice, void** mapping, size_t* mapping_size) {
+    KC__ASSERT(size > 0);
+    const size_t page_offset = offset % fr->page_size;
+    *mapping_size = page_offset + size;
+    *mapping = mmap(NULL, *mapping_size, PROT_READ, MAP_PRIVATE, fd, (off_t)(offset - page_offset));
+    if (*mapping == MAP_FAILED) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, "Map file failed");
+    }
+    madvise(*mapping, *mapping_size, advice);
+    return (char*)(*mapping) + page_offset;
+}
+
+/**
+ * Fill a buffer with a view into a mapping of [offset, offset + size) of the file.
+ */
+static void KC__file_reader_complete_view(KC__FileReader* fr, int fd, size_t offset, size_t size, bool continued) {
+    if (size == 0) {
+        return;
+    }
+    KC__ASSERT(size <= UINT32_MAX);
+
+    KC__Buffer* bf;
+    KC__file_reader_request_buffer(fr, &bf);
+    KC__ASSERT(bf->mapping == NULL);
+    if (continued) {
+        bf->type = KC__BUFFER_TYPE_FASTA_CONTINUED;
+    }
+
+    bf->data = KC__file_reader_map(fr, fd, offset, size, MADV_SEQUENTIAL, &(bf->mapping), &(bf->mapping_size));
+    // The pages of the view are read ahead while the processors handle the views in front of it.
+    madvise(bf->mapping, bf->mapping_size, MADV_WILLNEED);
+    bf->size = (uint32_t)size;
+    bf->length = (uint32_t)size;
+
+    KC__file_reader_complete_buffer(fr, &bf);
+}
+
+static inline bool KC__file_reader_is_line_start(const char* data, size_t i) {
+    return (data[i - 1] == '\n') || (data[i - 1] == '\r');
+}
+
+/**
+ * Check if a FASTQ record starts at i, by its '@' and '+' lines, and its sequence and quality lines of the same length.
+ */
+static bool KC__file_reader_is_fastq_record(const char* data, size_t i, size_t size) {
+    const char* end = data + size;
+    const char* header = data + i;
+    if (header[0] != '@') {
+        return false;
+    }
+
+    const char* lines[4];
+    lines[0] = header;
+    for (size_t n = 1; n < 4; n++) {
+        const char* line_end = memchr(lines[n - 1], '\n', (size_t)(end - lines[n - 1]));
+        if ((line_end == NULL) || (line_end + 1 == end)) {
+            return false;
+        }
+        lines[n] = line_end + 1;
+    }
+    if (lines[2][0] != '+') {
+        return false;
+    }
+
+    // The quality line of the last record may not be ended.
+    const char* quality_end = memchr(lines[3], '\n', (size_t)(end - lines[3]));
+    if (quality_end == NULL) {
+        quality_end = end;
+    }
+    return (lines[2] - lines[1]) == (quality_end + 1 - lines[3]);
+}
+
+/**
+ * Find where to cut the view starting at i, at most view_size bytes long.
+ * @param fr The file reader.
+ * @param data The data.
+ * @param i The start of the view.
+ * @param size The size of the data, larger than i + view_size.
+ * @param continued Set if the data after the cut continues the sequence of the record in the view.
+ * @return The end of the view, also the start of the next view if not continued.
+ */
+static size_t KC__file_reader_cut_view(KC__FileReader* fr, const char* data, size_t i, size_t size, bool* continued) {
+    const size_t limit = i + fr->view_size;
+    KC__ASSERT(limit < size);
+
+    *continued = false;
+    for (size_t n = limit; n > i; n--) {
+        if ((fr->input.file_type == KC__FILE_TYPE_FASTA) && (data[n] == '>') && KC__file_reader_is_line_start(data, n)) {
+            return n;
+        }
+        if ((fr->input.file_type == KC__FILE_TYPE_FASTQ) && (data[n] == '@') && (data[n - 1] == '\n') && KC__file_reader_is_fastq_record(data, n, size)) {
+            return n;
+        }
+    }
+
+    if (fr->input.file_type == KC__FILE_TYPE_FASTQ) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "Sequence may be too long");
+    }
+
+    // The FASTA record is longer than the view, the next view continues its sequence.
+    *continued = true;
+    return limit;
+}
+
+/**
+ * The view continuing the sequence starts at the last K - 1 characters (line breaks excluded) in front of the cut, so
+ * each K-mer is in exactly one of the views.
+ */
+static size_t KC__file_reader_continued_view_start(KC__FileReader* fr, const char* data, size_t i, size_t cut) {
+    size_t n = cut;
+    size_t chars_count = 0;
+    while (chars_count < fr->K - 1) {
+        if (n == i) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "Header may be too long");
+        }
+        n--;
+        if ((data[n] != '\n') && (data[n] != '\r')) {
+            chars_count++;
+        }
+    }
+
+    // The view does not continue from inside the header line.
+    if (data[i] == '>') {
+        const char* header_end = memchr(data + i, '\n', cut - i);
+        if ((header_end == NULL) || ((size_t)(header_end - data) >= n)) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "Header may be too long");
+        }
+    }
+    return n;
+}
+
+/**
+ * The range of the file is mapped to find where to cut the views, each view is mapped on its own, and unmapped when the
+ * buffer is recycled.
+ */
+static void KC__file_reader_process_mapped_reads_file(KC__FileReader* fr, FILE* file) {
+    const int fd = fileno(file);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
+    }
+    const size_t file_size = (size_t)(st.st_size);
+
+    size_t start = 0;
+    size_t end = file_size;
+    if (fr->range_start != 0) {
+        start = KC__file_reader_find_record_start(fr, file, fr->range_start);
+    }
+    if (fr->range_end < file_size) {
+        end = KC__file_reader_find_record_start(fr, file, fr->range_end);
+    }
+    if (start >= end) {
+        return;
+    }
+    LOGGING_DEBUG("Map range [%zu, %zu) [%s]", start, end, fr->file_name);
+
+    void* mapping;
+    size_t mapping_size;
+    const char* data = KC__file_reader_map(fr, fd, start, end - start, MADV_RANDOM, &mapping, &mapping_size);
+    const size_t size = end - start;
+
+    size_t i = 0;
+    bool continued = false;
+    while (size - i > fr->view_size) {
+        bool next_continued;
+        const size_t cut = KC__file_reader_cut_view(fr, data, i, size, &next_continued);
+        KC__file_reader_complete_view(fr, fd, start + i, cut - i, continued);
+
+        i = next_continued ? KC__file_reader_continued_view_start(fr, data, i, cut) : cut;
+        continued = next_continued;
+    }
+    KC__file_reader_complete_view(fr, fd, start + i, size - i, continued);
+
+    munmap(mapping, mapping_size);
+}
+
+/**
+ * Each block of the super K-mers file, its size in front of it, is a view.
+ */
+static void KC__file_reader_process_mapped_super_kmer_file(KC__FileReader* fr, FILE* file) {
+    const int fd = fileno(file);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
+    }
+    const size_t file_size = (size_t)(st.st_size);
+    if (file_size == 0) {
+        return;
+    }
+
+    void* mapping;
+    size_t mapping_size;
+    const char* data = KC__file_reader_map(fr, fd, 0, file_size, MADV_RANDOM, &mapping, &mapping_size);
+
+    size_t i = 0;
+    while (i < file_size) {
+        uint32_t buffer_length;
+        if (file_size - i < sizeof(uint32_t)) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "File is truncated");
+        }
+        memcpy(&buffer_length, data + i, sizeof(uint32_t));
+        i += sizeof(uint32_t);
+
+        if (file_size - i < buffer_length) {
+            KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_PARSE, "File is truncated");
+        }
+        KC__file_reader_complete_view(fr, fd, i, buffer_length, false);
+        i += buffer_length;
+    }
+
+    munmap(mapping, mapping_size);
+}
+
 static void KC__file_reader_read(KC__FileReader* fr, FILE* file, const size_t in_size, void* out, size_t* out_size, bool* end_of_file) {
-    if (fr->input.compression_type == KC__FILE_COMPRESSION_TYPE_PLAIN) {
-        const size_t read_size = fread(out, 1, in_size, file);
+    if (fr->bgzf) {
+        KC__file_reader_read_bgzf(fr, file, in_size, out, out_size, end_of_file);
+
+    } else if (fr->input.compression_type == KC__FILE_COMPRESSION_TYPE_PLAIN) {
+        const size_t size = (in_size < fr->range_remaining) ? in_size : fr->range_remaining;
+        const size_t read_size = fread(out, 1, size, file);
         if (ferror(file)) {
             KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
         }
+        fr->range_remaining -= read_size;
 
         *out_size = read_size;
         *end_of_file = (read_size < in_size);
@@ -246,13 +950,7 @@ static void KC__file_reader_read(KC__FileReader* fr, FILE* file, const size_t in
 
         while (true) {
             if (fr->gz_stream.avail_in == 0) {
-                const size_t read_size = fread(fr->gz_data, 1, fr->gz_data_size, file);
-
-                if (ferror(file)) {
-                    inflateEnd(&(fr->gz_stream));
-                    KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_READ, NULL);
-                }
-
+                const size_t read_size = KC__file_reader_read_compressed(fr, file, fr->gz_data, fr->gz_data_size);
                 if (read_size == 0) {
                     eof = true;
                     break;
@@ -307,8 +1005,23 @@ static void KC__file_reader_process_reads_file(KC__FileReader* fr) {
         KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_OPEN, NULL);
     }
 
+    if (fr->mapping_files) {
+        KC__ASSERT(fr->input.compression_type == KC__FILE_COMPRESSION_TYPE_PLAIN);
+        KC__file_reader_process_mapped_reads_file(fr, file);
+        fclose(file);
+        return;
+    }
+
+    fr->bgzf = false;
+    KC__ThreadPoolPhase inflating_phase;
+    void* inflating_args[fr->inflating_threads_count];
+
     switch (fr->input.compression_type) {
         case KC__FILE_COMPRESSION_TYPE_PLAIN:
+            fr->range_remaining = SIZE_MAX;
+            if ((fr->range_start != 0) || (fr->range_end != SIZE_MAX)) {
+                KC__file_reader_seek_range(fr, file);
+            }
             break;
         case KC__FILE_COMPRESSION_TYPE_GZIP:
             fr->gz_stream.zalloc = Z_NULL;
@@ -316,9 +1029,41 @@ static void KC__file_reader_process_reads_file(KC__FileReader* fr) {
             fr->gz_stream.opaque = Z_NULL;
             fr->gz_stream.avail_in = 0;
             fr->gz_stream.next_in = Z_NULL;
-            if (inflateInit2(&(fr->gz_stream), 31) != Z_OK) {
-                LOGGING_ERROR("Init gz stream failed.");
-                exit(EXIT_FAILURE);
+
+            if (fr->async_reader != NULL) {
+                KC__async_reader_start(fr->async_reader, fileno(file), fr->direct_io);
+            }
+
+            // The data read to check the format is kept for either path.
+            fr->gz_data_start = 0;
+            fr->gz_data_end = 0;
+            fr->gz_data_eof = false;
+            KC__file_reader_refill_gz_data(fr, file);
+            fr->bgzf = (KC__bgzf_block_size(fr->gz_data, fr->gz_data_end) != 0);
+
+            if (fr->bgzf) {
+                LOGGING_DEBUG("BGZF file, inflated by %zu threads [%s]", fr->inflating_threads_count, fr->file_name);
+                if (inflateInit2(&(fr->gz_stream), -15) != Z_OK) {
+                    LOGGING_ERROR("Init gz stream failed.");
+                    exit(EXIT_FAILURE);
+                }
+                fr->bgzf_pending_start = 0;
+                fr->bgzf_pending_end = 0;
+                fr->bgzf_stop = false;
+                if (fr->inflating_threads_count > 1) {
+                    KC__ASSERT(fr->thread_pool != NULL);
+                    for (size_t i = 0; i < fr->inflating_threads_count - 1; i++) {
+                        inflating_args[i] = fr;
+                    }
+                    KC__thread_pool_start(fr->thread_pool, &inflating_phase, KC__file_reader_inflate_work, inflating_args, fr->inflating_threads_count - 1);
+                }
+            } else {
+                if (inflateInit2(&(fr->gz_stream), 31) != Z_OK) {
+                    LOGGING_ERROR("Init gz stream failed.");
+                    exit(EXIT_FAILURE);
+                }
+                fr->gz_stream.avail_in = (uint)(fr->gz_data_end);
+                fr->gz_stream.next_in = fr->gz_data;
             }
             break;
         default:
@@ -372,6 +1117,19 @@ static void KC__file_reader_process_reads_file(KC__FileReader* fr) {
 
     KC__file_reader_complete_buffer(fr, &current_buffer);
 
+    if (fr->bgzf) {
+        if (fr->inflating_threads_count > 1) {
+            fr->bgzf_stop = true;
+            pthread_barrier_wait(&(fr->bgzf_barrier));
+            KC__thread_pool_wait(fr->thread_pool, &inflating_phase);
+        }
+        inflateEnd(&(fr->gz_stream));
+        fr->bgzf = false;
+    }
+
+    if (fr->async_reader != NULL) {
+        KC__async_reader_stop(fr->async_reader);
+    }
     fclose(file);
 }
 
@@ -381,6 +1139,12 @@ static void KC__file_reader_process_super_kmer_file(KC__FileReader* fr) {
         KC__file_reader_process_file_error_exit(fr, KC__FILE_READ_ERROR_OPEN, NULL);
     }
 
+    if (fr->mapping_files) {
+        KC__file_reader_process_mapped_super_kmer_file(fr, file);
+        fclose(file);
+        return;
+    }
+
     while (true) {
         uint32_t buffer_length;
 
@@ -421,8 +1185,23 @@ static void KC__file_reader_process_super_kmer_file(KC__FileReader* fr) {
 void* KC__file_reader_work(void* ptr) {
     KC__FileReader* fr = ptr;
 
-    for (size_t i = 0; i < fr->input.files_count; i++) {
+    fr->busy_ranges_count = 0;
+    fr->recycled_time = 0;
+    fr->start_time = KC__monotonic_time_ns();
+
+    for (size_t k = 0; k < fr->input.files_count; k++) {
+        size_t i = k;
+        if (fr->input.next_file != NULL) {
+            // The files are shared by the readers, take the next one.
+            i = __sync_fetch_and_add(fr->input.next_file, 1);
+            if (i >= fr->input.files_count) {
+                break;
+            }
+        }
+        fr->busy_ranges_count++;
         fr->file_name = fr->input.file_names[i];
+        fr->range_start = (fr->input.range_starts != NULL) ? fr->input.range_starts[i] : 0;
+        fr->range_end = (fr->input.range_ends != NULL) ? fr->input.range_ends[i] : SIZE_MAX;
         LOGGING_DEBUG("Start reading file %s", fr->file_name);
 
         switch (fr->input.file_type) {
@@ -441,7 +1220,15 @@ void* KC__file_reader_work(void* ptr) {
         LOGGING_DEBUG("Finish reading file %s", fr->file_name);
     }
 
+    fr->finish_time = KC__monotonic_time_ns();
+
     fr->file_name = NULL;
 
-    pthread_exit(NULL);
+    return NULL;
+}
+
+void KC__file_reader_log_busy_time(const KC__FileReader* fr, size_t id) {
+    const uint64_t recycled_time = __atomic_load_n(&(fr->recycled_time), __ATOMIC_RELAXED);
+    const uint64_t end_time = (recycled_time > fr->finish_time) ? recycled_time : fr->finish_time;
+    LOGGING_INFO("Reader #%zu read %zu file ranges in %.3f seconds.", id, fr->busy_ranges_count, (double)(end_time - fr->start_time) / 1e9);
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 #include "types.h"
 #include "mem_allocator.h"
 #include "buffer_queue.h"
+#include "thread_pool.h"
 
 struct KC__FileReader;
 typedef struct KC__FileReader KC__FileReader;
@@ -33,14 +34,54 @@ typedef struct {
     size_t files_count;
     KC__FileType file_type;
     KC__FileCompressionType compression_type;
+    /** The byte ranges [range_starts[i], range_ends[i]) of the plain files read, the whole files if NULL. */
+    size_t* range_starts;
+    size_t* range_ends;
+    /** If not NULL, the index of the next file shared by the readers, each reader takes the next file by it. */
+    size_t* next_file;
 } KC__FileInputDescription;
 
-KC__FileReader* KC__file_reader_create(KC__MemAllocator* mem_allocator, size_t K, KC__FileCompressionType compression_type, size_t buffer_size);
+/**
+ * Create a file reader.
+ * @param mem_allocator Memory allocator.
+ * @param K K-mer length.
+ * @param compression_type The compression type of input files.
+ * @param buffer_size The size of read buffers, also the size of the compressed data read at a time.
+ * @param inflating_threads_count The threads (the reader included) inflating the blocks of a BGZF file in parallel.
+ * @return The file reader.
+ */
+KC__FileReader* KC__file_reader_create(KC__MemAllocator* mem_allocator, size_t K, KC__FileCompressionType compression_type, size_t buffer_size, size_t inflating_threads_count);
 void KC__file_reader_free(KC__MemAllocator* mem_allocator, KC__FileReader* file_reader);
 
+/**
+ * Read compressed files ahead by an async reader, which keeps depth reads in flight while the data read is inflated.
+ * @param mem_allocator Memory allocator.
+ * @param file_reader The file reader of compressed files.
+ * @param engine The engine of the async reader.
+ * @param depth The count of reads in flight.
+ * @param direct_io Read by O_DIRECT, bypassing the page cache.
+ */
+void KC__file_reader_init_async_reading(KC__MemAllocator* mem_allocator, KC__FileReader* file_reader, KC__AsyncReadEngine engine, size_t depth, bool direct_io);
+
+/**
+ * The helpers inflating BGZF blocks are works of the pool, it should be set if the reader inflates by more than 1 thread,
+ * and have inflating_threads_count - 1 threads free for each file the reader is reading.
+ * @param file_reader The file reader.
+ * @param thread_pool The thread pool.
+ */
+void KC__file_reader_set_thread_pool(KC__FileReader* file_reader, KC__ThreadPool* thread_pool);
+
 void KC__file_reader_link_modules(KC__FileReader* file_reader, KC__BufferQueue* buffer_queue);
 void KC__file_reader_update_input(KC__FileReader* file_reader, KC__FileInputDescription input);
 
 void* KC__file_reader_work(void* ptr);
 
+/**
+ * Log the time the file reader spent reading files by the last work, until its last buffer was consumed, and the count
+ * of the file ranges (or whole files) read. It should be called after the consumers of the buffers finish.
+ * @param file_reader The file reader.
+ * @param id The id of the file reader in the log.
+ */
+void KC__file_reader_log_busy_time(const KC__FileReader* file_reader, size_t id);
+
 #endif
@@ -22,10 +22,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "file_writer.h"
+#include "types.h"
 #include "assert.h"
 #include "logging.h"
+#include "utils.h"
 
 
 struct KC__FileWriter {
@@ -33,7 +36,17 @@ struct KC__FileWriter {
     FILE* output_file;
 
     const char* tmp_file_name;
-    size_t tmp_file_size;
+    const char* const* tmp_file_names;
+    size_t tmp_files_count;
+    size_t tmp_file_sizes[KC__SPILL_PARTITIONS_MAX];
+
+    // Partitioned super K-mers are regrouped by partition in these buffers before written to tmp files, they share the
+    // memory allocated before the count of partitions is known.
+    size_t K;
+    size_t partitions_count;
+    KC__Buffer partition_buffers[KC__SPILL_PARTITIONS_MAX];
+    void* partitions_data;
+    uint32_t partitions_data_size;
 
     KC__BufferQueue* buffer_queue;
 };
@@ -56,6 +69,15 @@ KC__FileWriter* KC__file_writer_create(KC__MemAllocator* ma, const char* output_
         }
     }
 
+    fw->tmp_file_name = NULL;
+    fw->tmp_file_names = NULL;
+    fw->tmp_files_count = 0;
+
+    fw->K = 0;
+    fw->partitions_count = 0;
+    fw->partitions_data = NULL;
+    fw->partitions_data_size = 0;
+
     fw->buffer_queue = NULL;
 
     return fw;
@@ -65,31 +87,166 @@ void KC__file_writer_free(KC__MemAllocator* ma, KC__FileWriter* fw) {
     KC__ASSERT(fw->output_file != NULL);
     fclose(fw->output_file);
 
+    if (fw->partitions_data != NULL) {
+        KC__mem_free(ma, fw->partitions_data);
+    }
+
     KC__mem_free(ma, fw);
 }
 
+/**
+ * The super K-mers count and the longest super K-mer should fit in a partition buffer.
+ */
+static inline uint32_t KC__file_writer_partition_buffer_size_min(size_t K) {
+    return (uint32_t)(sizeof(uint32_t) + sizeof(uint8_t) * (KC__calculate_kmer_width_by_unit_size(K + UINT8_MAX, sizeof(uint8_t)) + 1));
+}
+
+void KC__file_writer_init_partitions(KC__MemAllocator* ma, KC__FileWriter* fw, size_t K, uint32_t mem_size) {
+    KC__ASSERT(fw->partitions_data == NULL);
+    KC__ASSERT(mem_size >= KC__file_writer_partition_buffer_size_min(K));
+
+    fw->K = K;
+    fw->partitions_count = 0;
+    fw->partitions_data = KC__mem_aligned_alloc(ma, mem_size, "file writer partition buffers data");
+    fw->partitions_data_size = mem_size;
+}
+
+size_t KC__file_writer_partitions_count_max(const KC__FileWriter* fw) {
+    const size_t count = fw->partitions_data_size / KC__file_writer_partition_buffer_size_min(fw->K);
+    return (count < KC__SPILL_PARTITIONS_MAX) ? count : KC__SPILL_PARTITIONS_MAX;
+}
+
+void KC__file_writer_set_partitions_count(KC__FileWriter* fw, size_t partitions_count) {
+    KC__ASSERT(fw->partitions_data != NULL);
+    KC__ASSERT((partitions_count > 0) && (partitions_count <= KC__file_writer_partitions_count_max(fw)));
+
+    // The buffers keep the alignment of the memory they share.
+    const uint32_t buffer_size = (uint32_t)(fw->partitions_data_size / partitions_count) & ~(uint32_t)(sizeof(uint64_t) - 1);
+    KC__ASSERT(buffer_size >= KC__file_writer_partition_buffer_size_min(fw->K));
+
+    fw->partitions_count = partitions_count;
+    for (size_t i = 0; i < partitions_count; i++) {
+        KC__Buffer* bf = &(fw->partition_buffers[i]);
+        bf->data = (char*)(fw->partitions_data) + buffer_size * i;
+        bf->type = KC__BUFFER_TYPE_SUPER_KMER;
+        bf->size = buffer_size;
+        bf->length = 0;
+    }
+}
+
 void KC__file_writer_link_modules(KC__FileWriter* fw, KC__BufferQueue* buffer_queue) {
     fw->buffer_queue = buffer_queue;
 }
 
 void KC__file_writer_update_tmp_file(KC__FileWriter* fw, const char* tmp_file_name) {
     fw->tmp_file_name = tmp_file_name;
-    fw->tmp_file_size = 0;
+    KC__file_writer_update_tmp_files(fw, &(fw->tmp_file_name), 1);
+}
+
+void KC__file_writer_update_tmp_files(KC__FileWriter* fw, const char* const* tmp_file_names, size_t tmp_files_count) {
+    KC__ASSERT((tmp_files_count > 0) && (tmp_files_count <= KC__SPILL_PARTITIONS_MAX));
+    KC__ASSERT((tmp_files_count == 1) || (tmp_files_count == fw->partitions_count));
+
+    fw->tmp_file_names = tmp_file_names;
+    fw->tmp_files_count = tmp_files_count;
+    for (size_t i = 0; i < tmp_files_count; i++) {
+        fw->tmp_file_sizes[i] = 0;
+    }
 }
 
 size_t KC__file_writer_get_tmp_file_size(const KC__FileWriter* fw) {
-    return fw->tmp_file_size;
+    size_t size = 0;
+    for (size_t i = 0; i < fw->tmp_files_count; i++) {
+        size += fw->tmp_file_sizes[i];
+    }
+    return size;
+}
+
+size_t KC__file_writer_get_partition_tmp_file_size(const KC__FileWriter* fw, size_t partition) {
+    KC__ASSERT(partition < fw->tmp_files_count);
+    return fw->tmp_file_sizes[partition];
+}
+
+static void KC__file_writer_write(const char* file_name, FILE* file, const KC__Buffer* buffer, bool write_buffer_length) {
+    if (write_buffer_length) {
+        size_t write_size = fwrite(&(buffer->length), 1, sizeof(uint32_t), file);
+        if (write_size < sizeof(uint32_t)) {
+            LOGGING_ERROR("Write file error [%s]", file_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t write_size = fwrite(buffer->data, 1, buffer->length, file);
+    if (write_size < buffer->length) {
+        LOGGING_ERROR("Write file error [%s]", file_name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inline void KC__file_writer_flush_partition(KC__FileWriter* fw, size_t partition, FILE* tmp_files[]) {
+    KC__Buffer* bf = &(fw->partition_buffers[partition]);
+    if (bf->length == 0) {
+        return;
+    }
+
+    KC__file_writer_write(fw->tmp_file_names[partition], tmp_files[partition], bf, true);
+    bf->length = 0;
+}
+
+/**
+ * Move the super K-mers of a partitioned buffer to the buffers of their partitions, which are written as super K-mer
+ * buffers once full.
+ */
+static void KC__file_writer_split_partitions(KC__FileWriter* fw, const KC__Buffer* buffer, FILE* tmp_files[]) {
+    KC__ASSERT(fw->tmp_files_count == fw->partitions_count);
+
+    const uint32_t header = *((uint32_t*)(buffer->data));
+    const uint32_t counted_flag = (header & KC__SUPER_KMERS_COUNTED_FLAG);
+    size_t super_kmers_count = (header & ~KC__SUPER_KMERS_COUNTED_FLAG);
+    const uint8_t* p = (const uint8_t*)((char*)(buffer->data) + sizeof(uint32_t));
+
+    for (size_t n = 0; n < super_kmers_count; n++) {
+        size_t partition = *p;
+        p++;
+        KC__ASSERT(partition < fw->partitions_count);
+
+        // Expanded bases count and the bases, or the mark, the count and the bases of a counted K-mer.
+        size_t size;
+        if (counted_flag && (*p == KC__SUPER_KMER_COUNTED_MARK)) {
+            size = sizeof(uint8_t) * (KC__calculate_kmer_width_by_unit_size(fw->K, sizeof(uint8_t)) + 2);
+        } else {
+            size = sizeof(uint8_t) * (KC__calculate_kmer_width_by_unit_size(fw->K + *p, sizeof(uint8_t)) + 1);
+        }
+
+        KC__Buffer* bf = &(fw->partition_buffers[partition]);
+        if (bf->size - bf->length < size) {
+            KC__file_writer_flush_partition(fw, partition, tmp_files);
+        }
+        if (bf->length == 0) {
+            *((uint32_t*)(bf->data)) = counted_flag;
+            bf->length = sizeof(uint32_t);
+        }
+        KC__ASSERT((*((uint32_t*)(bf->data)) & KC__SUPER_KMERS_COUNTED_FLAG) == counted_flag);
+
+        memcpy((char*)(bf->data) + bf->length, p, size);
+        bf->length += size;
+        *((uint32_t*)(bf->data)) += 1;
+
+        p += size;
+    }
+
+    KC__ASSERT((const char*)p - (const char*)(buffer->data) == buffer->length);
 }
 
 void* KC__file_writer_work(void* ptr) {
     KC__FileWriter* fw = ptr;
 
-    FILE* tmp_file = NULL;
+    FILE* tmp_files[KC__SPILL_PARTITIONS_MAX];
 
-    if (fw->tmp_file_name != NULL) {
-        tmp_file = fopen(fw->tmp_file_name, "wb");
-        if (tmp_file == NULL) {
-            LOGGING_ERROR("Open tmp file error [%s]", fw->tmp_file_name);
+    for (size_t i = 0; i < fw->tmp_files_count; i++) {
+        tmp_files[i] = fopen(fw->tmp_file_names[i], "wb");
+        if (tmp_files[i] == NULL) {
+            LOGGING_ERROR("Open tmp file error [%s]", fw->tmp_file_names[i]);
             exit(EXIT_FAILURE);
         }
     }
@@ -100,53 +257,40 @@ void* KC__file_writer_work(void* ptr) {
             break;
         }
 
-        const char* file_name;
-        FILE* file;
-        bool write_buffer_length = false;
-
         switch (buffer->type) {
             case KC__BUFFER_TYPE_SUPER_KMER:
-                file_name = fw->tmp_file_name;
-                file = tmp_file;
-                write_buffer_length = true;
+                KC__ASSERT(fw->tmp_files_count == 1);
+                KC__file_writer_write(fw->tmp_file_names[0], tmp_files[0], buffer, true);
+                break;
+            case KC__BUFFER_TYPE_PARTITIONED_SUPER_KMER:
+                KC__file_writer_split_partitions(fw, buffer, tmp_files);
                 break;
             case KC__BUFFER_TYPE_KMER:
-                file_name = fw->output_file_name;
-                file = fw->output_file;
+                KC__file_writer_write(fw->output_file_name, fw->output_file, buffer, false);
                 break;
             default:
                 KC__ASSERT(false);
                 break;
         }
 
-        if (write_buffer_length) {
-            size_t write_size = fwrite(&(buffer->length), 1, sizeof(uint32_t), file);
-            if (write_size < sizeof(uint32_t)) {
-                LOGGING_ERROR("Write file error [%s]", file_name);
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        size_t write_size = fwrite(buffer->data, 1, buffer->length, file);
-        if (write_size < buffer->length) {
-            LOGGING_ERROR("Write file error [%s]", file_name);
-            exit(EXIT_FAILURE);
-        }
-
         KC__buffer_queue_recycle_blank_buffer(fw->buffer_queue, buffer);
     }
 
-    if (tmp_file != NULL) {
-        long pos = ftell(tmp_file);
+    for (size_t i = 0; i < fw->tmp_files_count; i++) {
+        if (fw->tmp_files_count > 1) {
+            KC__file_writer_flush_partition(fw, i, tmp_files);
+        }
+
+        long pos = ftell(tmp_files[i]);
         if (pos >= 0) {
-            fw->tmp_file_size = (size_t) pos;
+            fw->tmp_file_sizes[i] = (size_t) pos;
         } else {
-            LOGGING_ERROR("Getting tmp file size error [%s]", fw->tmp_file_name);
+            LOGGING_ERROR("Getting tmp file size error [%s]", fw->tmp_file_names[i]);
             exit(EXIT_FAILURE);
         }
 
-        fclose(tmp_file);
+        fclose(tmp_files[i]);
     }
 
-    pthread_exit(NULL);
+    return NULL;
 }
\ No newline at end of file
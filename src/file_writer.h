@@ -32,8 +32,38 @@ KC__FileWriter* KC__file_writer_create(KC__MemAllocator* mem_allocator, const ch
 void KC__file_writer_free(KC__MemAllocator* mem_allocator, KC__FileWriter* file_writer);
 
 void KC__file_writer_link_modules(KC__FileWriter* file_writer, KC__BufferQueue* buffer_queue);
+/**
+ * Allocate the memory of the buffers which regroup partitioned super K-mers by partition, it is split among them when
+ * the count of partitions is set.
+ * @param mem_allocator Memory allocator.
+ * @param file_writer File writer.
+ * @param K K-mer length.
+ * @param mem_size Size of the buffers of all partitions, should not be larger than the read buffers.
+ */
+void KC__file_writer_init_partitions(KC__MemAllocator* mem_allocator, KC__FileWriter* file_writer, size_t K, uint32_t mem_size);
+/**
+ * Get the most partitions whose buffers can hold the longest super K-mer.
+ * @param file_writer File writer.
+ * @return The partitions count.
+ */
+size_t KC__file_writer_partitions_count_max(const KC__FileWriter* file_writer);
+/**
+ * Split the memory of partition buffers among the partitions.
+ * @param file_writer File writer.
+ * @param partitions_count Partitions count.
+ */
+void KC__file_writer_set_partitions_count(KC__FileWriter* file_writer, size_t partitions_count);
+
 void KC__file_writer_update_tmp_file(KC__FileWriter* file_writer, const char* tmp_file_name);
+/**
+ * Set the tmp files of the next run, either one file or one file for each partition.
+ * @param file_writer File writer.
+ * @param tmp_file_names Tmp file names, should be valid until the run finishes.
+ * @param tmp_files_count Tmp files count.
+ */
+void KC__file_writer_update_tmp_files(KC__FileWriter* file_writer, const char* const* tmp_file_names, size_t tmp_files_count);
 size_t KC__file_writer_get_tmp_file_size(const KC__FileWriter* file_writer);
+size_t KC__file_writer_get_partition_tmp_file_size(const KC__FileWriter* file_writer, size_t partition);
 
 void* KC__file_writer_work(void* ptr);
 
@@ -0,0 +1,67 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+#ifndef KC__HASH_H
+#define KC__HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "types.h"
+
+
+/**
+ * Finalizer of MurmurHash3 (64-bit), every input bit affects every output bit.
+ * @param x The value to be mixed.
+ * @return The mixed value.
+ */
+static inline uint64_t KC__hash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Hash all units of a K-mer.
+ * @param kmer The K-mer.
+ * @param width The count of units of the K-mer.
+ * @return The 64-bit hash value.
+ */
+static inline uint64_t KC__hash_kmer(const KC__unit_t* kmer, size_t width) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < width; i++) {
+        h = KC__hash_mix(h ^ kmer[i]);
+    }
+    return h;
+}
+
+/**
+ * Map a 64-bit hash value to [0, n) by multiply-shift, which avoids the division of modulo.
+ * @param h The hash value.
+ * @param n The range.
+ * @return The reduced value.
+ */
+static inline size_t KC__hash_reduce(uint64_t h, size_t n) {
+    return (size_t)(((unsigned __int128)h * (unsigned __int128)n) >> 64);
+}
+
+#endif
@@ -24,12 +24,15 @@
 #include "pthread_barrier.h"
 #endif // __APPLE__
 
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hash_map.h"
 #include "logging.h"
 #include "assert.h"
 #include "utils.h"
+#include "hash.h"
+#include "kmer_sorter.h"
 
 
 typedef struct {
@@ -42,6 +45,67 @@ typedef struct {
 } KC__HashMapNode;
 
 
+/**
+ * Slot of the open addressing table, the K-mer and its count are stored inline.
+ */
+typedef struct {
+    /** See KC__HashMapSlotState. */
+    uint32_t state;
+    KC__count_t count;
+
+    KC__unit_t kmer[];
+} KC__HashMapSlot;
+
+
+/**
+ * Entry of the hot K-mer cache. A K-mer is only cached once it exists in the table with a high count, so all its
+ * sightings can be counted locally, and its counter stays at the same address until the table is cleared (it is too
+ * frequent to be evicted).
+ */
+typedef struct {
+    /** NULL means the entry is empty. */
+    KC__count_t* count_ptr;
+    /** Sightings not yet added to the counter. */
+    KC__count_t pending;
+
+    KC__unit_t kmer[];
+} KC__HashMapHotEntry;
+
+#define KC__HASH_MAP_HOT_CACHE_SIZE 1024
+/** Count a K-mer should reach in the table before it is cached. */
+#define KC__HASH_MAP_HOT_COUNT_MIN 64
+
+typedef enum {
+    KC__HASH_MAP_SLOT_STATE_EMPTY = 0,
+    /** The slot has been claimed by a thread, and the K-mer is being copied. */
+    KC__HASH_MAP_SLOT_STATE_BUSY,
+    KC__HASH_MAP_SLOT_STATE_READY
+} KC__HashMapSlotState;
+
+/**
+ * The links of the chaining table (and the states of the open addressing slots) are stamped with the generation of the
+ * table in their high bits, a link or state of an older generation reads as empty. So clearing the table is an increment
+ * of the generation, and the table is only wiped when the generation wraps around. Generation 0 is never used, so that
+ * zeroed memory is empty. With 32-bit node ids, fewer bits are taken from the ids, and the table is wiped more often.
+ */
+#ifdef KC__MEM_OPT
+#define KC__HASH_MAP_GENERATION_BITS 2
+#else
+#define KC__HASH_MAP_GENERATION_BITS 8
+#endif
+#define KC__HASH_MAP_GENERATION_MAX (((size_t)1 << KC__HASH_MAP_GENERATION_BITS) - 1)
+#define KC__HASH_MAP_LINK_ID_MASK ((KC__node_id_t)(KC__NODE_ID_MAX >> KC__HASH_MAP_GENERATION_BITS))
+#define KC__HASH_MAP_SLOT_STATE_BITS 2
+
+/** The memory of the table and nodes is not limited by the count of K-mers below this. */
+#define KC__HASH_MAP_MEM_MIN ((size_t)1 << 20)
+
+
+/**
+ * For the chaining engine, a block is a range of nodes. For the open addressing engine, there are no nodes, the ids of a
+ * block only work as tickets, each of which allows a thread to fill an empty slot, so that the load factor of the table
+ * is limited.
+ */
 typedef struct {
     KC__node_id_t start_id;
     KC__node_id_t end_id;
@@ -61,58 +125,401 @@ typedef struct {
     KC__node_id_t next_id;
 
     bool synced;
+
+    /** Nodes freed by eviction, linked by their next fields, only popped by the owner thread. */
+    KC__node_id_t free_id;
+
+    /** Count of K-mers absorbed by the bloom filter on their first sighting. */
+    size_t absorbed_count;
+
+    /** Count of K-mers dropped by the recount pass, as they have been seen once. */
+    size_t dropped_count;
+
+    /**
+     * Hot K-mer cache of the thread, direct-mapped by table index, NULL if disabled. The sightings of a cached K-mer are
+     * added to its counter in bulk, instead of one CAS each.
+     */
+    char* hot_entries;
+    /** Contention stats, failed CAS on counters and sightings counted by the hot cache. */
+    size_t cas_retries_count;
+    size_t hot_hits_count;
+
+    /**
+     * Used by the partitioned mode, where a block is also the partition of the table owned by the thread. The table
+     * slice and nodes of a partition are only touched by the thread holding partition_mtx, so no atomics are needed,
+     * and the partition locks its keys on its own when its nodes are used out.
+     */
+    pthread_mutex_t partition_mtx;
+    bool partition_locked;
+    bool adding_finished;
+    KC__HashMapRejectCallback reject_callback;
+    void* reject_data;
 } KC__HashMapNodeBlock;
 
 
+/**
+ * Route queue from one thread to the partition of another thread. Only the source thread pushes, and only the thread
+ * holding the lock of the destination partition pops. Head and tail are in separate cache lines.
+ */
+typedef struct {
+    size_t tail;
+    char tail_padding[64 - sizeof(size_t)];
+
+    size_t head;
+    char head_padding[64 - sizeof(size_t)];
+} KC__HashMapRouteQueue;
+
+#define KC__HASH_MAP_ROUTE_QUEUE_SIZE 256
+
+
 struct KC__HashMap {
+    KC__HashMapEngine engine;
+
     KC__node_id_t* table;
     size_t table_capacity;
 
+    /**
+     * The table (or slots, or counters) and nodes are mapped, so their pages are only allocated when touched, and they
+     * are clean (zeroed) until the first clear.
+     */
+    size_t table_mem;
+    size_t nodes_mem;
+    bool table_clean;
+
+    /** Used by the open addressing engine instead of table and nodes, the capacity is table_capacity. */
+    KC__HashMapSlot* slots;
+    size_t slot_size;
+
+    /** Used by the direct engine, one counter for each of the 4^K K-mers, the capacity is table_capacity. */
+    KC__count_t* counts;
+
+    /** The sort engine works as a whole in its own module, the hash map only forwards calls to it. */
+    KC__KmerSorter* sorter;
+
     /** The node at position 0 is reserved as NULL. */
     KC__HashMapNode* nodes;
     size_t node_size;
     size_t kmer_size;
     size_t kmer_width;
 
+    /** The adding functions specialized for kmer_width, selected at creation. */
+    bool (*add_kmer)(struct KC__HashMap* hm, size_t n, const KC__unit_t* kmer);
+    void (*add_kmers_batch)(struct KC__HashMap* hm, size_t n, const KC__unit_t* kmers, size_t count, bool* added);
+
+    size_t hot_entry_size;
+
     KC__HashMapNodeBlock** blocks;
     size_t blocks_count;
 
+    /**
+     * Partitioned mode, the queue from thread i to partition j is at i * blocks_count + j, each entry holds a table index
+     * and a K-mer.
+     */
+    bool partitioned;
+    KC__HashMapRouteQueue* route_queues;
+    char* route_entries;
+    size_t route_entry_size;
+
+    /**
+     * Blocked bloom filter in front of the table, all bits of a K-mer are in the same word so that a single atomic OR
+     * decides which thread sees the first sighting. The filter is only consulted in the first pass, which only finds the
+     * candidate keys: a K-mer seen twice is either added to the table or, if it cannot be added, marked in the spilled
+     * filter. The counts of the first pass are not exact, as a false positive of the filter lets the first sighting of
+     * a K-mer in. The recount pass reads the same input again with the keys locked and the counts reset, so the keys
+     * are counted exactly, the sightings of the K-mers in the spilled filter are written to tmp file, and the K-mers
+     * left have been seen once and are dropped.
+     */
+    uint64_t* bloom_filter;
+    size_t bloom_filter_words;
+    bool bloom_filter_active;
+    uint64_t* spilled_filter;
+    size_t spilled_filter_words;
+    bool recounting;
+
+    /**
+     * Eviction mode of the chaining engine. When the nodes are used out, all threads stop, and the nodes still holding the
+     * count of a new key are removed from the table and passed to the reject callbacks, so that they are counted in a
+     * later pass. The evicted filter keeps all other sightings of an evicted K-mer out of the table for the rest of the
+     * pass, so a K-mer is still counted either wholly in the table or wholly in later passes. Keys are only locked once an
+     * eviction frees too few nodes, or once eviction is stopped for the passes over the spilled K-mers.
+     */
+    bool evict_singletons;
+    bool evict_requested;
+    bool evict_exhausted;
+    size_t evicted_count;
+    size_t evict_rounds_count;
+    size_t finished_count;
+    uint64_t* evicted_filter;
+    size_t evicted_filter_words;
+    bool evicted_filter_active;
+
     bool keys_locked;
     pthread_barrier_t barrier;
+
+    /** The generation of the table, and the stamp of it in the links of the chaining table. */
+    size_t generation;
+    KC__node_id_t link_stamp;
+
+    KC__ThreadPool* thread_pool;
 };
 
 
-KC__HashMap* KC__hash_map_create(KC__MemAllocator* ma, size_t K, size_t threads_count) {
+static void KC__hash_map_select_adding(KC__HashMap* hm);
+
+static KC__node_id_t KC__hash_map_limit_nodes_count(size_t nodes_count_limit) {
+    if (nodes_count_limit > KC__NODE_ID_MAX) {
+        LOGGING_WARNING("The count of nodes to be allocated is too large: %zu.", nodes_count_limit);
+        nodes_count_limit = KC__NODE_ID_MAX;
+        LOGGING_WARNING("Reduce the count of nodes to %zu.", nodes_count_limit);
+    }
+    return (KC__node_id_t)nodes_count_limit;
+}
+
+static KC__node_id_t KC__hash_map_create_chaining(KC__MemAllocator* ma, KC__HashMap* hm, size_t mem_limit) {
+    size_t nodes_count_limit = mem_limit / (hm->node_size * 3 + sizeof(KC__node_id_t) * 4) * 3;
+    // The high bits of the links are taken by the generation stamp.
+    if (nodes_count_limit > (size_t)KC__HASH_MAP_LINK_ID_MASK) {
+        LOGGING_WARNING("Reduce the count of nodes from %zu to %zu for the generation stamps.", nodes_count_limit, (size_t)KC__HASH_MAP_LINK_ID_MASK);
+        nodes_count_limit = KC__HASH_MAP_LINK_ID_MASK;
+    }
+    KC__node_id_t nodes_count = KC__hash_map_limit_nodes_count(nodes_count_limit);
+    const size_t nodes_mem = hm->node_size * nodes_count;
+
+    const size_t table_mem_limit = mem_limit - nodes_mem;
+    const size_t table_capacity_limit = table_mem_limit / sizeof(KC__node_id_t);
+    // The K-mers are mixed before being reduced to table index, so the capacity needs not be a prime number.
+    hm->table_capacity = table_capacity_limit;
+    const size_t table_mem = sizeof(KC__node_id_t) * hm->table_capacity;
+    hm->table = (KC__node_id_t*)KC__mem_mapped_alloc(ma, table_mem, "hash map table");
+    hm->table_mem = table_mem;
+
+    hm->nodes = (KC__HashMapNode*)KC__mem_mapped_alloc(ma, nodes_mem, "hash map nodes");
+    hm->nodes_mem = nodes_mem;
+
+    LOGGING_DEBUG("        Hash table capacity: %zu (limit: %zu)", hm->table_capacity, table_capacity_limit);
+    LOGGING_DEBUG("          Hash table memory: %zu", table_mem);
+    LOGGING_DEBUG("                Nodes count: %zu", nodes_count);
+    LOGGING_DEBUG("               Nodes memory: %zu", nodes_mem);
+    LOGGING_DEBUG("Hash table and nodes memory: %zu (limit: %zu)", table_mem + nodes_mem, mem_limit);
+
+    return nodes_count;
+}
+
+static KC__node_id_t KC__hash_map_create_open_addressing(KC__MemAllocator* ma, KC__HashMap* hm, size_t mem_limit) {
+    hm->slot_size = sizeof(KC__HashMapSlot) + hm->kmer_size;
+    hm->table_capacity = mem_limit / hm->slot_size;
+    const size_t slots_mem = hm->slot_size * hm->table_capacity;
+    hm->slots = (KC__HashMapSlot*)KC__mem_mapped_alloc(ma, slots_mem, "hash map slots");
+    hm->table_mem = slots_mem;
+
+    // Linear probing degrades quickly when the table is nearly full, keep a quarter of the slots empty. The ticket at
+    // position 0 is reserved as NULL as the node.
+    KC__node_id_t tickets_count = KC__hash_map_limit_nodes_count(hm->table_capacity / 4 * 3 + 1);
+
+    LOGGING_DEBUG("Open addressing table capacity: %zu", hm->table_capacity);
+    LOGGING_DEBUG("  Open addressing table memory: %zu (limit: %zu)", slots_mem, mem_limit);
+    LOGGING_DEBUG("                 Tickets count: %zu", tickets_count);
+
+    return tickets_count;
+}
+
+/**
+ * The direct engine needs neither nodes nor tickets, but the blocks still hold one id for each K-mer, so that
+ * KC__hash_map_max_key_count works the same.
+ */
+static KC__node_id_t KC__hash_map_create_direct(KC__MemAllocator* ma, KC__HashMap* hm, size_t K) {
+    KC__ASSERT(K < KC__UNIT_BIT / 2);
+    hm->table_capacity = (size_t)1 << (K * 2);
+    const size_t counts_mem = sizeof(KC__count_t) * hm->table_capacity;
+    hm->counts = (KC__count_t*)KC__mem_mapped_alloc(ma, counts_mem, "hash map direct counts");
+    hm->table_mem = counts_mem;
+
+    LOGGING_DEBUG("Direct counts capacity: %zu", hm->table_capacity);
+    LOGGING_DEBUG("  Direct counts memory: %zu", counts_mem);
+
+    return KC__hash_map_limit_nodes_count(hm->table_capacity + 1);
+}
+
+static KC__node_id_t KC__hash_map_create_sort(KC__MemAllocator* ma, KC__HashMap* hm, size_t K, size_t mem_limit) {
+    hm->table_capacity = 0;
+    hm->sorter = KC__kmer_sorter_create(ma, K, hm->blocks_count, mem_limit);
+    return KC__hash_map_limit_nodes_count(KC__kmer_sorter_max_key_count(hm->sorter) + 1);
+}
+
+bool KC__hash_map_direct_fits(size_t K, size_t threads_count, size_t mem_limit) {
+    if (K >= KC__UNIT_BIT / 2) {
+        return false;
+    }
+
+    // 4^K should not overflow the memory size.
+    const size_t capacity = (size_t)1 << (K * 2);
+    if (capacity > SIZE_MAX / sizeof(KC__count_t)) {
+        return false;
+    }
+
+    const size_t mem = sizeof(KC__count_t) * capacity + sizeof(struct KC__HashMap) + (sizeof(KC__HashMapNodeBlock*) + sizeof(KC__HashMapNodeBlock)) * threads_count;
+    return mem <= mem_limit;
+}
+
+/**
+ * The memory the chaining or open addressing engine takes to hold the count of K-mers, the other engines take a fixed
+ * size or all the memory.
+ */
+static size_t KC__hash_map_mem_needed(const KC__HashMap* hm, size_t keys_count) {
+    // A node for each K-mer and a spare one for each thread, the inverse of the split of memory at creation.
+    const size_t nodes_count = keys_count + hm->blocks_count + 1;
+    size_t mem;
+    switch (hm->engine) {
+        case KC__HASH_MAP_ENGINE_CHAINING:
+            mem = (nodes_count + 2) / 3 * (hm->node_size * 3 + sizeof(KC__node_id_t) * 4);
+            break;
+        case KC__HASH_MAP_ENGINE_OPEN_ADDRESSING:
+            mem = (nodes_count / 3 + 1) * 4 * (sizeof(KC__HashMapSlot) + hm->kmer_size);
+            break;
+        default:
+            return SIZE_MAX;
+    }
+    return (mem > KC__HASH_MAP_MEM_MIN) ? mem : KC__HASH_MAP_MEM_MIN;
+}
+
+static void KC__hash_map_create_bloom_filter(KC__MemAllocator* ma, KC__HashMap* hm, size_t bloom_filter_mem) {
+    const size_t mem_limit = KC__mem_available(ma) / 2;
+    if (bloom_filter_mem > mem_limit) {
+        LOGGING_WARNING("Bloom filter memory is too large: %zu.", bloom_filter_mem);
+        bloom_filter_mem = mem_limit;
+        LOGGING_WARNING("Reduce bloom filter memory to %zu.", bloom_filter_mem);
+    }
+
+    // The spilled filter takes a small part of the memory, it only holds the K-mers which cannot be added to the table.
+    const size_t words_count = bloom_filter_mem / sizeof(uint64_t);
+    hm->spilled_filter_words = words_count / 8;
+    hm->bloom_filter_words = words_count - hm->spilled_filter_words;
+    KC__ASSERT(hm->spilled_filter_words > 0);
+    hm->bloom_filter = (uint64_t*)KC__mem_mapped_alloc(ma, sizeof(uint64_t) * hm->bloom_filter_words, "hash map bloom filter");
+    hm->spilled_filter = (uint64_t*)KC__mem_mapped_alloc(ma, sizeof(uint64_t) * hm->spilled_filter_words, "hash map spilled filter");
+    hm->bloom_filter_active = true;
+
+    LOGGING_DEBUG("Bloom filter words: %zu", hm->bloom_filter_words);
+    LOGGING_DEBUG("Spilled filter words: %zu", hm->spilled_filter_words);
+}
+
+KC__HashMap* KC__hash_map_create(KC__MemAllocator* ma, size_t K, size_t threads_count, KC__HashMapParam param, KC__ThreadPool* thread_pool) {
+    KC__ASSERT((thread_pool != NULL) && (KC__thread_pool_threads_count(thread_pool) >= threads_count));
+
     KC__HashMap* hm = (KC__HashMap*)KC__mem_alloc(ma, sizeof(struct KC__HashMap), "hash map");
 
+    hm->engine = param.engine;
+    hm->partitioned = param.partitioned;
+    if (hm->partitioned && (hm->engine != KC__HASH_MAP_ENGINE_CHAINING)) {
+        LOGGING_WARNING("Partitioned mode only works with the chaining engine, disabled.");
+        hm->partitioned = false;
+    }
+    hm->evict_singletons = param.evict_singletons;
+    if (hm->evict_singletons && ((hm->engine != KC__HASH_MAP_ENGINE_CHAINING) || hm->partitioned)) {
+        LOGGING_WARNING("Eviction only works with the chaining engine (not partitioned), disabled.");
+        hm->evict_singletons = false;
+    }
+
     hm->blocks_count = threads_count;
     hm->blocks = (KC__HashMapNodeBlock**)KC__mem_alloc(ma, sizeof(KC__HashMapNodeBlock*) * hm->blocks_count, "hash map blocks array");
     for (size_t i = 0; i < hm->blocks_count; i++) {
         hm->blocks[i] = (KC__HashMapNodeBlock*)KC__mem_aligned_alloc(ma, sizeof(KC__HashMapNodeBlock), "hash map block");
+        pthread_mutex_init(&(hm->blocks[i]->partition_mtx), NULL);
+        hm->blocks[i]->reject_callback = NULL;
+        hm->blocks[i]->reject_data = NULL;
+        hm->blocks[i]->hot_entries = NULL;
     }
 
     hm->kmer_width = KC__calculate_kmer_width(K);
+    KC__hash_map_select_adding(hm);
     hm->kmer_size = KC__calculate_kmer_size(K);
     hm->node_size = sizeof(KC__HashMapNode) + hm->kmer_size;
 
-    const size_t mem_limit = KC__mem_available(ma);
+    // Aligned to the pointer.
+    hm->hot_entry_size = (sizeof(KC__HashMapHotEntry) + hm->kmer_size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+    if (param.hot_cache) {
+        if (((hm->engine != KC__HASH_MAP_ENGINE_CHAINING) && (hm->engine != KC__HASH_MAP_ENGINE_OPEN_ADDRESSING)) || hm->partitioned) {
+            LOGGING_WARNING("Hot cache only works with the chaining and open addressing engines (not partitioned), disabled.");
+        } else {
+            for (size_t i = 0; i < hm->blocks_count; i++) {
+                hm->blocks[i]->hot_entries = (char*)KC__mem_aligned_alloc(ma, hm->hot_entry_size * KC__HASH_MAP_HOT_CACHE_SIZE, "hash map hot cache");
+            }
+            LOGGING_DEBUG("Hot cache memory: %zu", hm->hot_entry_size * KC__HASH_MAP_HOT_CACHE_SIZE * hm->blocks_count);
+        }
+    }
 
-    size_t nodes_count_limit = mem_limit / (hm->node_size * 3 + sizeof(KC__node_id_t) * 4) * 3;
-    if (nodes_count_limit > KC__NODE_ID_MAX) {
-        LOGGING_WARNING("The count of nodes to be allocated is too large: %zu.", nodes_count_limit);
-        nodes_count_limit = KC__NODE_ID_MAX;
-        LOGGING_WARNING("Reduce the count of nodes to %zu.", nodes_count_limit);
+    hm->route_queues = NULL;
+    hm->route_entries = NULL;
+    hm->route_entry_size = sizeof(size_t) + hm->kmer_size;
+    if (hm->partitioned) {
+        const size_t queues_count = hm->blocks_count * hm->blocks_count;
+        hm->route_queues = (KC__HashMapRouteQueue*)KC__mem_aligned_alloc(ma, sizeof(KC__HashMapRouteQueue) * queues_count, "hash map route queues");
+        hm->route_entries = (char*)KC__mem_aligned_alloc(ma, hm->route_entry_size * KC__HASH_MAP_ROUTE_QUEUE_SIZE * queues_count, "hash map route entries");
+        LOGGING_DEBUG("Route queues memory: %zu", (sizeof(KC__HashMapRouteQueue) + hm->route_entry_size * KC__HASH_MAP_ROUTE_QUEUE_SIZE) * queues_count);
     }
-    KC__node_id_t nodes_count = (KC__node_id_t)nodes_count_limit;
-    const size_t nodes_mem = hm->node_size * nodes_count;
 
-    const size_t table_mem_limit = mem_limit - nodes_mem;
-    const size_t table_capacity_limit = table_mem_limit / sizeof(KC__node_id_t);
-    hm->table_capacity = KC__max_prime_number(table_capacity_limit);
-    const size_t table_mem = sizeof(KC__node_id_t) * hm->table_capacity;
-    hm->table = (KC__node_id_t*)KC__mem_aligned_alloc(ma, table_mem, "hash map table");
+    hm->table = NULL;
+    hm->nodes = NULL;
+    hm->table_mem = 0;
+    hm->nodes_mem = 0;
+    hm->slots = NULL;
+    hm->slot_size = 0;
+    hm->counts = NULL;
+    hm->sorter = NULL;
+
+    hm->bloom_filter = NULL;
+    hm->bloom_filter_words = 0;
+    hm->bloom_filter_active = false;
+    hm->spilled_filter = NULL;
+    hm->spilled_filter_words = 0;
+    hm->recounting = false;
+    if (param.bloom_filter_mem > 0) {
+        if ((hm->engine == KC__HASH_MAP_ENGINE_DIRECT) || (hm->engine == KC__HASH_MAP_ENGINE_SORT)) {
+            LOGGING_WARNING("Bloom filter is only used by the chaining and open addressing engines.");
+        } else {
+            KC__hash_map_create_bloom_filter(ma, hm, param.bloom_filter_mem);
+        }
+    }
+
+    hm->evicted_filter = NULL;
+    hm->evicted_filter_words = 0;
+    if (hm->evict_singletons) {
+        // A small part of the memory, a K-mer takes less than 2 bits of it for every node.
+        hm->evicted_filter_words = KC__mem_available(ma) / 32 / sizeof(uint64_t);
+        KC__ASSERT(hm->evicted_filter_words > 0);
+        hm->evicted_filter = (uint64_t*)KC__mem_mapped_alloc(ma, sizeof(uint64_t) * hm->evicted_filter_words, "hash map evicted filter");
+        LOGGING_DEBUG("Evicted filter words: %zu", hm->evicted_filter_words);
+    }
+    hm->evicted_filter_active = false;
+
+    size_t mem_limit = KC__mem_available(ma);
+    if (param.keys_count_hint > 0) {
+        const size_t mem_needed = KC__hash_map_mem_needed(hm, param.keys_count_hint);
+        if (mem_needed < mem_limit) {
+            LOGGING_INFO("Hash map memory limited to %zu for %zu K-mers at most.", mem_needed, param.keys_count_hint);
+            mem_limit = mem_needed;
+        }
+    }
+
+    KC__node_id_t nodes_count = 0;
+    switch (hm->engine) {
+        case KC__HASH_MAP_ENGINE_CHAINING:
+            nodes_count = KC__hash_map_create_chaining(ma, hm, mem_limit);
+            break;
+        case KC__HASH_MAP_ENGINE_OPEN_ADDRESSING:
+            nodes_count = KC__hash_map_create_open_addressing(ma, hm, mem_limit);
+            break;
+        case KC__HASH_MAP_ENGINE_DIRECT:
+            nodes_count = KC__hash_map_create_direct(ma, hm, K);
+            break;
+        case KC__HASH_MAP_ENGINE_SORT:
+            nodes_count = KC__hash_map_create_sort(ma, hm, K, mem_limit);
+            break;
+        default:
+            KC__ASSERT(false);
+            break;
+    }
 
-    hm->nodes = (KC__HashMapNode*)KC__mem_aligned_alloc(ma, nodes_mem, "hash map nodes");
     const KC__node_id_t step = nodes_count / (KC__node_id_t)(hm->blocks_count);
     for (size_t i = 0; i < hm->blocks_count; i++) {
         KC__HashMapNodeBlock* block = hm->blocks[i];
@@ -120,11 +527,6 @@ KC__HashMap* KC__hash_map_create(KC__MemAllocator* ma, size_t K, size_t threads_
         block->end_id = (i == hm->blocks_count - 1) ? (nodes_count) : (1 + step * (KC__node_id_t)(i + 1));
     }
 
-    LOGGING_DEBUG("        Hash table capacity: %zu (limit: %zu)", hm->table_capacity, table_capacity_limit);
-    LOGGING_DEBUG("          Hash table memory: %zu", table_mem);
-    LOGGING_DEBUG("                Nodes count: %zu", nodes_count);
-    LOGGING_DEBUG("               Nodes memory: %zu", nodes_mem);
-    LOGGING_DEBUG("Hash table and nodes memory: %zu (limit: %zu)", table_mem + nodes_mem, mem_limit);
     for (size_t i = 0; i < hm->blocks_count; i++) {
         KC__HashMapNodeBlock* block = hm->blocks[i];
         LOGGING_DEBUG("Nodes block #%zu (start: %zu, end: %zu, length: %zu)", i, block->start_id, block->end_id, block->end_id - block->start_id);
@@ -132,6 +534,9 @@ KC__HashMap* KC__hash_map_create(KC__MemAllocator* ma, size_t K, size_t threads_
 
     pthread_barrier_init(&(hm->barrier), NULL, (unsigned int)threads_count);
 
+    hm->thread_pool = thread_pool;
+    hm->generation = 0;
+    hm->table_clean = true;
     KC__hash_map_clear(hm);
 
     return hm;
@@ -139,12 +544,43 @@ KC__HashMap* KC__hash_map_create(KC__MemAllocator* ma, size_t K, size_t threads_
 
 void KC__hash_map_free(KC__MemAllocator* ma, KC__HashMap* hm) {
     for (size_t i = 0; i < hm->blocks_count; i++) {
+        pthread_mutex_destroy(&(hm->blocks[i]->partition_mtx));
+        if (hm->blocks[i]->hot_entries != NULL) {
+            KC__mem_free(ma, hm->blocks[i]->hot_entries);
+        }
         KC__mem_free(ma, hm->blocks[i]);
     }
     KC__mem_free(ma, hm->blocks);
 
-    KC__mem_free(ma, hm->nodes);
-    KC__mem_free(ma, hm->table);
+    if (hm->route_queues != NULL) {
+        KC__mem_free(ma, hm->route_queues);
+        KC__mem_free(ma, hm->route_entries);
+    }
+
+    if (hm->nodes != NULL) {
+        KC__mem_mapped_free(ma, hm->nodes, hm->nodes_mem);
+    }
+    if (hm->table != NULL) {
+        KC__mem_mapped_free(ma, hm->table, hm->table_mem);
+    }
+    if (hm->slots != NULL) {
+        KC__mem_mapped_free(ma, hm->slots, hm->table_mem);
+    }
+    if (hm->counts != NULL) {
+        KC__mem_mapped_free(ma, hm->counts, hm->table_mem);
+    }
+    if (hm->sorter != NULL) {
+        KC__kmer_sorter_free(ma, hm->sorter);
+    }
+    if (hm->bloom_filter != NULL) {
+        KC__mem_mapped_free(ma, hm->bloom_filter, sizeof(uint64_t) * hm->bloom_filter_words);
+    }
+    if (hm->spilled_filter != NULL) {
+        KC__mem_mapped_free(ma, hm->spilled_filter, sizeof(uint64_t) * hm->spilled_filter_words);
+    }
+    if (hm->evicted_filter != NULL) {
+        KC__mem_mapped_free(ma, hm->evicted_filter, sizeof(uint64_t) * hm->evicted_filter_words);
+    }
 
     pthread_barrier_destroy(&(hm->barrier));
 
@@ -156,8 +592,14 @@ size_t KC__hash_map_max_key_count(const KC__HashMap* hm) {
     return hm->blocks[hm->blocks_count - 1]->end_id - 1;
 }
 
+void KC__hash_map_bloom_filter_bits(const KC__HashMap* hm, size_t* bloom_filter_bits, size_t* spilled_filter_bits) {
+    *bloom_filter_bits = hm->bloom_filter_words * 64;
+    *spilled_filter_bits = hm->spilled_filter_words * 64;
+}
+
 void KC__hash_map_set_table_capacity(KC__HashMap* hm, size_t capacity) {
     LOGGING_WARNING("Set table capacity to %zu (should only be used for tests)", capacity);
+    KC__ASSERT(hm->engine == KC__HASH_MAP_ENGINE_CHAINING);
     KC__ASSERT(capacity <= hm->table_capacity);
     hm->table_capacity = capacity;
 }
@@ -167,8 +609,8 @@ void KC__hash_map_lock_keys(KC__HashMap* hm) {
     hm->keys_locked = true;
 }
 
-static inline bool KC__hash_map_kmers_equal(const KC__HashMap* hm, const KC__unit_t* kmer_1, const KC__unit_t* kmer_2) {
-    for (size_t i = 0; i < hm->kmer_width; i++) {
+static KC__ALWAYS_INLINE bool KC__hash_map_kmers_equal(const size_t W, const KC__unit_t* kmer_1, const KC__unit_t* kmer_2) {
+    for (size_t i = 0; i < W; i++) {
         if (kmer_1[i] != kmer_2[i]) {
             return false;
         }
@@ -176,8 +618,8 @@ static inline bool KC__hash_map_kmers_equal(const KC__HashMap* hm, const KC__uni
     return true;
 }
 
-static inline void KC__hash_map_copy_kmer(KC__HashMap* hm, KC__unit_t* dest, const KC__unit_t* src) {
-    memcpy(dest, src, hm->kmer_size);
+static KC__ALWAYS_INLINE void KC__hash_map_copy_kmer(const size_t W, KC__unit_t* dest, const KC__unit_t* src) {
+    memcpy(dest, src, sizeof(KC__unit_t) * W);
 }
 
 static inline KC__HashMapNode* KC__hash_map_get_node(const KC__HashMap* hm, KC__node_id_t node_id) {
@@ -186,6 +628,30 @@ static inline KC__HashMapNode* KC__hash_map_get_node(const KC__HashMap* hm, KC__
     return (KC__HashMapNode*)node;
 }
 
+static inline KC__HashMapSlot* KC__hash_map_get_slot(const KC__HashMap* hm, size_t idx) {
+    char* slot = (char*)(hm->slots);
+    slot += hm->slot_size * idx;
+    return (KC__HashMapSlot*)slot;
+}
+
+/** The node id a link of the chaining table points to, NULL if the link is of an older generation. */
+static inline KC__node_id_t KC__hash_map_link_id(const KC__HashMap* hm, KC__node_id_t link) {
+    return ((link & ~KC__HASH_MAP_LINK_ID_MASK) == hm->link_stamp) ? (link & KC__HASH_MAP_LINK_ID_MASK) : KC__NODE_ID_NULL;
+}
+
+static inline KC__node_id_t KC__hash_map_link_to(const KC__HashMap* hm, KC__node_id_t node_id) {
+    return node_id | hm->link_stamp;
+}
+
+/** The state of an open addressing slot, empty if it is of an older generation. */
+static inline uint32_t KC__hash_map_slot_state(const KC__HashMap* hm, uint32_t stamped_state) {
+    return ((stamped_state >> KC__HASH_MAP_SLOT_STATE_BITS) == hm->generation) ? (stamped_state & ((1u << KC__HASH_MAP_SLOT_STATE_BITS) - 1)) : KC__HASH_MAP_SLOT_STATE_EMPTY;
+}
+
+static inline uint32_t KC__hash_map_stamp_slot_state(const KC__HashMap* hm, uint32_t state) {
+    return ((uint32_t)(hm->generation) << KC__HASH_MAP_SLOT_STATE_BITS) | state;
+}
+
 static inline KC__node_id_t KC__hash_map_request_node(KC__HashMap* hm, size_t n) {
     KC__HashMapNodeBlock* block = hm->blocks[n];
     KC__node_id_t node_id;
@@ -197,13 +663,22 @@ static inline KC__node_id_t KC__hash_map_request_node(KC__HashMap* hm, size_t n)
         }
     } while (!__sync_bool_compare_and_swap(&(block->next_id), node_id, node_id + 1));
 
-    KC__HashMapNode* node = KC__hash_map_get_node(hm, node_id);
-    node->count = 0;
+    if (hm->engine == KC__HASH_MAP_ENGINE_CHAINING) {
+        KC__HashMapNode* node = KC__hash_map_get_node(hm, node_id);
+        node->count = 0;
+    }
 
     return node_id;
 }
 
 static inline KC__node_id_t KC__hash_map_polling_request_node(KC__HashMap* hm, size_t n) {
+    KC__HashMapNodeBlock* block = hm->blocks[n];
+    if (block->free_id != KC__NODE_ID_NULL) {
+        KC__node_id_t free_id = block->free_id;
+        block->free_id = KC__hash_map_get_node(hm, free_id)->next;
+        return free_id;
+    }
+
     KC__node_id_t node_id = KC__hash_map_request_node(hm, n);
     if (node_id != KC__NODE_ID_NULL) {
         return node_id;
@@ -237,26 +712,80 @@ static void* KC__hash_map_clear_table(void* ptr) {
     size_t start = param->start;
     size_t end = param->end;
     LOGGING_DEBUG("Hash table clear #%zu from %zu to %zu (length: %zu)", n, start, end, end - start);
-    for (size_t i = param->start; i < param->end; i++) {
-        hm->table[i] = KC__NODE_ID_NULL;
+    if (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) {
+        for (size_t i = param->start; i < param->end; i++) {
+            KC__hash_map_get_slot(hm, i)->state = 0;
+        }
+    } else if (hm->engine == KC__HASH_MAP_ENGINE_DIRECT) {
+        memset(&(hm->counts[start]), 0, sizeof(KC__count_t) * (end - start));
+    } else {
+        for (size_t i = param->start; i < param->end; i++) {
+            hm->table[i] = 0;
+        }
     }
-    pthread_exit(NULL);
+    return NULL;
 }
 
 void KC__hash_map_clear(KC__HashMap* hm) {
     hm->keys_locked = false;
+    hm->recounting = false;
+
+    hm->evict_requested = false;
+    hm->evict_exhausted = false;
+    hm->evicted_count = 0;
+    hm->evict_rounds_count = 0;
+    hm->finished_count = 0;
+    if (hm->evicted_filter_active) {
+        memset(hm->evicted_filter, 0, sizeof(uint64_t) * hm->evicted_filter_words);
+        hm->evicted_filter_active = false;
+    }
+
+    if (hm->sorter != NULL) {
+        KC__kmer_sorter_clear(hm->sorter);
+    }
 
     for (size_t i = 0; i < hm->blocks_count; i++) {
         KC__HashMapNodeBlock* block = hm->blocks[i];
         block->next_id = block->start_id;
         block->current_id = KC__NODE_ID_NULL;
         block->synced = false;
+        block->free_id = KC__NODE_ID_NULL;
+        block->absorbed_count = 0;
+        block->dropped_count = 0;
+        block->cas_retries_count = 0;
+        block->hot_hits_count = 0;
+        if (block->hot_entries != NULL) {
+            memset(block->hot_entries, 0, hm->hot_entry_size * KC__HASH_MAP_HOT_CACHE_SIZE);
+        }
+        block->partition_locked = false;
+        block->adding_finished = false;
+    }
+
+    if (hm->partitioned) {
+        for (size_t i = 0; i < hm->blocks_count * hm->blocks_count; i++) {
+            hm->route_queues[i].head = 0;
+            hm->route_queues[i].tail = 0;
+        }
+    }
+
+    // The links and slots of the last generation read as empty in the next one, the table is only wiped when the
+    // generation wraps around, or for the direct engine whose counters are not stamped.
+    hm->generation++;
+    const bool wiping = !(hm->table_clean) && ((hm->generation > KC__HASH_MAP_GENERATION_MAX) || (hm->engine == KC__HASH_MAP_ENGINE_DIRECT));
+    hm->table_clean = false;
+    if (hm->generation > KC__HASH_MAP_GENERATION_MAX) {
+        hm->generation = 1;
     }
+    hm->link_stamp = (KC__node_id_t)(hm->generation) << (sizeof(KC__node_id_t) * 8 - KC__HASH_MAP_GENERATION_BITS);
+    if (!wiping || (hm->table_capacity == 0)) {
+        return;
+    }
+    LOGGING_DEBUG("Wipe hash table (generation: %zu)", hm->generation);
 
     // The count of threads used to clear hash table equals to blocks count.
     size_t clear_table_threads_count = hm->blocks_count;
-    pthread_t threads[clear_table_threads_count];
     KC__HashMapClearTableParam params[clear_table_threads_count];
+    void* params_ptrs[clear_table_threads_count];
     size_t step = hm->table_capacity / clear_table_threads_count;
     for (size_t i = 0; i < clear_table_threads_count; i++) {
         size_t start = i * step;
@@ -265,67 +794,286 @@ void KC__hash_map_clear(KC__HashMap* hm) {
         params[i].n = i;
         params[i].start = start;
         params[i].end = end;
-        pthread_create(&(threads[i]), NULL, KC__hash_map_clear_table, &(params[i]));
+        params_ptrs[i] = &(params[i]);
     }
 
-    for (size_t i = 0; i < clear_table_threads_count; i++) {
-        pthread_join(threads[i], NULL);
+    KC__ThreadPoolPhase phase;
+    KC__thread_pool_start(hm->thread_pool, &phase, KC__hash_map_clear_table, params_ptrs, clear_table_threads_count);
+    KC__thread_pool_wait(hm->thread_pool, &phase);
+}
+
+static KC__ALWAYS_INLINE size_t KC__hash_map_hash_function(const KC__HashMap* hm, const size_t W, const KC__unit_t* kmer) {
+    if (hm->engine == KC__HASH_MAP_ENGINE_DIRECT) {
+        // K < 32, the K-mer is held by the low bits of a single unit.
+        return (size_t)(kmer[0]);
+    }
+    return KC__hash_reduce(KC__hash_kmer(kmer, W), hm->table_capacity);
+}
+
+/**
+ * Locate the bits of a K-mer in a blocked bloom filter, all of them are in the same word.
+ * @param W The width of K-mers.
+ * @param filter The words of the filter.
+ * @param words_count The count of words.
+ * @param kmer The K-mer.
+ * @param salt Mixed into the hash, otherwise the K-mers of the same bucket would also share the same word.
+ * @param mask Set to the bits of the K-mer.
+ * @return The word.
+ */
+static KC__ALWAYS_INLINE uint64_t* KC__hash_map_filter_word(const size_t W, uint64_t* filter, size_t words_count, const KC__unit_t* kmer, uint64_t salt, uint64_t* mask) {
+    const uint64_t h = KC__hash_mix(KC__hash_kmer(kmer, W) ^ salt);
+    *mask = (UINT64_C(1) << (h & 63)) | (UINT64_C(1) << ((h >> 6) & 63)) | (UINT64_C(1) << ((h >> 12) & 63));
+    return &(filter[KC__hash_reduce(h, words_count)]);
+}
+
+#define KC__HASH_MAP_EVICTED_FILTER_SALT UINT64_C(0xc2b2ae3d27d4eb4f)
+
+static KC__ALWAYS_INLINE bool KC__hash_map_evicted_filter_test(KC__HashMap* hm, const size_t W, const KC__unit_t* kmer) {
+    uint64_t mask;
+    uint64_t* word = KC__hash_map_filter_word(W, hm->evicted_filter, hm->evicted_filter_words, kmer, KC__HASH_MAP_EVICTED_FILTER_SALT, &mask);
+    return (*word & mask) == mask;
+}
+
+static KC__ALWAYS_INLINE void KC__hash_map_evicted_filter_set(KC__HashMap* hm, const size_t W, const KC__unit_t* kmer) {
+    uint64_t mask;
+    uint64_t* word = KC__hash_map_filter_word(W, hm->evicted_filter, hm->evicted_filter_words, kmer, KC__HASH_MAP_EVICTED_FILTER_SALT, &mask);
+    __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+}
+
+#define KC__HASH_MAP_SPILLED_FILTER_SALT UINT64_C(0x165667b19e3779f9)
+
+static KC__ALWAYS_INLINE bool KC__hash_map_spilled_filter_test(KC__HashMap* hm, const size_t W, const KC__unit_t* kmer) {
+    uint64_t mask;
+    uint64_t* word = KC__hash_map_filter_word(W, hm->spilled_filter, hm->spilled_filter_words, kmer, KC__HASH_MAP_SPILLED_FILTER_SALT, &mask);
+    return (*word & mask) == mask;
+}
+
+static KC__ALWAYS_INLINE void KC__hash_map_spilled_filter_set(KC__HashMap* hm, const size_t W, const KC__unit_t* kmer) {
+    uint64_t mask;
+    uint64_t* word = KC__hash_map_filter_word(W, hm->spilled_filter, hm->spilled_filter_words, kmer, KC__HASH_MAP_SPILLED_FILTER_SALT, &mask);
+    if ((__atomic_load_n(word, __ATOMIC_RELAXED) & mask) != mask) {
+        __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Handle a K-mer which is not in the table and cannot be added to it. In the first pass of the bloom filter, it is only
+ * marked in the spilled filter, all its sightings are written to tmp file by the recount pass. In the recount pass, a
+ * K-mer not marked has been seen once, it is dropped.
+ * @param hm The hash map.
+ * @param W The width of K-mers.
+ * @param block The block of the adding thread.
+ * @param kmer The K-mer.
+ * @return If the K-mer has been handled, else it should be passed to the reject callback.
+ */
+static KC__ALWAYS_INLINE bool KC__hash_map_reject_kmer(KC__HashMap* hm, const size_t W, KC__HashMapNodeBlock* block, const KC__unit_t* kmer) {
+    if (hm->bloom_filter_active) {
+        KC__hash_map_spilled_filter_set(hm, W, kmer);
+        return true;
+    }
+    if (hm->recounting && !KC__hash_map_spilled_filter_test(hm, W, kmer)) {
+        block->dropped_count++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Mark the K-mer as seen in the bloom filter.
+ * @param hm The hash map.
+ * @param W The width of K-mers.
+ * @param kmer The K-mer.
+ * @return If the K-mer may have been seen before (all its bits were set already).
+ */
+static KC__ALWAYS_INLINE bool KC__hash_map_bloom_filter_test_and_set(KC__HashMap* hm, const size_t W, const KC__unit_t* kmer) {
+    uint64_t mask;
+    uint64_t* word = KC__hash_map_filter_word(W, hm->bloom_filter, hm->bloom_filter_words, kmer, UINT64_C(0x9e3779b97f4a7c15), &mask);
+
+    // Repeated K-mers are common, skip the atomic write when all bits are already set.
+    if ((__atomic_load_n(word, __ATOMIC_RELAXED) & mask) == mask) {
+        return true;
+    }
+    return (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) == mask;
+}
+
+/**
+ * Add to the counter by CAS, the count saturates at KC__COUNT_MAX. Failed CAS are counted by the block.
+ */
+static inline void KC__hash_map_add_count(KC__HashMapNodeBlock* block, KC__count_t* count_ptr, KC__count_t delta) {
+    KC__count_t count = *count_ptr;
+    while (count != KC__COUNT_MAX) {
+        KC__count_t new_count = (KC__COUNT_MAX - count > delta) ? (count + delta) : KC__COUNT_MAX;
+        if (__sync_bool_compare_and_swap(count_ptr, count, new_count)) {
+            break;
+        }
+        block->cas_retries_count++;
+        count = *count_ptr;
+    }
+}
+
+static inline void KC__hash_map_increase_count(KC__HashMapNodeBlock* block, KC__count_t* count_ptr) {
+    KC__hash_map_add_count(block, count_ptr, 1);
+}
+
+static inline KC__HashMapHotEntry* KC__hash_map_get_hot_entry(const KC__HashMap* hm, const KC__HashMapNodeBlock* block, size_t table_idx) {
+    return (KC__HashMapHotEntry*)(block->hot_entries + hm->hot_entry_size * (table_idx & (KC__HASH_MAP_HOT_CACHE_SIZE - 1)));
+}
+
+static inline void KC__hash_map_flush_hot_entry(KC__HashMapNodeBlock* block, KC__HashMapHotEntry* entry) {
+    if (entry->pending > 0) {
+        KC__hash_map_add_count(block, entry->count_ptr, entry->pending);
+        entry->pending = 0;
+    }
+}
+
+/**
+ * Cache the K-mer just counted in the table if it is hot, the K-mer held by the entry is flushed and replaced.
+ */
+static KC__ALWAYS_INLINE void KC__hash_map_offer_hot_kmer(const size_t W, KC__HashMapNodeBlock* block, KC__HashMapHotEntry* entry, const KC__unit_t* kmer, KC__count_t* count_ptr) {
+    if (__atomic_load_n(count_ptr, __ATOMIC_RELAXED) < KC__HASH_MAP_HOT_COUNT_MIN) {
+        return;
+    }
+
+    if (entry->count_ptr != NULL) {
+        KC__hash_map_flush_hot_entry(block, entry);
     }
+    KC__hash_map_copy_kmer(W, entry->kmer, kmer);
+    entry->count_ptr = count_ptr;
 }
 
-static inline size_t KC__hash_map_hash_function(const KC__HashMap* hm, const KC__unit_t* kmer) {
-    size_t n = 0;
-    for (size_t i = 0; i < hm->kmer_width; i++) {
-        n += kmer[i];
+/**
+ * Flush all K-mers of the hot cache to the table and empty it.
+ */
+static void KC__hash_map_flush_hot_cache(KC__HashMap* hm, KC__HashMapNodeBlock* block) {
+    for (size_t i = 0; i < KC__HASH_MAP_HOT_CACHE_SIZE; i++) {
+        KC__HashMapHotEntry* entry = KC__hash_map_get_hot_entry(hm, block, i);
+        if (entry->count_ptr != NULL) {
+            KC__hash_map_flush_hot_entry(block, entry);
+            entry->count_ptr = NULL;
+        }
     }
-    return n % hm->table_capacity;
 }
 
 /**
  * Add K-mer to collision list (may be part of the list) specified by pointer to a node id.
  * @param hm The hash map.
+ * @param W The width of K-mers.
+ * @param block The block of the adding thread.
  * @param kmer The K-mer to be added.
  * @param list Specify the head of the (sub-) collision list, will be updated before return.
- * @return If the K-mer already exists in the collision list, the node id will be returned, and list will be updated to
- * a pointer to this node, else the tail (KC__NODE_ID_NULL) of collision list will be returned and list will be updated
- * to the corresponding pointer.
+ * @return If the K-mer already exists in the collision list, the link to its node will be returned, and list will be
+ * updated to a pointer to this link, else the tail (a link reading as KC__NODE_ID_NULL) of collision list will be
+ * returned and list will be updated to the corresponding pointer.
  */
-static inline KC__node_id_t KC__hash_map_collision_list_add_kmer(KC__HashMap* hm, KC__node_id_t** list, const KC__unit_t* kmer) {
-    KC__node_id_t node_id;
+static KC__ALWAYS_INLINE KC__node_id_t KC__hash_map_collision_list_add_kmer(KC__HashMap* hm, const size_t W, KC__HashMapNodeBlock* block, KC__node_id_t** list, const KC__unit_t* kmer) {
+    KC__node_id_t link;
     KC__node_id_t* p = *list;
     while (true) {
-        node_id = *p;
+        link = *p;
 
+        const KC__node_id_t node_id = KC__hash_map_link_id(hm, link);
         if (node_id == KC__NODE_ID_NULL) {
             break;
         }
 
         KC__HashMapNode* node = KC__hash_map_get_node(hm, node_id);
-        if (KC__hash_map_kmers_equal(hm, node->kmer, kmer)) {
-            KC__count_t count;
-            do {
-                count = node->count;
-                if (count == KC__COUNT_MAX)
-                    break;
-            } while (!__sync_bool_compare_and_swap(&(node->count), count, count + 1));
-
+        if (KC__hash_map_kmers_equal(W, node->kmer, kmer)) {
+            KC__hash_map_increase_count(block, &(node->count));
             break;
         }
         p = &(node->next);
     }
 
     *list = p;
-    return node_id;
+    return link;
 }
 
-bool KC__hash_map_add_kmer(KC__HashMap* hm, size_t n, const KC__unit_t* kmer) {
+/**
+ * A round of eviction, every thread should call it once the round is requested. Thread n evicts the K-mers of its range
+ * of the table, and keeps the freed nodes. If the round frees too few nodes, the keys will be locked the next time
+ * the nodes are used out.
+ */
+static void KC__hash_map_evict(KC__HashMap* hm, size_t n) {
     KC__HashMapNodeBlock* block = hm->blocks[n];
 
-    if (!(block->synced) && (block->current_id == KC__NODE_ID_NULL)) {
+    // No thread is adding K-mers after this.
+    pthread_barrier_wait(&(hm->barrier));
+
+    size_t step = hm->table_capacity / hm->blocks_count;
+    size_t start = n * step;
+    size_t end = (n == hm->blocks_count - 1) ? (hm->table_capacity) : ((n + 1) * step);
+    size_t evicted_count = 0;
+
+    for (size_t i = start; i < end; i++) {
+        KC__node_id_t* list = &(hm->table[i]);
+        KC__node_id_t node_id;
+        while ((node_id = KC__hash_map_link_id(hm, *list)) != KC__NODE_ID_NULL) {
+            KC__HashMapNode* node = KC__hash_map_get_node(hm, node_id);
+
+            if (node->count != 1) {
+                list = &(node->next);
+                continue;
+            }
+
+            KC__hash_map_evicted_filter_set(hm, hm->kmer_width, node->kmer);
+            if (!KC__hash_map_reject_kmer(hm, hm->kmer_width, block, node->kmer)) {
+                KC__ASSERT(block->reject_callback != NULL);
+                block->reject_callback(node->kmer, block->reject_data);
+            }
+
+            *list = node->next;
+            node->count = 0;
+            node->next = block->free_id;
+            block->free_id = node_id;
+            evicted_count++;
+        }
+    }
+
+    __atomic_add_fetch(&(hm->evicted_count), evicted_count, __ATOMIC_RELAXED);
+
+    if (pthread_barrier_wait(&(hm->barrier)) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        hm->evict_rounds_count++;
+        LOGGING_INFO("Eviction round #%zu evicted %zu K-mers seen once.", hm->evict_rounds_count, hm->evicted_count);
+
+        // Evicting again soon would cost more than it saves.
+        if (hm->evicted_count < KC__hash_map_max_key_count(hm) / 16) {
+            hm->evict_exhausted = true;
+        }
+        hm->evicted_count = 0;
+        hm->evicted_filter_active = true;
+        hm->evict_requested = false;
+    }
+
+    pthread_barrier_wait(&(hm->barrier));
+}
+
+/**
+ * Make sure the block holds a node (or ticket) for a new K-mer, or it has been synced after keys locked.
+ * @param hm The hash map.
+ * @param n The id of the block (thread).
+ * @return The block.
+ */
+static inline KC__HashMapNodeBlock* KC__hash_map_prepare_block(KC__HashMap* hm, size_t n) {
+    KC__HashMapNodeBlock* block = hm->blocks[n];
+
+    if (hm->evict_singletons && __atomic_load_n(&(hm->evict_requested), __ATOMIC_ACQUIRE)) {
+        KC__hash_map_evict(hm, n);
+    }
+
+    while (!(block->synced) && (block->current_id == KC__NODE_ID_NULL)) {
         block->current_id = KC__hash_map_polling_request_node(hm, n);
-        if (block->current_id == KC__NODE_ID_NULL) {
+        if (block->current_id != KC__NODE_ID_NULL) {
+            break;
+        }
+
+        // All threads see the same evict_exhausted between two rounds.
+        if (hm->evict_singletons && !(hm->evict_exhausted)) {
+            __atomic_store_n(&(hm->evict_requested), true, __ATOMIC_RELEASE);
+            KC__hash_map_evict(hm, n);
+        } else {
             hm->keys_locked = true;
             LOGGING_DEBUG("Set hash map keys locked.");
+            break;
         }
     }
 
@@ -340,12 +1088,31 @@ bool KC__hash_map_add_kmer(KC__HashMap* hm, size_t n, const KC__unit_t* kmer) {
         LOGGING_DEBUG("Block #%zu synced (keys locked).", n);
     }
 
-    size_t table_idx = KC__hash_map_hash_function(hm, kmer);
+    return block;
+}
 
+/**
+ * Add K-mer to the chaining table.
+ * @param hm The hash map.
+ * @param W The width of K-mers.
+ * @param block The block of the adding thread.
+ * @param kmer The K-mer.
+ * @param table_idx The table index of the K-mer.
+ * @param count_ptr Set to the counter of the K-mer if it already exists in the table, else left unchanged.
+ * @return If the K-mer is added.
+ */
+static KC__ALWAYS_INLINE bool KC__hash_map_chaining_add_kmer(KC__HashMap* hm, const size_t W, KC__HashMapNodeBlock* block, const KC__unit_t* kmer, size_t table_idx, KC__count_t** count_ptr) {
     KC__node_id_t* collision_list = &(hm->table[table_idx]);
-    KC__node_id_t node_id = KC__hash_map_collision_list_add_kmer(hm, &collision_list, kmer);
+    KC__node_id_t link = KC__hash_map_collision_list_add_kmer(hm, W, block, &collision_list, kmer);
 
-    if (node_id != KC__NODE_ID_NULL) {
+    if (KC__hash_map_link_id(hm, link) != KC__NODE_ID_NULL) {
+        *count_ptr = &(KC__hash_map_get_node(hm, KC__hash_map_link_id(hm, link))->count);
+        return true;
+    }
+
+    // The filter is consulted before keys_locked, so that a K-mer seen once is never marked in the spilled filter.
+    if (hm->bloom_filter_active && !KC__hash_map_bloom_filter_test_and_set(hm, W, kmer)) {
+        block->absorbed_count++;
         return true;
     }
 
@@ -353,31 +1120,515 @@ bool KC__hash_map_add_kmer(KC__HashMap* hm, size_t n, const KC__unit_t* kmer) {
     // thread has not seen the change and is adding a new node to hash table, then it may cause inconsistency.
     // Checking if this thread has been synced is important.
     if (block->synced && hm->keys_locked) {
-        return false;
+        return KC__hash_map_reject_kmer(hm, W, block, kmer);
+    }
+
+    // The other sightings of an evicted K-mer are counted in a later pass with it.
+    if (hm->evicted_filter_active && KC__hash_map_evicted_filter_test(hm, W, kmer)) {
+        return KC__hash_map_reject_kmer(hm, W, block, kmer);
     }
 
     KC__HashMapNode *node = KC__hash_map_get_node(hm, block->current_id);
-    KC__hash_map_copy_kmer(hm, node->kmer, kmer);
+    KC__hash_map_copy_kmer(W, node->kmer, kmer);
     node->count = 1;
     node->next = KC__NODE_ID_NULL;
 
     do {
-        node_id = KC__hash_map_collision_list_add_kmer(hm, &collision_list, kmer);
-        if (node_id != KC__NODE_ID_NULL) {
+        link = KC__hash_map_collision_list_add_kmer(hm, W, block, &collision_list, kmer);
+        if (KC__hash_map_link_id(hm, link) != KC__NODE_ID_NULL) {
             // Mark the node invalid.
             node->count = 0;
             return true;
         }
-    } while (!__sync_bool_compare_and_swap(collision_list, node_id, block->current_id));
+    } while (!__sync_bool_compare_and_swap(collision_list, link, KC__hash_map_link_to(hm, block->current_id)));
 
     block->current_id = KC__NODE_ID_NULL;
 
     return true;
 }
 
+/**
+ * Add K-mer by linear probing. An empty slot is claimed by CAS on its state, the thread which claims it copies the K-mer
+ * and then publishes the slot, the other threads probing the slot wait until it is published. The count_ptr is set as
+ * the chaining engine does.
+ */
+static KC__ALWAYS_INLINE bool KC__hash_map_open_addressing_add_kmer(KC__HashMap* hm, const size_t W, KC__HashMapNodeBlock* block, const KC__unit_t* kmer, size_t idx, KC__count_t** count_ptr) {
+    bool filtered = false;
+
+    while (true) {
+        KC__HashMapSlot* slot = KC__hash_map_get_slot(hm, idx);
+        const uint32_t stamped_state = __atomic_load_n(&(slot->state), __ATOMIC_ACQUIRE);
+        uint32_t state = KC__hash_map_slot_state(hm, stamped_state);
+
+        if (state == KC__HASH_MAP_SLOT_STATE_EMPTY) {
+            // The K-mer is not in the table, it should only pass the filter once even if the slot is lost to another
+            // thread.
+            if (hm->bloom_filter_active && !filtered) {
+                if (!KC__hash_map_bloom_filter_test_and_set(hm, W, kmer)) {
+                    block->absorbed_count++;
+                    return true;
+                }
+                filtered = true;
+            }
+
+            // The same as chaining engine, only a synced thread can trust keys_locked.
+            if (block->synced && hm->keys_locked) {
+                return KC__hash_map_reject_kmer(hm, W, block, kmer);
+            }
+
+            if (!__sync_bool_compare_and_swap(&(slot->state), stamped_state, KC__hash_map_stamp_slot_state(hm, KC__HASH_MAP_SLOT_STATE_BUSY))) {
+                // Check the same slot again.
+                continue;
+            }
+
+            KC__hash_map_copy_kmer(W, slot->kmer, kmer);
+            slot->count = 1;
+            __atomic_store_n(&(slot->state), KC__hash_map_stamp_slot_state(hm, KC__HASH_MAP_SLOT_STATE_READY), __ATOMIC_RELEASE);
+
+            block->current_id = KC__NODE_ID_NULL;
+
+            return true;
+        }
+
+        while (state == KC__HASH_MAP_SLOT_STATE_BUSY) {
+            state = KC__hash_map_slot_state(hm, __atomic_load_n(&(slot->state), __ATOMIC_ACQUIRE));
+        }
+
+        if (KC__hash_map_kmers_equal(W, slot->kmer, kmer)) {
+            KC__hash_map_increase_count(block, &(slot->count));
+            *count_ptr = &(slot->count);
+            return true;
+        }
+
+        idx++;
+        if (idx == hm->table_capacity) {
+            idx = 0;
+        }
+    }
+}
+
+/**
+ * Increase the counter of the K-mer. Keys are never locked, relaxed atomic add is enough unless the counter is close to
+ * the max value, where at most one add from each thread may be in flight.
+ */
+static inline bool KC__hash_map_direct_add_kmer(KC__HashMap* hm, size_t n, size_t idx) {
+    KC__count_t* count_ptr = &(hm->counts[idx]);
+    if (__atomic_load_n(count_ptr, __ATOMIC_RELAXED) < KC__COUNT_MAX - (KC__count_t)(hm->blocks_count)) {
+        __atomic_fetch_add(count_ptr, 1, __ATOMIC_RELAXED);
+    } else {
+        KC__hash_map_increase_count(hm->blocks[n], count_ptr);
+    }
+    return true;
+}
+
+static KC__ALWAYS_INLINE bool KC__hash_map_add_kmer_by_index(KC__HashMap* hm, const size_t W, size_t n, const KC__unit_t* kmer, size_t table_idx) {
+    if (hm->engine == KC__HASH_MAP_ENGINE_DIRECT) {
+        return KC__hash_map_direct_add_kmer(hm, n, table_idx);
+    }
+
+    KC__HashMapNodeBlock* block = KC__hash_map_prepare_block(hm, n);
+
+    KC__HashMapHotEntry* entry = NULL;
+    if (block->hot_entries != NULL) {
+        entry = KC__hash_map_get_hot_entry(hm, block, table_idx);
+        if ((entry->count_ptr != NULL) && KC__hash_map_kmers_equal(W, entry->kmer, kmer)) {
+            entry->pending++;
+            block->hot_hits_count++;
+            // The pending count never overflows.
+            if (entry->pending == KC__COUNT_MAX) {
+                KC__hash_map_flush_hot_entry(block, entry);
+            }
+            return true;
+        }
+    }
+
+    KC__count_t* count_ptr = NULL;
+    bool added;
+    switch (hm->engine) {
+        case KC__HASH_MAP_ENGINE_CHAINING:
+            added = KC__hash_map_chaining_add_kmer(hm, W, block, kmer, table_idx, &count_ptr);
+            break;
+        case KC__HASH_MAP_ENGINE_OPEN_ADDRESSING:
+            added = KC__hash_map_open_addressing_add_kmer(hm, W, block, kmer, table_idx, &count_ptr);
+            break;
+        default:
+            KC__ASSERT(false);
+            return false;
+    }
+
+    if ((entry != NULL) && (count_ptr != NULL)) {
+        KC__hash_map_offer_hot_kmer(W, block, entry, kmer, count_ptr);
+    }
+
+    return added;
+}
+
+static inline size_t KC__hash_map_partition_of(const KC__HashMap* hm, size_t table_idx) {
+    // Derived from the table index, so that a collision list is always owned by a single partition.
+    return table_idx * hm->blocks_count / hm->table_capacity;
+}
+
+/**
+ * Add K-mer to the table slice of partition p, the caller should hold the lock of the partition.
+ */
+static KC__ALWAYS_INLINE bool KC__hash_map_partition_add_kmer(KC__HashMap* hm, const size_t W, size_t p, const KC__unit_t* kmer, size_t table_idx) {
+    KC__HashMapNodeBlock* block = hm->blocks[p];
+
+    KC__node_id_t* list = &(hm->table[table_idx]);
+    while (KC__hash_map_link_id(hm, *list) != KC__NODE_ID_NULL) {
+        KC__HashMapNode* node = KC__hash_map_get_node(hm, KC__hash_map_link_id(hm, *list));
+        if (KC__hash_map_kmers_equal(W, node->kmer, kmer)) {
+            if (node->count != KC__COUNT_MAX) {
+                node->count++;
+            }
+            return true;
+        }
+        list = &(node->next);
+    }
+
+    if (hm->bloom_filter_active && !KC__hash_map_bloom_filter_test_and_set(hm, W, kmer)) {
+        block->absorbed_count++;
+        return true;
+    }
+
+    if (block->partition_locked) {
+        return KC__hash_map_reject_kmer(hm, W, block, kmer);
+    }
+
+    // Nodes are only taken from the block of the partition.
+    KC__node_id_t node_id = KC__hash_map_request_node(hm, p);
+    if (node_id == KC__NODE_ID_NULL) {
+        block->partition_locked = true;
+        LOGGING_DEBUG("Set partition #%zu keys locked.", p);
+        return KC__hash_map_reject_kmer(hm, W, block, kmer);
+    }
+
+    KC__HashMapNode* node = KC__hash_map_get_node(hm, node_id);
+    KC__hash_map_copy_kmer(W, node->kmer, kmer);
+    node->count = 1;
+    node->next = KC__NODE_ID_NULL;
+    *list = KC__hash_map_link_to(hm, node_id);
+
+    return true;
+}
+
+static inline KC__HashMapRouteQueue* KC__hash_map_get_route_queue(const KC__HashMap* hm, size_t src, size_t dst) {
+    return &(hm->route_queues[src * hm->blocks_count + dst]);
+}
+
+static inline char* KC__hash_map_get_route_entry(const KC__HashMap* hm, size_t src, size_t dst, size_t pos) {
+    size_t i = (src * hm->blocks_count + dst) * KC__HASH_MAP_ROUTE_QUEUE_SIZE + pos % KC__HASH_MAP_ROUTE_QUEUE_SIZE;
+    return hm->route_entries + hm->route_entry_size * i;
+}
+
+/**
+ * Add the K-mers routed to partition p, the caller should hold the lock of the partition.
+ * @param hm The hash map.
+ * @param n The id of the calling thread, the K-mers failed to be added are passed to its reject callback.
+ * @param p The partition.
+ * @return The count of K-mers drained.
+ */
+static size_t KC__hash_map_partition_drain(KC__HashMap* hm, size_t n, size_t p) {
+    KC__HashMapNodeBlock* block = hm->blocks[n];
+    size_t drained = 0;
+
+    for (size_t src = 0; src < hm->blocks_count; src++) {
+        KC__HashMapRouteQueue* queue = KC__hash_map_get_route_queue(hm, src, p);
+        size_t head = queue->head;
+        const size_t tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            char* entry = KC__hash_map_get_route_entry(hm, src, p, head);
+            const KC__unit_t* kmer = (const KC__unit_t*)(entry + sizeof(size_t));
+            if (!KC__hash_map_partition_add_kmer(hm, hm->kmer_width, p, kmer, *((size_t*)entry))) {
+                KC__ASSERT(block->reject_callback != NULL);
+                block->reject_callback(kmer, block->reject_data);
+            }
+            drained++;
+        }
+
+        __atomic_store_n(&(queue->head), head, __ATOMIC_RELEASE);
+    }
+
+    return drained;
+}
+
+static KC__ALWAYS_INLINE void KC__hash_map_route_kmer(KC__HashMap* hm, const size_t W, size_t n, size_t p, const KC__unit_t* kmer, size_t table_idx) {
+    KC__HashMapRouteQueue* queue = KC__hash_map_get_route_queue(hm, n, p);
+    const size_t tail = queue->tail;
+
+    while (tail - __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE) == KC__HASH_MAP_ROUTE_QUEUE_SIZE) {
+        // The owner may be waiting for input, drain its partition instead of waiting for it, so that no thread ever
+        // blocks on another one.
+        pthread_mutex_lock(&(hm->blocks[p]->partition_mtx));
+        KC__hash_map_partition_drain(hm, n, p);
+        pthread_mutex_unlock(&(hm->blocks[p]->partition_mtx));
+    }
+
+    char* entry = KC__hash_map_get_route_entry(hm, n, p, tail);
+    *((size_t*)entry) = table_idx;
+    KC__hash_map_copy_kmer(W, (KC__unit_t*)(entry + sizeof(size_t)), kmer);
+    __atomic_store_n(&(queue->tail), tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * The K-mers owned by other partitions are routed to their owners and reported as added, the failed ones will be passed
+ * to the reject callback of the thread which drains them.
+ */
+static KC__ALWAYS_INLINE void KC__hash_map_partitioned_add_kmers_batch(KC__HashMap* hm, const size_t W, size_t n, const KC__unit_t* kmers, size_t count, const size_t* table_indexes, bool* added) {
+    size_t partitions[KC__HASH_MAP_BATCH_SIZE_MAX];
+
+    for (size_t i = 0; i < count; i++) {
+        partitions[i] = KC__hash_map_partition_of(hm, table_indexes[i]);
+        if (partitions[i] != n) {
+            KC__hash_map_route_kmer(hm, W, n, partitions[i], kmers + i * W, table_indexes[i]);
+            added[i] = true;
+        }
+    }
+
+    pthread_mutex_lock(&(hm->blocks[n]->partition_mtx));
+    for (size_t i = 0; i < count; i++) {
+        if (partitions[i] == n) {
+            added[i] = KC__hash_map_partition_add_kmer(hm, W, n, kmers + i * W, table_indexes[i]);
+        }
+    }
+    KC__hash_map_partition_drain(hm, n, n);
+    pthread_mutex_unlock(&(hm->blocks[n]->partition_mtx));
+}
+
+/**
+ * Keep draining the partition until all threads have finished adding and all route queues to it are empty.
+ */
+static void KC__hash_map_partition_finish(KC__HashMap* hm, size_t n) {
+    KC__HashMapNodeBlock* block = hm->blocks[n];
+    __atomic_store_n(&(block->adding_finished), true, __ATOMIC_RELEASE);
+
+    while (true) {
+        // Check the flags before draining, the K-mers routed before a flag was set are visible to the drain.
+        bool all_finished = true;
+        for (size_t i = 0; i < hm->blocks_count; i++) {
+            if (!__atomic_load_n(&(hm->blocks[i]->adding_finished), __ATOMIC_ACQUIRE)) {
+                all_finished = false;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&(block->partition_mtx));
+        size_t drained = KC__hash_map_partition_drain(hm, n, n);
+        pthread_mutex_unlock(&(block->partition_mtx));
+
+        if (all_finished && (drained == 0)) {
+            break;
+        }
+        if (drained == 0) {
+            sched_yield();
+        }
+    }
+}
+
+void KC__hash_map_set_reject_callback(KC__HashMap* hm, size_t n, KC__HashMapRejectCallback callback, void* data) {
+    KC__ASSERT(n < hm->blocks_count);
+    hm->blocks[n]->reject_callback = callback;
+    hm->blocks[n]->reject_data = data;
+}
+
+static KC__ALWAYS_INLINE void KC__hash_map_add_kmers_batch_of_width(KC__HashMap* hm, const size_t W, size_t n, const KC__unit_t* kmers, size_t count, bool* added) {
+    size_t table_indexes[KC__HASH_MAP_BATCH_SIZE_MAX];
+
+    if (hm->engine == KC__HASH_MAP_ENGINE_SORT) {
+        for (size_t i = 0; i < count; i++) {
+            added[i] = KC__kmer_sorter_add_kmer(hm->sorter, n, kmers + i * W);
+        }
+        return;
+    }
+
+    // Hash all K-mers first, so that the loads of buckets are issued together instead of one after another.
+    for (size_t i = 0; i < count; i++) {
+        size_t table_idx = KC__hash_map_hash_function(hm, W, kmers + i * W);
+        table_indexes[i] = table_idx;
+
+        if (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) {
+            __builtin_prefetch(KC__hash_map_get_slot(hm, table_idx), 1, 3);
+        } else if (hm->engine == KC__HASH_MAP_ENGINE_DIRECT) {
+            __builtin_prefetch(&(hm->counts[table_idx]), 1, 3);
+        } else {
+            __builtin_prefetch(&(hm->table[table_idx]), 0, 3);
+        }
+    }
+
+    // The buckets should have arrived, then the head nodes of collision lists can be fetched.
+    if (hm->engine == KC__HASH_MAP_ENGINE_CHAINING) {
+        for (size_t i = 0; i < count; i++) {
+            KC__node_id_t node_id = KC__hash_map_link_id(hm, hm->table[table_indexes[i]]);
+            if (node_id != KC__NODE_ID_NULL) {
+                __builtin_prefetch(KC__hash_map_get_node(hm, node_id), 1, 3);
+            }
+        }
+    }
+
+    if (hm->partitioned) {
+        KC__hash_map_partitioned_add_kmers_batch(hm, W, n, kmers, count, table_indexes, added);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        added[i] = KC__hash_map_add_kmer_by_index(hm, W, n, kmers + i * W, table_indexes[i]);
+    }
+}
+
+static KC__ALWAYS_INLINE bool KC__hash_map_add_kmer_of_width(KC__HashMap* hm, const size_t W, size_t n, const KC__unit_t* kmer) {
+    if (hm->engine == KC__HASH_MAP_ENGINE_SORT) {
+        return KC__kmer_sorter_add_kmer(hm->sorter, n, kmer);
+    }
+
+    if (hm->partitioned) {
+        bool added;
+        KC__hash_map_add_kmers_batch_of_width(hm, W, n, kmer, 1, &added);
+        return added;
+    }
+
+    return KC__hash_map_add_kmer_by_index(hm, W, n, kmer, KC__hash_map_hash_function(hm, W, kmer));
+}
+
+/**
+ * Define the adding functions for K-mers of the width, the specialized ones take it as a constant.
+ */
+#define KC__HASH_MAP_DEFINE_ADDING(SUFFIX, WIDTH) \
+    static bool KC__hash_map_add_kmer_##SUFFIX(KC__HashMap* hm, size_t n, const KC__unit_t* kmer) { \
+        return KC__hash_map_add_kmer_of_width(hm, (WIDTH), n, kmer); \
+    } \
+    static void KC__hash_map_add_kmers_batch_##SUFFIX(KC__HashMap* hm, size_t n, const KC__unit_t* kmers, size_t count, bool* added) { \
+        KC__hash_map_add_kmers_batch_of_width(hm, (WIDTH), n, kmers, count, added); \
+    }
+
+KC__HASH_MAP_DEFINE_ADDING(w1, 1)
+KC__HASH_MAP_DEFINE_ADDING(w2, 2)
+KC__HASH_MAP_DEFINE_ADDING(w3, 3)
+KC__HASH_MAP_DEFINE_ADDING(w4, 4)
+KC__HASH_MAP_DEFINE_ADDING(generic, hm->kmer_width)
+
+static void KC__hash_map_select_adding(KC__HashMap* hm) {
+    switch (hm->kmer_width) {
+        case 1:
+            hm->add_kmer = KC__hash_map_add_kmer_w1;
+            hm->add_kmers_batch = KC__hash_map_add_kmers_batch_w1;
+            break;
+        case 2:
+            hm->add_kmer = KC__hash_map_add_kmer_w2;
+            hm->add_kmers_batch = KC__hash_map_add_kmers_batch_w2;
+            break;
+        case 3:
+            hm->add_kmer = KC__hash_map_add_kmer_w3;
+            hm->add_kmers_batch = KC__hash_map_add_kmers_batch_w3;
+            break;
+        case 4:
+            hm->add_kmer = KC__hash_map_add_kmer_w4;
+            hm->add_kmers_batch = KC__hash_map_add_kmers_batch_w4;
+            break;
+        default:
+            hm->add_kmer = KC__hash_map_add_kmer_generic;
+            hm->add_kmers_batch = KC__hash_map_add_kmers_batch_generic;
+            break;
+    }
+}
+
+bool KC__hash_map_add_kmer(KC__HashMap* hm, size_t n, const KC__unit_t* kmer) {
+    return hm->add_kmer(hm, n, kmer);
+}
+
+void KC__hash_map_add_kmers_batch(KC__HashMap* hm, size_t n, const KC__unit_t* kmers, size_t count, bool* added) {
+    KC__ASSERT(count <= KC__HASH_MAP_BATCH_SIZE_MAX);
+    hm->add_kmers_batch(hm, n, kmers, count, added);
+}
+
+bool KC__hash_map_start_recounting(KC__HashMap* hm) {
+    if (!(hm->bloom_filter_active)) {
+        return false;
+    }
+
+    size_t absorbed_count = 0;
+    for (size_t i = 0; i < hm->blocks_count; i++) {
+        absorbed_count += hm->blocks[i]->absorbed_count;
+    }
+    LOGGING_INFO("K-mers absorbed by bloom filter: %zu", absorbed_count);
+
+    hm->bloom_filter_active = false;
+    hm->recounting = true;
+
+    // The keys are kept, only their counts are reset. Invalid and evicted nodes hold count 0 already.
+    if (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) {
+        for (size_t i = 0; i < hm->table_capacity; i++) {
+            KC__HashMapSlot* slot = KC__hash_map_get_slot(hm, i);
+            if (KC__hash_map_slot_state(hm, slot->state) == KC__HASH_MAP_SLOT_STATE_READY) {
+                slot->count = 0;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < hm->blocks_count; i++) {
+            KC__HashMapNodeBlock* block = hm->blocks[i];
+            for (KC__node_id_t id = block->start_id; id < block->next_id; id++) {
+                KC__hash_map_get_node(hm, id)->count = 0;
+            }
+        }
+    }
+
+    // No new key is added in the recount pass.
+    hm->keys_locked = true;
+    hm->evict_requested = false;
+    for (size_t i = 0; i < hm->blocks_count; i++) {
+        hm->blocks[i]->synced = true;
+        hm->blocks[i]->partition_locked = true;
+        hm->blocks[i]->adding_finished = false;
+    }
+
+    return true;
+}
+
+void KC__hash_map_stop_evicting(KC__HashMap* hm) {
+    if (hm->evict_singletons) {
+        LOGGING_DEBUG("Stop evicting K-mers seen once.");
+        hm->evict_singletons = false;
+    }
+}
+
+size_t KC__hash_map_dropped_kmers_count(const KC__HashMap* hm) {
+    size_t dropped_count = 0;
+    for (size_t i = 0; i < hm->blocks_count; i++) {
+        dropped_count += hm->blocks[i]->dropped_count;
+    }
+    return dropped_count;
+}
+
 void KC__hash_map_finish_adding_kmers(KC__HashMap* hm, size_t n) {
     KC__HashMapNodeBlock* block = hm->blocks[n];
 
+    if (block->hot_entries != NULL) {
+        KC__hash_map_flush_hot_cache(hm, block);
+    }
+
+    if (hm->partitioned) {
+        KC__hash_map_partition_finish(hm, n);
+    }
+    if (hm->engine == KC__HASH_MAP_ENGINE_SORT) {
+        KC__kmer_sorter_finish_adding_kmers(hm->sorter, n);
+    }
+
+    // A finished thread still takes part in the eviction rounds and the sync of keys locked until all threads finish.
+    if (hm->evict_singletons) {
+        __atomic_add_fetch(&(hm->finished_count), 1, __ATOMIC_ACQ_REL);
+        while (__atomic_load_n(&(hm->finished_count), __ATOMIC_ACQUIRE) < hm->blocks_count) {
+            if (__atomic_load_n(&(hm->evict_requested), __ATOMIC_ACQUIRE)) {
+                KC__hash_map_evict(hm, n);
+            } else if (!(block->synced) && __atomic_load_n(&(hm->keys_locked), __ATOMIC_ACQUIRE)) {
+                pthread_barrier_wait(&(hm->barrier));
+                block->synced = true;
+                LOGGING_DEBUG("Block #%zu synced (keys locked).", n);
+            } else {
+                sched_yield();
+            }
+        }
+    }
+
     if (!(block->synced)) {
         pthread_barrier_wait(&(hm->barrier));
         block->synced = true;
@@ -390,6 +1641,50 @@ void KC__hash_map_export(KC__HashMap* hm, size_t n, KC__HashMapExportCallback ca
 
     KC__ASSERT(n < hm->blocks_count);
 
+    if (hm->engine == KC__HASH_MAP_ENGINE_SORT) {
+        KC__kmer_sorter_export(hm->sorter, n, callback, data, exported_count);
+        return;
+    }
+
+    if (hm->engine == KC__HASH_MAP_ENGINE_DIRECT) {
+        // Counters are exported by ranges, the K-mer is the index.
+        size_t step = hm->table_capacity / hm->blocks_count;
+        size_t start = n * step;
+        size_t end = (n == hm->blocks_count - 1) ? (hm->table_capacity) : ((n + 1) * step);
+        for (size_t i = start; i < end; i++) {
+            KC__count_t count = hm->counts[i];
+            if (count != 0) {
+                KC__unit_t kmer = (KC__unit_t)i;
+                callback(&kmer, count, data);
+                ec++;
+            }
+        }
+
+        if (exported_count != NULL) {
+            *exported_count = ec;
+        }
+        return;
+    }
+
+    if (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) {
+        // Slots are exported by ranges, as the slots filled by a thread spread across the whole table.
+        size_t step = hm->table_capacity / hm->blocks_count;
+        size_t start = n * step;
+        size_t end = (n == hm->blocks_count - 1) ? (hm->table_capacity) : ((n + 1) * step);
+        for (size_t i = start; i < end; i++) {
+            KC__HashMapSlot* slot = KC__hash_map_get_slot(hm, i);
+            if (KC__hash_map_slot_state(hm, slot->state) == KC__HASH_MAP_SLOT_STATE_READY) {
+                callback(slot->kmer, slot->count, data);
+                ec++;
+            }
+        }
+
+        if (exported_count != NULL) {
+            *exported_count = ec;
+        }
+        return;
+    }
+
     KC__HashMapNodeBlock* block = hm->blocks[n];
     for (KC__node_id_t i = block->start_id; i < block->next_id; i++) {
         KC__HashMapNode* node = KC__hash_map_get_node(hm, i);
@@ -404,4 +1699,127 @@ void KC__hash_map_export(KC__HashMap* hm, size_t n, KC__HashMapExportCallback ca
     if (exported_count != NULL) {
         *exported_count = ec;
     }
-}
\ No newline at end of file
+}
+
+typedef struct {
+    KC__HashMap* hash_map;
+    size_t start;
+    size_t end;
+
+    size_t lengths_count[KC__HASH_MAP_CHAIN_LENGTH_SLOTS];
+    size_t max_length;
+} KC__HashMapChainStatsParam;
+
+static void* KC__hash_map_chain_stats(void* ptr) {
+    KC__HashMapChainStatsParam* param = (KC__HashMapChainStatsParam*)ptr;
+    KC__HashMap* hm = param->hash_map;
+
+    for (size_t i = 0; i < KC__HASH_MAP_CHAIN_LENGTH_SLOTS; i++) {
+        param->lengths_count[i] = 0;
+    }
+    param->max_length = 0;
+
+    for (size_t i = param->start; i < param->end; i++) {
+        size_t length = 0;
+        if (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) {
+            // For open addressing, the length is the count of probes to find the K-mer of the slot.
+            KC__HashMapSlot* slot = KC__hash_map_get_slot(hm, i);
+            if (KC__hash_map_slot_state(hm, slot->state) == KC__HASH_MAP_SLOT_STATE_READY) {
+                size_t home_idx = KC__hash_map_hash_function(hm, hm->kmer_width, slot->kmer);
+                length = (i >= home_idx) ? (i - home_idx + 1) : (i + hm->table_capacity - home_idx + 1);
+            }
+        } else {
+            KC__node_id_t node_id = KC__hash_map_link_id(hm, hm->table[i]);
+            while (node_id != KC__NODE_ID_NULL) {
+                length++;
+                node_id = KC__hash_map_link_id(hm, KC__hash_map_get_node(hm, node_id)->next);
+            }
+        }
+
+        if (length > param->max_length) {
+            param->max_length = length;
+        }
+        if (length >= KC__HASH_MAP_CHAIN_LENGTH_SLOTS) {
+            length = KC__HASH_MAP_CHAIN_LENGTH_SLOTS - 1;
+        }
+        param->lengths_count[length]++;
+    }
+    return NULL;
+}
+
+void KC__hash_map_log_chain_lengths(KC__HashMap* hm) {
+    if (hm->engine == KC__HASH_MAP_ENGINE_DIRECT) {
+        LOGGING_INFO("Hash table of the direct engine has no collisions (capacity: %zu)", hm->table_capacity);
+        return;
+    }
+    if (hm->engine == KC__HASH_MAP_ENGINE_SORT) {
+        LOGGING_INFO("The sort engine has no hash table.");
+        return;
+    }
+
+    size_t threads_count = hm->blocks_count;
+    KC__HashMapChainStatsParam params[threads_count];
+    void* params_ptrs[threads_count];
+    memset(params, 0, sizeof(params));
+    memset(params_ptrs, 0, sizeof(params_ptrs));
+    size_t step = hm->table_capacity / threads_count;
+    for (size_t i = 0; i < threads_count; i++) {
+        params[i].hash_map = hm;
+        params[i].start = i * step;
+        params[i].end = (i == threads_count - 1) ? (hm->table_capacity) : ((i + 1) * step);
+        params_ptrs[i] = &(params[i]);
+    }
+
+    KC__ThreadPoolPhase phase = {0};
+    KC__thread_pool_start(hm->thread_pool, &phase, KC__hash_map_chain_stats, params_ptrs, threads_count);
+    KC__thread_pool_wait(hm->thread_pool, &phase);
+
+    size_t lengths_count[KC__HASH_MAP_CHAIN_LENGTH_SLOTS] = {0};
+    size_t max_length = 0;
+    for (size_t i = 0; i < threads_count; i++) {
+        for (size_t n = 0; n < KC__HASH_MAP_CHAIN_LENGTH_SLOTS; n++) {
+            lengths_count[n] += params[i].lengths_count[n];
+        }
+        if (params[i].max_length > max_length) {
+            max_length = params[i].max_length;
+        }
+    }
+
+    // Keys count and probes count are exact only when no chain is longer than the last slot.
+    size_t keys_count = 0;
+    size_t probes_count = 0;
+    for (size_t n = 1; n < KC__HASH_MAP_CHAIN_LENGTH_SLOTS; n++) {
+        if (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) {
+            keys_count += lengths_count[n];
+            probes_count += n * lengths_count[n];
+        } else {
+            keys_count += n * lengths_count[n];
+            probes_count += n * (n + 1) / 2 * lengths_count[n];
+        }
+    }
+    const size_t used_count = hm->table_capacity - lengths_count[0];
+    const char* name = (hm->engine == KC__HASH_MAP_ENGINE_OPEN_ADDRESSING) ? "Probe" : "Chain";
+
+    LOGGING_INFO("Hash table %s lengths (capacity: %zu, used: %zu, max length: %zu, mean probes per key: %.3f)",
+                 name, hm->table_capacity, used_count, max_length, (keys_count == 0) ? 0.0 : (double)probes_count / (double)keys_count);
+    for (size_t n = 0; n < KC__HASH_MAP_CHAIN_LENGTH_SLOTS; n++) {
+        if (lengths_count[n] == 0) {
+            continue;
+        }
+        if (n == KC__HASH_MAP_CHAIN_LENGTH_SLOTS - 1) {
+            LOGGING_INFO("    %s length >= %2zu: %zu", name, n, lengths_count[n]);
+        } else {
+            LOGGING_INFO("    %s length    %2zu: %zu", name, n, lengths_count[n]);
+        }
+    }
+}
+
+void KC__hash_map_log_contention(KC__HashMap* hm) {
+    size_t cas_retries_count = 0;
+    size_t hot_hits_count = 0;
+    for (size_t i = 0; i < hm->blocks_count; i++) {
+        cas_retries_count += hm->blocks[i]->cas_retries_count;
+        hot_hits_count += hm->blocks[i]->hot_hits_count;
+    }
+    LOGGING_INFO("Counter CAS retries: %zu, K-mers counted by hot cache: %zu", cas_retries_count, hot_hits_count);
+}
@@ -24,23 +24,113 @@
 #include <stdbool.h>
 #include "types.h"
 #include "mem_allocator.h"
+#include "param.h"
+#include "thread_pool.h"
+
+#define KC__HASH_MAP_CHAIN_LENGTH_SLOTS 16
+#define KC__HASH_MAP_BATCH_SIZE_MAX 64
 
 struct KC__HashMap;
 typedef struct KC__HashMap KC__HashMap;
 
 typedef void (*KC__HashMapExportCallback) (const KC__unit_t* kmer, KC__count_t count, void* data);
+typedef void (*KC__HashMapRejectCallback) (const KC__unit_t* kmer, void* data);
+
+/**
+ * Check if the direct engine, which holds a counter for each of the 4^K K-mers, fits in the memory limit.
+ * @param K K-mer length.
+ * @param threads_count The count of adding threads.
+ * @param mem_limit The memory available for the hash map.
+ * @return If the direct engine fits.
+ */
+bool KC__hash_map_direct_fits(size_t K, size_t threads_count, size_t mem_limit);
 
-KC__HashMap* KC__hash_map_create(KC__MemAllocator* mem_allocator, size_t K, size_t threads_count);
+/**
+ * Create a hash map.
+ * @param mem_allocator Memory allocator.
+ * @param K K-mer length.
+ * @param threads_count The count of adding threads.
+ * @param param The hash map param.
+ * @param thread_pool The table is cleared and its stats are collected by the works of the pool, it should have a thread
+ *                    for each adding thread free when the hash map is cleared or its chain lengths are logged.
+ * @return The hash map.
+ */
+KC__HashMap* KC__hash_map_create(KC__MemAllocator* mem_allocator, size_t K, size_t threads_count, KC__HashMapParam param, KC__ThreadPool* thread_pool);
 void KC__hash_map_free(KC__MemAllocator* mem_allocator, KC__HashMap* hash_map);
 
 size_t KC__hash_map_max_key_count(const KC__HashMap* hash_map);
+/**
+ * Get the bits of the bloom filter, and of the filter marking the K-mers its first pass cannot add to the table. Each
+ * K-mer sets 3 bits of a filter. Both are 0 without the bloom filter.
+ */
+void KC__hash_map_bloom_filter_bits(const KC__HashMap* hash_map, size_t* bloom_filter_bits, size_t* spilled_filter_bits);
 void KC__hash_map_set_table_capacity(KC__HashMap* hash_map, size_t capacity);
 void KC__hash_map_lock_keys(KC__HashMap* hash_map);
 
+
 void KC__hash_map_clear(KC__HashMap* hash_map);
 bool KC__hash_map_add_kmer(KC__HashMap* hash_map, size_t thread_id, const KC__unit_t* kmer);
+
+/**
+ * Add a batch of K-mers, the buckets of all K-mers are prefetched before any collision list is walked.
+ * @param hash_map The hash map.
+ * @param thread_id The id of the adding thread.
+ * @param kmers The K-mers stored one after another, count should not be larger than KC__HASH_MAP_BATCH_SIZE_MAX.
+ * @param count The count of K-mers.
+ * @param added Set to the result of KC__hash_map_add_kmer for each K-mer.
+ */
+void KC__hash_map_add_kmers_batch(KC__HashMap* hash_map, size_t thread_id, const KC__unit_t* kmers, size_t count, bool* added);
 void KC__hash_map_finish_adding_kmers(KC__HashMap* hash_map, size_t thread_id);
 
+/**
+ * In partitioned mode, the K-mers routed from other threads are added by the thread draining them, the ones failed to
+ * be added are passed to the callback of the draining thread. It may be called in the adding functions and in
+ * KC__hash_map_finish_adding_kmers.
+ * @param hash_map The hash map.
+ * @param thread_id The id of the adding thread.
+ * @param callback Called with each rejected (canonical) K-mer.
+ * @param data Passed to the callback.
+ */
+void KC__hash_map_set_reject_callback(KC__HashMap* hash_map, size_t thread_id, KC__HashMapRejectCallback callback, void* data);
+
+/**
+ * Stop consulting the bloom filter, should be called after the first pass. The keys found by the first pass are kept
+ * with their counts reset and locked, and the same input should be added again to count them exactly. In that recount
+ * pass, only the K-mers which could not be added to the table in the first pass are rejected, the other K-mers not in
+ * the table have been seen once and are dropped. The hash map should not be exported after the first pass.
+ * @param hash_map The hash map.
+ * @return If the recount pass is needed, false if the bloom filter has not been used.
+ */
+bool KC__hash_map_start_recounting(KC__HashMap* hash_map);
+
+/**
+ * @param hash_map The hash map.
+ * @return The count of K-mers seen once and dropped by the recount pass since the last clear.
+ */
+size_t KC__hash_map_dropped_kmers_count(const KC__HashMap* hash_map);
+
+/**
+ * Stop evicting the K-mers seen once, the keys are locked when the nodes are used out from then on. It should be called
+ * before the passes over the spilled K-mers, which are mostly the singletons evicted before, so evicting them again would
+ * spill them all to the next pass. Only called when no K-mers are being added.
+ * @param hash_map The hash map.
+ */
+void KC__hash_map_stop_evicting(KC__HashMap* hash_map);
+
 void KC__hash_map_export(KC__HashMap* hash_map, size_t thread_id, KC__HashMapExportCallback callback, void* data, size_t* exported_count);
 
+/**
+ * Log the histogram of collision list lengths (probe lengths for open addressing), should be called when no K-mers are
+ * being added.
+ * @param hash_map The hash map.
+ */
+void KC__hash_map_log_chain_lengths(KC__HashMap* hash_map);
+
+/**
+ * Log the failed CAS on counters and the sightings counted by the hot cache of the current pass, should be called after
+ * adding finished.
+ * @param hash_map The hash map.
+ */
+void KC__hash_map_log_contention(KC__HashMap* hash_map);
+
 #endif
@@ -18,16 +18,22 @@
  */
 
 
-#include <pthread.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "kmer_counter.h"
+#include "assert.h"
 #include "file_reader.h"
 #include "file_writer.h"
 #include "kmer_processor.h"
+#include "kmer_sketch.h"
 #include "logging.h"
 #include "param.h"
 #include "header.h"
+#include "thread_pool.h"
 
 
 struct KC__KmerCounter {
@@ -45,8 +51,118 @@ struct KC__KmerCounter {
     KC__BufferQueue* write_buffer_queue;
 
     KC__HashMap* hash_map;
+
+    /** Runs the readers, the K-mer processors and the writer of each pass, and the clearing of the hash map. */
+    KC__ThreadPool* thread_pool;
 };
 
+/**
+ * Plain input files are mapped and read through views, so the read buffers take no memory, unless some of them are not
+ * regular files, like pipes.
+ */
+static bool KC__kmer_counter_maps_input_files(const KC__Param* param) {
+    if (param->input_compression_type != KC__FILE_COMPRESSION_TYPE_PLAIN) {
+        return false;
+    }
+    for (size_t i = 0; i < param->input_files_count; i++) {
+        struct stat st;
+        if ((stat(param->input_file_names[i], &st) != 0) || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Compressed files are assumed to inflate to at most this many times their size when estimating the K-mers. */
+#define KC__KMER_COUNTER_COMPRESSION_RATIO_MAX 10
+
+/**
+ * The count of distinct K-mers the input files hold at most, each base starts a K-mer at most, and a FASTQ record takes
+ * as many bytes of qualities as of bases. 0 if some of the files are not regular files, like pipes.
+ */
+static size_t KC__kmer_counter_estimate_keys_count(const KC__Param* param) {
+    size_t bytes_count = 0;
+    for (size_t i = 0; i < param->input_files_count; i++) {
+        struct stat st;
+        if ((stat(param->input_file_names[i], &st) != 0) || !S_ISREG(st.st_mode)) {
+            return 0;
+        }
+        bytes_count += (size_t)(st.st_size);
+    }
+
+    if (param->input_compression_type != KC__FILE_COMPRESSION_TYPE_PLAIN) {
+        bytes_count = (bytes_count > SIZE_MAX / KC__KMER_COUNTER_COMPRESSION_RATIO_MAX) ? SIZE_MAX : bytes_count * KC__KMER_COUNTER_COMPRESSION_RATIO_MAX;
+    }
+    return (param->input_file_type == KC__FILE_TYPE_FASTQ) ? (bytes_count / 2 + 1) : (bytes_count + 1);
+}
+
+static bool KC__kmer_counter_prescan(KC__MemAllocator* ma, KC__KmerCounter* kc, size_t* distinct_count, size_t* solid_count);
+
+/** A round over tmp files takes the files whose keys are expected to fill this part of the hash map. */
+#define KC__KMER_COUNTER_TMP_KEYS_LOAD 0.875
+
+/** The spill partitions of the first pass when the K-mers of the input files are not known. */
+#define KC__KMER_COUNTER_SPILL_PARTITIONS_DEFAULT 16
+
+/**
+ * The spill partitions which split the K-mers the first pass cannot count into parts the hash map holds, so that the
+ * second pass counts each of them in a table of its own.
+ */
+static size_t KC__kmer_counter_spill_partitions_count(size_t keys_count, size_t max_key_count, size_t partitions_count_max) {
+    size_t partitions_count = KC__KMER_COUNTER_SPILL_PARTITIONS_DEFAULT;
+    if (keys_count > 0) {
+        const size_t spilled_keys_count = (keys_count > max_key_count) ? (keys_count - max_key_count) : 0;
+        const double partition_keys_count = (double)max_key_count * KC__KMER_COUNTER_TMP_KEYS_LOAD;
+        partitions_count = (size_t)ceil((double)spilled_keys_count / partition_keys_count);
+        if (partitions_count == 0) {
+            partitions_count = 1;
+        }
+    }
+    return (partitions_count < partitions_count_max) ? partitions_count : partitions_count_max;
+}
+
+/** The keys expected in the hash map exceed the estimate by this part, for its error. */
+#define KC__KMER_COUNTER_PRESCAN_MARGIN_PART 16
+
+/**
+ * The false positive rate of a filter setting 3 bits for each of the keys.
+ */
+static inline double KC__kmer_counter_filter_false_positive_rate(size_t keys_count, size_t bits_count) {
+    const double p = 1.0 - exp(-3.0 * (double)keys_count / (double)bits_count);
+    return p * p * p;
+}
+
+/**
+ * The passes counting the K-mers the hash map cannot hold. With a single tmp file, each pass counts a full table and
+ * spills the rest to the next one. With more, the K-mers left by the first pass are split into the spill partitions,
+ * which are all counted by the second pass, and the K-mers of the partitions the hash map cannot hold are left to the
+ * next ones. With the bloom filter, the table only takes the solid K-mers and the false positives of the filter, and the
+ * input files are read once more to count them. The K-mers seen once are spilled by the recount pass too if they are
+ * false positives of the spilled filter, which marks the keys the table cannot hold.
+ */
+static size_t KC__kmer_counter_predict_passes_count(size_t distinct_count, size_t solid_count, size_t max_key_count, size_t partitions_count, size_t bloom_filter_bits, size_t spilled_filter_bits) {
+    const size_t singletons_count = (distinct_count > solid_count) ? (distinct_count - solid_count) : 0;
+    const size_t recounting_passes_count = (bloom_filter_bits > 0) ? 1 : 0;
+    size_t keys_count = distinct_count;
+    if (bloom_filter_bits > 0) {
+        // The filter is filled as the input is read, a K-mer seen once meets half of the others on average.
+        keys_count = solid_count + (size_t)((double)singletons_count * KC__kmer_counter_filter_false_positive_rate(distinct_count / 2, bloom_filter_bits));
+    }
+    if ((max_key_count == 0) || (keys_count <= max_key_count)) {
+        return recounting_passes_count + 1;
+    }
+    size_t spilled_keys_count = keys_count - max_key_count;
+    if (bloom_filter_bits > 0) {
+        spilled_keys_count += (size_t)((double)singletons_count * KC__kmer_counter_filter_false_positive_rate(spilled_keys_count, spilled_filter_bits));
+    }
+    if (partitions_count == 1) {
+        return recounting_passes_count + 1 + (spilled_keys_count + max_key_count - 1) / max_key_count;
+    }
+    const size_t partition_keys_count = (spilled_keys_count + partitions_count - 1) / partitions_count;
+    const size_t rest_keys_count = (partition_keys_count > max_key_count) ? (partition_keys_count - max_key_count) * partitions_count : 0;
+    return recounting_passes_count + 2 + (rest_keys_count + max_key_count - 1) / max_key_count;
+}
+
 KC__KmerCounter* KC__kmer_counter_create(KC__MemAllocator* ma, KC__Param* param) {
     KC__KmerCounter* kc = (KC__KmerCounter*)KC__mem_alloc(ma, sizeof(KC__KmerCounter), "kmer counter");
     kc->param = param;
@@ -54,7 +170,10 @@ KC__KmerCounter* KC__kmer_counter_create(KC__MemAllocator* ma, KC__Param* param)
     kc->file_readers_count = param->reading_threads_count;
     kc->file_readers = (KC__FileReader**)KC__mem_alloc(ma, sizeof(KC__FileReader*) * kc->file_readers_count, "kmer counter file readers");
     for (size_t i= 0; i < kc->file_readers_count; i++) {
-        kc->file_readers[i] = KC__file_reader_create(ma, param->K, param->input_compression_type, param->read_buffer_size);
+        kc->file_readers[i] = KC__file_reader_create(ma, param->K, param->input_compression_type, param->read_buffer_size, param->inflating_threads_count);
+        if ((param->input_compression_type == KC__FILE_COMPRESSION_TYPE_GZIP) && (param->read_depth > 0)) {
+            KC__file_reader_init_async_reading(ma, kc->file_readers[i], param->read_engine, param->read_depth, param->direct_io);
+        }
     }
 
     KC__Header header;
@@ -64,21 +183,104 @@ KC__KmerCounter* KC__kmer_counter_create(KC__MemAllocator* ma, KC__Param* param)
     header.filter_max = param->output_param.filter_max;
 
     kc->file_writer = KC__file_writer_create(ma, param->output_file_name, &header);
+    // The memory of the partition buffers is taken before the hash map, but the partitions count may depend on the keys
+    // it holds.
+    if (param->spill_partitions_count != 1) {
+        KC__file_writer_init_partitions(ma, kc->file_writer, param->K, param->write_buffer_size);
+    }
 
     kc->kmer_processors_count = param->kmer_processing_threads_count;
     kc->kmer_processors = (KC__KmerProcessor**)KC__mem_alloc(ma, sizeof(KC__KmerProcessor*) * kc->kmer_processors_count, "kmer counter kmer processors");
     for (size_t i = 0; i < kc->kmer_processors_count; i++) {
         kc->kmer_processors[i] = KC__kmer_processor_create(ma, i, param->K, param->output_param);
+        if (param->spill_combiner) {
+            KC__kmer_processor_init_combiner(ma, kc->kmer_processors[i]);
+        }
     }
 
-    kc->read_buffer_queue = KC__buffer_queue_create(ma, param->read_buffer_size, param->read_buffers_count);
+    if (KC__kmer_counter_maps_input_files(param)) {
+        LOGGING_DEBUG("Map input files.");
+        kc->read_buffer_queue = KC__buffer_queue_create_views(ma, param->read_buffers_count);
+    } else {
+        kc->read_buffer_queue = KC__buffer_queue_create(ma, param->read_buffer_size, param->read_buffers_count);
+    }
     kc->write_buffer_queue = KC__buffer_queue_create(ma, param->write_buffer_size, param->write_buffers_count);
 
-    kc->hash_map = KC__hash_map_create(ma, param->K, kc->kmer_processors_count);
-
+    // The hash map takes the memory left, so the pool is created before it. Besides the readers, processors and writer,
+    // it runs the helpers inflating BGZF blocks for each reader.
+    size_t threads_count = kc->file_readers_count + kc->kmer_processors_count + 1;
+    if ((param->input_compression_type == KC__FILE_COMPRESSION_TYPE_GZIP) && (param->inflating_threads_count > 1)) {
+        threads_count += kc->file_readers_count * (param->inflating_threads_count - 1);
+    }
+    kc->thread_pool = KC__thread_pool_create(ma, threads_count);
+
+    const bool direct_fits = KC__hash_map_direct_fits(param->K, kc->kmer_processors_count, KC__mem_available(ma));
+    if (param->hash_map_engine_auto && direct_fits) {
+        LOGGING_INFO("Use direct engine for K = %zu.", param->K);
+        param->hash_map_param.engine = KC__HASH_MAP_ENGINE_DIRECT;
+    } else if ((param->hash_map_param.engine == KC__HASH_MAP_ENGINE_DIRECT) && !direct_fits) {
+        LOGGING_ERROR("Direct engine does not fit in the memory for K = %zu, 4^K counters are needed.", param->K);
+        exit(EXIT_FAILURE);
+    }
     for (size_t i= 0; i < kc->file_readers_count; i++) {
+        KC__file_reader_set_thread_pool(kc->file_readers[i], kc->thread_pool);
         KC__file_reader_link_modules(kc->file_readers[i], kc->read_buffer_queue);
     }
+
+    param->hash_map_param.keys_count_hint = KC__kmer_counter_estimate_keys_count(param);
+    if ((param->hash_map_param.bloom_filter_mem > 0) && (param->hash_map_param.keys_count_hint == 0)) {
+        // The K-mers found with the bloom filter are counted by reading the input again, pipes cannot be read twice.
+        LOGGING_WARNING("Bloom filter is disabled, some of the input files are not regular files.");
+        param->hash_map_param.bloom_filter_mem = 0;
+    }
+    bool prescanned = false;
+    size_t prescan_distinct_count = 0;
+    size_t prescan_solid_count = 0;
+    if (param->prescan) {
+        const KC__HashMapEngine engine = param->hash_map_param.engine;
+        if ((engine != KC__HASH_MAP_ENGINE_CHAINING) && (engine != KC__HASH_MAP_ENGINE_OPEN_ADDRESSING)) {
+            LOGGING_WARNING("Pre-scan is only used by the chaining and open addressing engines.");
+        } else if (param->hash_map_param.keys_count_hint == 0) {
+            // Pipes cannot be read twice.
+            LOGGING_WARNING("Pre-scan is skipped, some of the input files are not regular files.");
+        } else {
+            prescanned = KC__kmer_counter_prescan(ma, kc, &prescan_distinct_count, &prescan_solid_count);
+            // The bloom filter only lets the solid K-mers into the table.
+            const size_t keys_count = (param->hash_map_param.bloom_filter_mem > 0) ? prescan_solid_count : prescan_distinct_count;
+            const size_t margin = prescan_distinct_count / KC__KMER_COUNTER_PRESCAN_MARGIN_PART + 1;
+            const size_t keys_count_hint = param->hash_map_param.keys_count_hint;
+            if (prescanned && (keys_count < keys_count_hint) && (keys_count_hint - keys_count > margin)) {
+                param->hash_map_param.keys_count_hint = keys_count + margin;
+            }
+        }
+    }
+
+    kc->hash_map = KC__hash_map_create(ma, param->K, kc->kmer_processors_count, param->hash_map_param, kc->thread_pool);
+
+    if (param->spill_partitions_count != 1) {
+        const size_t partitions_count_max = KC__file_writer_partitions_count_max(kc->file_writer);
+        if (param->spill_partitions_count == 0) {
+            param->spill_partitions_count = KC__kmer_counter_spill_partitions_count(param->hash_map_param.keys_count_hint, KC__hash_map_max_key_count(kc->hash_map), partitions_count_max);
+            LOGGING_INFO("Spill files count: %zu", param->spill_partitions_count);
+        } else if (param->spill_partitions_count > partitions_count_max) {
+            LOGGING_WARNING("Spill files count is too large for the write buffers: %zu.", param->spill_partitions_count);
+            param->spill_partitions_count = partitions_count_max;
+            LOGGING_WARNING("Reduce spill files count to %zu.", param->spill_partitions_count);
+        }
+        if (param->spill_partitions_count > 1) {
+            KC__file_writer_set_partitions_count(kc->file_writer, param->spill_partitions_count);
+        }
+    }
+
+    if (prescanned) {
+        const size_t max_key_count = KC__hash_map_max_key_count(kc->hash_map);
+        size_t bloom_filter_bits;
+        size_t spilled_filter_bits;
+        KC__hash_map_bloom_filter_bits(kc->hash_map, &bloom_filter_bits, &spilled_filter_bits);
+        const size_t passes_count = KC__kmer_counter_predict_passes_count(prescan_distinct_count, prescan_solid_count, max_key_count, param->spill_partitions_count, bloom_filter_bits, spilled_filter_bits);
+        LOGGING_INFO("Pre-scan predicts %zu passes (hash map keys: %zu).", passes_count, max_key_count);
+    }
+
     KC__file_writer_link_modules(kc->file_writer, kc->write_buffer_queue);
     for (size_t i = 0; i < kc->kmer_processors_count; i++) {
         KC__kmer_processor_link_modules(kc->kmer_processors[i], kc->hash_map, kc->read_buffer_queue, kc->write_buffer_queue);
@@ -88,6 +290,8 @@ KC__KmerCounter* KC__kmer_counter_create(KC__MemAllocator* ma, KC__Param* param)
 }
 
 void KC__kmer_counter_free(KC__MemAllocator* ma, KC__KmerCounter* kc) {
+    KC__thread_pool_free(ma, kc->thread_pool);
+
     for (size_t i= 0; i < kc->file_readers_count; i++) {
         KC__file_reader_free(ma, kc->file_readers[i]);
     }
@@ -107,26 +311,365 @@ void KC__kmer_counter_free(KC__MemAllocator* ma, KC__KmerCounter* kc) {
     KC__mem_free(ma, kc);
 }
 
-static inline void KC__kmer_counter_schedule_files(KC__FileInputDescription inputs[], size_t n, KC__Param* param) {
-    size_t files_count_for_each = param->input_files_count / n;
-    size_t remain_files_count = param->input_files_count % n;
-    for (size_t i = 0; i < n; i++) {
-        inputs[i].files_count = files_count_for_each;
+/** Plain files are not split into ranges smaller than this, so small files are not read by many readers. */
+#define KC__KMER_COUNTER_RANGE_SIZE_MIN ((size_t)1 << 20)
+/** Plain files are split into about this many ranges for each reader, so the readers finish at about the same time. */
+#define KC__KMER_COUNTER_RANGES_PER_READER 4
+
+typedef struct {
+    char* file_name;
+    size_t start;
+    size_t end;
+    size_t size;
+} KC__KmerCounterPart;
+
+static int KC__kmer_counter_compare_parts(const void* a, const void* b) {
+    const KC__KmerCounterPart* pa = a;
+    const KC__KmerCounterPart* pb = b;
+    return (pa->size < pb->size) ? 1 : ((pa->size > pb->size) ? -1 : 0);
+}
+
+/**
+ * The files (or byte ranges of plain files) are put in a queue shared by the readers, largest first, each reader takes
+ * the next part when it finishes one. Plain files are cut into ranges of about the same size, and a range covering a
+ * whole file is read as the file. The parts arrays hold the files count plus n * KC__KMER_COUNTER_RANGES_PER_READER
+ * parts at most.
+ */
+static inline void KC__kmer_counter_schedule_files(KC__FileInputDescription inputs[], size_t n, KC__Param* param, char* part_file_names[], size_t part_starts[], size_t part_ends[], size_t* next_part) {
+    const bool plain = (param->input_compression_type == KC__FILE_COMPRESSION_TYPE_PLAIN);
+
+    size_t file_sizes[param->input_files_count];
+    size_t total_size = 0;
+    for (size_t i = 0; i < param->input_files_count; i++) {
+        struct stat st;
+        // The reader reports the files it cannot open, so they are read as whole files.
+        file_sizes[i] = (stat(param->input_file_names[i], &st) == 0) ? (size_t)(st.st_size) : 0;
+        total_size += file_sizes[i];
     }
-    for (size_t i = 0; i < remain_files_count; i++) {
-        inputs[i].files_count += 1;
+
+    const size_t ranges_count = n * KC__KMER_COUNTER_RANGES_PER_READER;
+    size_t range_size = (total_size + ranges_count - 1) / ranges_count;
+    if (range_size < KC__KMER_COUNTER_RANGE_SIZE_MIN) {
+        range_size = KC__KMER_COUNTER_RANGE_SIZE_MIN;
     }
 
-    size_t offset = 0;
-    for (size_t i = 0; i < n; i++) {
-        inputs[i].file_names = &(param->input_file_names[offset]);
-        offset += inputs[i].files_count;
+    KC__KmerCounterPart parts[param->input_files_count + ranges_count];
+    size_t parts_count = 0;
+    for (size_t i = 0; i < param->input_files_count; i++) {
+        const size_t file_size = file_sizes[i];
+        // Ranges of the same size, the last one takes the rest.
+        const size_t file_ranges_count = plain ? ((file_size + range_size / 2) / range_size) : 1;
+        const size_t file_range_size = (file_ranges_count > 1) ? (file_size / file_ranges_count) : file_size;
+        for (size_t r = 0; (r == 0) || (r < file_ranges_count); r++) {
+            KC__KmerCounterPart* part = &(parts[parts_count++]);
+            part->file_name = param->input_file_names[i];
+            part->start = r * file_range_size;
+            part->end = (r + 1 >= file_ranges_count) ? file_size : (r + 1) * file_range_size;
+            part->size = part->end - part->start;
+            if ((part->start == 0) && (part->end == file_size)) {
+                part->end = SIZE_MAX;
+            }
+        }
+    }
+    KC__ASSERT(parts_count <= param->input_files_count + ranges_count);
 
+    qsort(parts, parts_count, sizeof(KC__KmerCounterPart), KC__kmer_counter_compare_parts);
+    for (size_t i = 0; i < parts_count; i++) {
+        part_file_names[i] = parts[i].file_name;
+        part_starts[i] = parts[i].start;
+        part_ends[i] = parts[i].end;
+    }
+    LOGGING_DEBUG("Files are read in %zu parts, the largest one of %zu bytes.", parts_count, parts[0].size);
+
+    *next_part = 0;
+    for (size_t i = 0; i < n; i++) {
+        inputs[i].file_names = part_file_names;
+        inputs[i].files_count = parts_count;
         inputs[i].file_type = param->input_file_type;
         inputs[i].compression_type = param->input_compression_type;
+        inputs[i].range_starts = plain ? part_starts : NULL;
+        inputs[i].range_ends = plain ? part_ends : NULL;
+        inputs[i].next_file = next_part;
+    }
+}
+
+/**
+ * K-mers kept by the sketch of each K-mer processor in the pre-scan at most, the estimates are within about 1% of the
+ * counts. A kept K-mer takes 32 bytes at most, and the sketches take half of the memory at most.
+ */
+#define KC__KMER_COUNTER_SKETCH_CAPACITY ((size_t)1 << 15)
+
+/** The pre-scan samples this part of the input files at most, and this many bytes at most. */
+#define KC__KMER_COUNTER_PRESCAN_PART 4
+#define KC__KMER_COUNTER_PRESCAN_SIZE_MAX ((size_t)1 << 28)
+/** Plain files are sampled by pieces of about this size spread over each file. */
+#define KC__KMER_COUNTER_PRESCAN_PIECE_SIZE ((size_t)1 << 20)
+#define KC__KMER_COUNTER_PRESCAN_PIECES_MAX (KC__KMER_COUNTER_PRESCAN_SIZE_MAX / KC__KMER_COUNTER_PRESCAN_PIECE_SIZE)
+
+/**
+ * Pick the samples read by the pre-scan, dealt to 2 rounds by turns. Plain files are sampled by pieces spread evenly over
+ * each file, about its share of the sample size. Compressed files cannot be read from the middle, so whole files are
+ * sampled with a stride, as long as they fit in the sample size. Each round holds the files count plus
+ * KC__KMER_COUNTER_PRESCAN_PIECES_MAX samples at most.
+ * @return The size of the input files.
+ */
+static size_t KC__kmer_counter_sample_files(const KC__Param* param, KC__KmerCounterPart* samples[2], size_t samples_counts[2], size_t samples_sizes[2]) {
+    size_t file_sizes[param->input_files_count];
+    size_t total_size = 0;
+    for (size_t i = 0; i < param->input_files_count; i++) {
+        struct stat st;
+        file_sizes[i] = (stat(param->input_file_names[i], &st) == 0) ? (size_t)(st.st_size) : 0;
+        total_size += file_sizes[i];
+    }
+
+    size_t sample_size = total_size / KC__KMER_COUNTER_PRESCAN_PART;
+    if (sample_size > KC__KMER_COUNTER_PRESCAN_SIZE_MAX) {
+        sample_size = KC__KMER_COUNTER_PRESCAN_SIZE_MAX;
+    }
+
+    size_t turn = 0;
+    samples_counts[0] = samples_counts[1] = 0;
+    samples_sizes[0] = samples_sizes[1] = 0;
+    if (sample_size == 0) {
+        return total_size;
+    }
+
+    if (param->input_compression_type == KC__FILE_COMPRESSION_TYPE_PLAIN) {
+        for (size_t i = 0; i < param->input_files_count; i++) {
+            const size_t file_sample_size = (size_t)((double)(file_sizes[i]) * (double)sample_size / (double)total_size);
+            const size_t pieces_count = (file_sample_size + KC__KMER_COUNTER_PRESCAN_PIECE_SIZE - 1) / KC__KMER_COUNTER_PRESCAN_PIECE_SIZE;
+            if (pieces_count == 0) {
+                continue;
+            }
+            // Each piece is in the middle of its stride.
+            const size_t piece_size = file_sample_size / pieces_count;
+            const size_t stride = file_sizes[i] / pieces_count;
+            for (size_t p = 0; p < pieces_count; p++) {
+                const size_t r = (turn++) % 2;
+                KC__KmerCounterPart* sample = &(samples[r][samples_counts[r]++]);
+                sample->file_name = param->input_file_names[i];
+                sample->start = p * stride + (stride - piece_size) / 2;
+                sample->end = sample->start + piece_size;
+                sample->size = piece_size;
+                samples_sizes[r] += piece_size;
+            }
+        }
+    } else {
+        for (size_t i = KC__KMER_COUNTER_PRESCAN_PART / 2; i < param->input_files_count; i += KC__KMER_COUNTER_PRESCAN_PART) {
+            if (samples_sizes[0] + samples_sizes[1] + file_sizes[i] > sample_size) {
+                continue;
+            }
+            const size_t r = (turn++) % 2;
+            KC__KmerCounterPart* sample = &(samples[r][samples_counts[r]++]);
+            sample->file_name = param->input_file_names[i];
+            sample->start = 0;
+            sample->end = SIZE_MAX;
+            sample->size = file_sizes[i];
+            samples_sizes[r] += file_sizes[i];
+        }
+    }
+    KC__ASSERT(samples_counts[0] <= param->input_files_count + KC__KMER_COUNTER_PRESCAN_PIECES_MAX);
+
+    return total_size;
+}
+
+/** The mean count in the sample of the genomic K-mers is searched in this range. */
+#define KC__KMER_COUNTER_POISSON_MEAN_MIN 0.01
+#define KC__KMER_COUNTER_POISSON_MEAN_MAX 1000.0
+
+/** The probability of a count of at least 2 drawn from a Poisson distribution of the mean. */
+static inline double KC__kmer_counter_poisson_solid(double mean) {
+    return 1.0 - exp(-mean) * (1.0 + mean);
+}
+
+/**
+ * Extend the counts of the K-mers in a sample of the input to the whole input. The genomic K-mers are taken to be seen
+ * a Poisson distributed number of times, and the K-mers made by sequencing errors to be seen once. The K-mers seen
+ * twice or more in the sample are genomic, the share of them seen exactly twice gives the mean count of the genomic
+ * K-mers in the sample, and so how many of them have not been seen twice yet. The K-mers seen once and not genomic are
+ * errors, whose count grows with the input.
+ * @param sketch The sketch of the sample.
+ * @param part The part of the input sampled.
+ * @param distinct_count Set to the distinct K-mers of the input.
+ * @param solid_count Set to the K-mers seen at least twice in the input.
+ */
+static void KC__kmer_counter_extend_sample(const KC__KmerSketch* sketch, double part, size_t* distinct_count, size_t* solid_count) {
+    const double seen_count = (double)KC__kmer_sketch_estimate(sketch, 1);
+    const double seen_twice_count = (double)KC__kmer_sketch_estimate(sketch, 2);
+    const double seen_thrice_count = (double)KC__kmer_sketch_estimate(sketch, 3);
+
+    double genomic_count = 0;
+    double mean = 0;
+    if (seen_twice_count > 0) {
+        // The share of the K-mers seen exactly twice falls as the mean rises, from 1 for a mean near 0.
+        const double twice_share = (seen_twice_count - seen_thrice_count) / seen_twice_count;
+        double low = KC__KMER_COUNTER_POISSON_MEAN_MIN;
+        double high = KC__KMER_COUNTER_POISSON_MEAN_MAX;
+        for (size_t i = 0; i < 64; i++) {
+            mean = (low + high) / 2;
+            const double share = mean * mean / 2 * exp(-mean) / KC__kmer_counter_poisson_solid(mean);
+            if (share > twice_share) {
+                low = mean;
+            } else {
+                high = mean;
+            }
+        }
+        genomic_count = seen_twice_count / KC__kmer_counter_poisson_solid(mean);
+    }
+
+    const double genomic_seen_once_count = genomic_count * mean * exp(-mean);
+    const double error_count = (seen_count - seen_twice_count > genomic_seen_once_count) ? (seen_count - seen_twice_count - genomic_seen_once_count) : 0;
+
+    // The mean count of the genomic K-mers in the input.
+    const double input_mean = mean / part;
+    const double input_distinct_count = genomic_count * (1.0 - exp(-input_mean)) + error_count / part;
+    const double input_solid_count = genomic_count * KC__kmer_counter_poisson_solid(input_mean);
+    *distinct_count = (input_distinct_count >= (double)SIZE_MAX) ? SIZE_MAX : (size_t)input_distinct_count;
+    *solid_count = (input_solid_count >= (double)SIZE_MAX) ? SIZE_MAX : (size_t)input_solid_count;
+}
+
+/**
+ * Add the K-mers of the samples to the sketches of the K-mer processors.
+ */
+static void KC__kmer_counter_read_samples(KC__KmerCounter* kc, const KC__KmerCounterPart samples[], size_t samples_count) {
+    KC__Param* param = kc->param;
+    const size_t inputs_count = kc->file_readers_count;
+
+    char* sample_file_names[samples_count];
+    size_t sample_starts[samples_count];
+    size_t sample_ends[samples_count];
+    size_t next_sample = 0;
+    for (size_t i = 0; i < samples_count; i++) {
+        sample_file_names[i] = samples[i].file_name;
+        sample_starts[i] = samples[i].start;
+        sample_ends[i] = samples[i].end;
+    }
+
+    const bool plain = (param->input_compression_type == KC__FILE_COMPRESSION_TYPE_PLAIN);
+    void* read_args[inputs_count];
+    void* process_args[kc->kmer_processors_count];
+    for (size_t i = 0; i < inputs_count; i++) {
+        KC__FileInputDescription input;
+        input.file_names = sample_file_names;
+        input.files_count = samples_count;
+        input.file_type = param->input_file_type;
+        input.compression_type = param->input_compression_type;
+        input.range_starts = plain ? sample_starts : NULL;
+        input.range_ends = plain ? sample_ends : NULL;
+        input.next_file = &next_sample;
+        read_args[i] = kc->file_readers[i];
+        KC__file_reader_update_input(kc->file_readers[i], input);
+    }
+    for (size_t i = 0; i < kc->kmer_processors_count; i++) {
+        process_args[i] = kc->kmer_processors[i];
+    }
+
+    KC__ThreadPoolPhase read_phase;
+    KC__ThreadPoolPhase process_phase;
+    KC__buffer_queue_start_input(kc->read_buffer_queue);
+    KC__thread_pool_start(kc->thread_pool, &read_phase, KC__file_reader_work, read_args, inputs_count);
+    KC__thread_pool_start(kc->thread_pool, &process_phase, KC__kmer_processor_work_extract, process_args, kc->kmer_processors_count);
+    KC__thread_pool_wait(kc->thread_pool, &read_phase);
+    KC__buffer_queue_finish_input(kc->read_buffer_queue);
+    KC__thread_pool_wait(kc->thread_pool, &process_phase);
+}
+
+/** The solid K-mers of the whole sample may exceed the ones expected from its first round by this ratio at most. */
+#define KC__KMER_COUNTER_PRESCAN_SOLID_RATIO_MAX 1.25
+
+/**
+ * Read samples of the input files before the hash map is created, each K-mer processor adds the K-mers to a sketch of its
+ * own. The merged sketch is extended to the distinct K-mers of the whole input, and the solid ones (seen at least twice)
+ * which are all the bloom filter lets into the table. The samples are read in 2 rounds, and the first one is extended
+ * to the whole sample as a check, the pieces of input files sorted by position hold the K-mers of a part of the genome
+ * only, so the solid K-mers of the whole sample are far more than expected.
+ * Return false if the input files cannot be sampled or the samples look sorted. The sketches are taken from an
+ * allocator of their own, limited by the memory left, and are freed before the hash map takes that memory.
+ */
+static bool KC__kmer_counter_prescan(KC__MemAllocator* ma, KC__KmerCounter* kc, size_t* distinct_count, size_t* solid_count) {
+    KC__Param* param = kc->param;
+
+    const size_t samples_max = param->input_files_count + KC__KMER_COUNTER_PRESCAN_PIECES_MAX;
+    KC__KmerCounterPart round_samples[2][samples_max];
+    KC__KmerCounterPart* samples[2] = {round_samples[0], round_samples[1]};
+    size_t samples_counts[2];
+    size_t samples_sizes[2];
+    const size_t total_size = KC__kmer_counter_sample_files(param, samples, samples_counts, samples_sizes);
+    if (samples_counts[0] == 0) {
+        LOGGING_WARNING("Pre-scan is skipped, no input file can be sampled (compressed files are only sampled whole).");
+        return false;
+    }
+    const size_t samples_size = samples_sizes[0] + samples_sizes[1];
+
+    LOGGING_INFO("Pre-scan start, sample %zu of %zu bytes.", samples_size, total_size);
+
+    KC__MemAllocator* sketch_ma = KC__mem_allocator_create(KC__mem_available(ma) / 2);
+    size_t sketch_capacity = KC__mem_available(sketch_ma) / (kc->kmer_processors_count + 1) / 32;
+    if (sketch_capacity > KC__KMER_COUNTER_SKETCH_CAPACITY) {
+        sketch_capacity = KC__KMER_COUNTER_SKETCH_CAPACITY;
+    }
+    KC__ASSERT(sketch_capacity > 0);
+
+    KC__KmerSketch* sketches[kc->kmer_processors_count];
+    for (size_t i = 0; i < kc->kmer_processors_count; i++) {
+        sketches[i] = KC__kmer_sketch_create(sketch_ma, sketch_capacity);
+        // The hash map is not created yet.
+        KC__kmer_processor_link_modules(kc->kmer_processors[i], NULL, kc->read_buffer_queue, kc->write_buffer_queue);
+        KC__kmer_processor_set_sketch(kc->kmer_processors[i], sketches[i]);
+    }
+
+    size_t expected_solid_count = 0;
+    KC__kmer_counter_read_samples(kc, samples[0], samples_counts[0]);
+    if (samples_counts[1] > 0) {
+        KC__KmerSketch* first_sketch = KC__kmer_sketch_create(sketch_ma, sketch_capacity);
+        for (size_t i = 0; i < kc->kmer_processors_count; i++) {
+            KC__kmer_sketch_merge(first_sketch, sketches[i]);
+        }
+        size_t expected_distinct_count;
+        KC__kmer_counter_extend_sample(first_sketch, (double)(samples_sizes[0]) / (double)samples_size, &expected_distinct_count, &expected_solid_count);
+        KC__kmer_sketch_free(sketch_ma, first_sketch);
+
+        KC__kmer_counter_read_samples(kc, samples[1], samples_counts[1]);
+    }
+
+    for (size_t i = 1; i < kc->kmer_processors_count; i++) {
+        KC__kmer_sketch_merge(sketches[0], sketches[i]);
+    }
+    const size_t sample_distinct_count = KC__kmer_sketch_estimate(sketches[0], 1);
+    const size_t sample_solid_count = KC__kmer_sketch_estimate(sketches[0], 2);
+    KC__kmer_counter_extend_sample(sketches[0], (double)samples_size / (double)total_size, distinct_count, solid_count);
+
+    for (size_t i = 0; i < kc->kmer_processors_count; i++) {
+        KC__kmer_processor_set_sketch(kc->kmer_processors[i], NULL);
+        KC__kmer_sketch_free(sketch_ma, sketches[i]);
+    }
+    KC__mem_allocator_free(sketch_ma);
+
+    LOGGING_INFO("Pre-scan sample holds %zu distinct K-mers, %zu solid (%zu expected from the first round).", sample_distinct_count, sample_solid_count, expected_solid_count);
+    if ((samples_counts[1] > 0) && ((double)sample_solid_count > (double)expected_solid_count * KC__KMER_COUNTER_PRESCAN_SOLID_RATIO_MAX)) {
+        LOGGING_WARNING("Pre-scan is skipped, the samples do not look like random reads, the input files may be sorted.");
+        return false;
+    }
+    LOGGING_INFO("Pre-scan estimates %zu distinct K-mers, %zu solid.", *distinct_count, *solid_count);
+    return true;
+}
+
+static inline void KC__kmer_counter_tmp_file_name(char* tmp_file_name, const char* output_file_name, size_t id) {
+    sprintf(tmp_file_name, "%s_tmp_%zu", output_file_name, id);
+}
+
+static inline void KC__kmer_counter_delete_tmp_file(const char* tmp_file_name) {
+    if (remove(tmp_file_name) != 0) {
+        LOGGING_WARNING("Delete file failed: %s", tmp_file_name);
     }
 }
 
+/**
+ * The first pass splits the super K-mers it cannot count into partitions by minimizer, each partition is written to a
+ * tmp file of its own. The next pass counts the tmp files in rounds, each round clears the hash map and counts as many
+ * of them as it is expected to hold. A round which still cannot count all K-mers writes one tmp file, which is counted
+ * by the pass after.
+ */
 void KC__kmer_counter_work(KC__KmerCounter* kc) {
     KC__Param* param = kc->param;
     size_t inputs_count = kc->file_readers_count;
@@ -134,32 +677,67 @@ void KC__kmer_counter_work(KC__KmerCounter* kc) {
     size_t n = 0;
 
     KC__FileInputDescription inputs[inputs_count];
-    KC__kmer_counter_schedule_files(inputs, inputs_count, param);
-
-    size_t tmp_file_name_str_len = strlen(param->output_file_name) + strlen("_tmp_N") + 1;
-    char tmp_file_1_name[tmp_file_name_str_len];
-    strcpy(tmp_file_1_name, param->output_file_name);
-    strcat(tmp_file_1_name, "_tmp_0");
-    char tmp_file_2_name[tmp_file_name_str_len];
-    strcpy(tmp_file_2_name, param->output_file_name);
-    strcat(tmp_file_2_name, "_tmp_1");
-    char* tmp_file_names[2] = {tmp_file_1_name, tmp_file_2_name};
-    bool should_delete_tmp_files[2] = {true, false};
-    int tmp_file_idx = 0;
+    const size_t parts_count_max = param->input_files_count + inputs_count * KC__KMER_COUNTER_RANGES_PER_READER;
+    char* part_file_names[parts_count_max];
+    size_t part_starts[parts_count_max];
+    size_t part_ends[parts_count_max];
+    size_t next_part;
+    KC__kmer_counter_schedule_files(inputs, inputs_count, param, part_file_names, part_starts, part_ends, &next_part);
+
+    const size_t partitions_count = param->spill_partitions_count;
+
+    size_t tmp_file_name_str_len = strlen(param->output_file_name) + strlen("_tmp_") + 21;
+    char write_tmp_file_names[partitions_count][tmp_file_name_str_len];
+    const char* write_tmp_file_names_ptrs[partitions_count];
+    for (size_t i = 0; i < partitions_count; i++) {
+        write_tmp_file_names_ptrs[i] = write_tmp_file_names[i];
+    }
+    size_t write_tmp_files_count = partitions_count;
+
+    char read_tmp_file_names[partitions_count][tmp_file_name_str_len];
+    char* read_tmp_file_names_ptrs[partitions_count];
+    for (size_t i = 0; i < partitions_count; i++) {
+        read_tmp_file_names_ptrs[i] = read_tmp_file_names[i];
+    }
+    size_t read_tmp_files_count = 0;
+    size_t read_tmp_bytes_count = 0;
+
+    // Ids, sizes and passes of tmp files to be counted, in the order they are written.
+    size_t pending_tmp_file_ids[partitions_count];
+    size_t pending_tmp_file_sizes[partitions_count];
+    size_t pending_tmp_file_passes[partitions_count];
+    size_t pending_tmp_files_start = 0;
+    size_t pending_tmp_files_count = 0;
+    size_t next_tmp_file_id = 0;
+
+    // Distinct K-mers per byte of tmp files, 0 until a pass has counted some of them.
+    double tmp_keys_per_byte = 0;
 
     size_t total_kmers_count = 0;
     size_t unique_kmers_count = 0;
     size_t exported_unique_kmers_count = 0;
 
 
+    // The pass of the next round, a pass over tmp files may take several rounds.
+    size_t round_pass = 1;
     while (true) {
-        n++;
-
-        LOGGING_INFO("Pass #%zu start.", n);
+        if (round_pass > n) {
+            n = round_pass;
+            LOGGING_INFO("Pass #%zu start.", n);
+        }
 
-        pthread_t read_threads[inputs_count];
-        pthread_t write_thread;
-        pthread_t process_threads[kc->kmer_processors_count];
+        KC__ThreadPoolPhase read_phase;
+        KC__ThreadPoolPhase write_phase;
+        KC__ThreadPoolPhase process_phase;
+        void* write_args[1] = {kc->file_writer};
+        void* read_args[inputs_count];
+        void* process_args[kc->kmer_processors_count];
+        for (size_t i = 0; i < inputs_count; i++) {
+            read_args[i] = kc->file_readers[i];
+        }
+        for (size_t i = 0; i < kc->kmer_processors_count; i++) {
+            process_args[i] = kc->kmer_processors[i];
+        }
 
         // Inform buffer queues to start input.
         KC__buffer_queue_start_input(kc->read_buffer_queue);
@@ -168,81 +746,151 @@ void KC__kmer_counter_work(KC__KmerCounter* kc) {
         // Start reading thread.
         for (size_t i = 0; i < inputs_count; i++) {
             KC__file_reader_update_input(kc->file_readers[i], inputs[i]);
-            pthread_create(&(read_threads[i]), NULL, KC__file_reader_work, kc->file_readers[i]);
         }
+        KC__thread_pool_start(kc->thread_pool, &read_phase, KC__file_reader_work, read_args, inputs_count);
 
         // Start extracting threads.
         for (size_t i = 0; i < kc->kmer_processors_count; i++) {
-            pthread_create(&(process_threads[i]), NULL, KC__kmer_processor_work_extract, kc->kmer_processors[i]);
+            KC__kmer_processor_set_spill_partitions_count(kc->kmer_processors[i], write_tmp_files_count);
         }
+        KC__thread_pool_start(kc->thread_pool, &process_phase, KC__kmer_processor_work_extract, process_args, kc->kmer_processors_count);
 
         // Start writing thread.
-        const char* tmp_file_name = tmp_file_names[tmp_file_idx];
-        KC__file_writer_update_tmp_file(kc->file_writer, tmp_file_name);
-        pthread_create(&write_thread, NULL, KC__file_writer_work, kc->file_writer);
+        size_t first_write_tmp_file_id = next_tmp_file_id;
+        for (size_t i = 0; i < write_tmp_files_count; i++) {
+            KC__kmer_counter_tmp_file_name(write_tmp_file_names[i], param->output_file_name, next_tmp_file_id++);
+        }
+        KC__file_writer_update_tmp_files(kc->file_writer, write_tmp_file_names_ptrs, write_tmp_files_count);
+        KC__thread_pool_start(kc->thread_pool, &write_phase, KC__file_writer_work, write_args, 1);
 
         // Reading thread finished, read buffer queue input finished.
-        for (size_t i = 0; i < inputs_count; i++) {
-            pthread_join(read_threads[i], NULL);
-        }
+        KC__thread_pool_wait(kc->thread_pool, &read_phase);
         KC__buffer_queue_finish_input(kc->read_buffer_queue);
 
         // Extracting threads finished.
-        for (size_t i = 0; i < kc->kmer_processors_count; i++) {
-            pthread_join(process_threads[i], NULL);
+        KC__thread_pool_wait(kc->thread_pool, &process_phase);
+        for (size_t i = 0; i < inputs_count; i++) {
+            KC__file_reader_log_busy_time(kc->file_readers[i], i);
         }
 
-        // Start exporting threads.
-        for (size_t i = 0; i < kc->kmer_processors_count; i++) {
-            pthread_create(&(process_threads[i]), NULL, KC__kmer_processor_work_export, kc->kmer_processors[i]);
+        if (param->hash_map_stats) {
+            KC__hash_map_log_chain_lengths(kc->hash_map);
+            KC__hash_map_log_contention(kc->hash_map);
         }
 
-        // Exporting threads finished, write buffer queue input finished.
-        for (size_t i = 0; i < kc->kmer_processors_count; i++) {
-            pthread_join(process_threads[i], NULL);
+        // The bloom filter only works for the first pass, which only finds the keys, the same input is read again to
+        // count them exactly, and the tmp files of the first pass are left empty.
+        if (KC__hash_map_start_recounting(kc->hash_map)) {
+            KC__buffer_queue_finish_input(kc->write_buffer_queue);
+            KC__thread_pool_wait(kc->thread_pool, &write_phase);
+            for (size_t i = 0; i < write_tmp_files_count; i++) {
+                KC__ASSERT(KC__file_writer_get_partition_tmp_file_size(kc->file_writer, i) == 0);
+                KC__kmer_counter_delete_tmp_file(write_tmp_file_names[i]);
+            }
+            KC__kmer_counter_schedule_files(inputs, inputs_count, param, part_file_names, part_starts, part_ends, &next_part);
+            round_pass = n + 1;
+            continue;
         }
+
+        // Start exporting threads.
+        KC__thread_pool_start(kc->thread_pool, &process_phase, KC__kmer_processor_work_export, process_args, kc->kmer_processors_count);
+
+        // Exporting threads finished, write buffer queue input finished.
+        KC__thread_pool_wait(kc->thread_pool, &process_phase);
         KC__buffer_queue_finish_input(kc->write_buffer_queue);
 
         // Writing thread finished.
-        pthread_join(write_thread, NULL);
+        KC__thread_pool_wait(kc->thread_pool, &write_phase);
 
 
+        size_t pass_unique_kmers_count = 0;
         for (size_t i = 0; i < kc->kmer_processors_count; i++) {
             size_t tc;
             size_t uc;
             size_t euc;
             KC__kmer_processor_get_exported_kmers_stats(kc->kmer_processors[i], &tc, &uc, &euc);
             total_kmers_count += tc;
-            unique_kmers_count += uc;
+            pass_unique_kmers_count += uc;
             exported_unique_kmers_count += euc;
         }
+        unique_kmers_count += pass_unique_kmers_count;
+        // The K-mers seen once are not in the table, but they are still counted in the stats.
+        const size_t dropped_count = KC__hash_map_dropped_kmers_count(kc->hash_map);
+        total_kmers_count += dropped_count;
+        unique_kmers_count += dropped_count;
 
 
-        size_t tmp_file_size = KC__file_writer_get_tmp_file_size(kc->file_writer);
-        LOGGING_DEBUG("Tmp file size: %zu", tmp_file_size);
+        if (read_tmp_files_count > 0) {
+            for (size_t i = 0; i < read_tmp_files_count; i++) {
+                KC__kmer_counter_delete_tmp_file(read_tmp_file_names[i]);
+            }
 
-        if (tmp_file_size == 0) {
-            break;
+            // A round which has spilled K-mers counted fewer keys than its files hold, so the ratio only grows.
+            const double keys_per_byte = (double)pass_unique_kmers_count / (double)read_tmp_bytes_count;
+            if (keys_per_byte > tmp_keys_per_byte) {
+                tmp_keys_per_byte = keys_per_byte;
+            }
         }
 
-        inputs_count = 1;
-        inputs[0].file_names = &(tmp_file_names[tmp_file_idx]);
-        inputs[0].files_count = 1;
-        inputs[0].file_type = KC__FILE_TYPE_SUPER_KMER;
-        inputs[0].compression_type = KC__FILE_COMPRESSION_TYPE_PLAIN;
-
-        tmp_file_idx = (tmp_file_idx + 1) % 2;
-        should_delete_tmp_files[tmp_file_idx] = true;
+        for (size_t i = 0; i < write_tmp_files_count; i++) {
+            size_t tmp_file_size = KC__file_writer_get_partition_tmp_file_size(kc->file_writer, i);
+            LOGGING_DEBUG("Tmp file size: %zu [%s]", tmp_file_size, write_tmp_file_names[i]);
+
+            if (tmp_file_size == 0) {
+                KC__kmer_counter_delete_tmp_file(write_tmp_file_names[i]);
+            } else {
+                KC__ASSERT(pending_tmp_files_count < partitions_count);
+                size_t idx = (pending_tmp_files_start + pending_tmp_files_count) % partitions_count;
+                pending_tmp_file_ids[idx] = first_write_tmp_file_id + i;
+                pending_tmp_file_sizes[idx] = tmp_file_size;
+                pending_tmp_file_passes[idx] = n + 1;
+                pending_tmp_files_count++;
+            }
+        }
 
-        KC__hash_map_clear(kc->hash_map);
-    }
+        if (pending_tmp_files_count == 0) {
+            break;
+        }
 
-    for (size_t i = 0; i < 2; i++) {
-        if (should_delete_tmp_files[i]) {
-            if (remove(tmp_file_names[i]) != 0) {
-                LOGGING_WARNING("Delete file failed: %s", tmp_file_names[i]);
+        // The partitions hold disjoint K-mers, so a round counts as many of them as the hash map is expected to hold. The
+        // first round over tmp files only reads one of them, as the keys they hold are not known before.
+        const double keys_count_max = (double)KC__hash_map_max_key_count(kc->hash_map) * KC__KMER_COUNTER_TMP_KEYS_LOAD;
+        round_pass = pending_tmp_file_passes[pending_tmp_files_start];
+        read_tmp_files_count = 0;
+        read_tmp_bytes_count = 0;
+        while (pending_tmp_files_count > 0) {
+            const size_t tmp_file_size = pending_tmp_file_sizes[pending_tmp_files_start];
+            if ((read_tmp_files_count > 0) && ((pending_tmp_file_passes[pending_tmp_files_start] != round_pass) || (tmp_keys_per_byte == 0) || ((double)(read_tmp_bytes_count + tmp_file_size) * tmp_keys_per_byte > keys_count_max))) {
+                break;
             }
+
+            KC__kmer_counter_tmp_file_name(read_tmp_file_names[read_tmp_files_count++], param->output_file_name, pending_tmp_file_ids[pending_tmp_files_start]);
+            read_tmp_bytes_count += tmp_file_size;
+            pending_tmp_files_start = (pending_tmp_files_start + 1) % partitions_count;
+            pending_tmp_files_count--;
         }
+        LOGGING_INFO("Count %zu tmp files (%zu bytes) in the next round of pass #%zu.", read_tmp_files_count, read_tmp_bytes_count, round_pass);
+
+        // The readers share the tmp files.
+        next_part = 0;
+        inputs_count = (read_tmp_files_count < kc->file_readers_count) ? read_tmp_files_count : kc->file_readers_count;
+        for (size_t i = 0; i < inputs_count; i++) {
+            inputs[i].file_names = read_tmp_file_names_ptrs;
+            inputs[i].files_count = read_tmp_files_count;
+            inputs[i].file_type = KC__FILE_TYPE_SUPER_KMER;
+            inputs[i].compression_type = KC__FILE_COMPRESSION_TYPE_PLAIN;
+            inputs[i].range_starts = NULL;
+            inputs[i].range_ends = NULL;
+            inputs[i].next_file = &next_part;
+        }
+
+        // The K-mers of a partition are all in its tmp file, so the K-mers left are not split again.
+        write_tmp_files_count = 1;
+
+        // The tmp files hold the singletons evicted before, the passes over them lock the keys so that each of them
+        // counts a full table.
+        KC__hash_map_stop_evicting(kc->hash_map);
+        KC__hash_map_clear(kc->hash_map);
     }
 
     LOGGING_INFO("Total K-mers count: %zu", total_kmers_count);
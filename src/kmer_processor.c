@@ -26,6 +26,9 @@
 #include "assert.h"
 #include "utils.h"
 #include "param.h"
+#include "hash.h"
+#include "encode.h"
+#include "kmer_sketch.h"
 
 
 typedef struct {
@@ -50,8 +53,47 @@ typedef struct {
     KC__unit_t* kmer;
     KC__unit_t* rc_kmer;
 
+    /**
+     * A run of valid codes is packed into 2-bit units once, 32 codes a unit with the first one in the highest bits, and
+     * so is its reverse complement. The K-mers are sliced out of them by funnel shifts, instead of shifting both K-mers
+     * by every code. Both packed arrays have W zero units in front of and after the run, so that no slice runs out of
+     * them. A long run is handled by parts, the last K - 1 codes of a part are kept for the next one.
+     */
+    uint8_t* run_codes;
+    size_t run_capacity;
+    size_t run_length;
+    /** The position in the read (or super K-mer) of the first code of the run. */
+    size_t run_start;
+    KC__unit_t* packed;
+    KC__unit_t* rc_packed;
+    size_t packed_units_count;
 } KC__KmerExtractUnit;
 
+/** The count of new codes of each part of a run. */
+#define KC__KMER_RUN_SIZE 1024
+
+
+#define KC__KMER_BATCH_SIZE 32
+
+/**
+ * K-mers are added to hash map by batches. As a K-mer may fail to be added and should be stored, the forward K-mer and
+ * the position information are kept with the canonical one.
+ */
+typedef struct {
+    size_t count;
+
+    KC__unit_t* canonical_kmers;
+    KC__unit_t* kmers;
+
+    uint8_t last_codes[KC__KMER_BATCH_SIZE];
+    /** If the K-mer is the first one of a read (or sub read, super K-mer). */
+    bool first[KC__KMER_BATCH_SIZE];
+    bool added[KC__KMER_BATCH_SIZE];
+} KC__KmerBatchUnit;
+
+
+/** Length of the minimizers which decide the spill partitions of K-mers. */
+#define KC__MINIMIZER_LEN 11
 
 typedef enum {
     KC__KMER_STORE_ACTION_NEW = 0,
@@ -70,12 +112,49 @@ typedef struct {
 
     // The length of super K-mer minus K, by base(A, C, G, T) count.
     uint8_t* expanded_bases_count;
+    // UINT8_MAX is reserved as the mark of counted K-mers when they are stored.
+    uint8_t expanded_bases_max;
     uint8_t* current_unit;
     // The count of bases in current_unit;
     size_t current_bases_count;
 
+    // Super K-mers are split by the canonical minimizers of K-mers into partitions, 1 means no partitioning.
+    size_t partitions_count;
+    size_t partition;
+
+    size_t minimizer_len;
+    uint64_t mmer_mask;
+    // The last m-mer of the last stored K-mer, and its reverse complement.
+    uint64_t mmer;
+    uint64_t rc_mmer;
+    // The minimizer is the m-mer with the min hash, its position is counted from the start of the K-mer.
+    uint64_t minimizer_hash;
+    size_t minimizer_pos;
+
 } KC__KmerStoreUnit;
 
+
+#define KC__COMBINER_SETS_COUNT 4096
+#define KC__COMBINER_WAYS_COUNT 4
+
+/**
+ * Rejected K-mers are remembered by a small set-associative table. A K-mer in a super K-mer only costs a base (2 bits),
+ * while a counted K-mer costs all its bases, so a K-mer is stored as usual until it has been seen hot_threshold times
+ * by its slot. After that its occurrences are only counted, and stored as a counted K-mer when the slot is taken by
+ * another K-mer or the pass is finished. The slot seen least recently in a set is taken by a new K-mer.
+ *
+ * A set is laid out in cache lines as the K-mers of its ways, the seen counts and the counts. A slot never used is taken
+ * as a K-mer of all A bases seen 0 times.
+ */
+typedef struct {
+    bool enabled;
+    size_t hot_threshold;
+
+    size_t set_size;
+    char* sets;
+
+} KC__KmerCombineUnit;
+
 typedef struct {
     KC__Buffer* buffer;
     size_t W;
@@ -95,43 +174,36 @@ struct KC__KmerProcessor {
     size_t id;
 
     KC__KmerExtractUnit kmer_extract_unit;
+    KC__KmerBatchUnit kmer_batch_unit;
     KC__KmerStoreUnit kmer_store_unit;
+    KC__KmerCombineUnit kmer_combine_unit;
     KC__KmerExportUnit kmer_export_unit;
 
     void* tmp_kmers_mem;
+    void* run_mem;
+    void* batch_kmers_mem;
+    void* combiner_mem;
 
     KC__HashMap* hash_map;
+    /** The K-mers are only added to the sketch if it is set, by the pre-scan before the hash map is created. */
+    KC__KmerSketch* sketch;
     KC__BufferQueue* read_buffer_queue;
     KC__BufferQueue* write_buffer_queue;
 
+    /** NULL unless set, reads and K-mers are then handled by the processor itself without indirect calls. */
     KC__KmerProcessorReadCallback read_callback;
     KC__KmerProcessorKmerCallback kmer_callback;
+    /** Specialized for the width of K-mers and the K-mer callback, selected once they are known. */
+    void (*handle_run)(struct KC__KmerProcessor* kp);
     KC__KmerProcessorStoreBufferRequestCallback store_buffer_request_callback;
     KC__KmerProcessorStoreBufferCompleteCallback store_buffer_complete_callback;
 };
 
 
-static inline KC__unit_t KC__encode(char ch) {
-    switch (ch) {
-        case 'A':
-        case 'a':
-            return 0x0;
-        case 'C':
-        case 'c':
-            return 0x1;
-        case 'G':
-        case 'g':
-            return 0x2;
-        case 'T':
-        case 't':
-            return 0x3;
-        case '\n':
-        case '\r':
-            return 0x4;
-        default:
-            return 0x5;
-    }
-}
+static void KC__kmer_processor_flush_kmers(KC__KmerProcessor* kp);
+static void KC__kmer_processor_select_run_handler(KC__KmerProcessor* kp);
+static void KC__kmer_processor_reject_kmer_callback(const KC__unit_t* kmer, void* data);
+
 
 static inline KC__unit_t KC__get_rc_code(KC__unit_t code) {
     KC__ASSERT(code <= 0x3);
@@ -185,28 +257,6 @@ static inline void KC__kmer_extract_unit_generate_kmer(KC__KmerExtractUnit* keu,
     }
 }
 
-static inline void KC__kmer_extract_unit_shift_kmer(KC__KmerExtractUnit* keu, KC__unit_t code) {
-    size_t W = keu->W;
-
-    KC__unit_t rc_code = KC__get_rc_code(code);
-
-    KC__unit_t tmp_code;
-    for (size_t i = 0; i < W - 1; i++) {
-        tmp_code = (keu->kmer[i] >> (KC__UNIT_BIT - 2));
-        keu->kmer[i] = (keu->kmer[i] << 2) | code;
-        code = tmp_code;
-    }
-    keu->kmer[W - 1] = ((keu->kmer[W - 1] << 2) | code) & (keu->shift_mask);
-
-    for (size_t i = W; i > 0; i--) {
-        size_t shift = (i == W) ? keu->rc_shift : KC__UNIT_BIT - 2;
-        size_t j = i - 1;
-        tmp_code = (keu->rc_kmer[j] & 0x3);
-        keu->rc_kmer[j] = ((keu->rc_kmer[j] >> 2) | (rc_code << shift));
-        rc_code = tmp_code;
-    }
-}
-
 static inline int KC__kmer_extract_unit_compare_kmers(KC__KmerExtractUnit* keu, const KC__unit_t* kmer_1, const KC__unit_t* kmer_2) {
     for (size_t i = keu->W; i > 0; i--) {
         size_t n = i - 1;
@@ -219,12 +269,98 @@ static inline int KC__kmer_extract_unit_compare_kmers(KC__KmerExtractUnit* keu,
     return 0;
 }
 
+/**
+ * Reverse the 32 codes of a unit and complement them.
+ */
+static inline KC__unit_t KC__reverse_complement_unit(KC__unit_t unit) {
+    unit = __builtin_bswap64(unit);
+    unit = ((unit >> 4) & UINT64_C(0x0F0F0F0F0F0F0F0F)) | ((unit & UINT64_C(0x0F0F0F0F0F0F0F0F)) << 4);
+    unit = ((unit >> 2) & UINT64_C(0x3333333333333333)) | ((unit & UINT64_C(0x3333333333333333)) << 2);
+    return ~unit;
+}
+
+/**
+ * Pack the codes of the run after W zero units, then compute the reverse complement of all units by reversing their
+ * order and each of them.
+ */
+static inline void KC__kmer_extract_unit_pack_run(KC__KmerExtractUnit* keu) {
+    const size_t n = keu->run_length;
+    const uint8_t* codes = keu->run_codes;
+    KC__unit_t* p = keu->packed;
+
+    memset(p, 0, sizeof(KC__unit_t) * keu->packed_units_count);
+    p += keu->W;
+
+    size_t i = 0;
+    for (; i + KC__UNIT_BIT / 2 <= n; i += KC__UNIT_BIT / 2) {
+        KC__unit_t unit = 0;
+        for (size_t j = 0; j < KC__UNIT_BIT / 2; j++) {
+            unit = (unit << 2) | codes[i + j];
+        }
+        *(p++) = unit;
+    }
+    if (i < n) {
+        KC__unit_t unit = 0;
+        size_t shift = KC__UNIT_BIT;
+        for (; i < n; i++) {
+            unit = (unit << 2) | codes[i];
+            shift -= 2;
+        }
+        *p = unit << shift;
+    }
+
+    const size_t m = keu->packed_units_count;
+    for (size_t j = 0; j < m; j++) {
+        keu->rc_packed[j] = KC__reverse_complement_unit(keu->packed[m - 1 - j]);
+    }
+}
+
+/**
+ * Slice a K-mer out of a packed array, the codes in front of the K-mer in its highest unit are masked out.
+ * @param keu K-mer extract unit.
+ * @param W The width of K-mers.
+ * @param packed The packed array.
+ * @param end The position in the packed array after the last code of the K-mer, not less than W units.
+ * @param kmer The K-mer.
+ */
+static KC__ALWAYS_INLINE void KC__kmer_extract_unit_slice_kmer(const KC__KmerExtractUnit* keu, const size_t W, const KC__unit_t* packed, size_t end, KC__unit_t* kmer) {
+    // Unit w of the K-mer holds the 32 codes in front of end - 32 * w, they are the same bits of two units of the array.
+    const size_t start = end - KC__UNIT_BIT / 2;
+    const size_t q = start / (KC__UNIT_BIT / 2);
+    const unsigned int r = (unsigned int)(start % (KC__UNIT_BIT / 2)) * 2;
+    for (size_t w = 0; w < W; w++) {
+        // Shifted twice, so that the low part is 0 rather than undefined when r is 0.
+        kmer[w] = (packed[q - w] << r) | ((packed[q - w + 1] >> (KC__UNIT_BIT - 1 - r)) >> 1);
+    }
+    kmer[W - 1] &= keu->shift_mask;
+}
+
+/**
+ * Compare two K-mers without early exits, from the highest unit to the lowest.
+ * @return If the first K-mer is less than the second one.
+ */
+static KC__ALWAYS_INLINE bool KC__kmer_extract_unit_kmer_less(const size_t W, const KC__unit_t* kmer_1, const KC__unit_t* kmer_2) {
+    int cmp = 0;
+    for (size_t i = W; i > 0; i--) {
+        const int c = (int)(kmer_1[i - 1] > kmer_2[i - 1]) - (int)(kmer_1[i - 1] < kmer_2[i - 1]);
+        cmp = (cmp != 0) ? cmp : c;
+    }
+    return cmp < 0;
+}
+
 static void KC__kmer_store_unit_init(KC__KmerStoreUnit* ksu, size_t K) {
     ksu->store_action = KC__KMER_STORE_ACTION_NEW;
     ksu->current_buffer = NULL;
 
     size_t max_units_count = KC__calculate_kmer_width_by_unit_size(K + UINT8_MAX, sizeof(uint8_t));
     ksu->super_kmer_info_max_size = sizeof(uint8_t) * (max_units_count + 1);
+    ksu->expanded_bases_max = UINT8_MAX;
+
+    ksu->partitions_count = 1;
+    ksu->partition = 0;
+
+    ksu->minimizer_len = (K < KC__MINIMIZER_LEN) ? K : KC__MINIMIZER_LEN;
+    ksu->mmer_mask = ((uint64_t)1 << (ksu->minimizer_len * 2)) - 1;
 }
 
 
@@ -242,15 +378,38 @@ KC__KmerProcessor* KC__kmer_processor_create(KC__MemAllocator* ma, size_t id, si
     kp->kmer_extract_unit.kmer = (KC__unit_t*)(mem);
     kp->kmer_extract_unit.rc_kmer = (KC__unit_t*)(mem + kmer_size);
 
+    KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
+    keu->run_capacity = K - 1 + KC__KMER_RUN_SIZE;
+    keu->packed_units_count = keu->W * 2 + (keu->run_capacity + KC__UNIT_BIT / 2 - 1) / (KC__UNIT_BIT / 2);
+    const size_t packed_size = sizeof(KC__unit_t) * keu->packed_units_count;
+    kp->run_mem = KC__mem_aligned_alloc(ma, packed_size * 2 + sizeof(uint8_t) * keu->run_capacity, "kmer processor run mem");
+    mem = kp->run_mem;
+    keu->packed = (KC__unit_t*)(mem);
+    keu->rc_packed = (KC__unit_t*)(mem + packed_size);
+    keu->run_codes = (uint8_t*)(mem + packed_size * 2);
+    keu->run_length = 0;
+    keu->run_start = 0;
+
+    kp->batch_kmers_mem = KC__mem_aligned_alloc(ma, kmer_size * KC__KMER_BATCH_SIZE * 2, "kmer processor batch kmers mem");
+    mem = kp->batch_kmers_mem;
+    kp->kmer_batch_unit.canonical_kmers = (KC__unit_t*)(mem);
+    kp->kmer_batch_unit.kmers = (KC__unit_t*)(mem + kmer_size * KC__KMER_BATCH_SIZE);
+    kp->kmer_batch_unit.count = 0;
+
+    kp->kmer_combine_unit.enabled = false;
+    kp->combiner_mem = NULL;
+
     kp->kmer_export_unit.output_param = output_param;
 
 
     kp->hash_map = NULL;
+    kp->sketch = NULL;
     kp->read_buffer_queue = NULL;
     kp->write_buffer_queue = NULL;
 
-    KC__kmer_processor_set_read_callback(kp, KC__kmer_processor_handle_read);
-    KC__kmer_processor_set_kmer_callback(kp, KC__kmer_processor_handle_kmer);
+    kp->read_callback = NULL;
+    kp->kmer_callback = NULL;
+    KC__kmer_processor_select_run_handler(kp);
 
     kp->store_buffer_request_callback = NULL;
     kp->store_buffer_complete_callback = NULL;
@@ -260,6 +419,11 @@ KC__KmerProcessor* KC__kmer_processor_create(KC__MemAllocator* ma, size_t id, si
 
 void KC__kmer_processor_free(KC__MemAllocator* ma, KC__KmerProcessor* kp) {
     KC__mem_free(ma, kp->tmp_kmers_mem);
+    KC__mem_free(ma, kp->run_mem);
+    KC__mem_free(ma, kp->batch_kmers_mem);
+    if (kp->combiner_mem != NULL) {
+        KC__mem_free(ma, kp->combiner_mem);
+    }
     KC__mem_free(ma, kp);
 }
 
@@ -267,6 +431,10 @@ void KC__kmer_processor_link_modules(KC__KmerProcessor* kp, KC__HashMap* hash_ma
     kp->hash_map = hash_map;
     kp->read_buffer_queue = read_buffer_queue;
     kp->write_buffer_queue = write_buffer_queue;
+
+    if (kp->hash_map != NULL) {
+        KC__hash_map_set_reject_callback(kp->hash_map, kp->id, KC__kmer_processor_reject_kmer_callback, kp);
+    }
 }
 
 void KC__kmer_processor_set_read_callback(KC__KmerProcessor* kp, KC__KmerProcessorReadCallback read_callback) {
@@ -275,6 +443,12 @@ void KC__kmer_processor_set_read_callback(KC__KmerProcessor* kp, KC__KmerProcess
 
 void KC__kmer_processor_set_kmer_callback(KC__KmerProcessor* kp, KC__KmerProcessorKmerCallback kmer_callback) {
     kp->kmer_callback = kmer_callback;
+    KC__kmer_processor_select_run_handler(kp);
+}
+
+void KC__kmer_processor_set_sketch(KC__KmerProcessor* kp, KC__KmerSketch* sketch) {
+    kp->sketch = sketch;
+    KC__kmer_processor_select_run_handler(kp);
 }
 
 void KC__kmer_processor_set_store_buffer_request_callback(KC__KmerProcessor* kp, KC__KmerProcessorStoreBufferRequestCallback request_callback) {
@@ -285,39 +459,257 @@ void KC__kmer_processor_set_store_buffer_complete_callback(KC__KmerProcessor* kp
     kp->store_buffer_complete_callback = complete_callback;
 }
 
+void KC__kmer_processor_set_spill_partitions_count(KC__KmerProcessor* kp, size_t partitions_count) {
+    KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
+
+    KC__ASSERT(ksu->current_buffer == NULL);
+    KC__ASSERT((partitions_count > 0) && (partitions_count <= KC__SPILL_PARTITIONS_MAX));
+
+    // A partitioned super K-mer has its partition in front of it.
+    if ((ksu->partitions_count > 1) && (partitions_count == 1)) {
+        ksu->super_kmer_info_max_size -= sizeof(uint8_t);
+    } else if ((ksu->partitions_count == 1) && (partitions_count > 1)) {
+        ksu->super_kmer_info_max_size += sizeof(uint8_t);
+    }
+
+    ksu->partitions_count = partitions_count;
+    ksu->store_action = KC__KMER_STORE_ACTION_NEW;
+}
+
+void KC__kmer_processor_init_combiner(KC__MemAllocator* ma, KC__KmerProcessor* kp) {
+    KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
+    KC__KmerCombineUnit* kcu = &(kp->kmer_combine_unit);
+    const size_t K = kp->kmer_extract_unit.K;
+
+    KC__ASSERT(ksu->current_buffer == NULL);
+    KC__ASSERT(!(kcu->enabled));
+
+    size_t set_size = (KC__calculate_kmer_size(K) + sizeof(uint8_t) * 2) * KC__COMBINER_WAYS_COUNT;
+    kcu->set_size = (set_size + 63) / 64 * 64;
+    kp->combiner_mem = KC__mem_aligned_alloc(ma, kcu->set_size * KC__COMBINER_SETS_COUNT, "kmer processor combiner mem");
+    kcu->sets = kp->combiner_mem;
+    memset(kcu->sets, 0, kcu->set_size * KC__COMBINER_SETS_COUNT);
+
+    // A counted K-mer costs K + 8 bases (the mark and the count take 8 bases), as many as K + 8 K-mers expanding super
+    // K-mers.
+    size_t hot_threshold = K + 8;
+    kcu->hot_threshold = (hot_threshold > UINT8_MAX) ? UINT8_MAX : hot_threshold;
+
+    kcu->enabled = true;
+    ksu->expanded_bases_max = UINT8_MAX - 1;
+    ksu->store_action = KC__KMER_STORE_ACTION_NEW;
+}
+
+/**
+ * Append the K-mer to the batch, the batch is flushed once it is full.
+ */
+static KC__ALWAYS_INLINE void KC__kmer_processor_batch_kmer(KC__KmerProcessor* kp, const size_t W, const KC__unit_t* canonical_kmer, size_t n, KC__unit_t last_code) {
+    KC__KmerBatchUnit* kbu = &(kp->kmer_batch_unit);
+    KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
+
+    size_t i = kbu->count;
+    for (size_t w = 0; w < W; w++) {
+        kbu->canonical_kmers[i * W + w] = canonical_kmer[w];
+        kbu->kmers[i * W + w] = keu->kmer[w];
+    }
+    kbu->last_codes[i] = (uint8_t)last_code;
+    kbu->first[i] = (n == 0);
+
+    kbu->count++;
+    if (kbu->count == KC__KMER_BATCH_SIZE) {
+        KC__kmer_processor_flush_kmers(kp);
+    }
+}
+
 /**
- * Handle code extracted by read (or super K-mer), update K-mer extract unit.
- * If a canonical K-mer is ready, call the K-mer callback.
+ * Handle the codes of the run (or the current part of it), every K-mer is batched, or passed to the K-mer callback or
+ * added to the sketch if it is set. The last K - 1 codes are kept, so that the run can be continued.
  * @param kp K-mer processor.
- * @param i The (i)th valid code of read (or super K-mer) is being handled.
- * @param code The code to be handled.
+ * @param W The width of K-mers.
+ * @param use_kmer_callback If the K-mer callback is set.
+ * @param use_sketch If the sketch is set.
  */
-static inline void KC__kmer_processor_handle_code(KC__KmerProcessor* kp, size_t i, KC__unit_t code) {
+static KC__ALWAYS_INLINE void KC__kmer_processor_handle_run_of_width(KC__KmerProcessor* kp, const size_t W, const bool use_kmer_callback, const bool use_sketch) {
     KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
+    const size_t K = keu->K;
+    const size_t n = keu->run_length;
+    if (n < K) {
+        return;
+    }
+
+    KC__kmer_extract_unit_pack_run(keu);
 
-    if (i < keu->K) {
-        KC__kmer_extract_unit_generate_kmer(keu, i, code);
+    const size_t offset = W * (KC__UNIT_BIT / 2);
+    const size_t rc_offset = keu->packed_units_count * (KC__UNIT_BIT / 2) - offset - n;
+    for (size_t p = 0; p + K <= n; p++) {
+        KC__kmer_extract_unit_slice_kmer(keu, W, keu->packed, offset + p + K, keu->kmer);
+        // The reverse complement of the K-mer at p ends at n - p in the reverse complement of the run.
+        KC__kmer_extract_unit_slice_kmer(keu, W, keu->rc_packed, rc_offset + n - p, keu->rc_kmer);
 
-        if (i != keu->K - 1) {
-            return;
+        KC__unit_t* canonical_kmer = KC__kmer_extract_unit_kmer_less(W, keu->kmer, keu->rc_kmer) ? keu->kmer : keu->rc_kmer;
+        if (use_kmer_callback) {
+            kp->kmer_callback(kp, canonical_kmer, keu->run_start + p, keu->run_codes[p + K - 1]);
+        } else if (use_sketch) {
+            KC__kmer_sketch_add(kp->sketch, KC__hash_kmer(canonical_kmer, W));
+        } else {
+            KC__kmer_processor_batch_kmer(kp, W, canonical_kmer, keu->run_start + p, keu->run_codes[p + K - 1]);
         }
+    }
 
+    memmove(keu->run_codes, keu->run_codes + n - (K - 1), sizeof(uint8_t) * (K - 1));
+    keu->run_start += n - (K - 1);
+    keu->run_length = K - 1;
+}
+
+#define KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(SUFFIX, WIDTH, USE_KMER_CALLBACK, USE_SKETCH) \
+    static void KC__kmer_processor_handle_run_##SUFFIX(KC__KmerProcessor* kp) { \
+        KC__kmer_processor_handle_run_of_width(kp, (WIDTH), (USE_KMER_CALLBACK), (USE_SKETCH)); \
+    }
+
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(w1, 1, false, false)
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(w2, 2, false, false)
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(w3, 3, false, false)
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(w4, 4, false, false)
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(generic, kp->kmer_extract_unit.W, false, false)
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(callback, kp->kmer_extract_unit.W, true, false)
+KC__KMER_PROCESSOR_DEFINE_HANDLE_RUN(sketch, kp->kmer_extract_unit.W, false, true)
+
+static void KC__kmer_processor_select_run_handler(KC__KmerProcessor* kp) {
+    if (kp->kmer_callback != NULL) {
+        kp->handle_run = KC__kmer_processor_handle_run_callback;
+        return;
+    }
+    if (kp->sketch != NULL) {
+        kp->handle_run = KC__kmer_processor_handle_run_sketch;
+        return;
+    }
+
+    switch (kp->kmer_extract_unit.W) {
+        case 1:
+            kp->handle_run = KC__kmer_processor_handle_run_w1;
+            break;
+        case 2:
+            kp->handle_run = KC__kmer_processor_handle_run_w2;
+            break;
+        case 3:
+            kp->handle_run = KC__kmer_processor_handle_run_w3;
+            break;
+        case 4:
+            kp->handle_run = KC__kmer_processor_handle_run_w4;
+            break;
+        default:
+            kp->handle_run = KC__kmer_processor_handle_run_generic;
+            break;
+    }
+}
+
+static inline void KC__kmer_processor_start_run(KC__KmerProcessor* kp) {
+    kp->kmer_extract_unit.run_start = 0;
+    kp->kmer_extract_unit.run_length = 0;
+}
+
+/**
+ * Append valid codes to the run, the full parts of the run are handled.
+ */
+static inline void KC__kmer_processor_append_run(KC__KmerProcessor* kp, const uint8_t* codes, size_t count) {
+    KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
+
+    while (count > 0) {
+        size_t m = keu->run_capacity - keu->run_length;
+        if (m > count) {
+            m = count;
+        }
+        memcpy(keu->run_codes + keu->run_length, codes, sizeof(uint8_t) * m);
+        keu->run_length += m;
+        codes += m;
+        count -= m;
+
+        if (keu->run_length == keu->run_capacity) {
+            kp->handle_run(kp);
+        }
+    }
+}
+
+static inline void KC__kmer_processor_dispatch_read(KC__KmerProcessor* kp, const char* read, size_t read_length) {
+    if (kp->read_callback != NULL) {
+        kp->read_callback(kp, read, read_length);
     } else {
-        KC__kmer_extract_unit_shift_kmer(keu, code);
+        KC__kmer_processor_handle_read(kp, read, read_length);
     }
+}
 
-    KC__unit_t *canonical_kmer;
-    if (KC__kmer_extract_unit_compare_kmers(keu, keu->kmer, keu->rc_kmer) < 0)
-        canonical_kmer = keu->kmer;
-    else
-        canonical_kmer = keu->rc_kmer;
+/**
+ * Find the line starting at line by memchr, the '\r' in front of the '\n' is not part of the line.
+ * @param line The start of the line.
+ * @param end The end of the buffer.
+ * @param line_length Set to the length of the line.
+ * @return The start of the next line, or NULL if the line is not ended in the buffer.
+ */
+static inline const char* KC__kmer_processor_next_line(const char* line, const char* end, size_t* line_length) {
+    const char* line_end = (line < end) ? memchr(line, '\n', (size_t)(end - line)) : NULL;
+    if (line_end == NULL) {
+        return NULL;
+    }
 
-    kp->kmer_callback(kp, canonical_kmer, i + 1 - keu->K, code);
+    *line_length = (size_t)(line_end - line);
+    if ((*line_length > 0) && (line_end[-1] == '\r')) {
+        (*line_length)--;
+    }
+    return line_end + 1;
 }
 
-static inline void KC__kmer_processor_handle_reads_buffer(KC__KmerProcessor* kp, const KC__Buffer* buffer) {
-    const char* data = buffer->data;
+/**
+ * Handle the FASTQ buffer record by record. The buffer is cut at a '@' which may be in a quality line, so a line is only
+ * taken as a header if it starts with '@' and is followed by a sequence line and a '+' line. The quality line is jumped
+ * over by the length of the sequence, the header and '+' lines are only searched for their ends.
+ */
+static inline void KC__kmer_processor_handle_fastq_buffer(KC__KmerProcessor* kp, const KC__Buffer* buffer) {
+    const char* end = (const char*)(buffer->data) + buffer->length;
+    const char* line = buffer->data;
+    size_t line_length;
+
+    while (line < end) {
+        const char* seq = KC__kmer_processor_next_line(line, end, &line_length);
+        if (seq == NULL) {
+            break;
+        }
+        if (line[0] != '@') {
+            line = seq;
+            continue;
+        }
+
+        size_t seq_length;
+        const char* plus = KC__kmer_processor_next_line(seq, end, &seq_length);
+        if ((plus == NULL) || (plus == end) || (plus[0] != '+')) {
+            // Not a record, the next line may be the header.
+            line = seq;
+            continue;
+        }
+
+        KC__kmer_processor_dispatch_read(kp, seq, seq_length);
+
+        const char* quality = KC__kmer_processor_next_line(plus, end, &line_length);
+        if (quality == NULL) {
+            break;
+        }
 
+        // The quality line is as long as the sequence in a well-formed record, otherwise its end is searched.
+        const char* quality_end = quality + seq_length;
+        if ((quality_end < end) && (quality_end[0] == '\r')) {
+            quality_end++;
+        }
+        if ((quality_end < end) && (quality_end[0] == '\n')) {
+            line = quality_end + 1;
+        } else {
+            line = KC__kmer_processor_next_line(quality, end, &line_length);
+            if (line == NULL) {
+                break;
+            }
+        }
+    }
+}
+
+static inline void KC__kmer_processor_handle_fasta_data(KC__KmerProcessor* kp, const char* data, size_t length) {
     const char* prev_line = NULL;
     const char* next_line = NULL;
 
@@ -329,7 +721,7 @@ static inline void KC__kmer_processor_handle_reads_buffer(KC__KmerProcessor* kp,
     size_t i = 0;
     while (true) {
         // Only analyze at the end of the line (or buffer).
-        const bool end_of_buffer = (i == buffer->length);
+        const bool end_of_buffer = (i == length);
         size_t line_end_idx = 0;
 
         bool end_of_line = false;
@@ -344,7 +736,7 @@ static inline void KC__kmer_processor_handle_reads_buffer(KC__KmerProcessor* kp,
 
             } else if (data[i] == '\r') {
                 line_end_idx = i;
-                if ((i < buffer->length - 1) && (data[i + 1] == '\n')) {
+                if ((i < length - 1) && (data[i + 1] == '\n')) {
                     i++;
                 }
                 end_of_line = true;
@@ -356,7 +748,7 @@ static inline void KC__kmer_processor_handle_reads_buffer(KC__KmerProcessor* kp,
             const size_t current_line_length = line_end_idx - line_start_idx;
 
             const size_t next_line_start_idx = i + 1;
-            if (next_line_start_idx >= buffer->length) {
+            if (next_line_start_idx >= length) {
                 next_line = NULL;
             } else {
                 next_line = &(data[next_line_start_idx]);
@@ -365,33 +757,17 @@ static inline void KC__kmer_processor_handle_reads_buffer(KC__KmerProcessor* kp,
             bool current_line_is_read = false;
             bool update_current_line = false;
 
-            switch (buffer->type) {
-                case KC__BUFFER_TYPE_FASTA:
-                    if ((prev_line != NULL) && (prev_line[0] == '>')) {
-                        if ((next_line == NULL) || (next_line[0] == '>')) {
-                            current_line_is_read = true;
-                            update_current_line = true;
-                        }
-                    } else {
-                        update_current_line = true;
-                    }
-                    break;
-                case KC__BUFFER_TYPE_FASTQ:
-                    // Prev line and next line at least has one character ('\n').
-                    if ((prev_line != NULL) && (prev_line[0] == '@')) {
-                        if ((next_line != NULL) && (next_line[0] == '+')) {
-                            current_line_is_read = true;
-                        }
-                    }
+            if ((prev_line != NULL) && (prev_line[0] == '>')) {
+                if ((next_line == NULL) || (next_line[0] == '>')) {
+                    current_line_is_read = true;
                     update_current_line = true;
-                    break;
-                default:
-                    KC__ASSERT(false);
-                    break;
+                }
+            } else {
+                update_current_line = true;
             }
 
             if (current_line_is_read) {
-                kp->read_callback(kp, current_line, current_line_length);
+                KC__kmer_processor_dispatch_read(kp, current_line, current_line_length);
             }
 
             if (end_of_buffer) {
@@ -409,23 +785,68 @@ static inline void KC__kmer_processor_handle_reads_buffer(KC__KmerProcessor* kp,
     }
 }
 
+/**
+ * The continued buffer starts with the rest of the sequence of a record, up to the first line starting with '>'.
+ */
+static inline void KC__kmer_processor_handle_fasta_continued_buffer(KC__KmerProcessor* kp, const KC__Buffer* buffer) {
+    const char* data = buffer->data;
+    const size_t length = buffer->length;
+
+    size_t sequence_length = 0;
+    while (true) {
+        const char* header = (sequence_length < length) ? memchr(data + sequence_length, '>', length - sequence_length) : NULL;
+        if (header == NULL) {
+            sequence_length = length;
+            break;
+        }
+        sequence_length = (size_t)(header - data);
+        if ((sequence_length > 0) && ((data[sequence_length - 1] == '\n') || (data[sequence_length - 1] == '\r'))) {
+            break;
+        }
+        sequence_length++;
+    }
+
+    KC__kmer_processor_dispatch_read(kp, data, sequence_length);
+    if (sequence_length < length) {
+        KC__kmer_processor_handle_fasta_data(kp, data + sequence_length, length - sequence_length);
+    }
+}
+
+static void KC__kmer_processor_add_counted_kmer(KC__KmerProcessor* kp, const KC__unit_t* canonical_kmer, KC__count_t count);
+
 static inline void KC__kmer_processor_handle_super_kmers_buffer(KC__KmerProcessor* kp, const KC__Buffer* buffer) {
     KC__ASSERT(buffer->type == KC__BUFFER_TYPE_SUPER_KMER);
+    KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
 
-    size_t super_kmers_count = *((uint32_t*)(buffer->data));
+    // Views into mapped tmp files may not be aligned.
+    uint32_t header;
+    memcpy(&header, buffer->data, sizeof(uint32_t));
+    const bool counted_kmers = ((header & KC__SUPER_KMERS_COUNTED_FLAG) != 0);
+    size_t super_kmers_count = (header & ~KC__SUPER_KMERS_COUNTED_FLAG);
     uint8_t* p = (uint8_t*)((char*)(buffer->data) + sizeof(uint32_t));
 
     for (size_t n = 0; n < super_kmers_count; n++) {
         uint8_t expanded_bases_count = *p;
-        size_t bases_count = kp->kmer_extract_unit.K + expanded_bases_count;
+
+        // A counted K-mer has its count after the mark, and is added to hash map count times.
+        KC__count_t count = 0;
+        if (counted_kmers && (expanded_bases_count == KC__SUPER_KMER_COUNTED_MARK)) {
+            p++;
+            count = *p;
+            expanded_bases_count = 0;
+        }
+
+        size_t bases_count = keu->K + expanded_bases_count;
 
         uint8_t mask = 0x3;
-        KC__unit_t code;
+        uint8_t code;
 
         p++;
         uint8_t unit = *p;
         size_t shift = 0;
 
+        // A super K-mer has at most K + 255 bases, it fits in a single part of the run.
+        KC__kmer_processor_start_run(kp);
         for (size_t i = 0; i < bases_count; i++) {
             if (shift == 8) {
                 shift = 0;
@@ -434,15 +855,32 @@ static inline void KC__kmer_processor_handle_super_kmers_buffer(KC__KmerProcesso
             }
 
             code = (unit >> shift) & mask;
-            KC__kmer_processor_handle_code(kp, i, code);
+            if (count == 0) {
+                keu->run_codes[i] = code;
+            } else {
+                KC__kmer_extract_unit_generate_kmer(keu, i, code);
+            }
 
             shift += 2;
         }
 
+        if (count == 0) {
+            keu->run_length = bases_count;
+            kp->handle_run(kp);
+        } else {
+            if (KC__kmer_extract_unit_compare_kmers(keu, keu->kmer, keu->rc_kmer) < 0) {
+                KC__kmer_processor_add_counted_kmer(kp, keu->kmer, count);
+            } else {
+                KC__kmer_processor_add_counted_kmer(kp, keu->rc_kmer, count);
+            }
+        }
+
         p++;
     }
 
     KC__ASSERT((char*)p - (char*)(buffer->data) == buffer->length);
+
+    KC__kmer_processor_flush_kmers(kp);
 }
 
 void KC__kmer_processor_handle_buffer(KC__KmerProcessor* kp, const KC__Buffer* buffer) {
@@ -454,8 +892,13 @@ void KC__kmer_processor_handle_buffer(KC__KmerProcessor* kp, const KC__Buffer* b
 
     switch (buffer->type) {
         case KC__BUFFER_TYPE_FASTA:
+            KC__kmer_processor_handle_fasta_data(kp, buffer->data, buffer->length);
+            break;
+        case KC__BUFFER_TYPE_FASTA_CONTINUED:
+            KC__kmer_processor_handle_fasta_continued_buffer(kp, buffer);
+            break;
         case KC__BUFFER_TYPE_FASTQ:
-            KC__kmer_processor_handle_reads_buffer(kp, buffer);
+            KC__kmer_processor_handle_fastq_buffer(kp, buffer);
             break;
         case KC__BUFFER_TYPE_SUPER_KMER:
             KC__kmer_processor_handle_super_kmers_buffer(kp, buffer);
@@ -478,31 +921,43 @@ static inline void KC__kmer_processor_handle_sub_read(KC__KmerProcessor* kp, con
     if (read_length < keu->K)
         return;
 
-    size_t i = 0;
-    size_t skipped_count = 0;
-    while (true) {
-        if (i == read_length)
-            break;
+    KC__kmer_processor_start_run(kp);
 
-        KC__unit_t code = KC__encode(read[i]);
+    uint8_t codes[KC__ENCODE_BLOCK_SIZE];
+    size_t i = 0;
+    while (i < read_length) {
+        size_t count = read_length - i;
+        if (count > KC__ENCODE_BLOCK_SIZE) {
+            count = KC__ENCODE_BLOCK_SIZE;
+        }
+        uint32_t invalid = KC__encode_bases(read + i, count, codes);
+
+        // Append the valid characters to the run, the skipped ones split them.
+        size_t n = 0;
+        while (n < count) {
+            size_t run_end = (invalid == 0) ? count : (size_t)__builtin_ctz(invalid);
+            KC__kmer_processor_append_run(kp, codes + n, run_end - n);
+            n = run_end;
+            if (n == count) {
+                break;
+            }
 
-        if (code == 0x5) {
-            // Unexpected character.
-            break;
+            if (KC__encode(read[i + n]) == KC__ENCODE_INVALID) {
+                // Unexpected character.
+                kp->handle_run(kp);
+                *handled_length = i + n;
+                return;
+            }
 
-        } else if (code == 0x4) {
             // Skipped character.
-            skipped_count++;
-
-        } else {
-            // Valid character.
-            size_t j = i - skipped_count;
-            KC__kmer_processor_handle_code(kp, j, code);
+            invalid &= invalid - 1;
+            n++;
         }
 
-        i++;
+        i += count;
     }
 
+    kp->handle_run(kp);
     *handled_length = i;
 }
 
@@ -518,6 +973,8 @@ void KC__kmer_processor_handle_read(struct KC__KmerProcessor* kp, const char* re
         read++;
         read_length--;
     }
+
+    KC__kmer_processor_flush_kmers(kp);
 }
 
 static inline void KC__kmer_store_unit_set_action(KC__KmerStoreUnit* ksu, KC__KmerStoreAction action) {
@@ -578,41 +1035,156 @@ static inline void KC__kmer_processor_store_buffer_complete(KC__KmerProcessor* k
     *buffer = NULL;
 }
 
-static inline void KC__kmer_processor_store_kmer(KC__KmerProcessor* kp, KC__unit_t last_code) {
+static inline void KC__kmer_store_unit_roll_mmer(KC__KmerStoreUnit* ksu, KC__unit_t code) {
+    ksu->mmer = ((ksu->mmer << 2) | code) & (ksu->mmer_mask);
+    ksu->rc_mmer = (ksu->rc_mmer >> 2) | ((uint64_t)KC__get_rc_code(code) << ((ksu->minimizer_len - 1) * 2));
+}
+
+static inline uint64_t KC__kmer_store_unit_mmer_hash(const KC__KmerStoreUnit* ksu) {
+    uint64_t canonical_mmer = (ksu->mmer < ksu->rc_mmer) ? ksu->mmer : ksu->rc_mmer;
+    return KC__hash_mix(canonical_mmer);
+}
+
+/**
+ * Find the minimizer of a K-mer by all of its m-mers.
+ */
+static void KC__kmer_store_unit_scan_minimizer(KC__KmerStoreUnit* ksu, const KC__KmerExtractUnit* keu, const KC__unit_t* kmer) {
+    const size_t M = ksu->minimizer_len;
+
+    ksu->minimizer_hash = UINT64_MAX;
+    ksu->minimizer_pos = 0;
+
+    size_t w = keu->gen_w_init;
+    size_t s = keu->gen_s_init;
+    for (size_t i = 0; i < keu->K; i++) {
+        KC__unit_t code = ((kmer[w] >> s) & 0x3);
+        KC__kmer_store_unit_roll_mmer(ksu, code);
+
+        if (i + 1 >= M) {
+            uint64_t h = KC__kmer_store_unit_mmer_hash(ksu);
+            if (h < ksu->minimizer_hash) {
+                ksu->minimizer_hash = h;
+                ksu->minimizer_pos = i + 1 - M;
+            }
+        }
+
+        if (s == 0) {
+            w--;
+            s = KC__UNIT_BIT - 2;
+        } else {
+            s -= 2;
+        }
+    }
+}
+
+/**
+ * Update the partition by the K-mer to be stored. The canonical minimizer is the same for a K-mer and its reverse
+ * complement, so all occurrences of a canonical K-mer are in the same partition.
+ * If the partition of a K-mer is different from the one of the super K-mer it would expand, a new super K-mer is started.
+ */
+static inline void KC__kmer_store_unit_update_partition(KC__KmerStoreUnit* ksu, const KC__KmerExtractUnit* keu, const KC__unit_t* kmer, KC__unit_t last_code) {
+    if (ksu->store_action == KC__KMER_STORE_ACTION_EXPAND) {
+        // The K-mer is the last one shifted by the last code, only the new m-mer at the end has to be checked unless
+        // the minimizer is shifted out.
+        KC__kmer_store_unit_roll_mmer(ksu, last_code);
+
+        if (ksu->minimizer_pos == 0) {
+            KC__kmer_store_unit_scan_minimizer(ksu, keu, kmer);
+        } else {
+            ksu->minimizer_pos--;
+
+            uint64_t h = KC__kmer_store_unit_mmer_hash(ksu);
+            if (h < ksu->minimizer_hash) {
+                ksu->minimizer_hash = h;
+                ksu->minimizer_pos = keu->K - ksu->minimizer_len;
+            }
+        }
+
+    } else {
+        KC__kmer_store_unit_scan_minimizer(ksu, keu, kmer);
+    }
+
+    // The min hash values are small, so they are mixed again to spread over partitions.
+    size_t partition = KC__hash_reduce(KC__hash_mix(ksu->minimizer_hash), ksu->partitions_count);
+    if (partition != ksu->partition) {
+        ksu->partition = partition;
+        KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+    }
+}
+
+/**
+ * Start a new record of the current buffer (a new buffer is requested if the current one is full), the partition is
+ * written in front of the record if super K-mers are partitioned.
+ */
+static inline void KC__kmer_processor_store_record_start(KC__KmerProcessor* kp) {
+    KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
+    const bool partitioned = (ksu->partitions_count > 1);
+
+    if ((ksu->current_buffer != NULL) && (!KC__kmer_store_unit_mem_sufficient(ksu))) {
+        KC__kmer_processor_store_buffer_complete(kp, &(ksu->current_buffer));
+    }
+
+    if (ksu->current_buffer == NULL) {
+        KC__BufferType buffer_type = partitioned ? KC__BUFFER_TYPE_PARTITIONED_SUPER_KMER : KC__BUFFER_TYPE_SUPER_KMER;
+        KC__kmer_processor_store_buffer_request(kp, &(ksu->current_buffer), buffer_type);
+        KC__ASSERT(KC__kmer_store_unit_mem_sufficient(ksu));
+
+        ksu->super_kmers_count = (uint32_t*)KC__kmer_store_unit_mem_request(ksu, sizeof(uint32_t));
+        *(ksu->super_kmers_count) = kp->kmer_combine_unit.enabled ? KC__SUPER_KMERS_COUNTED_FLAG : 0;
+    }
+
+    *(ksu->super_kmers_count) += 1;
+    if (partitioned) {
+        uint8_t* partition = (uint8_t*)KC__kmer_store_unit_mem_request(ksu, sizeof(uint8_t));
+        *partition = (uint8_t)(ksu->partition);
+    }
+}
+
+/**
+ * Store the K bases of a K-mer to the current record.
+ */
+static inline void KC__kmer_processor_store_bases(KC__KmerProcessor* kp, const KC__unit_t* kmer) {
     KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
     KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
 
-    if (ksu->store_action == KC__KMER_STORE_ACTION_NEW) {
-        if ((ksu->current_buffer != NULL) && (!KC__kmer_store_unit_mem_sufficient(ksu))) {
-            KC__kmer_processor_store_buffer_complete(kp, &(ksu->current_buffer));
-        }
+    ksu->current_unit = NULL;
 
-        if (ksu->current_buffer == NULL) {
-            KC__kmer_processor_store_buffer_request(kp, &(ksu->current_buffer), KC__BUFFER_TYPE_SUPER_KMER);
-            KC__ASSERT(KC__kmer_store_unit_mem_sufficient(ksu));
+    size_t w = keu->gen_w_init;
+    size_t s = keu->gen_s_init;
+    for (size_t i = 0; i < keu->K; i++) {
+        KC__unit_t code = ((kmer[w] >> s) & 0x3);
+        KC__kmer_store_unit_expand(ksu, code);
 
-            ksu->super_kmers_count = (uint32_t*)KC__kmer_store_unit_mem_request(ksu, sizeof(uint32_t));
-            *(ksu->super_kmers_count) = 0;
+        if (s == 0) {
+            w--;
+            s = KC__UNIT_BIT - 2;
+        } else {
+            s -= 2;
         }
+    }
+}
+
+/**
+ * Store K-mer which failed to be added to hash map as (part of) super K-mer.
+ * @param kp K-mer processor.
+ * @param kmer The forward K-mer.
+ * @param last_code The code of the last base of the K-mer.
+ */
+static inline void KC__kmer_processor_store_kmer(KC__KmerProcessor* kp, const KC__unit_t* kmer, KC__unit_t last_code) {
+    KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
+    KC__KmerExtractUnit* keu = &(kp->kmer_extract_unit);
+
+    if (ksu->partitions_count > 1) {
+        KC__kmer_store_unit_update_partition(ksu, keu, kmer, last_code);
+    }
+
+    if (ksu->store_action == KC__KMER_STORE_ACTION_NEW) {
+        KC__kmer_processor_store_record_start(kp);
 
-        *(ksu->super_kmers_count) += 1;
         ksu->expanded_bases_count = (uint8_t*)KC__kmer_store_unit_mem_request(ksu, sizeof(uint8_t));
         *(ksu->expanded_bases_count) = 0;
-        ksu->current_unit = NULL;
-
-        size_t w = keu->gen_w_init;
-        size_t s = keu->gen_s_init;
-        for (size_t i = 0; i < keu->K; i++) {
-            KC__unit_t code = ((keu->kmer[w] >> s) & 0x3);
-            KC__kmer_store_unit_expand(ksu, code);
 
-            if (s == 0) {
-                w--;
-                s = KC__UNIT_BIT - 2;
-            } else {
-                s -= 2;
-            }
-        }
+        KC__kmer_processor_store_bases(kp, kmer);
 
         KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_EXPAND);
 
@@ -621,7 +1193,7 @@ static inline void KC__kmer_processor_store_kmer(KC__KmerProcessor* kp, KC__unit
         KC__kmer_store_unit_expand(ksu, last_code);
 
         *(ksu->expanded_bases_count) += 1;
-        if (*(ksu->expanded_bases_count) == UINT8_MAX) {
+        if (*(ksu->expanded_bases_count) == ksu->expanded_bases_max) {
             KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
         }
 
@@ -630,19 +1202,190 @@ static inline void KC__kmer_processor_store_kmer(KC__KmerProcessor* kp, KC__unit
     }
 }
 
-void KC__kmer_processor_handle_kmer(KC__KmerProcessor* kp, const KC__unit_t* canonical_kmer, size_t n, KC__unit_t last_code) {
+/**
+ * Store a K-mer with the count of its occurrences as a record of its own, the current super K-mer is ended.
+ * @param kp K-mer processor.
+ * @param kmer The canonical K-mer.
+ * @param count The count of the K-mer.
+ */
+static void KC__kmer_processor_store_counted_kmer(KC__KmerProcessor* kp, const KC__unit_t* kmer, KC__count_t count) {
     KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
 
-    if (n == 0) {
-        KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+    KC__ASSERT(kp->kmer_combine_unit.enabled);
+    KC__ASSERT((count > 0) && (count <= UINT8_MAX));
+
+    KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+    if (ksu->partitions_count > 1) {
+        KC__kmer_store_unit_update_partition(ksu, &(kp->kmer_extract_unit), kmer, 0);
     }
 
-    if (KC__hash_map_add_kmer(kp->hash_map, kp->id, canonical_kmer)) {
-        KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+    KC__kmer_processor_store_record_start(kp);
+
+    uint8_t* mark = (uint8_t*)KC__kmer_store_unit_mem_request(ksu, sizeof(uint8_t) * 2);
+    mark[0] = KC__SUPER_KMER_COUNTED_MARK;
+    mark[1] = (uint8_t)count;
+
+    KC__kmer_processor_store_bases(kp, kmer);
+
+    KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+}
+
+static inline KC__unit_t* KC__kmer_combine_unit_get_set(KC__KmerCombineUnit* kcu, const KC__unit_t* kmer, size_t W) {
+    size_t n = (size_t)(KC__hash_kmer(kmer, W) & (KC__COMBINER_SETS_COUNT - 1));
+    return (KC__unit_t*)(kcu->sets + n * kcu->set_size);
+}
+
+/**
+ * Count a rejected K-mer by the combiner.
+ * @param kp K-mer processor.
+ * @param kmer The canonical K-mer.
+ * @return If the occurrence is counted by the combiner, otherwise the K-mer should be stored.
+ */
+static inline bool KC__kmer_processor_combine_kmer(KC__KmerProcessor* kp, const KC__unit_t* kmer) {
+    KC__KmerCombineUnit* kcu = &(kp->kmer_combine_unit);
+    const size_t W = kp->kmer_extract_unit.W;
+
+    KC__unit_t* kmers = KC__kmer_combine_unit_get_set(kcu, kmer, W);
+    uint8_t* seen = (uint8_t*)(kmers + KC__COMBINER_WAYS_COUNT * W);
+    uint8_t* counts = seen + KC__COMBINER_WAYS_COUNT;
+
+    size_t slot = 0;
+    for (size_t i = 0; i < KC__COMBINER_WAYS_COUNT; i++) {
+        if (KC__kmer_extract_unit_compare_kmers(&(kp->kmer_extract_unit), kmers + i * W, kmer) == 0) {
+            if (seen[i] < UINT8_MAX) {
+                seen[i]++;
+            }
+            if (seen[i] < kcu->hot_threshold) {
+                return false;
+            }
+
+            if (counts[i] == UINT8_MAX) {
+                KC__kmer_processor_store_counted_kmer(kp, kmers + i * W, counts[i]);
+                counts[i] = 0;
+            }
+            counts[i]++;
+            return true;
+        }
+
+        if (seen[i] < seen[slot]) {
+            slot = i;
+        }
+    }
+
+    // The slots are aged by misses, so the K-mers not seen for a while are replaced first.
+    for (size_t i = 0; i < KC__COMBINER_WAYS_COUNT; i++) {
+        if (seen[i] > 0) {
+            seen[i]--;
+        }
+    }
+
+    if (counts[slot] > 0) {
+        // Storing the counted K-mer would end the super K-mer being expanded.
+        if (kp->kmer_store_unit.store_action == KC__KMER_STORE_ACTION_EXPAND) {
+            return false;
+        }
+        KC__kmer_processor_store_counted_kmer(kp, kmers + slot * W, counts[slot]);
+    }
+
+    for (size_t w = 0; w < W; w++) {
+        kmers[slot * W + w] = kmer[w];
+    }
+    counts[slot] = 0;
+    seen[slot] = 1;
+
+    return false;
+}
+
+/**
+ * Store the counts kept by the combiner, and clear it.
+ */
+static void KC__kmer_processor_flush_combiner(KC__KmerProcessor* kp) {
+    KC__KmerCombineUnit* kcu = &(kp->kmer_combine_unit);
+    const size_t W = kp->kmer_extract_unit.W;
+
+    for (size_t n = 0; n < KC__COMBINER_SETS_COUNT; n++) {
+        KC__unit_t* kmers = (KC__unit_t*)(kcu->sets + n * kcu->set_size);
+        uint8_t* counts = (uint8_t*)(kmers + KC__COMBINER_WAYS_COUNT * W) + KC__COMBINER_WAYS_COUNT;
+
+        for (size_t i = 0; i < KC__COMBINER_WAYS_COUNT; i++) {
+            if (counts[i] > 0) {
+                KC__kmer_processor_store_counted_kmer(kp, kmers + i * W, counts[i]);
+            }
+        }
+    }
+
+    memset(kcu->sets, 0, kcu->set_size * KC__COMBINER_SETS_COUNT);
+}
+
+/**
+ * Add a counted K-mer read from tmp file to hash map, the rest of the count is stored again once it is rejected.
+ */
+static void KC__kmer_processor_add_counted_kmer(KC__KmerProcessor* kp, const KC__unit_t* canonical_kmer, KC__count_t count) {
+    for (KC__count_t c = 0; c < count; c++) {
+        if (!KC__hash_map_add_kmer(kp->hash_map, kp->id, canonical_kmer)) {
+            KC__kmer_processor_store_counted_kmer(kp, canonical_kmer, count - c);
+            break;
+        }
+    }
+}
+
+/**
+ * Add all K-mers of the batch to hash map, and store the ones failed to be added in order.
+ * @param kp K-mer processor.
+ */
+static void KC__kmer_processor_flush_kmers(KC__KmerProcessor* kp) {
+    KC__KmerBatchUnit* kbu = &(kp->kmer_batch_unit);
+    KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
+    const size_t W = kp->kmer_extract_unit.W;
+
+    if (kbu->count == 0) {
         return;
     }
 
-    KC__kmer_processor_store_kmer(kp, last_code);
+    KC__hash_map_add_kmers_batch(kp->hash_map, kp->id, kbu->canonical_kmers, kbu->count, kbu->added);
+
+    if (kp->kmer_combine_unit.enabled) {
+        for (size_t i = 0; i < kbu->count; i++) {
+            if (!(kbu->added[i])) {
+                __builtin_prefetch(KC__kmer_combine_unit_get_set(&(kp->kmer_combine_unit), kbu->canonical_kmers + i * W, W), 1, 3);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < kbu->count; i++) {
+        if (kbu->first[i] || kbu->added[i]) {
+            KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+        }
+
+        if (!(kbu->added[i])) {
+            if (kp->kmer_combine_unit.enabled && KC__kmer_processor_combine_kmer(kp, kbu->canonical_kmers + i * W)) {
+                KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+            } else {
+                KC__kmer_processor_store_kmer(kp, kbu->kmers + i * W, kbu->last_codes[i]);
+            }
+        }
+    }
+
+    kbu->count = 0;
+}
+
+/**
+ * Store a K-mer rejected by the partition drained by this thread, it is stored as a super K-mer of its own, and the
+ * current super K-mer of this thread is ended.
+ */
+static void KC__kmer_processor_reject_kmer_callback(const KC__unit_t* kmer, void* data) {
+    KC__KmerProcessor* kp = data;
+    KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
+
+    KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+    if (!(kp->kmer_combine_unit.enabled && KC__kmer_processor_combine_kmer(kp, kmer))) {
+        KC__kmer_processor_store_kmer(kp, kmer, 0);
+    }
+    KC__kmer_store_unit_set_action(ksu, KC__KMER_STORE_ACTION_NEW);
+}
+
+void KC__kmer_processor_handle_kmer(KC__KmerProcessor* kp, const KC__unit_t* canonical_kmer, size_t n, KC__unit_t last_code) {
+    KC__kmer_processor_batch_kmer(kp, kp->kmer_extract_unit.W, canonical_kmer, n, last_code);
 }
 
 
@@ -737,12 +1480,24 @@ void KC__kmer_processor_get_exported_kmers_stats(KC__KmerProcessor* kp, size_t*
 
 
 void KC__kmer_processor_finish(KC__KmerProcessor* kp) {
+    // Nothing is batched or stored while the K-mers are added to the sketch.
+    if (kp->sketch != NULL) {
+        return;
+    }
+
+    KC__kmer_processor_flush_kmers(kp);
+
+    // K-mers routed from other threads may still be rejected before adding finished.
+    KC__hash_map_finish_adding_kmers(kp->hash_map, kp->id);
+
+    if (kp->kmer_combine_unit.enabled) {
+        KC__kmer_processor_flush_combiner(kp);
+    }
+
     KC__KmerStoreUnit* ksu = &(kp->kmer_store_unit);
     if (ksu->current_buffer != NULL) {
         KC__kmer_processor_store_buffer_complete(kp, &(ksu->current_buffer));
     }
-
-    KC__hash_map_finish_adding_kmers(kp->hash_map, kp->id);
 }
 
 void* KC__kmer_processor_work_extract(void* ptr) {
@@ -760,11 +1515,11 @@ void* KC__kmer_processor_work_extract(void* ptr) {
 
     KC__kmer_processor_finish(kp);
 
-    pthread_exit(NULL);
+    return NULL;
 }
 
 void* KC__kmer_processor_work_export(void* ptr) {
     KC__KmerProcessor* kp = ptr;
     KC__kmer_processor_export_kmers(kp);
-    pthread_exit(NULL);
+    return NULL;
 }
\ No newline at end of file
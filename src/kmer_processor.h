@@ -26,6 +26,7 @@
 #include "mem_allocator.h"
 #include "buffer_queue.h"
 #include "hash_map.h"
+#include "kmer_sketch.h"
 
 
 struct KC__KmerProcessor;
@@ -40,11 +41,37 @@ KC__KmerProcessor* KC__kmer_processor_create(KC__MemAllocator* mem_allocator, si
 void KC__kmer_processor_free(KC__MemAllocator* mem_allocator, KC__KmerProcessor* kmer_processor);
 void KC__kmer_processor_link_modules(KC__KmerProcessor* kmer_processor, KC__HashMap* hash_map, KC__BufferQueue* read_buffer_queue, KC__BufferQueue* write_buffer_queue);
 
+/**
+ * The read and K-mer callbacks replace the handling of reads and K-mers by the processor (for tests), NULL restores it.
+ */
 void KC__kmer_processor_set_read_callback(KC__KmerProcessor* kmer_processor, KC__KmerProcessorReadCallback read_callback);
 void KC__kmer_processor_set_kmer_callback(KC__KmerProcessor* kmer_processor, KC__KmerProcessorKmerCallback kmer_callback);
+/**
+ * Add the K-mers to the sketch instead of the hash map (for the pre-scan), NULL restores it. The hash map linked may be
+ * NULL while the sketch is set.
+ * @param kmer_processor K-mer processor.
+ * @param sketch K-mer sketch, owned by the caller.
+ */
+void KC__kmer_processor_set_sketch(KC__KmerProcessor* kmer_processor, KC__KmerSketch* sketch);
+
 void KC__kmer_processor_set_store_buffer_request_callback(KC__KmerProcessor* kmer_processor, KC__KmerProcessorStoreBufferRequestCallback request_callback);
 void KC__kmer_processor_set_store_buffer_complete_callback(KC__KmerProcessor* kmer_processor, KC__KmerProcessorStoreBufferCompleteCallback complete_callback);
 
+/**
+ * Split the stored super K-mers by the minimizers of K-mers into partitions, should be called between passes.
+ * @param kmer_processor K-mer processor.
+ * @param partitions_count Partitions count, 1 means the super K-mers are not partitioned.
+ */
+void KC__kmer_processor_set_spill_partitions_count(KC__KmerProcessor* kmer_processor, size_t partitions_count);
+
+/**
+ * Combine the frequent K-mers failed to be added into counted K-mers before they are stored, should be called before
+ * the first pass.
+ * @param mem_allocator Memory allocator.
+ * @param kmer_processor K-mer processor.
+ */
+void KC__kmer_processor_init_combiner(KC__MemAllocator* mem_allocator, KC__KmerProcessor* kmer_processor);
+
 void KC__kmer_processor_handle_buffer(KC__KmerProcessor* kmer_processor, const KC__Buffer* buffer);
 void KC__kmer_processor_handle_read(KC__KmerProcessor* kmer_processor, const char* read, size_t read_length);
 void KC__kmer_processor_handle_kmer(KC__KmerProcessor* kmer_processor, const KC__unit_t* kmer, size_t n, KC__unit_t last_code);
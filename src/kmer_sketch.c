@@ -0,0 +1,181 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include "kmer_sketch.h"
+#include "logging.h"
+#include "assert.h"
+
+
+typedef struct {
+    uint64_t hash;
+    KC__count_t count;
+} KC__KmerSketchEntry;
+
+/**
+ * The kept K-mers are in the entries array in the order they are added, and are found by their hashes through a table of
+ * entry indexes (plus 1, 0 as empty) with linear probing. The table is indexed by the low bits of the hashes, as the high
+ * bits are the cleared ones. The table is rebuilt when the level is raised.
+ */
+struct KC__KmerSketch {
+    KC__KmerSketchEntry* entries;
+    size_t entries_count;
+    size_t capacity;
+
+    uint32_t* slots;
+    size_t slots_mask;
+
+    size_t level;
+    /** The top level bits, a K-mer is kept if none of them is set in its hash. */
+    uint64_t level_mask;
+};
+
+
+KC__KmerSketch* KC__kmer_sketch_create(KC__MemAllocator* ma, size_t capacity) {
+    KC__ASSERT((capacity > 0) && (capacity < UINT32_MAX));
+
+    KC__KmerSketch* sk = (KC__KmerSketch*)KC__mem_alloc(ma, sizeof(KC__KmerSketch), "kmer sketch");
+
+    sk->capacity = capacity;
+    // An entry over the capacity is kept until the level is raised.
+    sk->entries = (KC__KmerSketchEntry*)KC__mem_alloc(ma, sizeof(KC__KmerSketchEntry) * (capacity + 1), "kmer sketch entries");
+    sk->entries_count = 0;
+
+    // Half of the slots at most are taken.
+    size_t slots_count = 1;
+    while (slots_count < (capacity + 1) * 2) {
+        slots_count <<= 1;
+    }
+    sk->slots = (uint32_t*)KC__mem_alloc(ma, sizeof(uint32_t) * slots_count, "kmer sketch slots");
+    memset(sk->slots, 0, sizeof(uint32_t) * slots_count);
+    sk->slots_mask = slots_count - 1;
+
+    sk->level = 0;
+    sk->level_mask = 0;
+
+    return sk;
+}
+
+void KC__kmer_sketch_free(KC__MemAllocator* ma, KC__KmerSketch* sk) {
+    KC__mem_free(ma, sk->entries);
+    KC__mem_free(ma, sk->slots);
+    KC__mem_free(ma, sk);
+}
+
+static inline bool KC__kmer_sketch_keeps(const KC__KmerSketch* sk, uint64_t hash) {
+    return (hash & sk->level_mask) == 0;
+}
+
+/**
+ * Find the slot of the hash, which is empty if the hash is not kept.
+ */
+static inline size_t KC__kmer_sketch_find_slot(const KC__KmerSketch* sk, uint64_t hash) {
+    size_t s = (size_t)hash & sk->slots_mask;
+    while ((sk->slots[s] != 0) && (sk->entries[sk->slots[s] - 1].hash != hash)) {
+        s = (s + 1) & sk->slots_mask;
+    }
+    return s;
+}
+
+/**
+ * Raise the level until the kept K-mers are no more than the capacity, the entries dropped are removed, and the table
+ * of the rest is rebuilt.
+ */
+static void KC__kmer_sketch_raise_level(KC__KmerSketch* sk, size_t level) {
+    KC__ASSERT(level <= 64);
+
+    while (true) {
+        sk->level = level;
+        sk->level_mask = (level == 0) ? 0 : (UINT64_MAX << (64 - level));
+
+        size_t n = 0;
+        for (size_t i = 0; i < sk->entries_count; i++) {
+            if (KC__kmer_sketch_keeps(sk, sk->entries[i].hash)) {
+                sk->entries[n++] = sk->entries[i];
+            }
+        }
+        sk->entries_count = n;
+
+        if ((n <= sk->capacity) || (level == 64)) {
+            break;
+        }
+        level++;
+    }
+
+    memset(sk->slots, 0, sizeof(uint32_t) * (sk->slots_mask + 1));
+    for (size_t i = 0; i < sk->entries_count; i++) {
+        sk->slots[KC__kmer_sketch_find_slot(sk, sk->entries[i].hash)] = (uint32_t)(i + 1);
+    }
+
+    LOGGING_DEBUG("K-mer sketch level raised to %zu, %zu K-mers kept.", sk->level, sk->entries_count);
+}
+
+static void KC__kmer_sketch_insert(KC__KmerSketch* sk, uint64_t hash, KC__count_t count) {
+    const size_t s = KC__kmer_sketch_find_slot(sk, hash);
+    if (sk->slots[s] != 0) {
+        KC__KmerSketchEntry* entry = &(sk->entries[sk->slots[s] - 1]);
+        entry->count = (entry->count > KC__COUNT_MAX - count) ? KC__COUNT_MAX : (entry->count + count);
+        return;
+    }
+
+    sk->entries[sk->entries_count].hash = hash;
+    sk->entries[sk->entries_count].count = count;
+    sk->entries_count++;
+    sk->slots[s] = (uint32_t)(sk->entries_count);
+
+    if (sk->entries_count > sk->capacity) {
+        KC__kmer_sketch_raise_level(sk, sk->level + 1);
+    }
+}
+
+void KC__kmer_sketch_add(KC__KmerSketch* sk, uint64_t hash) {
+    if (KC__kmer_sketch_keeps(sk, hash)) {
+        KC__kmer_sketch_insert(sk, hash, 1);
+    }
+}
+
+void KC__kmer_sketch_merge(KC__KmerSketch* sk, const KC__KmerSketch* other) {
+    // The K-mers dropped by the other sketch are dropped by this one too.
+    if (sk->level < other->level) {
+        KC__kmer_sketch_raise_level(sk, other->level);
+    }
+
+    for (size_t i = 0; i < other->entries_count; i++) {
+        const KC__KmerSketchEntry* entry = &(other->entries[i]);
+        // The level may be raised by the merged entries.
+        if (KC__kmer_sketch_keeps(sk, entry->hash)) {
+            KC__kmer_sketch_insert(sk, entry->hash, entry->count);
+        }
+    }
+}
+
+size_t KC__kmer_sketch_estimate(const KC__KmerSketch* sk, KC__count_t count_min) {
+    size_t n = 0;
+    for (size_t i = 0; i < sk->entries_count; i++) {
+        if (sk->entries[i].count >= count_min) {
+            n++;
+        }
+    }
+
+    if (sk->level >= 64) {
+        return (n == 0) ? 0 : SIZE_MAX;
+    }
+    return (n > (SIZE_MAX >> sk->level)) ? SIZE_MAX : (n << sk->level);
+}
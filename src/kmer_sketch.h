@@ -0,0 +1,63 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+#ifndef KC__KMER_SKETCH_H
+#define KC__KMER_SKETCH_H
+
+#include <stdint.h>
+#include "types.h"
+#include "mem_allocator.h"
+
+
+/**
+ * Sketch of the distinct K-mers by hash sampling. Only the K-mers whose hashes have the top level bits cleared are
+ * kept, each with its exact count, and the level is raised whenever more K-mers than the capacity are kept. So the
+ * kept K-mers are a uniform sample of 1 / 2^level of the distinct ones, which estimates both the distinct K-mers and the
+ * ones seen at least a few times (solid), unlike a HyperLogLog which only estimates the distinct ones. The relative
+ * error is about 1 / sqrt(capacity / 2).
+ */
+struct KC__KmerSketch;
+typedef struct KC__KmerSketch KC__KmerSketch;
+
+KC__KmerSketch* KC__kmer_sketch_create(KC__MemAllocator* mem_allocator, size_t capacity);
+void KC__kmer_sketch_free(KC__MemAllocator* mem_allocator, KC__KmerSketch* kmer_sketch);
+
+/**
+ * Add a K-mer by its hash, should be called by one thread at a time.
+ * @param kmer_sketch The K-mer sketch.
+ * @param hash The 64-bit hash of the canonical K-mer.
+ */
+void KC__kmer_sketch_add(KC__KmerSketch* kmer_sketch, uint64_t hash);
+
+/**
+ * Add the K-mers of another sketch, as if they were added to this one.
+ * @param kmer_sketch The K-mer sketch.
+ * @param other The sketch to be merged, not changed.
+ */
+void KC__kmer_sketch_merge(KC__KmerSketch* kmer_sketch, const KC__KmerSketch* other);
+
+/**
+ * Estimate the count of distinct K-mers seen at least count_min times, exact if the level has never been raised.
+ * @param kmer_sketch The K-mer sketch.
+ * @param count_min The min count, 1 for all distinct K-mers.
+ * @return The estimated count.
+ */
+size_t KC__kmer_sketch_estimate(const KC__KmerSketch* kmer_sketch, KC__count_t count_min);
+
+#endif
@@ -0,0 +1,562 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include "pthread_barrier.h"
+#endif // __APPLE__
+
+#include <string.h>
+#include "kmer_sorter.h"
+#include "logging.h"
+#include "assert.h"
+#include "utils.h"
+
+
+#define KC__KMER_SORTER_RUNS_MAX 1024
+
+
+typedef struct {
+    KC__count_t count;
+    KC__unit_t kmer[];
+} KC__KmerSorterRecord;
+
+typedef struct {
+    /** Index of the first record. */
+    size_t start;
+    size_t length;
+} KC__KmerSorterRun;
+
+/**
+ * Position of a run being merged, records between current and end are not merged yet.
+ */
+typedef struct {
+    size_t current;
+    size_t end;
+} KC__KmerSorterCursor;
+
+typedef struct {
+    KC__unit_t* kmers;
+    size_t length;
+
+    /** Buffer of radix sort. */
+    KC__unit_t* tmp_kmers;
+
+    /** Heap of the runs being merged by this thread. */
+    KC__KmerSorterCursor* cursors;
+
+    bool synced;
+} KC__KmerSorterThread;
+
+
+struct KC__KmerSorter {
+    size_t kmer_width;
+    size_t kmer_size;
+    size_t record_size;
+
+    KC__KmerSorterThread** threads;
+    size_t threads_count;
+    /** Count of K-mers the array of each thread can hold. */
+    size_t buffer_capacity;
+
+    char* records;
+    size_t records_capacity;
+    size_t records_used;
+    /**
+     * The runs are locked once fewer records than this are left, so that the array of every thread can still be flushed
+     * once when the threads sync.
+     */
+    size_t records_reserved;
+
+    KC__KmerSorterRun runs[KC__KMER_SORTER_RUNS_MAX];
+    size_t runs_count;
+    /** Guards the runs, the records of a run are written with it held, and runs are compacted with it held. */
+    pthread_mutex_t runs_mtx;
+
+    /**
+     * The same size as records. The runs are merged into it when they are compacted (after which the two are swapped) or
+     * locked.
+     */
+    char* merged_records;
+    size_t merged_count;
+    KC__KmerSorterCursor* merge_cursors;
+
+    bool locked;
+    pthread_barrier_t barrier;
+};
+
+
+KC__KmerSorter* KC__kmer_sorter_create(KC__MemAllocator* ma, size_t K, size_t threads_count, size_t mem_limit) {
+    KC__KmerSorter* ks = (KC__KmerSorter*)KC__mem_alloc(ma, sizeof(struct KC__KmerSorter), "kmer sorter");
+
+    ks->kmer_width = KC__calculate_kmer_width(K);
+    ks->kmer_size = KC__calculate_kmer_size(K);
+    ks->record_size = sizeof(KC__KmerSorterRecord) + ks->kmer_size;
+
+    ks->threads_count = threads_count;
+    ks->threads = (KC__KmerSorterThread**)KC__mem_alloc(ma, sizeof(KC__KmerSorterThread*) * ks->threads_count, "kmer sorter threads array");
+    for (size_t i = 0; i < ks->threads_count; i++) {
+        ks->threads[i] = (KC__KmerSorterThread*)KC__mem_aligned_alloc(ma, sizeof(KC__KmerSorterThread), "kmer sorter thread");
+        ks->threads[i]->cursors = (KC__KmerSorterCursor*)KC__mem_alloc(ma, sizeof(KC__KmerSorterCursor) * KC__KMER_SORTER_RUNS_MAX, "kmer sorter cursors");
+    }
+    ks->merge_cursors = (KC__KmerSorterCursor*)KC__mem_alloc(ma, sizeof(KC__KmerSorterCursor) * KC__KMER_SORTER_RUNS_MAX, "kmer sorter merge cursors");
+
+    size_t mem = KC__mem_available(ma);
+    if (mem > mem_limit) {
+        mem = mem_limit;
+    }
+
+    // The merged records take as much memory as the runs, and the arrays of threads (with their radix sort buffers)
+    // take 1/8 of it.
+    const size_t records_mem = mem / 17 * 8;
+    ks->records_capacity = records_mem / ks->record_size;
+    ks->buffer_capacity = (mem - records_mem * 2) / (ks->kmer_size * ks->threads_count * 2);
+    ks->records_reserved = ks->buffer_capacity * ks->threads_count;
+    KC__ASSERT(ks->buffer_capacity > 0);
+    KC__ASSERT(ks->records_capacity > ks->records_reserved * 2);
+
+    ks->records = (char*)KC__mem_aligned_alloc(ma, ks->record_size * ks->records_capacity, "kmer sorter records");
+    ks->merged_records = (char*)KC__mem_aligned_alloc(ma, ks->record_size * ks->records_capacity, "kmer sorter merged records");
+    for (size_t i = 0; i < ks->threads_count; i++) {
+        ks->threads[i]->kmers = (KC__unit_t*)KC__mem_aligned_alloc(ma, ks->kmer_size * ks->buffer_capacity, "kmer sorter thread kmers");
+        ks->threads[i]->tmp_kmers = (KC__unit_t*)KC__mem_aligned_alloc(ma, ks->kmer_size * ks->buffer_capacity, "kmer sorter thread tmp kmers");
+    }
+
+    LOGGING_DEBUG("Sorter records capacity: %zu (reserved: %zu)", ks->records_capacity, ks->records_reserved);
+    LOGGING_DEBUG("  Sorter records memory: %zu", ks->record_size * ks->records_capacity * 2);
+    LOGGING_DEBUG("Sorter buffers capacity: %zu", ks->buffer_capacity);
+
+    pthread_mutex_init(&(ks->runs_mtx), NULL);
+    pthread_barrier_init(&(ks->barrier), NULL, (unsigned int)threads_count);
+
+    KC__kmer_sorter_clear(ks);
+
+    return ks;
+}
+
+void KC__kmer_sorter_free(KC__MemAllocator* ma, KC__KmerSorter* ks) {
+    for (size_t i = 0; i < ks->threads_count; i++) {
+        KC__mem_free(ma, ks->threads[i]->kmers);
+        KC__mem_free(ma, ks->threads[i]->tmp_kmers);
+        KC__mem_free(ma, ks->threads[i]->cursors);
+        KC__mem_free(ma, ks->threads[i]);
+    }
+    KC__mem_free(ma, ks->threads);
+    KC__mem_free(ma, ks->merge_cursors);
+
+    KC__mem_free(ma, ks->records);
+    KC__mem_free(ma, ks->merged_records);
+
+    pthread_mutex_destroy(&(ks->runs_mtx));
+    pthread_barrier_destroy(&(ks->barrier));
+
+    KC__mem_free(ma, ks);
+}
+
+size_t KC__kmer_sorter_max_key_count(const KC__KmerSorter* ks) {
+    return ks->records_capacity;
+}
+
+void KC__kmer_sorter_clear(KC__KmerSorter* ks) {
+    for (size_t i = 0; i < ks->threads_count; i++) {
+        ks->threads[i]->length = 0;
+        ks->threads[i]->synced = false;
+    }
+
+    ks->records_used = 0;
+    ks->runs_count = 0;
+    ks->merged_count = 0;
+    ks->locked = false;
+}
+
+static inline KC__KmerSorterRecord* KC__kmer_sorter_get_record(const KC__KmerSorter* ks, char* records, size_t idx) {
+    return (KC__KmerSorterRecord*)(records + ks->record_size * idx);
+}
+
+/**
+ * K-mers are ordered by units from the last one, which holds the first bases.
+ */
+static inline int KC__kmer_sorter_compare(const KC__KmerSorter* ks, const KC__unit_t* kmer_1, const KC__unit_t* kmer_2) {
+    for (size_t i = ks->kmer_width; i > 0; i--) {
+        if (kmer_1[i - 1] < kmer_2[i - 1]) {
+            return -1;
+        } else if (kmer_1[i - 1] > kmer_2[i - 1]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline KC__count_t KC__kmer_sorter_add_count(KC__count_t count_1, KC__count_t count_2) {
+    return (count_1 > KC__COUNT_MAX - count_2) ? KC__COUNT_MAX : (count_1 + count_2);
+}
+
+/**
+ * LSD radix sort by bytes, the digits shared by all K-mers (such as the bits beyond 2K) are skipped.
+ * @return The buffer holding the sorted K-mers, either kmers or tmp_kmers.
+ */
+static KC__unit_t* KC__kmer_sorter_radix_sort(const KC__KmerSorter* ks, KC__unit_t* kmers, KC__unit_t* tmp_kmers, size_t n) {
+    const size_t W = ks->kmer_width;
+    KC__unit_t* src = kmers;
+    KC__unit_t* dest = tmp_kmers;
+    size_t offsets[256];
+
+    for (size_t w = 0; w < W; w++) {
+        for (size_t shift = 0; shift < KC__UNIT_BIT; shift += 8) {
+            memset(offsets, 0, sizeof(offsets));
+            for (size_t i = 0; i < n; i++) {
+                offsets[(src[i * W + w] >> shift) & 0xff]++;
+            }
+            if (offsets[(src[w] >> shift) & 0xff] == n) {
+                continue;
+            }
+
+            size_t sum = 0;
+            for (size_t d = 0; d < 256; d++) {
+                size_t c = offsets[d];
+                offsets[d] = sum;
+                sum += c;
+            }
+
+            for (size_t i = 0; i < n; i++) {
+                size_t pos = offsets[(src[i * W + w] >> shift) & 0xff]++;
+                memcpy(dest + pos * W, src + i * W, ks->kmer_size);
+            }
+
+            KC__unit_t* tmp = src;
+            src = dest;
+            dest = tmp;
+        }
+    }
+
+    return src;
+}
+
+static inline bool KC__kmer_sorter_cursor_less(const KC__KmerSorter* ks, const KC__KmerSorterCursor* cursor_1, const KC__KmerSorterCursor* cursor_2) {
+    const KC__KmerSorterRecord* record_1 = KC__kmer_sorter_get_record(ks, ks->records, cursor_1->current);
+    const KC__KmerSorterRecord* record_2 = KC__kmer_sorter_get_record(ks, ks->records, cursor_2->current);
+    return KC__kmer_sorter_compare(ks, record_1->kmer, record_2->kmer) < 0;
+}
+
+static void KC__kmer_sorter_sift_down(const KC__KmerSorter* ks, KC__KmerSorterCursor* heap, size_t size, size_t i) {
+    while (true) {
+        size_t min = i;
+        size_t left = i * 2 + 1;
+        size_t right = left + 1;
+        if ((left < size) && KC__kmer_sorter_cursor_less(ks, &(heap[left]), &(heap[min]))) {
+            min = left;
+        }
+        if ((right < size) && KC__kmer_sorter_cursor_less(ks, &(heap[right]), &(heap[min]))) {
+            min = right;
+        }
+        if (min == i) {
+            break;
+        }
+
+        KC__KmerSorterCursor tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/**
+ * Merge ranges of runs by a min heap, equal K-mers of different runs are collapsed.
+ * @return The count of K-mers passed to the callback.
+ */
+static size_t KC__kmer_sorter_merge(const KC__KmerSorter* ks, KC__KmerSorterCursor* heap, size_t size, KC__KmerSorterExportCallback callback, void* data) {
+    for (size_t i = size / 2; i > 0; i--) {
+        KC__kmer_sorter_sift_down(ks, heap, size, i - 1);
+    }
+
+    size_t merged_count = 0;
+    const KC__unit_t* kmer = NULL;
+    KC__count_t count = 0;
+
+    while (size > 0) {
+        const KC__KmerSorterRecord* record = KC__kmer_sorter_get_record(ks, ks->records, heap[0].current);
+        if ((kmer != NULL) && (KC__kmer_sorter_compare(ks, kmer, record->kmer) == 0)) {
+            count = KC__kmer_sorter_add_count(count, record->count);
+        } else {
+            if (kmer != NULL) {
+                callback(kmer, count, data);
+                merged_count++;
+            }
+            kmer = record->kmer;
+            count = record->count;
+        }
+
+        heap[0].current++;
+        if (heap[0].current == heap[0].end) {
+            size--;
+            heap[0] = heap[size];
+        }
+        KC__kmer_sorter_sift_down(ks, heap, size, 0);
+    }
+
+    if (kmer != NULL) {
+        callback(kmer, count, data);
+        merged_count++;
+    }
+
+    return merged_count;
+}
+
+static void KC__kmer_sorter_append_merged_callback(const KC__unit_t* kmer, KC__count_t count, void* data) {
+    KC__KmerSorter* ks = data;
+    KC__KmerSorterRecord* record = KC__kmer_sorter_get_record(ks, ks->merged_records, ks->merged_count++);
+    memcpy(record->kmer, kmer, ks->kmer_size);
+    record->count = count;
+}
+
+static void KC__kmer_sorter_merge_runs(KC__KmerSorter* ks) {
+    KC__KmerSorterCursor* heap = ks->merge_cursors;
+    for (size_t i = 0; i < ks->runs_count; i++) {
+        heap[i].current = ks->runs[i].start;
+        heap[i].end = ks->runs[i].start + ks->runs[i].length;
+    }
+
+    ks->merged_count = 0;
+    KC__kmer_sorter_merge(ks, heap, ks->runs_count, KC__kmer_sorter_append_merged_callback, ks);
+
+    LOGGING_DEBUG("K-mer sorter merged %zu runs (records: %zu, merged: %zu).", ks->runs_count, ks->records_used, ks->merged_count);
+}
+
+/**
+ * Merge all runs into one, which collapses the K-mers repeated in different runs.
+ */
+static void KC__kmer_sorter_compact_runs(KC__KmerSorter* ks) {
+    KC__kmer_sorter_merge_runs(ks);
+
+    char* records = ks->records;
+    ks->records = ks->merged_records;
+    ks->merged_records = records;
+
+    ks->runs[0].start = 0;
+    ks->runs[0].length = ks->merged_count;
+    ks->runs_count = 1;
+    ks->records_used = ks->merged_count;
+    ks->merged_count = 0;
+}
+
+static inline bool KC__kmer_sorter_run_fits(const KC__KmerSorter* ks, size_t length, size_t records_limit) {
+    return (ks->records_used + length + ks->records_reserved <= records_limit) && (ks->runs_count + ks->threads_count < KC__KMER_SORTER_RUNS_MAX);
+}
+
+/**
+ * Sort the K-mers of the thread and collapse them into a new run.
+ */
+static void KC__kmer_sorter_flush(KC__KmerSorter* ks, size_t n) {
+    KC__KmerSorterThread* thread = ks->threads[n];
+    const size_t W = ks->kmer_width;
+    const size_t length = thread->length;
+
+    if (length == 0) {
+        return;
+    }
+
+    const KC__unit_t* kmers = KC__kmer_sorter_radix_sort(ks, thread->kmers, thread->tmp_kmers, length);
+
+    size_t unique_count = 1;
+    for (size_t i = 1; i < length; i++) {
+        if (KC__kmer_sorter_compare(ks, kmers + i * W, kmers + (i - 1) * W) != 0) {
+            unique_count++;
+        }
+    }
+
+    pthread_mutex_lock(&(ks->runs_mtx));
+
+    if (!(ks->locked) && !KC__kmer_sorter_run_fits(ks, unique_count, ks->records_capacity)) {
+        KC__kmer_sorter_compact_runs(ks);
+
+        // Compacting again soon would cost more than it saves, lock the runs unless a good part of records is free.
+        if (!KC__kmer_sorter_run_fits(ks, unique_count, ks->records_capacity / 8 * 7)) {
+            __atomic_store_n(&(ks->locked), true, __ATOMIC_RELEASE);
+            LOGGING_DEBUG("Set K-mer sorter runs locked.");
+        }
+    }
+
+    KC__ASSERT(ks->records_used + unique_count <= ks->records_capacity);
+    KC__ASSERT(ks->runs_count < KC__KMER_SORTER_RUNS_MAX);
+    ks->runs[ks->runs_count].start = ks->records_used;
+    ks->runs[ks->runs_count].length = unique_count;
+    ks->runs_count++;
+
+    KC__KmerSorterRecord* record = NULL;
+    size_t idx = ks->records_used;
+    for (size_t i = 0; i < length; i++) {
+        if ((record != NULL) && (KC__kmer_sorter_compare(ks, kmers + i * W, record->kmer) == 0)) {
+            record->count = KC__kmer_sorter_add_count(record->count, 1);
+        } else {
+            record = KC__kmer_sorter_get_record(ks, ks->records, idx++);
+            memcpy(record->kmer, kmers + i * W, ks->kmer_size);
+            record->count = 1;
+        }
+    }
+    ks->records_used += unique_count;
+
+    pthread_mutex_unlock(&(ks->runs_mtx));
+
+    thread->length = 0;
+}
+
+/**
+ * Flush the array of the thread and wait for the others, the runs are merged by thread 0 if they have been locked.
+ */
+static void KC__kmer_sorter_sync(KC__KmerSorter* ks, size_t n) {
+    KC__kmer_sorter_flush(ks, n);
+
+    // All threads have stopped appending after this, the runs will not change any more.
+    pthread_barrier_wait(&(ks->barrier));
+    if ((n == 0) && ks->locked) {
+        KC__kmer_sorter_merge_runs(ks);
+    }
+    pthread_barrier_wait(&(ks->barrier));
+
+    ks->threads[n]->synced = true;
+    LOGGING_DEBUG("K-mer sorter thread #%zu synced.", n);
+}
+
+static bool KC__kmer_sorter_count_merged_kmer(KC__KmerSorter* ks, const KC__unit_t* kmer) {
+    size_t low = 0;
+    size_t high = ks->merged_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        KC__KmerSorterRecord* record = KC__kmer_sorter_get_record(ks, ks->merged_records, mid);
+        int result = KC__kmer_sorter_compare(ks, record->kmer, kmer);
+        if (result == 0) {
+            KC__count_t count;
+            do {
+                count = record->count;
+                if (count == KC__COUNT_MAX)
+                    break;
+            } while (!__sync_bool_compare_and_swap(&(record->count), count, count + 1));
+            return true;
+        } else if (result < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+bool KC__kmer_sorter_add_kmer(KC__KmerSorter* ks, size_t n, const KC__unit_t* kmer) {
+    KC__KmerSorterThread* thread = ks->threads[n];
+
+    if (!(thread->synced) && __atomic_load_n(&(ks->locked), __ATOMIC_ACQUIRE)) {
+        KC__kmer_sorter_sync(ks, n);
+    }
+
+    if (thread->synced) {
+        KC__ASSERT(ks->locked);
+        return KC__kmer_sorter_count_merged_kmer(ks, kmer);
+    }
+
+    memcpy(thread->kmers + thread->length * ks->kmer_width, kmer, ks->kmer_size);
+    thread->length++;
+
+    if (thread->length == ks->buffer_capacity) {
+        KC__kmer_sorter_flush(ks, n);
+
+        // The flush sees the lock under the mutex, it is the last flush of this thread allowed by the reserved records.
+        if (ks->locked) {
+            KC__kmer_sorter_sync(ks, n);
+        }
+    }
+
+    return true;
+}
+
+void KC__kmer_sorter_finish_adding_kmers(KC__KmerSorter* ks, size_t n) {
+    if (!(ks->threads[n]->synced)) {
+        KC__kmer_sorter_sync(ks, n);
+    }
+}
+
+/**
+ * Find the first record of the run not less than the K-mer.
+ */
+static size_t KC__kmer_sorter_lower_bound(const KC__KmerSorter* ks, const KC__KmerSorterRun* run, const KC__unit_t* kmer) {
+    size_t low = run->start;
+    size_t high = run->start + run->length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (KC__kmer_sorter_compare(ks, KC__kmer_sorter_get_record(ks, ks->records, mid)->kmer, kmer) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void KC__kmer_sorter_export(KC__KmerSorter* ks, size_t n, KC__KmerSorterExportCallback callback, void* data, size_t* exported_count) {
+    const size_t T = ks->threads_count;
+    size_t ec = 0;
+
+    KC__ASSERT(n < T);
+
+    if (ks->locked) {
+        size_t start = ks->merged_count / T * n;
+        size_t end = (n == T - 1) ? (ks->merged_count) : (ks->merged_count / T * (n + 1));
+        for (size_t i = start; i < end; i++) {
+            KC__KmerSorterRecord* record = KC__kmer_sorter_get_record(ks, ks->merged_records, i);
+            callback(record->kmer, record->count, data);
+            ec++;
+        }
+    } else if (ks->runs_count > 0) {
+        // The K-mers of the longest run split the key space into the ranges of threads.
+        const KC__KmerSorterRun* longest = &(ks->runs[0]);
+        for (size_t i = 1; i < ks->runs_count; i++) {
+            if (ks->runs[i].length > longest->length) {
+                longest = &(ks->runs[i]);
+            }
+        }
+        const KC__unit_t* start_kmer = NULL;
+        const KC__unit_t* end_kmer = NULL;
+        if (n > 0) {
+            start_kmer = KC__kmer_sorter_get_record(ks, ks->records, longest->start + longest->length * n / T)->kmer;
+        }
+        if (n < T - 1) {
+            end_kmer = KC__kmer_sorter_get_record(ks, ks->records, longest->start + longest->length * (n + 1) / T)->kmer;
+        }
+
+        KC__KmerSorterCursor* heap = ks->threads[n]->cursors;
+        size_t size = 0;
+        for (size_t i = 0; i < ks->runs_count; i++) {
+            const KC__KmerSorterRun* run = &(ks->runs[i]);
+            size_t current = (start_kmer == NULL) ? (run->start) : KC__kmer_sorter_lower_bound(ks, run, start_kmer);
+            size_t end = (end_kmer == NULL) ? (run->start + run->length) : KC__kmer_sorter_lower_bound(ks, run, end_kmer);
+            if (current < end) {
+                heap[size].current = current;
+                heap[size].end = end;
+                size++;
+            }
+        }
+
+        ec = KC__kmer_sorter_merge(ks, heap, size, callback, data);
+    }
+
+    if (exported_count != NULL) {
+        *exported_count = ec;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+#ifndef KC__KMER_SORTER_H
+#define KC__KMER_SORTER_H
+
+#include <stdbool.h>
+#include "types.h"
+#include "mem_allocator.h"
+
+
+/**
+ * Sort based counting engine. Each thread appends canonical K-mers to its own array, a full array is radix sorted and
+ * collapsed into a sorted run of (K-mer, count) records, and the runs are merged when exporting. When the memory of runs
+ * is used out, all runs are merged into one sorted array, after which only K-mers found in it are counted, the same as
+ * a hash map whose keys are locked.
+ */
+struct KC__KmerSorter;
+typedef struct KC__KmerSorter KC__KmerSorter;
+
+typedef void (*KC__KmerSorterExportCallback) (const KC__unit_t* kmer, KC__count_t count, void* data);
+
+KC__KmerSorter* KC__kmer_sorter_create(KC__MemAllocator* mem_allocator, size_t K, size_t threads_count, size_t mem_limit);
+void KC__kmer_sorter_free(KC__MemAllocator* mem_allocator, KC__KmerSorter* kmer_sorter);
+
+/**
+ * The max count of unique K-mers the runs can hold.
+ * @param kmer_sorter The K-mer sorter.
+ * @return The max key count.
+ */
+size_t KC__kmer_sorter_max_key_count(const KC__KmerSorter* kmer_sorter);
+
+void KC__kmer_sorter_clear(KC__KmerSorter* kmer_sorter);
+
+/**
+ * Add a K-mer, should be called by the thread of thread_id only.
+ * @param kmer_sorter The K-mer sorter.
+ * @param thread_id The id of the adding thread.
+ * @param kmer The canonical K-mer.
+ * @return False if the runs have been merged and the K-mer is not found, the K-mer should be stored for the next pass.
+ */
+bool KC__kmer_sorter_add_kmer(KC__KmerSorter* kmer_sorter, size_t thread_id, const KC__unit_t* kmer);
+
+/**
+ * Should be called by every adding thread when it finishes adding, all threads should finish before exporting.
+ * @param kmer_sorter The K-mer sorter.
+ * @param thread_id The id of the adding thread.
+ */
+void KC__kmer_sorter_finish_adding_kmers(KC__KmerSorter* kmer_sorter, size_t thread_id);
+
+/**
+ * Export a range of K-mers in ascending order, the ranges of the threads do not overlap.
+ * @param kmer_sorter The K-mer sorter.
+ * @param thread_id The id of the exporting thread.
+ * @param callback Called with each K-mer and its count.
+ * @param data Passed to the callback.
+ * @param exported_count Set to the count of exported K-mers if not NULL.
+ */
+void KC__kmer_sorter_export(KC__KmerSorter* kmer_sorter, size_t thread_id, KC__KmerSorterExportCallback callback, void* data, size_t* exported_count);
+
+#endif
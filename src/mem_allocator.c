@@ -19,6 +19,7 @@
 
 
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "mem_allocator.h"
 #include "logging.h"
 #include "assert.h"
@@ -91,4 +92,22 @@ void* KC__mem_aligned_alloc(KC__MemAllocator* ma, size_t size, const char* name)
 void KC__mem_free(KC__MemAllocator* ma, void* ptr) {
     free(ptr);
     ma->freed_count++;
+}
+
+void* KC__mem_mapped_alloc(KC__MemAllocator* ma, size_t size, const char* name) {
+    if ((size > 0) && (size <= ma->available)) {
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem != MAP_FAILED) {
+            ma->allocated_count++;
+            ma->available -= size;
+            return mem;
+        }
+    }
+    LOGGING_CRITICAL("Allocating memory for %s failed.", name);
+    exit(EXIT_FAILURE);
+}
+
+void KC__mem_mapped_free(KC__MemAllocator* ma, void* ptr, size_t size) {
+    munmap(ptr, size);
+    ma->freed_count++;
 }
\ No newline at end of file
@@ -36,4 +36,15 @@ void* KC__mem_alloc(KC__MemAllocator* mem_allocator, size_t size, const char* na
 void* KC__mem_aligned_alloc(KC__MemAllocator* mem_allocator, size_t size, const char* name);
 void KC__mem_free(KC__MemAllocator* mem_allocator, void* ptr);
 
+/**
+ * Allocate zeroed memory by an anonymous mapping, the pages are only allocated by the system when they are first
+ * touched, so large tables cost nothing until they are used.
+ * @param mem_allocator Memory allocator.
+ * @param size The size.
+ * @param name The name of the memory in the error message.
+ * @return The memory, aligned to the page.
+ */
+void* KC__mem_mapped_alloc(KC__MemAllocator* mem_allocator, size_t size, const char* name);
+void KC__mem_mapped_free(KC__MemAllocator* mem_allocator, void* ptr, size_t size);
+
 #endif
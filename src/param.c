@@ -36,6 +36,19 @@
 #define KC__OPT_BS 7
 #define KC__OPT_RT 8
 #define KC__OPT_LOG 9
+#define KC__OPT_HASH_STATS 10
+#define KC__OPT_ENGINE 11
+#define KC__OPT_BLOOM 12
+#define KC__OPT_PARTITIONED 13
+#define KC__OPT_SPILL_FILES 14
+#define KC__OPT_EVICT 15
+#define KC__OPT_COMBINER 16
+#define KC__OPT_HOT_CACHE 17
+#define KC__OPT_INFLATING_THREADS 18
+#define KC__OPT_READ_DEPTH 19
+#define KC__OPT_IO_ENGINE 20
+#define KC__OPT_DIRECT_IO 21
+#define KC__OPT_PRESCAN 22
 
 
 static inline size_t KC__parse_number(struct argp_state* state, const char* arg, const char* info) {
@@ -46,10 +59,31 @@ static inline size_t KC__parse_number(struct argp_state* state, const char* arg,
     return (size_t)n;
 }
 
+static inline size_t KC__parse_mem_size(struct argp_state* state, const char* arg, const char* info) {
+    size_t m = strlen(arg);
+    size_t n = 0;
+    if (m > 0) {
+        switch (arg[m - 1]) {
+            case 'M':
+            case 'm':
+                n = 1000000;
+                break;
+            case 'G':
+            case 'g':
+                n = 1000000000;
+                break;
+            default:
+                break;
+        }
+    }
+    if (n == 0) {
+        argp_error(state, "%s not ends with M/G: %s.", info, arg);
+    }
+    return KC__parse_number(state, arg, info) * n;
+}
+
 static error_t KC__parse_opt(int key, char* arg, struct argp_state* state) {
     KC__Param *param = state->input;
-    size_t m;
-    size_t n;
 
     switch (key) {
         case 'k':
@@ -62,26 +96,7 @@ static error_t KC__parse_opt(int key, char* arg, struct argp_state* state) {
             }
             break;
         case 'm':
-            m = strlen(arg);
-            n = 0;
-            if (m > 0) {
-                switch (arg[m - 1]) {
-                    case 'M':
-                    case 'm':
-                        n = 1000000;
-                        break;
-                    case 'G':
-                    case 'g':
-                        n = 1000000000;
-                        break;
-                    default:
-                        break;
-                }
-            }
-            if (n == 0) {
-                argp_error(state, "Memory size not ends with M/G: %s.", arg);
-            }
-            param->mem_limit = KC__parse_number(state, arg, "Memory size") * n;
+            param->mem_limit = KC__parse_mem_size(state, arg, "Memory size");
             break;
         case 'o':
             param->output_file_name = arg;
@@ -116,9 +131,70 @@ static error_t KC__parse_opt(int key, char* arg, struct argp_state* state) {
                 argp_error(state, "Reading threads count cannot be less than 1.");
             }
             break;
+        case KC__OPT_INFLATING_THREADS:
+            param->inflating_threads_count = KC__parse_number(state, arg, "Inflating threads count");
+            break;
+        case KC__OPT_READ_DEPTH:
+            // 0 turns off reading ahead.
+            param->read_depth = (strcmp(arg, "0") == 0) ? 0 : KC__parse_number(state, arg, "Read depth");
+            break;
+        case KC__OPT_IO_ENGINE:
+            if (strcmp(arg, "uring") == 0) {
+                param->read_engine = KC__ASYNC_READ_ENGINE_URING;
+            } else if (strcmp(arg, "pread") == 0) {
+                param->read_engine = KC__ASYNC_READ_ENGINE_PREAD;
+            } else {
+                argp_error(state, "I/O engine invalid: %s.", arg);
+            }
+            break;
+        case KC__OPT_DIRECT_IO:
+            param->direct_io = true;
+            break;
         case KC__OPT_LOG:
             param->log_file_name = arg;
             break;
+        case KC__OPT_ENGINE:
+            param->hash_map_engine_auto = false;
+            if (strcmp(arg, "chain") == 0) {
+                param->hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+            } else if (strcmp(arg, "open") == 0) {
+                param->hash_map_param.engine = KC__HASH_MAP_ENGINE_OPEN_ADDRESSING;
+            } else if (strcmp(arg, "direct") == 0) {
+                param->hash_map_param.engine = KC__HASH_MAP_ENGINE_DIRECT;
+            } else if (strcmp(arg, "sort") == 0) {
+                param->hash_map_param.engine = KC__HASH_MAP_ENGINE_SORT;
+            } else {
+                argp_error(state, "Hash map engine invalid: %s.", arg);
+            }
+            break;
+        case KC__OPT_BLOOM:
+            param->hash_map_param.bloom_filter_mem = KC__parse_mem_size(state, arg, "Bloom filter memory size");
+            break;
+        case KC__OPT_PARTITIONED:
+            param->hash_map_param.partitioned = true;
+            break;
+        case KC__OPT_EVICT:
+            param->hash_map_param.evict_singletons = true;
+            break;
+        case KC__OPT_HOT_CACHE:
+            param->hash_map_param.hot_cache = true;
+            break;
+        case KC__OPT_SPILL_FILES:
+            // 0 picks the count by the K-mers expected.
+            param->spill_partitions_count = (strcmp(arg, "0") == 0) ? 0 : KC__parse_number(state, arg, "Spill files count");
+            if (param->spill_partitions_count > KC__SPILL_PARTITIONS_MAX) {
+                argp_error(state, "Spill files count should be in [0, %d].", KC__SPILL_PARTITIONS_MAX);
+            }
+            break;
+        case KC__OPT_COMBINER:
+            param->spill_combiner = true;
+            break;
+        case KC__OPT_PRESCAN:
+            param->prescan = true;
+            break;
+        case KC__OPT_HASH_STATS:
+            param->hash_map_stats = true;
+            break;
         case ARGP_KEY_ARGS:
             param->input_file_names = (state->argv + state->next);
             param->input_files_count = (size_t)(state->argc - state->next);
@@ -132,6 +208,12 @@ static error_t KC__parse_opt(int key, char* arg, struct argp_state* state) {
                 argp_error(state, "Memory size value must be provided.");
             if (param->input_file_type == KC__FILE_TYPE_UNKNOWN)
                 argp_error(state, "Input file type (fa/fq) should be specified.");
+            // K-mers seen only once never reach the table when the bloom filter is enabled.
+            if ((param->hash_map_param.bloom_filter_mem > 0) && (param->output_param.filter_min < 2))
+                argp_error(state, "Filter min value cannot be less than 2 when bloom filter is enabled.");
+            // The direct engine indexes the counters by the K-mer of a single unit.
+            if (!(param->hash_map_engine_auto) && (param->hash_map_param.engine == KC__HASH_MAP_ENGINE_DIRECT) && (param->K >= KC__UNIT_BIT / 2))
+                argp_error(state, "K-mer length should be less than %d for the direct engine.", KC__UNIT_BIT / 2);
             break;
         default:
             return ARGP_ERR_UNKNOWN;
@@ -155,19 +237,36 @@ void KC__param_init(KC__Param* param, int argc, char** argv) {
 
     param->threads_count = KC__get_processors_count();
     param->reading_threads_count = 0;
+    param->inflating_threads_count = 0;
 
     param->input_file_type = KC__FILE_TYPE_UNKNOWN;
     param->input_compression_type = KC__FILE_COMPRESSION_TYPE_PLAIN;
 
     param->output_file_name = "./KC__output";
     param->log_file_name = NULL;
+    param->hash_map_stats = false;
 
     param->read_buffer_size = 0;
+    param->read_depth = 4;
+    param->read_engine = KC__ASYNC_READ_ENGINE_URING;
+    param->direct_io = false;
 
     param->output_param.filter_min = 2;
     param->output_param.filter_max = KC__COUNT_MAX;
     param->output_param.count_max = 255;
 
+    param->hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    param->hash_map_param.bloom_filter_mem = 0;
+    param->hash_map_param.partitioned = false;
+    param->hash_map_param.evict_singletons = false;
+    param->hash_map_param.hot_cache = false;
+    param->hash_map_param.keys_count_hint = 0;
+    param->hash_map_engine_auto = true;
+
+    param->spill_partitions_count = 0;
+    param->spill_combiner = false;
+    param->prescan = false;
+
     struct argp_option options[] = {
             {"kmer-len", 'k', "Length", 0, "Length of K-mer", 0},
             {"threads", 't', "N", 0, "Threads count", 0},
@@ -183,9 +282,22 @@ void KC__param_init(KC__Param* param, int argc, char** argv) {
             {"filter-max", KC__OPT_FILTER_MAX, "N", 0, "Filter max value", 2},
 
             {"log", KC__OPT_LOG, "FILE", 0, "Log file", 3},
+            {"hash-stats", KC__OPT_HASH_STATS, 0, 0, "Log hash table chain lengths and counter contention of each pass", 3},
 
+            {"engine", KC__OPT_ENGINE, "chain/open/direct/sort", 0, "Hash map engine, default: direct if 4^K counters fit in memory, else chain", 4},
+            {"bloom", KC__OPT_BLOOM, "SIZE", 0, "Bloom filter memory (part of the memory size), keeps K-mers seen once out of hash map, the input files are read twice", 4},
+            {"partitioned", KC__OPT_PARTITIONED, 0, 0, "Each thread owns a partition of hash map (chaining engine only)", 4},
+            {"evict", KC__OPT_EVICT, 0, 0, "Evict K-mers seen once to tmp file when hash map is full in the pass over the input files, instead of locking keys (chaining engine only)", 4},
+            {"hot-cache", KC__OPT_HOT_CACHE, 0, 0, "Count K-mers of high counts in each thread and add them to hash map in bulk (chain/open engines)", 4},
             {"bs", KC__OPT_BS, "SIZE", 0, "Buffer size", 4},
             {"rt", KC__OPT_RT, "N", 0, "Reading threads count", 4},
+            {"inflating-threads", KC__OPT_INFLATING_THREADS, "N", 0, "Threads inflating a BGZF file in parallel for each reading thread", 4},
+            {"read-depth", KC__OPT_READ_DEPTH, "N", 0, "Reads of 1 MB kept in flight for each reading thread of GZIP files, 0 to read synchronously, default: 4", 4},
+            {"io-engine", KC__OPT_IO_ENGINE, "uring/pread", 0, "Engine of the reads in flight, default: uring, pread if io_uring is not available", 4},
+            {"direct-io", KC__OPT_DIRECT_IO, 0, 0, "Read GZIP files by O_DIRECT, bypassing the page cache", 4},
+            {"spill-files", KC__OPT_SPILL_FILES, "N", 0, "Tmp files the first pass splits K-mers into by minimizer, counted by the second pass in a table of its own, 0 to fit each of them in the hash map by the K-mers expected, 1 for a single file counted by as many passes as needed, default: 0", 4},
+            {"combiner", KC__OPT_COMBINER, 0, 0, "Combine the frequent K-mers spilled to tmp files into counts, for samples with highly repeated K-mers", 4},
+            {"prescan", KC__OPT_PRESCAN, 0, 0, "Estimate the distinct K-mers by sampling the input files, to size hash map and predict passes (chain/open engines)", 4},
             {0}
     };
     struct argp argp = {options, KC__parse_opt, "FILE...", "Count k-mers."};
@@ -196,20 +308,32 @@ void KC__param_init(KC__Param* param, int argc, char** argv) {
 
     bool reading_threads_count_provided = (param->reading_threads_count != 0);
 
+    // A thread inflating gzip files feeds about 8 K-mer processing threads.
+    const size_t gz_threads_count = (param->kmer_processing_threads_count + 7) / 8;
+
     if (!reading_threads_count_provided) {
         param->reading_threads_count = 1;
         if (param->input_compression_type == KC__FILE_COMPRESSION_TYPE_GZIP) {
-            param->reading_threads_count = (param->kmer_processing_threads_count + 7) / 8;
+            param->reading_threads_count = gz_threads_count;
         }
     }
 
-    if (param->input_files_count < param->reading_threads_count) {
+    // Plain files are split into ranges, so only compressed files limit the readers.
+    if ((param->input_compression_type != KC__FILE_COMPRESSION_TYPE_PLAIN) && (param->input_files_count < param->reading_threads_count)) {
         param->reading_threads_count = param->input_files_count;
         if (reading_threads_count_provided) {
             LOGGING_WARNING("Reduce reading threads count to number of files: %zu", param->reading_threads_count);
         }
     }
 
+    // The threads left by the readers of too few files inflate the blocks of BGZF files.
+    if (param->inflating_threads_count == 0) {
+        param->inflating_threads_count = 1;
+        if ((param->input_compression_type == KC__FILE_COMPRESSION_TYPE_GZIP) && (param->reading_threads_count > 0)) {
+            param->inflating_threads_count = (gz_threads_count + param->reading_threads_count - 1) / param->reading_threads_count;
+        }
+    }
+
 
     param->write_buffer_size = 5000000;
     if (param->read_buffer_size == 0) {
@@ -218,8 +342,13 @@ void KC__param_init(KC__Param* param, int argc, char** argv) {
             param->read_buffer_size *= 4;
         }
     }
+    // Buffers of tmp file are read back as they are written, so they should not be larger than the read buffers.
+    if (param->write_buffer_size > param->read_buffer_size) {
+        param->write_buffer_size = param->read_buffer_size;
+    }
 
-    param->read_buffers_count = param->kmer_processing_threads_count * 2;
+    // Each reader holds up to 2 buffers while it splits the data between them.
+    param->read_buffers_count = param->kmer_processing_threads_count * 2 + param->reading_threads_count * 2;
     param->write_buffers_count = param->kmer_processing_threads_count * 2;
 
 
@@ -235,6 +364,8 @@ void KC__param_init(KC__Param* param, int argc, char** argv) {
 
     LOGGING_DEBUG("K: %zu", param->K);
     LOGGING_DEBUG("Threads count(r/p): %zu(%zu/%zu)", param->threads_count, param->reading_threads_count, param->kmer_processing_threads_count);
+    LOGGING_DEBUG("Inflating threads count of each reader: %zu", param->inflating_threads_count);
+    LOGGING_DEBUG("Read depth: %zu, engine: %d, direct I/O: %d", param->read_depth, param->read_engine, param->direct_io);
     LOGGING_DEBUG("Memory limit: %zu", param->mem_limit);
     for (size_t i = 0; i < param->input_files_count; i++) {
         LOGGING_DEBUG("Input file #%zu: %s", i, param->input_file_names[i]);
@@ -243,6 +374,14 @@ void KC__param_init(KC__Param* param, int argc, char** argv) {
     LOGGING_DEBUG("Output files: %s", param->output_file_name);
     LOGGING_DEBUG("Buffer size(r/w): %zu/%zu, count(r/w): %zu/%zu", param->read_buffer_size, param->write_buffer_size, param->read_buffers_count, param->write_buffers_count);
     LOGGING_DEBUG("Count max: %zu, filter min: %zu, max: %zu", param->output_param.count_max, param->output_param.filter_min, param->output_param.filter_max);
+    LOGGING_DEBUG("Hash map engine: %d", param->hash_map_param.engine);
+    LOGGING_DEBUG("Bloom filter memory: %zu", param->hash_map_param.bloom_filter_mem);
+    LOGGING_DEBUG("Hash map partitioned: %d", param->hash_map_param.partitioned);
+    LOGGING_DEBUG("Hash map evict singletons: %d", param->hash_map_param.evict_singletons);
+    LOGGING_DEBUG("Hash map hot cache: %d", param->hash_map_param.hot_cache);
+    LOGGING_DEBUG("Spill partitions count: %zu", param->spill_partitions_count);
+    LOGGING_DEBUG("Spill combiner: %d", param->spill_combiner);
+    LOGGING_DEBUG("Pre-scan: %d", param->prescan);
 }
 
 void KC__param_destroy(KC__Param* param) {
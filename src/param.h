@@ -31,11 +31,35 @@ typedef struct {
     KC__count_t count_max;
 } KC__OutputParam;
 
+typedef struct {
+    KC__HashMapEngine engine;
+
+    /** Memory of the bloom filter which keeps the first sighting of K-mers out of the table, 0 means disabled. */
+    size_t bloom_filter_mem;
+
+    /** Each thread owns a partition of the table, the K-mers of other partitions are routed to their owners. */
+    bool partitioned;
+
+    /** When the nodes are used out, the K-mers seen only once are evicted to the tmp file instead of locking keys. */
+    bool evict_singletons;
+
+    /** Each thread counts the K-mers of high counts locally and adds them to the table in bulk. */
+    bool hot_cache;
+
+    /**
+     * The count of distinct K-mers the input may hold at most, the chaining and open addressing engines take only the
+     * memory to hold them, 0 means unknown.
+     */
+    size_t keys_count_hint;
+} KC__HashMapParam;
+
 typedef struct {
     size_t K;
 
     size_t threads_count;
     size_t reading_threads_count;
+    /** The threads (the reader included) inflating the blocks of a BGZF file in parallel, for each reader. */
+    size_t inflating_threads_count;
     size_t kmer_processing_threads_count;
 
     char** input_file_names;
@@ -47,6 +71,11 @@ typedef struct {
 
     uint32_t read_buffer_size;
     size_t read_buffers_count;
+    /** Reads of compressed files kept in flight ahead of inflating by each reader, 0 means reading synchronously. */
+    size_t read_depth;
+    KC__AsyncReadEngine read_engine;
+    /** Compressed files are read by O_DIRECT, bypassing the page cache. */
+    bool direct_io;
 
     uint32_t write_buffer_size;
     size_t write_buffers_count;
@@ -54,8 +83,23 @@ typedef struct {
     size_t mem_limit;
 
     KC__OutputParam output_param;
+    KC__HashMapParam hash_map_param;
+    /** The hash map engine is not specified, the direct engine will be used if it fits. */
+    bool hash_map_engine_auto;
+
+    /**
+     * Super K-mers spilled by the first pass are split into this many tmp files, the second pass counts them in rounds
+     * which clear the hash map and take as many of them as it is expected to hold. 0 picks the count when the hash map
+     * is created.
+     */
+    size_t spill_partitions_count;
+    /** Frequent K-mers spilled by each thread are combined into counted K-mers. */
+    bool spill_combiner;
+    /** The distinct K-mers are estimated by a pre-pass over the input, before the hash map is created. */
+    bool prescan;
 
     const char* log_file_name;
+    bool hash_map_stats;
 } KC__Param;
 
 
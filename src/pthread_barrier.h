@@ -19,6 +19,8 @@ typedef struct
     int tripCount;
 } pthread_barrier_t;
 
+#define PTHREAD_BARRIER_SERIAL_THREAD 1
+
 
 int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count);
 int pthread_barrier_destroy(pthread_barrier_t *barrier);
@@ -0,0 +1,156 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "thread_pool.h"
+#include "logging.h"
+#include "assert.h"
+
+
+typedef struct {
+    KC__ThreadPoolWork work;
+    void* arg;
+    KC__ThreadPoolPhase* phase;
+} KC__ThreadPoolTask;
+
+/**
+ * The tasks waiting for a thread are in [tasks_start, tasks_start + tasks_count) of the ring of tasks, the pending count
+ * of a phase is decreased by the thread finishing each of its tasks.
+ */
+struct KC__ThreadPool {
+    pthread_t* threads;
+    size_t threads_count;
+
+    KC__ThreadPoolTask* tasks;
+    size_t tasks_start;
+    size_t tasks_count;
+    size_t running_count;
+    bool stopping;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cv_has_tasks;
+    pthread_cond_t cv_phase_finished;
+};
+
+
+static void* KC__thread_pool_work(void* ptr) {
+    KC__ThreadPool* pool = ptr;
+
+    pthread_mutex_lock(&(pool->mtx));
+    while (true) {
+        while ((pool->tasks_count == 0) && !pool->stopping) {
+            pthread_cond_wait(&(pool->cv_has_tasks), &(pool->mtx));
+        }
+        if (pool->tasks_count == 0) {
+            break;
+        }
+
+        KC__ThreadPoolTask task = pool->tasks[pool->tasks_start];
+        pool->tasks_start = (pool->tasks_start + 1) % pool->threads_count;
+        pool->tasks_count--;
+        pthread_mutex_unlock(&(pool->mtx));
+
+        task.work(task.arg);
+
+        pthread_mutex_lock(&(pool->mtx));
+        pool->running_count--;
+        task.phase->pending_count--;
+        if (task.phase->pending_count == 0) {
+            pthread_cond_broadcast(&(pool->cv_phase_finished));
+        }
+    }
+    pthread_mutex_unlock(&(pool->mtx));
+
+    return NULL;
+}
+
+KC__ThreadPool* KC__thread_pool_create(KC__MemAllocator* ma, size_t threads_count) {
+    KC__ASSERT(threads_count > 0);
+
+    KC__ThreadPool* pool = (KC__ThreadPool*)KC__mem_alloc(ma, sizeof(KC__ThreadPool), "thread pool");
+    pool->threads_count = threads_count;
+    pool->threads = (pthread_t*)KC__mem_alloc(ma, sizeof(pthread_t) * threads_count, "thread pool threads");
+    pool->tasks = (KC__ThreadPoolTask*)KC__mem_alloc(ma, sizeof(KC__ThreadPoolTask) * threads_count, "thread pool tasks");
+    pool->tasks_start = 0;
+    pool->tasks_count = 0;
+    pool->running_count = 0;
+    pool->stopping = false;
+
+    pthread_mutex_init(&(pool->mtx), NULL);
+    pthread_cond_init(&(pool->cv_has_tasks), NULL);
+    pthread_cond_init(&(pool->cv_phase_finished), NULL);
+
+    for (size_t i = 0; i < threads_count; i++) {
+        pthread_create(&(pool->threads[i]), NULL, KC__thread_pool_work, pool);
+    }
+    LOGGING_DEBUG("Thread pool of %zu threads", threads_count);
+
+    return pool;
+}
+
+void KC__thread_pool_free(KC__MemAllocator* ma, KC__ThreadPool* pool) {
+    pthread_mutex_lock(&(pool->mtx));
+    KC__ASSERT(pool->running_count == 0);
+    pool->stopping = true;
+    pthread_cond_broadcast(&(pool->cv_has_tasks));
+    pthread_mutex_unlock(&(pool->mtx));
+
+    for (size_t i = 0; i < pool->threads_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&(pool->mtx));
+    pthread_cond_destroy(&(pool->cv_has_tasks));
+    pthread_cond_destroy(&(pool->cv_phase_finished));
+
+    KC__mem_free(ma, pool->tasks);
+    KC__mem_free(ma, pool->threads);
+    KC__mem_free(ma, pool);
+}
+
+size_t KC__thread_pool_threads_count(const KC__ThreadPool* pool) {
+    return pool->threads_count;
+}
+
+void KC__thread_pool_start(KC__ThreadPool* pool, KC__ThreadPoolPhase* phase, KC__ThreadPoolWork work, void* const args[], size_t count) {
+    pthread_mutex_lock(&(pool->mtx));
+    // The works of all the phases started run at the same time, as they may wait for each other.
+    KC__ASSERT(pool->running_count + count <= pool->threads_count);
+    phase->pending_count = count;
+    for (size_t i = 0; i < count; i++) {
+        KC__ThreadPoolTask* task = &(pool->tasks[(pool->tasks_start + pool->tasks_count) % pool->threads_count]);
+        task->work = work;
+        task->arg = args[i];
+        task->phase = phase;
+        pool->tasks_count++;
+    }
+    pool->running_count += count;
+    pthread_cond_broadcast(&(pool->cv_has_tasks));
+    pthread_mutex_unlock(&(pool->mtx));
+}
+
+void KC__thread_pool_wait(KC__ThreadPool* pool, KC__ThreadPoolPhase* phase) {
+    pthread_mutex_lock(&(pool->mtx));
+    while (phase->pending_count > 0) {
+        pthread_cond_wait(&(pool->cv_phase_finished), &(pool->mtx));
+    }
+    pthread_mutex_unlock(&(pool->mtx));
+}
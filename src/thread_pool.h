@@ -0,0 +1,72 @@
+/*
+ * This file is part of CHTKC.
+ *
+ * CHTKC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CHTKC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CHTKC.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: Jianan Wang
+ */
+
+
+#ifndef KC__THREAD_POOL_H
+#define KC__THREAD_POOL_H
+
+#include <stddef.h>
+#include "mem_allocator.h"
+
+
+typedef void* (*KC__ThreadPoolWork)(void* arg);
+
+/** The works started together, which are waited for together. */
+typedef struct {
+    size_t pending_count;
+} KC__ThreadPoolPhase;
+
+struct KC__ThreadPool;
+typedef struct KC__ThreadPool KC__ThreadPool;
+
+/**
+ * Create a thread pool, the threads are started at once and kept until the pool is freed.
+ * @param mem_allocator Memory allocator.
+ * @param threads_count The count of threads, no more works than it can run at the same time.
+ * @return The thread pool.
+ */
+KC__ThreadPool* KC__thread_pool_create(KC__MemAllocator* mem_allocator, size_t threads_count);
+
+/**
+ * Free a thread pool, the works started should be finished.
+ * @param mem_allocator Memory allocator.
+ * @param thread_pool The thread pool.
+ */
+void KC__thread_pool_free(KC__MemAllocator* mem_allocator, KC__ThreadPool* thread_pool);
+
+size_t KC__thread_pool_threads_count(const KC__ThreadPool* thread_pool);
+
+/**
+ * Start a phase, run the work with each of the args by a thread of its own, return at once.
+ * @param thread_pool The thread pool.
+ * @param phase The phase.
+ * @param work The work.
+ * @param args The args, one for each work.
+ * @param count The count of works.
+ */
+void KC__thread_pool_start(KC__ThreadPool* thread_pool, KC__ThreadPoolPhase* phase, KC__ThreadPoolWork work, void* const args[], size_t count);
+
+/**
+ * Wait for the works of a phase to finish.
+ * @param thread_pool The thread pool.
+ * @param phase The phase.
+ */
+void KC__thread_pool_wait(KC__ThreadPool* thread_pool, KC__ThreadPoolPhase* phase);
+
+#endif
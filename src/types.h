@@ -44,6 +44,20 @@ typedef uint64_t KC__node_id_t;
 
 #define KC__NODE_ID_NULL 0
 
+/**
+ * For the hot paths instantiated per width of K-mers (1 to 4 units, and a generic one), so that the width is a constant
+ * in the inlined code.
+ */
+#define KC__ALWAYS_INLINE inline __attribute__((always_inline))
+
+/** The spill partition of a super K-mer is stored in a byte. */
+#define KC__SPILL_PARTITIONS_MAX 255
+
+/** Set in the super K-mers count of a spilled buffer whose records may be counted K-mers. */
+#define KC__SUPER_KMERS_COUNTED_FLAG UINT32_C(0x80000000)
+/** The expanded bases count of a counted K-mer record, which is followed by the count (uint8_t) and the K bases. */
+#define KC__SUPER_KMER_COUNTED_MARK UINT8_MAX
+
 typedef enum {
     KC__FILE_TYPE_FASTA = 0,
     KC__FILE_TYPE_FASTQ,
@@ -56,4 +70,16 @@ typedef enum {
     KC__FILE_COMPRESSION_TYPE_GZIP
 } KC__FileCompressionType;
 
+typedef enum {
+    KC__HASH_MAP_ENGINE_CHAINING = 0,
+    KC__HASH_MAP_ENGINE_OPEN_ADDRESSING,
+    KC__HASH_MAP_ENGINE_DIRECT,
+    KC__HASH_MAP_ENGINE_SORT
+} KC__HashMapEngine;
+
+typedef enum {
+    KC__ASYNC_READ_ENGINE_URING = 0,
+    KC__ASYNC_READ_ENGINE_PREAD
+} KC__AsyncReadEngine;
+
 #endif //KC__TYPES_H
@@ -20,6 +20,7 @@
 
 #include <stdlib.h>
 #include <limits.h>
+#include <time.h>
 
 #include "utils.h"
 #include "types.h"
@@ -40,28 +41,6 @@ size_t KC__calculate_kmer_size(size_t K) {
     return sizeof(KC__unit_t) * kmer_width;
 }
 
-
-static inline bool KC__is_prime_number(size_t n) {
-    if (n < 2)
-        return false;
-    for (size_t i = 2; i * i <= n; i++) {
-        if (n % i == 0)
-            return false;
-    }
-    return true;
-}
-
-size_t KC__max_prime_number(size_t limit) {
-    size_t n = limit;
-    while (!KC__is_prime_number(n) && (n > 0))
-        n--;
-    if (n == 0) {
-        LOGGING_CRITICAL("Error getting prime number limited by %zu.", limit);
-        exit(EXIT_FAILURE);
-    }
-    return n;
-}
-
 void KC__calculate_count_field(size_t count_max, size_t* count_bit, size_t* count_size) {
     if (count_max <= UINT8_MAX) {
         *count_bit = 8;
@@ -87,3 +66,9 @@ void KC__file_error_exit(const char* file_name, const char* action, const char*
 
     exit(EXIT_FAILURE);
 }
+
+uint64_t KC__monotonic_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec) * UINT64_C(1000000000) + (uint64_t)(ts.tv_nsec);
+}
@@ -23,12 +23,15 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 size_t KC__calculate_kmer_width_by_unit_size(size_t K, size_t unit_size);
 size_t KC__calculate_kmer_width(size_t K);
 size_t KC__calculate_kmer_size(size_t K);
-size_t KC__max_prime_number(size_t limit);
 void KC__calculate_count_field(size_t count_max, size_t* count_bit, size_t* count_size);
 void KC__file_error_exit(const char* file_name, const char* action, const char* msg);
 
+/** The monotonic clock in nanoseconds. */
+uint64_t KC__monotonic_time_ns(void);
+
 #endif
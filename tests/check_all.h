@@ -5,8 +5,12 @@
 
 Suite* queue_suite();
 Suite* buffer_queue_suite();
+Suite* thread_pool_suite();
+Suite* async_reader_suite();
 Suite* kmer_processor_suite();
 Suite* hash_map_suite();
+Suite* kmer_sorter_suite();
+Suite* kmer_sketch_suite();
 Suite* file_reader_suite();
 Suite* file_writer_suite();
 
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check_all.h"
+#include "../src/async_reader.h"
+
+#define CHUNK_SIZE 4096
+
+
+static KC__MemAllocator* ma;
+static const char* file_name = "../tests/test_files/test_async_read";
+static char content[CHUNK_SIZE * 3 + 1000];
+static char out[sizeof(content) + CHUNK_SIZE];
+
+
+static void setup() {
+    ma = KC__mem_allocator_create(1000000);
+
+    for (size_t i = 0; i < sizeof(content); i++) {
+        content[i] = (char)('a' + (i * 7 + i / 13) % 26);
+    }
+    FILE* file = fopen(file_name, "wb");
+    ck_assert(file != NULL);
+    ck_assert(fwrite(content, 1, sizeof(content), file) == sizeof(content));
+    fclose(file);
+}
+
+static void teardown() {
+    remove(file_name);
+    KC__mem_allocator_free(ma);
+}
+
+/**
+ * Read the file of 3 chunks and a part twice, in pieces of sizes not aligned to the chunks, by both engines, with 1 to 4
+ * reads in flight.
+ */
+START_TEST(test_read)
+    {
+        const KC__AsyncReadEngine engine = (_i % 2 == 0) ? KC__ASYNC_READ_ENGINE_URING : KC__ASYNC_READ_ENGINE_PREAD;
+        const size_t depth = (size_t)_i / 2 + 1;
+        KC__AsyncReader* ar = KC__async_reader_create(ma, engine, CHUNK_SIZE, depth);
+
+        for (size_t n = 0; n < 2; n++) {
+            FILE* file = fopen(file_name, "rb");
+            ck_assert(file != NULL);
+            KC__async_reader_start(ar, fileno(file), n == 1);
+
+            const size_t piece_sizes[3] = {1000, CHUNK_SIZE, 3000};
+            size_t got_size = 0;
+            for (size_t i = 0; true; i++) {
+                size_t read_size;
+                const size_t piece_size = piece_sizes[i % 3];
+                ck_assert(KC__async_reader_read(ar, out + got_size, piece_size, &read_size));
+                got_size += read_size;
+                if (read_size < piece_size) {
+                    break;
+                }
+            }
+            ck_assert(got_size == sizeof(content));
+            ck_assert(memcmp(out, content, sizeof(content)) == 0);
+
+            size_t read_size;
+            ck_assert(KC__async_reader_read(ar, out, 1, &read_size));
+            ck_assert(read_size == 0);
+
+            KC__async_reader_stop(ar);
+            fclose(file);
+        }
+
+        KC__async_reader_free(ma, ar);
+    }
+END_TEST
+
+/**
+ * The reads in flight are waited for when the file is not read to the end.
+ */
+START_TEST(test_stop_early)
+    {
+        const KC__AsyncReadEngine engine = (_i % 2 == 0) ? KC__ASYNC_READ_ENGINE_URING : KC__ASYNC_READ_ENGINE_PREAD;
+        KC__AsyncReader* ar = KC__async_reader_create(ma, engine, CHUNK_SIZE, 4);
+
+        FILE* file = fopen(file_name, "rb");
+        ck_assert(file != NULL);
+        KC__async_reader_start(ar, fileno(file), false);
+
+        size_t read_size;
+        ck_assert(KC__async_reader_read(ar, out, 10, &read_size));
+        ck_assert(read_size == 10);
+        ck_assert(memcmp(out, content, 10) == 0);
+
+        KC__async_reader_stop(ar);
+        fclose(file);
+
+        KC__async_reader_free(ma, ar);
+    }
+END_TEST
+
+
+Suite* async_reader_suite() {
+    TCase* tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_loop_test(tc_core, test_read, 0, 8);
+    tcase_add_loop_test(tc_core, test_stop_early, 0, 2);
+
+    Suite* s = suite_create("Async reader");
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
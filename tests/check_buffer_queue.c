@@ -1,6 +1,7 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "check_all.h"
 #include "../src/buffer_queue.h"
@@ -141,12 +142,88 @@ START_TEST(test_multiple_producers_multiple_consumers)
     }
 END_TEST
 
+#define STRESS_ITEMS_COUNT 20000
+#define STRESS_PASSES_COUNT 3
+
+static size_t stress_produced_count;
+static int stress_consumed_counts[STRESS_ITEMS_COUNT];
+
+static void* stress_produce(void* ptr) {
+    KC__BufferQueue* bq = ptr;
+
+    while (true) {
+        const size_t id = __sync_fetch_and_add(&stress_produced_count, 1);
+        if (id >= STRESS_ITEMS_COUNT)
+            break;
+
+        KC__Buffer* buffer = KC__buffer_queue_get_blank_buffer(bq);
+        ck_assert(buffer->length == 0);
+        const uint32_t item = (uint32_t)id;
+        memcpy(buffer->data, &item, sizeof(item));
+        buffer->length = sizeof(item);
+        KC__buffer_queue_enqueue_filled_buffer(bq, buffer);
+    }
+
+    pthread_exit(NULL);
+}
+
+static void* stress_consume(void* ptr) {
+    KC__BufferQueue* bq = ptr;
+
+    KC__Buffer* buffer;
+    while ((buffer = KC__buffer_queue_dequeue_filled_buffer(bq)) != NULL) {
+        ck_assert(buffer->length == sizeof(uint32_t));
+        uint32_t item;
+        memcpy(&item, buffer->data, sizeof(item));
+        ck_assert(item < STRESS_ITEMS_COUNT);
+        __sync_fetch_and_add(&(stress_consumed_counts[item]), 1);
+        KC__buffer_queue_recycle_blank_buffer(bq, buffer);
+    }
+
+    pthread_exit(NULL);
+}
+
+START_TEST(test_stress)
+    {
+        // Many more items than buffers, through several passes of the same queue.
+        const int p_count = _i;
+        const int c_count = 10 - _i;
+        pthread_t p_threads[p_count];
+        pthread_t c_threads[c_count];
+
+        for (int pass = 0; pass < STRESS_PASSES_COUNT; pass++) {
+            stress_produced_count = 0;
+            memset(stress_consumed_counts, 0, sizeof(stress_consumed_counts));
+
+            KC__buffer_queue_start_input(bq);
+
+            for (int i = 0; i < p_count; i++)
+                pthread_create(&(p_threads[i]), NULL, stress_produce, bq);
+            for (int i = 0; i < c_count; i++)
+                pthread_create(&(c_threads[i]), NULL, stress_consume, bq);
+
+            for (int i = 0; i < p_count; i++)
+                pthread_join(p_threads[i], NULL);
+
+            KC__buffer_queue_finish_input(bq);
+
+            for (int i = 0; i < c_count; i++)
+                pthread_join(c_threads[i], NULL);
+
+            for (int i = 0; i < STRESS_ITEMS_COUNT; i++) {
+                ck_assert(stress_consumed_counts[i] == 1);
+            }
+        }
+    }
+END_TEST
+
 Suite* buffer_queue_suite() {
     TCase* tc_core = tcase_create("Core");
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_loop_test(tc_core, test_one_producer_multiple_consumers, 1, 21);
     tcase_add_loop_test(tc_core, test_multiple_producers_one_consumer, 1, 21);
     tcase_add_loop_test(tc_core, test_multiple_producers_multiple_consumers, 1, 21);
+    tcase_add_loop_test(tc_core, test_stress, 1, 10);
 
     Suite* s = suite_create("Buffer Queue");
     suite_add_tcase(s, tc_core);
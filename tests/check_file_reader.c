@@ -13,7 +13,7 @@ static KC__BufferQueue* bq;
 static void setup() {
     ma = KC__mem_allocator_create(1000000);
     // Create with type gzip ensures gzip buffer exists.
-    fr = KC__file_reader_create(ma, 4, KC__FILE_COMPRESSION_TYPE_GZIP, 3);
+    fr = KC__file_reader_create(ma, 4, KC__FILE_COMPRESSION_TYPE_GZIP, 3, 1);
     bq = KC__buffer_queue_create(ma, 20, 10);
     KC__file_reader_link_modules(fr, bq);
 }
@@ -24,6 +24,17 @@ static void teardown() {
     KC__mem_allocator_free(ma);
 }
 
+/**
+ * Read through views of at most view_size bytes into the mapped files.
+ */
+static void use_views(size_t view_size) {
+    KC__file_reader_free(ma, fr);
+    KC__buffer_queue_free(ma, bq);
+    fr = KC__file_reader_create(ma, 4, KC__FILE_COMPRESSION_TYPE_PLAIN, view_size, 1);
+    bq = KC__buffer_queue_create_views(ma, 10);
+    KC__file_reader_link_modules(fr, bq);
+}
+
 static inline void read_files() {
     KC__buffer_queue_start_input(bq);
 
@@ -127,6 +138,58 @@ START_TEST(test_fastq)
     }
 END_TEST
 
+START_TEST(test_fastq_ranges)
+    {
+        // Quality lines starting with '@' and '+' are not taken as the start of records.
+        const char* content = "@1\nACGTA\n+\n@@---\n@2\nTGCAT\n+\n+@---\n@3\nATCGA\n+\n@----\n";
+        const size_t content_size = strlen(content);
+
+        char* file_names[] = {"../tests/test_files/test_fastq_3.fq",
+                              "../tests/test_files/test_fastq_3.fq"};
+        // The file is read through views in the second half of the loop.
+        const size_t split = (size_t)_i % (content_size + 1);
+        if ((size_t)_i > content_size) {
+            use_views(20);
+        }
+        size_t range_starts[] = {0, split};
+        size_t range_ends[] = {split, content_size};
+        KC__FileInputDescription input = {file_names, 2, KC__FILE_TYPE_FASTQ, KC__FILE_COMPRESSION_TYPE_PLAIN, range_starts, range_ends};
+        KC__file_reader_update_input(fr, input);
+        read_files();
+
+        // Each record is read once, and no buffer holds part of a record.
+        char data[64];
+        size_t data_size = 0;
+        KC__Buffer* bf;
+        while ((bf = KC__buffer_queue_dequeue_filled_buffer(bq)) != NULL) {
+            ck_assert(bf->type == KC__BUFFER_TYPE_FASTQ);
+            ck_assert((bf->length == 0) || (bf->length == 17));
+            ck_assert(data_size + bf->length <= sizeof(data));
+            memcpy(data + data_size, bf->data, bf->length);
+            data_size += bf->length;
+            KC__buffer_queue_recycle_blank_buffer(bq, bf);
+        }
+
+        ck_assert(data_size == content_size);
+        ck_assert(memcmp(content, data, data_size) == 0);
+    }
+END_TEST
+
+START_TEST(test_shared_files)
+    {
+        char* file_names[] = {"../tests/test_files/test_fastq_1.fq",
+                              "../tests/test_files/test_fastq_2.fq"};
+        size_t next_file = 0;
+        KC__FileInputDescription input = {file_names, 2, KC__FILE_TYPE_FASTQ, KC__FILE_COMPRESSION_TYPE_PLAIN, NULL, NULL, &next_file};
+        KC__file_reader_update_input(fr, input);
+        read_files();
+
+        // The reader takes the files one by one until none is left.
+        ck_assert(next_file == 2);
+        check_buffers(check_fastq_buffer, 3);
+    }
+END_TEST
+
 START_TEST(test_gz)
     {
         char* file_names[] = {"../tests/test_files/test_fastq_1.fq.gz",
@@ -150,6 +213,27 @@ START_TEST(test_cat_gz)
     }
 END_TEST
 
+/**
+ * The blocks of 7 bytes are split between buffers, they are inflated by 1 to 4 threads.
+ */
+START_TEST(test_bgzf)
+    {
+        KC__file_reader_free(ma, fr);
+        fr = KC__file_reader_create(ma, 4, KC__FILE_COMPRESSION_TYPE_GZIP, 1000, (size_t)_i);
+        KC__file_reader_link_modules(fr, bq);
+        KC__ThreadPool* pool = KC__thread_pool_create(ma, (size_t)_i);
+        KC__file_reader_set_thread_pool(fr, pool);
+
+        char* file_names[] = {"../tests/test_files/test_fastq_bgzf.fq.gz"};
+        KC__FileInputDescription input = {file_names, 1, KC__FILE_TYPE_FASTQ, KC__FILE_COMPRESSION_TYPE_GZIP};
+        KC__file_reader_update_input(fr, input);
+        read_files();
+
+        check_buffers(check_fastq_buffer, 3);
+        KC__thread_pool_free(ma, pool);
+    }
+END_TEST
+
 static void check_super_kmer_buffer(KC__Buffer* bf, size_t i) {
     ck_assert(bf->type == KC__BUFFER_TYPE_SUPER_KMER);
 
@@ -181,14 +265,95 @@ START_TEST(test_super_kmer)
     }
 END_TEST
 
+static void check_fasta_view(KC__Buffer* bf, size_t i) {
+    ck_assert(bf->mapping != NULL);
+
+    const char* content;
+    KC__BufferType type = KC__BUFFER_TYPE_FASTA;
+    switch (i) {
+        case 0:
+            content = ">1\nACGTA\n>2\nTCGAT\n";
+            break;
+        case 1:
+            content = ">\nATCGATCG\nAACNCGNN\n";
+            break;
+        case 2:
+            content = "GNN\nGTT\n";
+            type = KC__BUFFER_TYPE_FASTA_CONTINUED;
+            break;
+        case 3:
+            content = ">\nNNNANNNC\nNNNGNNNN\n";
+            break;
+        case 4:
+            content = "NNN\nT\n";
+            type = KC__BUFFER_TYPE_FASTA_CONTINUED;
+            break;
+        default:
+            ck_abort();
+    }
+
+    ck_assert(bf->type == type);
+    ck_assert(bf->length == strlen(content));
+    ck_assert(memcmp(content, bf->data, bf->length) == 0);
+}
+
+/**
+ * A record longer than a view is continued by the next view from its last K - 1 bases.
+ */
+START_TEST(test_fasta_views)
+    {
+        use_views(20);
+
+        char* file_names[] = {"../tests/test_files/test_fasta.fa"};
+        KC__FileInputDescription input = {file_names, 1, KC__FILE_TYPE_FASTA, KC__FILE_COMPRESSION_TYPE_PLAIN};
+        KC__file_reader_update_input(fr, input);
+        read_files();
+
+        check_buffers(check_fasta_view, 5);
+    }
+END_TEST
+
+START_TEST(test_fastq_views)
+    {
+        use_views(20);
+
+        char* file_names[] = {"../tests/test_files/test_fastq_1.fq",
+                              "../tests/test_files/test_fastq_2.fq"};
+        KC__FileInputDescription input = {file_names, 2, KC__FILE_TYPE_FASTQ, KC__FILE_COMPRESSION_TYPE_PLAIN};
+        KC__file_reader_update_input(fr, input);
+        read_files();
+
+        check_buffers(check_fastq_buffer, 3);
+    }
+END_TEST
+
+START_TEST(test_super_kmer_views)
+    {
+        use_views(20);
+
+        char* file_names[] = {"../tests/test_files/test_super_kmer"};
+        KC__FileInputDescription input = {file_names, 1, KC__FILE_TYPE_SUPER_KMER, KC__FILE_COMPRESSION_TYPE_PLAIN};
+        KC__file_reader_update_input(fr, input);
+        read_files();
+
+        check_buffers(check_super_kmer_buffer, 4);
+    }
+END_TEST
+
 Suite* file_reader_suite() {
     TCase* tc_core = tcase_create("Core");
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_fasta);
     tcase_add_test(tc_core, test_fastq);
+    tcase_add_loop_test(tc_core, test_fastq_ranges, 0, 104);
+    tcase_add_test(tc_core, test_shared_files);
     tcase_add_test(tc_core, test_gz);
     tcase_add_test(tc_core, test_cat_gz);
+    tcase_add_loop_test(tc_core, test_bgzf, 1, 5);
     tcase_add_test(tc_core, test_super_kmer);
+    tcase_add_test(tc_core, test_fasta_views);
+    tcase_add_test(tc_core, test_fastq_views);
+    tcase_add_test(tc_core, test_super_kmer_views);
 
     Suite* s = suite_create("File reader");
     suite_add_tcase(s, tc_core);
@@ -11,6 +11,8 @@ static KC__FileWriter* fw;
 static KC__BufferQueue* bq;
 static const char* kmer_file_name = "../tests/test_files/test_write_kmers";
 static const char* super_kmer_file_name = "../tests/test_files/test_write_super_kmers";
+static const char* partitioned_kmer_file_name = "../tests/test_files/test_write_partitioned_kmers";
+static const char* partition_file_names[2] = {"../tests/test_files/test_write_partitioned_super_kmers_0", "../tests/test_files/test_write_partitioned_super_kmers_1"};
 
 static void setup() {
     ma = KC__mem_allocator_create(1000000);
@@ -23,6 +25,19 @@ static void setup() {
     KC__file_writer_update_tmp_file(fw, super_kmer_file_name);
 }
 
+static void setup_partitions() {
+    ma = KC__mem_allocator_create(1000000);
+
+    fw = KC__file_writer_create(ma, partitioned_kmer_file_name, NULL);
+    KC__file_writer_init_partitions(ma, fw, 4, 200);
+    KC__file_writer_set_partitions_count(fw, 2);
+
+    bq = KC__buffer_queue_create(ma, 20, 10);
+    KC__file_writer_link_modules(fw, bq);
+
+    KC__file_writer_update_tmp_files(fw, partition_file_names, 2);
+}
+
 static void teardown() {
     if (fw != NULL) {
         KC__file_writer_free(ma, fw);
@@ -32,6 +47,16 @@ static void teardown() {
     KC__mem_allocator_free(ma);
 }
 
+static void teardown_partitions() {
+    teardown();
+
+    // The files are only checked by the test.
+    remove(partitioned_kmer_file_name);
+    for (size_t i = 0; i < 2; i++) {
+        remove(partition_file_names[i]);
+    }
+}
+
 static inline void add_buffers() {
     KC__buffer_queue_start_input(bq);
 
@@ -104,13 +129,65 @@ START_TEST(test_function)
     }
 END_TEST
 
+START_TEST(test_partitions)
+    {
+        // The buffers of 2 partitions hold the longest super K-mer of K = 4, the ones of 3 partitions cannot.
+        ck_assert(KC__file_writer_partitions_count_max(fw) == 2);
+
+        KC__buffer_queue_start_input(bq);
+
+        // Super K-mers of K = 4 with 0, 4 and 1 expanded bases, in partitions 1, 0 and 1.
+        unsigned char content[15] = {0x3, 0x0, 0x0, 0x0,
+                                     0x1, 0x0, 0x11,
+                                     0x0, 0x4, 0xAA, 0xBB,
+                                     0x1, 0x1, 0x22, 0x33};
+
+        KC__Buffer* bf = KC__buffer_queue_get_blank_buffer(bq);
+        bf->type = KC__BUFFER_TYPE_PARTITIONED_SUPER_KMER;
+        bf->length = 15;
+        memcpy(bf->data, content, bf->length);
+        KC__buffer_queue_enqueue_filled_buffer(bq, bf);
+
+        KC__buffer_queue_finish_input(bq);
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, KC__file_writer_work, fw);
+        pthread_join(thread, NULL);
+
+        ck_assert(KC__file_writer_get_partition_tmp_file_size(fw, 0) == 11);
+        ck_assert(KC__file_writer_get_partition_tmp_file_size(fw, 1) == 13);
+        ck_assert(KC__file_writer_get_tmp_file_size(fw) == 24);
+
+        unsigned char contents[2][13] = {{0x7, 0x0, 0x0, 0x0, 0x1, 0x0, 0x0, 0x0, 0x4, 0xAA, 0xBB},
+                                         {0x9, 0x0, 0x0, 0x0, 0x2, 0x0, 0x0, 0x0, 0x0, 0x11, 0x1, 0x22, 0x33}};
+        size_t file_sizes[2] = {11, 13};
+
+        for (size_t i = 0; i < 2; i++) {
+            FILE* fp = fopen(partition_file_names[i], "rb");
+            ck_assert(fp != NULL);
+
+            unsigned char read_content[50];
+            size_t read_size = fread(read_content, 1, sizeof(read_content), fp);
+            fclose(fp);
+
+            ck_assert(read_size == file_sizes[i]);
+            ck_assert(memcmp(contents[i], read_content, file_sizes[i]) == 0);
+        }
+    }
+END_TEST
+
 Suite* file_writer_suite() {
     TCase* tc_core = tcase_create("Core");
     tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, test_function);
 
+    TCase* tc_partitions = tcase_create("Partitions");
+    tcase_add_checked_fixture(tc_partitions, setup_partitions, teardown_partitions);
+    tcase_add_test(tc_partitions, test_partitions);
+
     Suite* s = suite_create("File writer");
     suite_add_tcase(s, tc_core);
+    suite_add_tcase(s, tc_partitions);
 
     return s;
 }
\ No newline at end of file
@@ -8,18 +8,45 @@
 
 
 static KC__MemAllocator* ma;
+static KC__ThreadPool* pool;
+static KC__HashMapParam hash_map_param;
+static size_t hash_map_K;
 static KC__HashMap* hm;
 static size_t max_key_count;
 static size_t unique_kmers_count;
+/** K-mers following the unique ones, added once by thread 0. */
+static size_t singleton_kmers_count;
 static KC__count_t* count_array_in_hash;
 static KC__count_t* count_array_out_hash;
 static KC__unit_t* threads_kmers[THREAD_COUNT];
 static size_t exported_count;
+static bool add_in_batch;
 
 
+static void reject_kmer_callback(const KC__unit_t* kmer, void* data) {
+    if (data != NULL) {
+        ck_abort();
+    }
+
+    KC__unit_t idx = kmer[0];
+    if (idx >= unique_kmers_count + singleton_kmers_count) {
+        ck_abort();
+    }
+
+    __sync_fetch_and_add(&(count_array_out_hash[idx]), 1);
+}
+
+static void set_reject_callbacks() {
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        KC__hash_map_set_reject_callback(hm, i, reject_kmer_callback, NULL);
+    }
+}
+
 static void setup() {
     ma = KC__mem_allocator_create(1000000);
-    hm = KC__hash_map_create(ma, 16, THREAD_COUNT);
+    pool = KC__thread_pool_create(ma, THREAD_COUNT);
+    hm = KC__hash_map_create(ma, hash_map_K, THREAD_COUNT, hash_map_param, pool);
+    set_reject_callbacks();
 
     max_key_count = KC__hash_map_max_key_count(hm);
     unique_kmers_count = max_key_count * 2;
@@ -38,11 +65,137 @@ static void setup() {
         }
     }
 
+    singleton_kmers_count = 0;
     exported_count = 0;
+    add_in_batch = false;
+}
+
+static void setup_chaining() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_open_addressing() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_OPEN_ADDRESSING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_chaining_bloom_filter() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 100000;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_open_addressing_bloom_filter() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_OPEN_ADDRESSING;
+    hash_map_param.bloom_filter_mem = 100000;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_evict_bloom_filter() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 100000;
+    hash_map_param.evict_singletons = true;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_partitioned_bloom_filter() {
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 100000;
+    hash_map_param.partitioned = true;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_direct() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 8;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_DIRECT;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+
+    // K-mers out of the 4^K key space are invalid for the direct engine.
+    unique_kmers_count = max_key_count;
+}
+
+static void setup_partitioned() {
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.partitioned = true;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_evict() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = true;
+    hash_map_param.hot_cache = false;
+    setup();
+}
+
+static void setup_hot_cache() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = true;
+    setup();
+}
+
+static void setup_open_addressing_hot_cache() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_OPEN_ADDRESSING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = false;
+    hash_map_param.hot_cache = true;
+    setup();
+}
+
+static void setup_evict_hot_cache() {
+    hash_map_param.partitioned = false;
+    hash_map_K = 16;
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
+    hash_map_param.bloom_filter_mem = 0;
+    hash_map_param.evict_singletons = true;
+    hash_map_param.hot_cache = true;
+    setup();
 }
 
 static void teardown() {
     KC__hash_map_free(ma, hm);
+    KC__thread_pool_free(ma, pool);
     KC__mem_allocator_free(ma);
 
     free(count_array_in_hash);
@@ -54,10 +207,13 @@ static void teardown() {
 
 static void realloc_by_mem_limit(size_t mem_limit) {
     KC__hash_map_free(ma, hm);
+    KC__thread_pool_free(ma, pool);
     KC__mem_allocator_free(ma);
 
     ma = KC__mem_allocator_create(mem_limit);
-    hm = KC__hash_map_create(ma, 16, THREAD_COUNT);
+    pool = KC__thread_pool_create(ma, THREAD_COUNT);
+    hm = KC__hash_map_create(ma, hash_map_K, THREAD_COUNT, hash_map_param, pool);
+    set_reject_callbacks();
 
     max_key_count = KC__hash_map_max_key_count(hm);
     unique_kmers_count = max_key_count * 2;
@@ -76,9 +232,58 @@ static void randomize_thread_kmers(int n) {
     }
 }
 
+static void add_singleton_kmers(size_t n) {
+    if (n != 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < singleton_kmers_count; i++) {
+        KC__unit_t kmer = unique_kmers_count + i;
+        if (!KC__hash_map_add_kmer(hm, n, &kmer)) {
+            __sync_fetch_and_add(&(count_array_out_hash[kmer]), 1);
+        }
+    }
+}
+
+static void* add_kmers_batch(void* ptr) {
+    size_t n = *((size_t *)ptr);
+
+    add_singleton_kmers(n);
+
+    KC__unit_t* kmers = threads_kmers[n];
+    bool added[KC__HASH_MAP_BATCH_SIZE_MAX];
+
+    for (size_t m = 0; m < 2; m++) {
+        for (size_t i = 0; i < unique_kmers_count; i += KC__HASH_MAP_BATCH_SIZE_MAX) {
+            size_t count = unique_kmers_count - i;
+            if (count > KC__HASH_MAP_BATCH_SIZE_MAX) {
+                count = KC__HASH_MAP_BATCH_SIZE_MAX;
+            }
+
+            KC__hash_map_add_kmers_batch(hm, n, kmers + i, count, added);
+
+            for (size_t j = 0; j < count; j++) {
+                if (!added[j]) {
+                    KC__unit_t kmer = kmers[i + j];
+                    if (kmer >= unique_kmers_count) {
+                        ck_abort();
+                    }
+                    __sync_fetch_and_add(&(count_array_out_hash[kmer]), 1);
+                }
+            }
+        }
+    }
+
+    KC__hash_map_finish_adding_kmers(hm, n);
+
+    pthread_exit(NULL);
+}
+
 static void* add_kmers(void* ptr) {
     size_t n = *((size_t *)ptr);
 
+    add_singleton_kmers(n);
+
     KC__unit_t* kmers = threads_kmers[n];
 
     for (size_t m = 0; m < 2; m++) {
@@ -105,7 +310,7 @@ static void add_all_kmers() {
 
     for (size_t i = 0; i < THREAD_COUNT; i++) {
         thread_ids[i] = i;
-        pthread_create(&(threads[i]), NULL, add_kmers, &(thread_ids[i]));
+        pthread_create(&(threads[i]), NULL, add_in_batch ? add_kmers_batch : add_kmers, &(thread_ids[i]));
     }
 
     for (size_t i = 0; i < THREAD_COUNT; i++) {
@@ -119,7 +324,7 @@ static void check_test_export_callback(const KC__unit_t* kmer, KC__count_t count
     }
 
     KC__unit_t idx = kmer[0];
-    if (idx >= unique_kmers_count) {
+    if (idx >= unique_kmers_count + singleton_kmers_count) {
         ck_abort();
     }
 
@@ -218,6 +423,25 @@ START_TEST(test_normal_case)
     }
 END_TEST
 
+START_TEST(test_many_clears)
+    {
+        randomize_thread_kmers(_i);
+
+        // The tables of earlier passes read as empty, also after the generation of the table wraps around.
+        add_all_kmers();
+        const size_t clears_count = 1 + (size_t)_i * 127;
+        for (size_t i = 0; i < clears_count; i++) {
+            KC__hash_map_clear(hm);
+        }
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            count_array_out_hash[i] = 0;
+        }
+
+        add_all_kmers();
+        check_results();
+    }
+END_TEST
+
 START_TEST(test_use_half_nodes)
     {
         unique_kmers_count = max_key_count / 2;
@@ -235,6 +459,326 @@ START_TEST(test_rigorous)
     }
 END_TEST
 
+START_TEST(test_batch)
+    {
+        add_in_batch = true;
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        check_results();
+    }
+END_TEST
+
+/**
+ * The first pass with the bloom filter only finds the keys, nothing is rejected by it, and the second pass over the same
+ * K-mers counts them exactly.
+ */
+static void add_all_kmers_twice() {
+    add_all_kmers();
+    for (size_t i = 0; i < unique_kmers_count + singleton_kmers_count; i++) {
+        if (count_array_out_hash[i] != 0) {
+            ck_abort_msg("%zu, out hash: %zu", i, count_array_out_hash[i]);
+        }
+    }
+
+    ck_assert(KC__hash_map_start_recounting(hm));
+    add_all_kmers();
+}
+
+/**
+ * With the bloom filter, a K-mer is still counted either wholly in hash map or wholly out of it. The singletons are
+ * dropped, unless a false positive of the filters lets them in, where they are counted exactly as well.
+ */
+static void check_bloom_filter_results() {
+    export_all_kmers();
+    ck_assert(exported_count <= max_key_count);
+
+    for (size_t i = 0; i < unique_kmers_count; i++) {
+        KC__count_t c1 = count_array_in_hash[i];
+        KC__count_t c2 = count_array_out_hash[i];
+
+        if ((c1 + c2 != (THREAD_COUNT * 2)) || ((c1 != 0) && (c2 != 0))) {
+            ck_abort_msg("%zu, in hash: %zu, out hash: %zu", i, c1, c2);
+        }
+    }
+
+    size_t kept_count = 0;
+    for (size_t i = unique_kmers_count; i < unique_kmers_count + singleton_kmers_count; i++) {
+        KC__count_t c1 = count_array_in_hash[i];
+        KC__count_t c2 = count_array_out_hash[i];
+
+        if (c1 + c2 > 1) {
+            ck_abort_msg("%zu, in hash: %zu, out hash: %zu", i, c1, c2);
+        }
+        kept_count += c1 + c2;
+    }
+    ck_assert_msg(kept_count + KC__hash_map_dropped_kmers_count(hm) == singleton_kmers_count, "kept: %zu, dropped: %zu", kept_count, KC__hash_map_dropped_kmers_count(hm));
+}
+
+START_TEST(test_bloom_filter_use_half_nodes)
+    {
+        unique_kmers_count = max_key_count / 2;
+        singleton_kmers_count = max_key_count / 2;
+        randomize_thread_kmers(_i);
+
+        add_all_kmers_twice();
+        check_bloom_filter_results();
+    }
+END_TEST
+
+START_TEST(test_bloom_filter_nodes_used_out)
+    {
+        randomize_thread_kmers(_i);
+
+        add_all_kmers_twice();
+        check_bloom_filter_results();
+    }
+END_TEST
+
+START_TEST(test_bloom_filter_batch)
+    {
+        add_in_batch = true;
+        unique_kmers_count = max_key_count / 2;
+        singleton_kmers_count = max_key_count / 2;
+        randomize_thread_kmers(_i);
+
+        add_all_kmers_twice();
+        check_bloom_filter_results();
+    }
+END_TEST
+
+START_TEST(test_bloom_filter_after_recounting)
+    {
+        // The filter only works for the first pass, the passes after it count new keys from 1.
+        add_all_kmers_twice();
+        ck_assert(!KC__hash_map_start_recounting(hm));
+        KC__hash_map_clear(hm);
+
+        unique_kmers_count = max_key_count / 2;
+        randomize_thread_kmers(_i);
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            count_array_out_hash[i] = 0;
+        }
+
+        add_all_kmers();
+        ck_assert(KC__hash_map_dropped_kmers_count(hm) == 0);
+        check_results();
+    }
+END_TEST
+
+/**
+ * Evicted K-mers are passed to the reject callbacks, a K-mer is either wholly in hash map or wholly out of it.
+ */
+static void check_evict_results() {
+    export_all_kmers();
+    ck_assert(exported_count <= max_key_count);
+
+    size_t in_hash_count = 0;
+    for (size_t i = 0; i < unique_kmers_count; i++) {
+        KC__count_t c1 = count_array_in_hash[i];
+        KC__count_t c2 = count_array_out_hash[i];
+
+        if ((c1 + c2 != (THREAD_COUNT * 2)) || ((c1 != 0) && (c2 != 0))) {
+            ck_abort_msg("%zu, in hash: %zu, out hash: %zu", i, c1, c2);
+        }
+        if (c1 != 0) {
+            in_hash_count++;
+        }
+    }
+    ck_assert(in_hash_count == exported_count);
+}
+
+START_TEST(test_evict)
+    {
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        KC__hash_map_clear(hm);
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            count_array_out_hash[i] = 0;
+        }
+
+        add_all_kmers();
+        check_evict_results();
+    }
+END_TEST
+
+START_TEST(test_evict_batch)
+    {
+        add_in_batch = true;
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        check_evict_results();
+    }
+END_TEST
+
+START_TEST(test_evict_use_half_nodes)
+    {
+        unique_kmers_count = max_key_count / 2;
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        check_results();
+    }
+END_TEST
+
+/** The sightings of each K-mer rejected by the last pass, added again by the next pass. */
+static KC__count_t* spilled_counts;
+
+static void* add_spilled_kmers(void* ptr) {
+    size_t n = *((size_t *)ptr);
+
+    for (size_t i = n; i < unique_kmers_count + singleton_kmers_count; i += THREAD_COUNT) {
+        for (KC__count_t c = 0; c < spilled_counts[i]; c++) {
+            KC__unit_t kmer = i;
+            if (!KC__hash_map_add_kmer(hm, n, &kmer)) {
+                __sync_fetch_and_add(&(count_array_out_hash[kmer]), 1);
+            }
+        }
+    }
+
+    KC__hash_map_finish_adding_kmers(hm, n);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Count all K-mers in passes like the K-mer counter, each pass after the first one adds the K-mers rejected by the pass
+ * before, with eviction stopped.
+ * @return The count of passes, or passes_count_max + 1 if K-mers are still rejected by the last pass.
+ */
+static size_t count_in_passes(size_t passes_count_max) {
+    const size_t kmers_count = unique_kmers_count + singleton_kmers_count;
+    spilled_counts = (KC__count_t*)malloc(sizeof(KC__count_t) * kmers_count);
+
+    add_all_kmers();
+    export_all_kmers();
+
+    size_t passes_count = 1;
+    while (true) {
+        bool spilled = false;
+        for (size_t i = 0; i < kmers_count; i++) {
+            spilled_counts[i] = count_array_out_hash[i];
+            count_array_out_hash[i] = 0;
+            spilled = spilled || (spilled_counts[i] != 0);
+        }
+        if (!spilled) {
+            break;
+        }
+        if (passes_count++ > passes_count_max) {
+            break;
+        }
+
+        KC__hash_map_stop_evicting(hm);
+        KC__hash_map_clear(hm);
+
+        pthread_t threads[THREAD_COUNT];
+        size_t thread_ids[THREAD_COUNT];
+        for (size_t i = 0; i < THREAD_COUNT; i++) {
+            thread_ids[i] = i;
+            pthread_create(&(threads[i]), NULL, add_spilled_kmers, &(thread_ids[i]));
+        }
+        for (size_t i = 0; i < THREAD_COUNT; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        export_all_kmers();
+    }
+
+    free(spilled_counts);
+    return passes_count;
+}
+
+START_TEST(test_evict_passes)
+    {
+        // Most of the keys are singletons, which would be evicted again by every pass over the spilled K-mers.
+        unique_kmers_count = max_key_count / 2;
+        singleton_kmers_count = max_key_count * 3 / 2;
+        randomize_thread_kmers(_i);
+
+        // A pass after the first one counts about a full table.
+        const size_t passes_count = count_in_passes(8);
+        ck_assert_msg(passes_count <= 4, "passes: %zu", passes_count);
+
+        for (size_t i = 0; i < unique_kmers_count + singleton_kmers_count; i++) {
+            const KC__count_t count = (i < unique_kmers_count) ? (THREAD_COUNT * 2) : 1;
+            if (count_array_in_hash[i] != count) {
+                ck_abort_msg("%zu, in hash: %zu, expected: %zu", i, count_array_in_hash[i], count);
+            }
+        }
+    }
+END_TEST
+
+#define HOT_KMERS_COUNT 8
+
+/**
+ * A few K-mers take a quarter of all sightings, they are counted by the hot caches once they get into the table, and
+ * should be flushed before export.
+ */
+START_TEST(test_hot_kmers)
+    {
+        add_in_batch = (_i % 2 == 1);
+        randomize_thread_kmers(_i);
+        for (size_t i = 0; i < THREAD_COUNT; i++) {
+            for (size_t j = 0; j < unique_kmers_count; j += 4) {
+                threads_kmers[i][j] = (j / 4) % HOT_KMERS_COUNT;
+            }
+        }
+
+        KC__count_t* expected_counts = (KC__count_t*)calloc(unique_kmers_count, sizeof(KC__count_t));
+        for (size_t i = 0; i < THREAD_COUNT; i++) {
+            for (size_t j = 0; j < unique_kmers_count; j++) {
+                expected_counts[threads_kmers[i][j]] += 2;
+            }
+        }
+
+        add_all_kmers();
+        export_all_kmers();
+        ck_assert(exported_count <= max_key_count);
+
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            KC__count_t c1 = count_array_in_hash[i];
+            KC__count_t c2 = count_array_out_hash[i];
+
+            if ((c1 + c2 != expected_counts[i]) || ((c1 != 0) && (c2 != 0))) {
+                ck_abort_msg("%zu, in hash: %zu, out hash: %zu, expected: %zu", i, c1, c2, expected_counts[i]);
+            }
+        }
+        free(expected_counts);
+    }
+END_TEST
+
+START_TEST(test_direct)
+    {
+        // All 4^K K-mers, each of them has a counter.
+        ck_assert(max_key_count == 65536);
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        KC__hash_map_clear(hm);
+        add_all_kmers();
+        export_all_kmers();
+
+        ck_assert(exported_count == unique_kmers_count);
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            KC__count_t c1 = count_array_in_hash[i];
+            KC__count_t c2 = count_array_out_hash[i];
+            if ((c1 != (THREAD_COUNT * 2)) || (c2 != 0)) {
+                ck_abort_msg("%zu, in hash: %zu, out hash: %zu", i, c1, c2);
+            }
+        }
+    }
+END_TEST
+
+START_TEST(test_direct_fits)
+    {
+        ck_assert(KC__hash_map_direct_fits(8, THREAD_COUNT, 1000000));
+        ck_assert(!KC__hash_map_direct_fits(8, THREAD_COUNT, 65536 * sizeof(KC__count_t)));
+        ck_assert(!KC__hash_map_direct_fits(16, THREAD_COUNT, 1000000));
+        ck_assert(!KC__hash_map_direct_fits(32, THREAD_COUNT, SIZE_MAX));
+    }
+END_TEST
+
 static void test_export_count_callback(const KC__unit_t* kmer, KC__count_t count, void* data) {
     size_t* m = data;
     if (m == NULL) {
@@ -266,17 +810,106 @@ END_TEST
 
 Suite* hash_map_suite() {
     TCase* tc_core = tcase_create("Core");
-    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_checked_fixture(tc_core, setup_chaining, teardown);
     tcase_add_loop_test(tc_core, test_table_capacity_one, 0, 5);
     tcase_add_loop_test(tc_core, test_normal_case, 0, 5);
+    tcase_add_loop_test(tc_core, test_many_clears, 0, 5);
     tcase_add_loop_test(tc_core, test_use_half_nodes, 0, 5);
     tcase_add_loop_test(tc_core, test_export_count, 0, 5);
+    tcase_add_loop_test(tc_core, test_batch, 0, 5);
 
     // tcase_add_loop_test(tc_core, test_rigorous, 0, 1000);
 
 
+    TCase* tc_open_addressing = tcase_create("Open Addressing");
+    tcase_add_checked_fixture(tc_open_addressing, setup_open_addressing, teardown);
+    tcase_add_loop_test(tc_open_addressing, test_normal_case, 0, 5);
+    tcase_add_loop_test(tc_open_addressing, test_many_clears, 0, 5);
+    tcase_add_loop_test(tc_open_addressing, test_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_open_addressing, test_export_count, 0, 5);
+    tcase_add_loop_test(tc_open_addressing, test_rigorous, 0, 5);
+    tcase_add_loop_test(tc_open_addressing, test_batch, 0, 5);
+
+
+    TCase* tc_bloom_filter = tcase_create("Bloom Filter");
+    tcase_add_checked_fixture(tc_bloom_filter, setup_chaining_bloom_filter, teardown);
+    tcase_add_loop_test(tc_bloom_filter, test_bloom_filter_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_bloom_filter, test_bloom_filter_nodes_used_out, 0, 5);
+    tcase_add_loop_test(tc_bloom_filter, test_bloom_filter_batch, 0, 5);
+    tcase_add_loop_test(tc_bloom_filter, test_bloom_filter_after_recounting, 0, 5);
+
+
+    TCase* tc_open_addressing_bloom_filter = tcase_create("Open Addressing Bloom Filter");
+    tcase_add_checked_fixture(tc_open_addressing_bloom_filter, setup_open_addressing_bloom_filter, teardown);
+    tcase_add_loop_test(tc_open_addressing_bloom_filter, test_bloom_filter_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_open_addressing_bloom_filter, test_bloom_filter_nodes_used_out, 0, 5);
+    tcase_add_loop_test(tc_open_addressing_bloom_filter, test_bloom_filter_batch, 0, 5);
+
+    TCase* tc_evict_bloom_filter = tcase_create("Evict Bloom Filter");
+    tcase_add_checked_fixture(tc_evict_bloom_filter, setup_evict_bloom_filter, teardown);
+    tcase_add_loop_test(tc_evict_bloom_filter, test_bloom_filter_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_evict_bloom_filter, test_bloom_filter_nodes_used_out, 0, 5);
+
+    TCase* tc_partitioned_bloom_filter = tcase_create("Partitioned Bloom Filter");
+    tcase_add_checked_fixture(tc_partitioned_bloom_filter, setup_partitioned_bloom_filter, teardown);
+    tcase_add_loop_test(tc_partitioned_bloom_filter, test_bloom_filter_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_partitioned_bloom_filter, test_bloom_filter_nodes_used_out, 0, 5);
+    tcase_add_loop_test(tc_partitioned_bloom_filter, test_bloom_filter_batch, 0, 5);
+
+
+    TCase* tc_direct = tcase_create("Direct");
+    tcase_add_checked_fixture(tc_direct, setup_direct, teardown);
+    tcase_add_loop_test(tc_direct, test_direct, 0, 5);
+    tcase_add_loop_test(tc_direct, test_export_count, 0, 5);
+    tcase_add_test(tc_direct, test_direct_fits);
+
+
+    TCase* tc_partitioned = tcase_create("Partitioned");
+    tcase_add_checked_fixture(tc_partitioned, setup_partitioned, teardown);
+    tcase_add_loop_test(tc_partitioned, test_normal_case, 0, 5);
+    tcase_add_loop_test(tc_partitioned, test_many_clears, 0, 5);
+    tcase_add_loop_test(tc_partitioned, test_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_partitioned, test_export_count, 0, 5);
+    tcase_add_loop_test(tc_partitioned, test_rigorous, 0, 5);
+    tcase_add_loop_test(tc_partitioned, test_batch, 0, 5);
+
+    TCase* tc_evict = tcase_create("Evict");
+    tcase_add_checked_fixture(tc_evict, setup_evict, teardown);
+    tcase_add_loop_test(tc_evict, test_evict, 0, 5);
+    tcase_add_loop_test(tc_evict, test_evict_batch, 0, 5);
+    tcase_add_loop_test(tc_evict, test_evict_use_half_nodes, 0, 5);
+    tcase_add_loop_test(tc_evict, test_evict_passes, 0, 5);
+
+
+    TCase* tc_hot_cache = tcase_create("Hot Cache");
+    tcase_add_checked_fixture(tc_hot_cache, setup_hot_cache, teardown);
+    tcase_add_loop_test(tc_hot_cache, test_normal_case, 0, 5);
+    tcase_add_loop_test(tc_hot_cache, test_hot_kmers, 0, 5);
+
+
+    TCase* tc_open_addressing_hot_cache = tcase_create("Open Addressing Hot Cache");
+    tcase_add_checked_fixture(tc_open_addressing_hot_cache, setup_open_addressing_hot_cache, teardown);
+    tcase_add_loop_test(tc_open_addressing_hot_cache, test_hot_kmers, 0, 5);
+
+
+    TCase* tc_evict_hot_cache = tcase_create("Evict Hot Cache");
+    tcase_add_checked_fixture(tc_evict_hot_cache, setup_evict_hot_cache, teardown);
+    tcase_add_loop_test(tc_evict_hot_cache, test_hot_kmers, 0, 5);
+
+
     Suite* s = suite_create("Hash Map");
     suite_add_tcase(s, tc_core);
+    suite_add_tcase(s, tc_open_addressing);
+    suite_add_tcase(s, tc_bloom_filter);
+    suite_add_tcase(s, tc_open_addressing_bloom_filter);
+    suite_add_tcase(s, tc_evict_bloom_filter);
+    suite_add_tcase(s, tc_partitioned_bloom_filter);
+    suite_add_tcase(s, tc_direct);
+    suite_add_tcase(s, tc_partitioned);
+    suite_add_tcase(s, tc_evict);
+    suite_add_tcase(s, tc_hot_cache);
+    suite_add_tcase(s, tc_open_addressing_hot_cache);
+    suite_add_tcase(s, tc_evict_hot_cache);
 
     return s;
 }
\ No newline at end of file
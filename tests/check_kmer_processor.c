@@ -4,6 +4,7 @@
 #include "check_all.h"
 #include "../src/kmer_processor.h"
 #include "../src/utils.h"
+#include "../src/encode.h"
 
 
 #define TEST_KMER_CHAR_COUNT 24
@@ -19,10 +20,14 @@ static char random_read_rc[101];
 static unsigned char test_canonical_kmer[TEST_KMER_CHAR_COUNT];
 
 static KC__MemAllocator *ma2;
+static KC__ThreadPool *pool;
 static size_t test_store_check_buffer_called_times;
+static uint8_t* test_store_kmer_partitions;
+static size_t test_store_partitions_kmers_count;
 static size_t test_export_kmer_buffers_count;
 
 static KC__OutputParam output_param;
+static KC__HashMapParam hash_map_param;
 
 
 static void setup() {
@@ -34,18 +39,22 @@ static void setup() {
     check_test_kmer_callback_called_times = 0;
 
     ma2 = KC__mem_allocator_create(1000000);
+    pool = KC__thread_pool_create(ma2, 1);
     test_store_check_buffer_called_times = 0;
     test_export_kmer_buffers_count = 0;
 
     output_param.filter_min = 1;
     output_param.filter_max = KC__COUNT_MAX;
     output_param.count_max = KC__COUNT_MAX;
+
+    hash_map_param.engine = KC__HASH_MAP_ENGINE_CHAINING;
 }
 
 static void teardown() {
     free(buffer.data);
     KC__kmer_processor_free(ma, kp);
     KC__mem_allocator_free(ma);
+    KC__thread_pool_free(ma2, pool);
     KC__mem_allocator_free(ma2);
 }
 
@@ -359,6 +368,85 @@ START_TEST(test_handle_buffer_fastq)
     }
 END_TEST
 
+static char fastq_records_reads[1000];
+
+static void check_test_read_callback_fastq_records(KC__KmerProcessor *kp, const char *read, size_t read_length) {
+    ck_assert(kp != NULL);
+    strncat(fastq_records_reads, read, read_length);
+    strcat(fastq_records_reads, ",");
+}
+
+/**
+ * The buffer starts in a quality line, the quality lines start with '@' or '+', and some of them are not as long as
+ * their sequences.
+ */
+START_TEST(test_handle_buffer_fastq_records)
+    {
+        buffer.type = KC__BUFFER_TYPE_FASTQ;
+
+        init_kmer_processor_by_K_1();
+        KC__kmer_processor_set_read_callback(kp, check_test_read_callback_fastq_records);
+
+        const char* fastq_text;
+        const char* reads;
+        switch (_i) {
+            case 0:
+                fastq_text = "@@II\n" "@r1\nAACCGGTT\n+\n@+@IIIII\n" "@r2\nACGT\n+r2\n+@II\n" "@r3\nCGTA\n+\nIIIIIII\n" "@r4\nTTTT\n+\nII";
+                reads = "AACCGGTT,ACGT,CGTA,TTTT,";
+                break;
+            case 1:
+                fastq_text = "@@II\r\n" "@r1\r\nAACCGGTT\r\n+\r\n@+@IIIII\r\n" "@r2\r\nACGT\r\n+r2\r\n+@II\r\n" "@r3\r\nCGTA\r\n+\r\nIIIIIII\r\n" "@r4\r\nTTTT\r\n+\r\nII";
+                reads = "AACCGGTT,ACGT,CGTA,TTTT,";
+                break;
+            case 2:
+                fastq_text = "@r1\nAACCGGTT\n+\nIII\n" "@r2\nACGT\n+\nIIII\n" "@r3\nACGT\n";
+                reads = "AACCGGTT,ACGT,";
+                break;
+            default:
+                ck_abort();
+        }
+        copy_text_to_buffer(fastq_text);
+        fastq_records_reads[0] = '\0';
+
+        KC__kmer_processor_handle_buffer(kp, &buffer);
+
+        ck_assert_msg(strcmp(fastq_records_reads, reads) == 0, "Reads: %s", fastq_records_reads);
+    }
+END_TEST
+
+/**
+ * The buffer continues the sequence of a record up to the first line starting with '>'.
+ */
+START_TEST(test_handle_buffer_fasta_continued)
+    {
+        buffer.type = KC__BUFFER_TYPE_FASTA_CONTINUED;
+
+        init_kmer_processor_by_K_1();
+        KC__kmer_processor_set_read_callback(kp, check_test_read_callback_fastq_records);
+
+        const char* fasta_text;
+        const char* reads;
+        switch (_i) {
+            case 0:
+                fasta_text = "CGTA\nAC\n" ">r\nGGTT\n" ">\nA";
+                reads = "CGTA\nAC\n,GGTT,A,";
+                break;
+            case 1:
+                fasta_text = "ACGT\r\nAC>G\n";
+                reads = "ACGT\r\nAC>G\n,";
+                break;
+            default:
+                ck_abort();
+        }
+        copy_text_to_buffer(fasta_text);
+        fastq_records_reads[0] = '\0';
+
+        KC__kmer_processor_handle_buffer(kp, &buffer);
+
+        ck_assert_msg(strcmp(fastq_records_reads, reads) == 0, "Reads: %s", fastq_records_reads);
+    }
+END_TEST
+
 START_TEST(test_handle_buffer_super_kmer_1)
     {
         K = 3;
@@ -440,6 +528,168 @@ START_TEST(test_handle_read_random_read)
     }
 END_TEST
 
+#define TEST_LONG_READ_LENGTH 3000
+
+static char long_random_read[TEST_LONG_READ_LENGTH + 1];
+static KC__unit_t long_read_kmer[8];
+
+/**
+ * Build the canonical K-mer at position n of the long read base by base.
+ */
+static void build_long_read_canonical_kmer(size_t n) {
+    KC__unit_t kmer[8] = {0};
+    KC__unit_t rc_kmer[8] = {0};
+    for (size_t j = 0; j < K; j++) {
+        KC__unit_t code;
+        switch (long_random_read[n + j]) {
+            case 'A': code = 0x0; break;
+            case 'C': code = 0x1; break;
+            case 'G': code = 0x2; break;
+            default: code = 0x3; break;
+        }
+        size_t pos = (K - 1 - j) * 2;
+        kmer[pos / 64] |= code << (pos % 64);
+        rc_kmer[j * 2 / 64] |= (0x3 - code) << (j * 2 % 64);
+    }
+
+    size_t W = KC__calculate_kmer_width(K);
+    const KC__unit_t* canonical = rc_kmer;
+    for (size_t i = W; i > 0; i--) {
+        if (kmer[i - 1] != rc_kmer[i - 1]) {
+            canonical = (kmer[i - 1] < rc_kmer[i - 1]) ? kmer : rc_kmer;
+            break;
+        }
+    }
+    memcpy(long_read_kmer, canonical, sizeof(KC__unit_t) * W);
+}
+
+static void check_test_kmer_callback_long_random_read(KC__KmerProcessor *kp, const KC__unit_t *canonical_kmer, size_t n,
+                                                      KC__unit_t last_code) {
+    ck_assert(kp != NULL);
+    ck_assert(last_code <= 0x3);
+    ck_assert(n == check_test_kmer_callback_called_times);
+
+    build_long_read_canonical_kmer(n);
+    for (size_t i = 0; i < KC__calculate_kmer_width(K); i++) {
+        if (canonical_kmer[i] != long_read_kmer[i]) {
+            ck_abort_msg("Error checking K-mer %zu (K: %zu)", n, K);
+        }
+    }
+
+    check_test_kmer_callback_called_times++;
+}
+
+/**
+ * A read longer than a part of the run, the K-mers across the parts should be the same as the others.
+ */
+START_TEST(test_handle_read_long_random_read)
+    {
+        const size_t Ks[] = {1, 5, 31, 32, 33, 64, 65, 127, 250};
+        K = Ks[_i];
+        init_kmer_processor_by_K();
+        KC__kmer_processor_set_kmer_callback(kp, check_test_kmer_callback_long_random_read);
+
+        srandom((unsigned int)time(NULL) + _i);
+        for (size_t i = 0; i < TEST_LONG_READ_LENGTH; i++) {
+            long_random_read[i] = "ACGT"[random() % 4];
+        }
+        long_random_read[TEST_LONG_READ_LENGTH] = '\0';
+
+        KC__kmer_processor_handle_read(kp, long_random_read, TEST_LONG_READ_LENGTH);
+
+        ck_assert(check_test_kmer_callback_called_times == TEST_LONG_READ_LENGTH + 1 - K);
+    }
+END_TEST
+
+static KC__unit_t long_read_kmers[TEST_LONG_READ_LENGTH][8];
+static size_t long_read_exported_count;
+
+static void check_export_callback_long_random_read(const KC__unit_t* kmer, KC__count_t count, void* data) {
+    ck_assert(data == NULL);
+
+    size_t W = KC__calculate_kmer_width(K);
+    KC__count_t expected_count = 0;
+    for (size_t n = 0; n + K <= TEST_LONG_READ_LENGTH; n++) {
+        if (memcmp(long_read_kmers[n], kmer, sizeof(KC__unit_t) * W) == 0) {
+            expected_count++;
+        }
+    }
+    if (count != expected_count) {
+        ck_abort_msg("Count %u of exported K-mer, expected %u (K: %zu)", count, expected_count, K);
+    }
+
+    long_read_exported_count += count;
+}
+
+/**
+ * The K-mers handled without K-mer callback are counted by the hash map, the paths specialized for the width of K-mers
+ * (1 to 4 units) and the generic one should count the same K-mers.
+ */
+START_TEST(test_handle_read_widths)
+    {
+        const size_t Ks[] = {5, 32, 33, 64, 65, 96, 97, 128, 129, 150};
+        K = Ks[_i];
+        init_kmer_processor_by_K();
+
+        KC__HashMap *hm = KC__hash_map_create(ma, K, 1, hash_map_param, pool);
+        KC__kmer_processor_link_modules(kp, hm, NULL, NULL);
+
+        srandom((unsigned int)time(NULL) + _i);
+        for (size_t i = 0; i < TEST_LONG_READ_LENGTH; i++) {
+            long_random_read[i] = "ACGT"[random() % 4];
+        }
+        long_random_read[TEST_LONG_READ_LENGTH] = '\0';
+        for (size_t n = 0; n + K <= TEST_LONG_READ_LENGTH; n++) {
+            build_long_read_canonical_kmer(n);
+            memcpy(long_read_kmers[n], long_read_kmer, sizeof(long_read_kmer));
+        }
+
+        KC__kmer_processor_handle_read(kp, long_random_read, TEST_LONG_READ_LENGTH);
+        KC__hash_map_finish_adding_kmers(hm, 0);
+
+        long_read_exported_count = 0;
+        size_t exported_count;
+        KC__hash_map_export(hm, 0, check_export_callback_long_random_read, NULL, &exported_count);
+        ck_assert(long_read_exported_count == TEST_LONG_READ_LENGTH + 1 - K);
+
+        KC__hash_map_free(ma, hm);
+    }
+END_TEST
+
+/**
+ * The block encoding should agree with KC__encode for every count of bases, including the vectorized full blocks.
+ */
+START_TEST(test_encode_bases)
+    {
+        const char alphabet[] = "ACGTacgtNn\r\n>-@";
+        char bases[KC__ENCODE_BLOCK_SIZE * 4];
+        uint8_t codes[KC__ENCODE_BLOCK_SIZE];
+
+        srandom((unsigned int)time(NULL) + _i);
+        for (size_t i = 0; i < sizeof(bases); i++) {
+            // Mostly valid bases, so that long runs are tested.
+            bases[i] = (random() % 4 == 0) ? alphabet[random() % (sizeof(alphabet) - 1)] : "ACGT"[random() % 4];
+        }
+
+        for (size_t start = 0; start < sizeof(bases) - KC__ENCODE_BLOCK_SIZE; start++) {
+            for (size_t count = 0; count <= KC__ENCODE_BLOCK_SIZE; count++) {
+                uint32_t invalid = KC__encode_bases(bases + start, count, codes);
+
+                for (size_t i = 0; i < count; i++) {
+                    KC__unit_t code = KC__encode(bases[start + i]);
+                    if (code > 0x3) {
+                        ck_assert_msg((invalid >> i) & 1, "%zu %zu %zu", start, count, i);
+                    } else {
+                        ck_assert_msg(!((invalid >> i) & 1), "%zu %zu %zu", start, count, i);
+                        ck_assert_msg(codes[i] == code, "%zu %zu %zu", start, count, i);
+                    }
+                }
+                ck_assert((count == KC__ENCODE_BLOCK_SIZE) || ((invalid >> count) == 0));
+            }
+        }
+    }
+END_TEST
+
 static void test_store_add_kmers(KC__HashMap *hm) {
     char long_read[285];
     for (size_t i = 0; i < 71; i++) {
@@ -517,7 +767,7 @@ START_TEST(test_store)
         KC__kmer_processor_set_store_buffer_request_callback(kp, test_store_alloc_buffer);
         KC__kmer_processor_set_store_buffer_complete_callback(kp, test_store_check_buffer);
 
-        KC__HashMap *hm = KC__hash_map_create(ma, K, 1);
+        KC__HashMap *hm = KC__hash_map_create(ma, K, 1, hash_map_param, pool);
         KC__kmer_processor_link_modules(kp, hm, NULL, NULL);
 
         test_store_add_kmers(hm);
@@ -583,6 +833,192 @@ static void test_export_check_buffer(KC__Buffer *bf) {
     KC__mem_free(ma2, bf);
 }
 
+static KC__Buffer *test_store_partitions_alloc_buffer() {
+    KC__Buffer *bf = (KC__Buffer *) KC__mem_alloc(ma2, sizeof(KC__Buffer), "test store buffer");
+    bf->size = 1000;
+    bf->length = 0;
+    bf->data = KC__mem_alloc(ma2, bf->size, "test store buffer data");
+    return bf;
+}
+
+static void test_store_partitions_check_buffer(KC__Buffer *bf) {
+    ck_assert(bf->type == KC__BUFFER_TYPE_PARTITIONED_SUPER_KMER);
+
+    size_t super_kmers_count = *((uint32_t *) (bf->data));
+    const uint8_t *p = (const uint8_t *) (bf->data) + sizeof(uint32_t);
+
+    for (size_t n = 0; n < super_kmers_count; n++) {
+        uint8_t partition = p[0];
+        size_t bases_count = K + p[1];
+        p += 2;
+        ck_assert(partition < 4);
+
+        uint8_t bases[K + UINT8_MAX];
+        for (size_t i = 0; i < bases_count; i++) {
+            bases[i] = (p[i / 4] >> ((i % 4) * 2)) & 0x3;
+        }
+        p += (bases_count + 3) / 4;
+
+        // Every K-mer of the super K-mer, in either strand, is in the partition.
+        for (size_t i = 0; i + K <= bases_count; i++) {
+            KC__unit_t kmer = 0;
+            KC__unit_t rc_kmer = 0;
+            for (size_t j = 0; j < K; j++) {
+                kmer = (kmer << 2) | bases[i + j];
+                rc_kmer = (rc_kmer << 2) | (0x3 - bases[i + K - 1 - j]);
+            }
+            KC__unit_t canonical_kmer = (kmer < rc_kmer) ? kmer : rc_kmer;
+
+            if (test_store_kmer_partitions[canonical_kmer] == UINT8_MAX) {
+                test_store_kmer_partitions[canonical_kmer] = partition;
+            }
+            ck_assert(test_store_kmer_partitions[canonical_kmer] == partition);
+            test_store_partitions_kmers_count++;
+        }
+    }
+
+    ck_assert((const char *) p - (const char *) (bf->data) == bf->length);
+
+    KC__mem_free(ma2, bf->data);
+    KC__mem_free(ma2, bf);
+}
+
+START_TEST(test_store_partitions)
+    {
+        K = 9;
+        init_kmer_processor_by_K();
+        KC__kmer_processor_set_store_buffer_request_callback(kp, test_store_partitions_alloc_buffer);
+        KC__kmer_processor_set_store_buffer_complete_callback(kp, test_store_partitions_check_buffer);
+        KC__kmer_processor_set_spill_partitions_count(kp, 4);
+
+        KC__HashMap *hm = KC__hash_map_create(ma, K, 1, hash_map_param, pool);
+        KC__kmer_processor_link_modules(kp, hm, NULL, NULL);
+        KC__hash_map_lock_keys(hm);
+
+        test_store_kmer_partitions = (uint8_t *) malloc((size_t) 1 << (K * 2));
+        memset(test_store_kmer_partitions, UINT8_MAX, (size_t) 1 << (K * 2));
+        test_store_partitions_kmers_count = 0;
+
+        generate_random_read(_i);
+        KC__kmer_processor_handle_read(kp, random_read, 100);
+        KC__kmer_processor_handle_read(kp, random_read_rc, 100);
+        KC__kmer_processor_finish(kp);
+
+        ck_assert(test_store_partitions_kmers_count == (101 - K) * 2);
+
+        free(test_store_kmer_partitions);
+        KC__hash_map_free(ma, hm);
+    }
+END_TEST
+
+#define TEST_COMBINER_ROUNDS 50
+#define TEST_COMBINER_BUFFERS_MAX 64
+
+static KC__Buffer* test_combiner_buffers[TEST_COMBINER_BUFFERS_MAX];
+static size_t test_combiner_buffers_count;
+static KC__count_t* test_combiner_counts;
+
+static KC__unit_t test_combiner_encode(char ch) {
+    switch (ch) {
+        case 'A':
+            return 0x0;
+        case 'C':
+            return 0x1;
+        case 'G':
+            return 0x2;
+        default:
+            return 0x3;
+    }
+}
+
+static void test_combiner_check_buffer(KC__Buffer *bf) {
+    ck_assert(bf->type == KC__BUFFER_TYPE_SUPER_KMER);
+    ck_assert((*((uint32_t *) (bf->data)) & KC__SUPER_KMERS_COUNTED_FLAG) != 0);
+    ck_assert(test_combiner_buffers_count < TEST_COMBINER_BUFFERS_MAX);
+
+    test_combiner_buffers[test_combiner_buffers_count] = bf;
+    test_combiner_buffers_count++;
+}
+
+static void test_combiner_export_callback(const KC__unit_t *kmer, KC__count_t count, void *data) {
+    size_t *exported_count = data;
+
+    ck_assert(test_combiner_counts[kmer[0]] == count);
+    (*exported_count)++;
+}
+
+START_TEST(test_store_combiner)
+    {
+        K = 9;
+        init_kmer_processor_by_K();
+        KC__kmer_processor_set_store_buffer_request_callback(kp, test_store_partitions_alloc_buffer);
+        KC__kmer_processor_set_store_buffer_complete_callback(kp, test_combiner_check_buffer);
+        KC__kmer_processor_init_combiner(ma, kp);
+
+        KC__HashMap *hm = KC__hash_map_create(ma, K, 1, hash_map_param, pool);
+        KC__kmer_processor_link_modules(kp, hm, NULL, NULL);
+        KC__hash_map_lock_keys(hm);
+
+        test_combiner_counts = (KC__count_t *) calloc((size_t) 1 << (K * 2), sizeof(KC__count_t));
+        test_combiner_buffers_count = 0;
+
+        generate_random_read(_i);
+        size_t unique_kmers_count = 0;
+        for (size_t i = 0; i + K <= 100; i++) {
+            KC__unit_t kmer = 0;
+            KC__unit_t rc_kmer = 0;
+            for (size_t j = 0; j < K; j++) {
+                kmer = (kmer << 2) | test_combiner_encode(random_read[i + j]);
+                rc_kmer = (rc_kmer << 2) | test_combiner_encode(random_read_rc[100 - K - i + j]);
+            }
+            KC__unit_t canonical_kmer = (kmer < rc_kmer) ? kmer : rc_kmer;
+            if (test_combiner_counts[canonical_kmer] == 0) {
+                unique_kmers_count++;
+            }
+            test_combiner_counts[canonical_kmer] += TEST_COMBINER_ROUNDS * 2;
+        }
+
+        for (size_t n = 0; n < TEST_COMBINER_ROUNDS; n++) {
+            KC__kmer_processor_handle_read(kp, random_read, 100);
+            KC__kmer_processor_handle_read(kp, random_read_rc, 100);
+        }
+        KC__kmer_processor_finish(kp);
+
+        // The frequent K-mers are stored as counted K-mers, the stored data is less than half of the super K-mers (26
+        // bytes for a read).
+        size_t stored_length = 0;
+        for (size_t i = 0; i < test_combiner_buffers_count; i++) {
+            stored_length += test_combiner_buffers[i]->length;
+        }
+        ck_assert(stored_length < TEST_COMBINER_ROUNDS * 2 * 26 / 2);
+
+        // All occurrences are counted by the next pass.
+        KC__MemAllocator *ma3 = KC__mem_allocator_create(1000000);
+        KC__KmerProcessor *kp2 = KC__kmer_processor_create(ma2, 0, K, output_param);
+        KC__HashMap *hm2 = KC__hash_map_create(ma3, K, 1, hash_map_param, pool);
+        KC__kmer_processor_link_modules(kp2, hm2, NULL, NULL);
+
+        for (size_t i = 0; i < test_combiner_buffers_count; i++) {
+            KC__Buffer *bf = test_combiner_buffers[i];
+            KC__kmer_processor_handle_buffer(kp2, bf);
+            KC__mem_free(ma2, bf->data);
+            KC__mem_free(ma2, bf);
+        }
+        KC__kmer_processor_finish(kp2);
+
+        size_t exported_count = 0;
+        KC__hash_map_export(hm2, 0, test_combiner_export_callback, &exported_count, NULL);
+        ck_assert(exported_count == unique_kmers_count);
+
+        KC__hash_map_free(ma3, hm2);
+        KC__kmer_processor_free(ma2, kp2);
+        KC__mem_allocator_free(ma3);
+
+        free(test_combiner_counts);
+        KC__hash_map_free(ma, hm);
+    }
+END_TEST
+
 START_TEST(test_export)
     {
         output_param.count_max = UINT32_MAX;
@@ -592,7 +1028,7 @@ START_TEST(test_export)
         KC__kmer_processor_set_store_buffer_request_callback(kp, test_export_alloc_buffer);
         KC__kmer_processor_set_store_buffer_complete_callback(kp, test_export_check_buffer);
 
-        KC__HashMap *hm = KC__hash_map_create(ma, K, 1);
+        KC__HashMap *hm = KC__hash_map_create(ma, K, 1, hash_map_param, pool);
         KC__kmer_processor_link_modules(kp, hm, NULL, NULL);
 
         const char* reads[6] = {"ACCGG", "ACGT", "ACCGG", "AGCCCCGG", "CCCG", "ATCG"};
@@ -700,7 +1136,7 @@ START_TEST(test_export_2)
         KC__kmer_processor_set_store_buffer_request_callback(kp, test_export_alloc_buffer);
         KC__kmer_processor_set_store_buffer_complete_callback(kp, test_export_check_buffer_2);
 
-        KC__HashMap *hm = KC__hash_map_create(ma, K, 1);
+        KC__HashMap *hm = KC__hash_map_create(ma, K, 1, hash_map_param, pool);
         KC__kmer_processor_link_modules(kp, hm, NULL, NULL);
 
         const char* read = "CCCGTTACGCCTACGTTAACGTGCACTGCCGGC";
@@ -727,20 +1163,30 @@ Suite *kmer_processor_suite() {
 
     tcase_add_loop_test(tc_core, test_handle_buffer_fasta, 0, 3);
     tcase_add_test(tc_core, test_handle_buffer_fastq);
+    tcase_add_loop_test(tc_core, test_handle_buffer_fastq_records, 0, 3);
+    tcase_add_loop_test(tc_core, test_handle_buffer_fasta_continued, 0, 2);
 
     tcase_add_test(tc_core, test_handle_read_short_read);
     tcase_add_test(tc_core, test_handle_read_long_read);
     tcase_add_loop_test(tc_core, test_handle_read_random_read, 1, 97);
+    tcase_add_loop_test(tc_core, test_handle_read_long_random_read, 0, 9);
+    tcase_add_loop_test(tc_core, test_handle_read_widths, 0, 10);
 
     tcase_add_test(tc_core, test_handle_buffer_super_kmer_1);
     tcase_add_test(tc_core, test_handle_buffer_super_kmer_2);
 
     tcase_add_test(tc_core, test_store);
+    tcase_add_loop_test(tc_core, test_store_partitions, 0, 5);
+    tcase_add_loop_test(tc_core, test_store_combiner, 0, 5);
     tcase_add_test(tc_core, test_export);
     tcase_add_loop_test(tc_core, test_export_2, 0, 3);
 
+    TCase *tc_encode = tcase_create("Encode");
+    tcase_add_loop_test(tc_encode, test_encode_bases, 0, 5);
+
     Suite *s = suite_create("Kmer Processor");
     suite_add_tcase(s, tc_core);
+    suite_add_tcase(s, tc_encode);
 
     return s;
 }
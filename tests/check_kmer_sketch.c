@@ -0,0 +1,100 @@
+#include <stdlib.h>
+
+#include "check_all.h"
+#include "../src/kmer_sketch.h"
+#include "../src/hash.h"
+
+
+static KC__MemAllocator* ma;
+
+
+static void setup() {
+    ma = KC__mem_allocator_create(10000000);
+}
+
+static void teardown() {
+    KC__mem_allocator_free(ma);
+}
+
+
+/**
+ * Add n distinct K-mers by hashes from start, the even ones twice.
+ */
+static void add_kmers(KC__KmerSketch* sketch, size_t start, size_t n) {
+    for (size_t i = start; i < start + n; i++) {
+        KC__kmer_sketch_add(sketch, KC__hash_mix(i + 1));
+        if (i % 2 == 0) {
+            KC__kmer_sketch_add(sketch, KC__hash_mix(i + 1));
+        }
+    }
+}
+
+static void ck_assert_near(size_t estimate, size_t count) {
+    // Far beyond the expected error.
+    ck_assert(estimate >= count - count / 10);
+    ck_assert(estimate <= count + count / 10);
+}
+
+START_TEST(test_exact)
+    {
+        KC__KmerSketch* sketch = KC__kmer_sketch_create(ma, 1024);
+        add_kmers(sketch, 0, 1000);
+
+        ck_assert(KC__kmer_sketch_estimate(sketch, 1) == 1000);
+        ck_assert(KC__kmer_sketch_estimate(sketch, 2) == 500);
+        ck_assert(KC__kmer_sketch_estimate(sketch, 3) == 0);
+
+        KC__kmer_sketch_free(ma, sketch);
+    }
+END_TEST
+
+START_TEST(test_estimate)
+    {
+        KC__KmerSketch* sketch = KC__kmer_sketch_create(ma, 4096);
+        add_kmers(sketch, 0, 200000);
+
+        ck_assert_near(KC__kmer_sketch_estimate(sketch, 1), 200000);
+        ck_assert_near(KC__kmer_sketch_estimate(sketch, 2), 100000);
+
+        KC__kmer_sketch_free(ma, sketch);
+    }
+END_TEST
+
+START_TEST(test_merge)
+    {
+        KC__KmerSketch* sketch = KC__kmer_sketch_create(ma, 4096);
+        KC__KmerSketch* sketch_1 = KC__kmer_sketch_create(ma, 4096);
+        KC__KmerSketch* sketch_2 = KC__kmer_sketch_create(ma, 4096);
+
+        // The K-mers in [60000, 100000) are added to both, so all of them are seen at least twice.
+        add_kmers(sketch, 0, 100000);
+        add_kmers(sketch, 60000, 100000);
+        add_kmers(sketch_1, 0, 100000);
+        add_kmers(sketch_2, 60000, 100000);
+        KC__kmer_sketch_merge(sketch_1, sketch_2);
+
+        // The same K-mers are kept, whatever thread they are added by.
+        for (KC__count_t c = 1; c <= 4; c++) {
+            ck_assert(KC__kmer_sketch_estimate(sketch_1, c) == KC__kmer_sketch_estimate(sketch, c));
+        }
+        ck_assert_near(KC__kmer_sketch_estimate(sketch_1, 1), 160000);
+        ck_assert_near(KC__kmer_sketch_estimate(sketch_1, 2), 100000);
+
+        KC__kmer_sketch_free(ma, sketch);
+        KC__kmer_sketch_free(ma, sketch_1);
+        KC__kmer_sketch_free(ma, sketch_2);
+    }
+END_TEST
+
+Suite* kmer_sketch_suite() {
+    TCase* tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_exact);
+    tcase_add_test(tc_core, test_estimate);
+    tcase_add_test(tc_core, test_merge);
+
+    Suite* s = suite_create("K-mer Sketch");
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -0,0 +1,232 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "check_all.h"
+#include "../src/kmer_sorter.h"
+
+#define THREAD_COUNT 4
+
+
+static KC__MemAllocator* ma;
+static KC__KmerSorter* ks;
+static size_t max_key_count;
+static size_t unique_kmers_count;
+static KC__count_t* count_array_in;
+static KC__count_t* count_array_out;
+static KC__unit_t* threads_kmers[THREAD_COUNT];
+static KC__unit_t last_exported_kmers[THREAD_COUNT];
+static size_t exported_counts[THREAD_COUNT];
+
+
+static void setup() {
+    ma = KC__mem_allocator_create(1000000);
+    ks = KC__kmer_sorter_create(ma, 16, THREAD_COUNT, KC__mem_available(ma));
+
+    max_key_count = KC__kmer_sorter_max_key_count(ks);
+    unique_kmers_count = max_key_count * 2;
+
+    count_array_in = (KC__count_t*)malloc(sizeof(KC__count_t) * unique_kmers_count);
+    count_array_out = (KC__count_t*)malloc(sizeof(KC__count_t) * unique_kmers_count);
+    for (size_t i = 0; i < unique_kmers_count; i++) {
+        count_array_in[i] = 0;
+        count_array_out[i] = 0;
+    }
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        threads_kmers[i] = (KC__unit_t*)malloc(sizeof(KC__unit_t) * unique_kmers_count);
+        for (size_t n = 0; n < unique_kmers_count; n++) {
+            threads_kmers[i][n] = n;
+        }
+    }
+}
+
+static void teardown() {
+    KC__kmer_sorter_free(ma, ks);
+    KC__mem_allocator_free(ma);
+
+    free(count_array_in);
+    free(count_array_out);
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        free(threads_kmers[i]);
+    }
+}
+
+static void randomize_thread_kmers(int n) {
+    srandom((unsigned int)time(NULL) + n);
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        for (size_t j = 0; j < unique_kmers_count; j++) {
+            long rand_i = random() % THREAD_COUNT;
+            long rand_j = random() % unique_kmers_count;
+            KC__unit_t tmp = threads_kmers[i][j];
+            threads_kmers[i][j] = threads_kmers[rand_i][rand_j];
+            threads_kmers[rand_i][rand_j] = tmp;
+        }
+    }
+}
+
+static void* add_kmers(void* ptr) {
+    size_t n = *((size_t *)ptr);
+
+    KC__unit_t* kmers = threads_kmers[n];
+
+    for (size_t m = 0; m < 2; m++) {
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            KC__unit_t kmer = kmers[i];
+
+            if (!KC__kmer_sorter_add_kmer(ks, n, &kmer)) {
+                if (kmer >= unique_kmers_count) {
+                    ck_abort();
+                }
+                __sync_fetch_and_add(&(count_array_out[kmer]), 1);
+            }
+        }
+    }
+
+    KC__kmer_sorter_finish_adding_kmers(ks, n);
+
+    pthread_exit(NULL);
+}
+
+static void add_all_kmers() {
+    pthread_t threads[THREAD_COUNT];
+    size_t thread_ids[THREAD_COUNT];
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        thread_ids[i] = i;
+        pthread_create(&(threads[i]), NULL, add_kmers, &(thread_ids[i]));
+    }
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static void check_export_callback(const KC__unit_t* kmer, KC__count_t count, void* data) {
+    size_t n = *((size_t *)data);
+
+    KC__unit_t idx = kmer[0];
+    if (idx >= unique_kmers_count) {
+        ck_abort();
+    }
+
+    // K-mers are exported in ascending order.
+    if ((exported_counts[n] > 0) && (idx <= last_exported_kmers[n])) {
+        ck_abort_msg("%zu exported after %zu", idx, last_exported_kmers[n]);
+    }
+    last_exported_kmers[n] = idx;
+    exported_counts[n]++;
+
+    __sync_fetch_and_add(&(count_array_in[idx]), count);
+}
+
+static void* export_kmers(void* ptr) {
+    size_t n = *((size_t *)ptr);
+
+    size_t exported_count;
+    KC__kmer_sorter_export(ks, n, check_export_callback, ptr, &exported_count);
+    ck_assert(exported_count == exported_counts[n]);
+
+    pthread_exit(NULL);
+}
+
+static void export_all_kmers() {
+    pthread_t threads[THREAD_COUNT];
+    size_t thread_ids[THREAD_COUNT];
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        thread_ids[i] = i;
+        exported_counts[i] = 0;
+        pthread_create(&(threads[i]), NULL, export_kmers, &(thread_ids[i]));
+    }
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The ranges of threads do not overlap and are in the order of threads.
+    for (size_t i = 1; i < THREAD_COUNT; i++) {
+        for (size_t j = 0; j < i; j++) {
+            if ((exported_counts[i] > 0) && (exported_counts[j] > 0)) {
+                ck_assert(last_exported_kmers[j] < last_exported_kmers[i]);
+            }
+        }
+    }
+}
+
+static void check_results(bool runs_locked) {
+    export_all_kmers();
+
+    size_t exported_count = 0;
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        exported_count += exported_counts[i];
+    }
+    ck_assert(exported_count <= max_key_count);
+
+    for (size_t i = 0; i < unique_kmers_count; i++) {
+        KC__count_t c1 = count_array_in[i];
+        KC__count_t c2 = count_array_out[i];
+
+        if ((c1 + c2 != (THREAD_COUNT * 2)) || ((c1 != 0) && (c2 != 0))) {
+            ck_abort_msg("%zu, in: %zu, out: %zu", i, c1, c2);
+        }
+        if (!runs_locked && (c2 != 0)) {
+            ck_abort_msg("%zu, in: %zu, out: %zu", i, c1, c2);
+        }
+    }
+}
+
+START_TEST(test_use_half_keys)
+    {
+        unique_kmers_count = max_key_count / 2;
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        check_results(false);
+    }
+END_TEST
+
+START_TEST(test_runs_locked)
+    {
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        check_results(true);
+    }
+END_TEST
+
+START_TEST(test_clear)
+    {
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        KC__kmer_sorter_clear(ks);
+        for (size_t i = 0; i < unique_kmers_count; i++) {
+            count_array_out[i] = 0;
+        }
+
+        unique_kmers_count = max_key_count / 2;
+        for (size_t i = 0; i < THREAD_COUNT; i++) {
+            for (size_t n = 0; n < unique_kmers_count; n++) {
+                threads_kmers[i][n] = n;
+            }
+        }
+        randomize_thread_kmers(_i);
+
+        add_all_kmers();
+        check_results(false);
+    }
+END_TEST
+
+
+Suite* kmer_sorter_suite() {
+    TCase* tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_loop_test(tc_core, test_use_half_keys, 0, 5);
+    tcase_add_loop_test(tc_core, test_runs_locked, 0, 5);
+    tcase_add_loop_test(tc_core, test_clear, 0, 5);
+
+    Suite* s = suite_create("Kmer Sorter");
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
@@ -10,7 +10,11 @@ int main() {
 
     srunner_add_suite(sr, queue_suite());
     srunner_add_suite(sr, buffer_queue_suite());
+    srunner_add_suite(sr, thread_pool_suite());
+    srunner_add_suite(sr, async_reader_suite());
     srunner_add_suite(sr, hash_map_suite());
+    srunner_add_suite(sr, kmer_sorter_suite());
+    srunner_add_suite(sr, kmer_sketch_suite());
     srunner_add_suite(sr, kmer_processor_suite());
     srunner_add_suite(sr, file_reader_suite());
     srunner_add_suite(sr, file_writer_suite());
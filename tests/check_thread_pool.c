@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "check_all.h"
+#include "../src/thread_pool.h"
+
+#define THREADS_COUNT 6
+#define PHASES_COUNT 100
+
+
+static KC__MemAllocator* ma;
+static KC__ThreadPool* pool;
+static pthread_barrier_t barrier;
+static size_t counts[THREADS_COUNT];
+static void* args[THREADS_COUNT];
+static volatile bool released;
+
+
+static void setup() {
+    ma = KC__mem_allocator_create(1000000);
+    pool = KC__thread_pool_create(ma, THREADS_COUNT);
+
+    for (size_t i = 0; i < THREADS_COUNT; i++) {
+        counts[i] = 0;
+        args[i] = &(counts[i]);
+    }
+    released = false;
+}
+
+static void teardown() {
+    KC__thread_pool_free(ma, pool);
+    KC__mem_allocator_free(ma);
+}
+
+
+static void* count(void* ptr) {
+    size_t* c = ptr;
+    (*c)++;
+    return NULL;
+}
+
+static void* count_together(void* ptr) {
+    // Only passes if all the works run at the same time.
+    pthread_barrier_wait(&barrier);
+    return count(ptr);
+}
+
+static void* wait_released(void* ptr) {
+    while (!__atomic_load_n(&released, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+    return count(ptr);
+}
+
+static void* release(void* ptr) {
+    __atomic_store_n(&released, true, __ATOMIC_SEQ_CST);
+    return count(ptr);
+}
+
+START_TEST(test_phases)
+    {
+        // Phases of 1 to THREADS_COUNT works, one after another.
+        for (size_t n = 0; n < PHASES_COUNT; n++) {
+            const size_t works_count = n % THREADS_COUNT + 1;
+            KC__ThreadPoolPhase phase;
+            KC__thread_pool_start(pool, &phase, count, args, works_count);
+            KC__thread_pool_wait(pool, &phase);
+            ck_assert(phase.pending_count == 0);
+        }
+
+        for (size_t i = 0; i < THREADS_COUNT; i++) {
+            size_t expected = 0;
+            for (size_t n = 0; n < PHASES_COUNT; n++) {
+                expected += (i < n % THREADS_COUNT + 1) ? 1 : 0;
+            }
+            ck_assert(counts[i] == expected);
+        }
+    }
+END_TEST
+
+START_TEST(test_concurrent_works)
+    {
+        pthread_barrier_init(&barrier, NULL, THREADS_COUNT);
+        for (size_t n = 0; n < 3; n++) {
+            KC__ThreadPoolPhase phase;
+            KC__thread_pool_start(pool, &phase, count_together, args, THREADS_COUNT);
+            KC__thread_pool_wait(pool, &phase);
+        }
+        pthread_barrier_destroy(&barrier);
+
+        for (size_t i = 0; i < THREADS_COUNT; i++) {
+            ck_assert(counts[i] == 3);
+        }
+    }
+END_TEST
+
+START_TEST(test_concurrent_phases)
+    {
+        // The works of the first phase wait for the one of the second phase, like the K-mer processors for the readers.
+        KC__ThreadPoolPhase waiting_phase;
+        KC__ThreadPoolPhase releasing_phase;
+        KC__thread_pool_start(pool, &waiting_phase, wait_released, args, THREADS_COUNT - 1);
+        KC__thread_pool_start(pool, &releasing_phase, release, &(args[THREADS_COUNT - 1]), 1);
+        KC__thread_pool_wait(pool, &waiting_phase);
+        KC__thread_pool_wait(pool, &releasing_phase);
+
+        for (size_t i = 0; i < THREADS_COUNT; i++) {
+            ck_assert(counts[i] == 1);
+        }
+    }
+END_TEST
+
+Suite* thread_pool_suite() {
+    TCase* tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
+    tcase_add_test(tc_core, test_phases);
+    tcase_add_test(tc_core, test_concurrent_works);
+    tcase_add_test(tc_core, test_concurrent_phases);
+
+    Suite* s = suite_create("Thread Pool");
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
\ No newline at end of file